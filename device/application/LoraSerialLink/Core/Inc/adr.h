@@ -0,0 +1,251 @@
+/**
+ * @file    adr.h
+ *
+ * @brief   Adaptive Data Rate Between Peers.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Steps the link through a table of spreading factor and bandwidth pairs
+ *  from the SNR margin measured on the frames of each peer. Both directions
+ *  share the modem configuration, so the margin is taken from the weaker of
+ *  the local measurement and the one each peer reports back, for the weakest
+ *  peer heard recently.
+ *
+ *  A change is agreed before it is made: one end proposes the new rate and
+ *  switches when the other acknowledges, the other switches once its
+ *  acknowledgement is on air. Both ends fall back to the safe rate, which is
+ *  also the rate they start at, if the peer is not heard soon after a switch
+ *  or for too long at any faster rate, so a lost frame cannot strand them on
+ *  different rates.
+ *
+ */
+
+#ifndef ADR_H
+#define ADR_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define ADR_MAX_PEERS				(4U)		/*!< Peers tracked, least recently heard is replaced */
+#define ADR_RATE_COUNT				(6U)		/*!< Entries in the rate table */
+#define ADR_SAFE_RATE				(0U)		/*!< Most robust rate, used at start and after losing contact */
+
+#define ADR_STEP_UP_MARGIN_QDB		(40)		/*!< SNR margin the next faster rate must keep (10 dB), in 0.25 dB */
+#define ADR_STEP_DOWN_MARGIN_QDB	(10)		/*!< SNR margin below which to slow down (2.5 dB), in 0.25 dB */
+#define ADR_MIN_SAMPLES				(8U)		/*!< Frames measured from a peer before it counts towards a decision */
+#define ADR_REPORT_SNR_UNKNOWN		(-128)		/*!< Link report sent before anything has been measured */
+
+#define ADR_POLL_PERIOD_MS			(1000U)		/*!< adr_poll is called this often */
+#define ADR_REPORT_PERIOD_MS		(10000U)	/*!< Link reports while faster than the safe rate, also keeping contact */
+#define ADR_SWITCH_RETRY_MS			(2000U)		/*!< Time to wait for an acknowledgement before proposing again */
+#define ADR_SWITCH_MAX_ATTEMPTS		(3U)		/*!< Proposals sent before giving up on a change */
+#define ADR_CONFIRM_TIMEOUT_MS		(5000U)		/*!< Fall back if the peer is not heard this soon after a switch */
+#define ADR_CONTACT_TIMEOUT_MS		(35000U)	/*!< Fall back if the peer is not heard for this long above the safe rate */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Modem configuration of a rate.
+ */
+typedef struct adr_rate_t_
+{
+	uint8_t spreading_factor;
+	uint32_t bandwidth_hz;
+	uint8_t coding_rate;			/*!< 1 to 4 for 4/5 to 4/8 */
+} adr_rate_t;
+
+
+/**
+ * @brief   Adaptive data rate statistics.
+ */
+typedef struct adr_stats_t_
+{
+	uint32_t switches_up;			/*!< Changes to a faster rate */
+	uint32_t switches_down;			/*!< Agreed changes to a slower rate */
+	uint32_t fallbacks;				/*!< Falls back to the safe rate after losing contact */
+	uint32_t proposals_failed;		/*!< Proposals given up on without an acknowledgement */
+	uint32_t bytes_sent;			/*!< Data payload bytes sent */
+	uint64_t airtime_us;			/*!< Time on air of those data packets */
+	uint64_t safe_airtime_us;		/*!< Their time on air scaled to the bit rate of the safe rate */
+} adr_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Adaptive Data Rate controller at the safe rate.
+ *
+ * @param[in]     own_address our address, which settles proposals crossing on air
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_init (uint8_t own_address, uint64_t now_ms);
+
+
+/**
+ * @brief   Record a frame received from a peer, with its measured SNR.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     snr_quarter_db packet SNR at the current rate, in 0.25 dB
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_on_frame_received (uint8_t source_address, int32_t snr_quarter_db, uint64_t now_ms);
+
+
+/**
+ * @brief   Apply a link report from a peer, its measurement of our frames.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     snr_ref_quarter_db SNR referred to 125 kHz, from adr_get_report at the peer
+ * @return        0 for success or Error
+ */
+int32_t adr_on_report (uint8_t source_address, int32_t snr_ref_quarter_db);
+
+
+/**
+ * @brief   Check whether to send a link report.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    snr_ref_quarter_db weakest SNR measured from the peers, referred to 125 kHz
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t adr_get_report (uint64_t now_ms, int32_t* snr_ref_quarter_db);
+
+
+/**
+ * @brief   Check whether to propose a rate change, from the margins or to retry an unanswered proposal.
+ *
+ * On success the proposal is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    rate_index proposed rate
+ * @param[out]    switch_id identifies the proposal in the acknowledgement
+ * @return        1 if a proposal should be sent now, 0 otherwise
+ */
+int32_t adr_get_switch (uint64_t now_ms, uint8_t* rate_index, uint8_t* switch_id);
+
+
+/**
+ * @brief   Apply a rate change proposed by a peer. It is acknowledged at the current rate.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     rate_index proposed rate
+ * @param[in]     switch_id identifies the proposal
+ * @return        0 if accepted, Error if rejected
+ */
+int32_t adr_on_switch (uint8_t source_address, uint8_t rate_index, uint8_t switch_id);
+
+
+/**
+ * @brief   Check whether to acknowledge a rate change proposed by a peer.
+ *
+ * @param[out]    rate_index accepted rate
+ * @param[out]    switch_id identifies the proposal
+ * @return        1 if an acknowledgement should be sent now, 0 otherwise
+ */
+int32_t adr_get_ack (uint8_t* rate_index, uint8_t* switch_id);
+
+
+/**
+ * @brief   The acknowledgement is on air - switch to the accepted rate.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_on_ack_sent (uint64_t now_ms);
+
+
+/**
+ * @brief   Apply an acknowledgement of our proposal - switch to the proposed rate.
+ *
+ * @param[in]     rate_index acknowledged rate
+ * @param[in]     switch_id identifies the proposal
+ * @param[in]     now_ms current time
+ * @return        0 if it matched the proposal, Error otherwise
+ */
+int32_t adr_on_ack (uint8_t rate_index, uint8_t switch_id, uint64_t now_ms);
+
+
+/**
+ * @brief   Fall back to the safe rate if the peers have not been heard in time.
+ *
+ * @param[in]     now_ms current time
+ * @return        1 if the rate changed, 0 otherwise
+ */
+int32_t adr_poll (uint64_t now_ms);
+
+
+/**
+ * @brief   Get the current rate.
+ *
+ * @param[out]    rate modem configuration of the rate
+ * @return        index of the rate in the table
+ */
+uint8_t adr_get_rate (adr_rate_t* rate);
+
+
+/**
+ * @brief   Get the SNR margin of a frame over the demodulation floor of the current rate.
+ *
+ * @param[in]     snr_quarter_db packet SNR at the current rate, in 0.25 dB
+ * @return        margin in 0.25 dB
+ */
+int32_t adr_get_margin (int32_t snr_quarter_db);
+
+
+/**
+ * @brief   Record a data packet sent, for the throughput statistics.
+ *
+ * @param[in]     payload_length payload length of the data packet
+ * @param[in]     airtime_us measured time on air
+ * @return        0 for success or Error
+ */
+int32_t adr_on_data_sent (uint32_t payload_length, uint32_t airtime_us);
+
+
+/**
+ * @brief   Get the adaptive data rate statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t adr_get_stats (adr_stats_t* stats);
+
+
+#endif /* ADR_H */
+
+/* End of file */
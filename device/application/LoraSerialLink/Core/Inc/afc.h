@@ -0,0 +1,115 @@
+/**
+ * @file    afc.h
+ *
+ * @brief   Automatic Frequency Correction From the Measured FEI.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Keeps an estimate of the carrier offset of each peer from the frequency
+ *  error the modem measures on its frames, and trims the link frequency to
+ *  the peer with the lowest address below ours. That peer is the frequency
+ *  reference: it does not trim towards us, so the two ends cannot chase each
+ *  other, and every unit in a network ends up on the crystal of the lowest
+ *  address. With the crystals matched the receiver no longer needs a wide
+ *  bandwidth to tolerate their drift.
+ *
+ */
+
+#ifndef AFC_H
+#define AFC_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define AFC_MAX_PEERS				(4U)		/*!< Peers tracked, least recently heard is replaced */
+#define AFC_MIN_SAMPLES				(2U)		/*!< Frames measured from a peer before trimming to it */
+#define AFC_DEADBAND_HZ				(100)		/*!< Retune only when the estimate moves by more than this, FRF steps are 61 Hz */
+#define AFC_MAX_CORRECTION_HZ		(25000)		/*!< RFM95W_MAX_FREQUENCY_CORRECTION_HZ */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Frequency correction statistics.
+ */
+typedef struct afc_stats_t_
+{
+	uint32_t frames;				/*!< Frames measured */
+	uint32_t retunes;				/*!< Changes of the correction */
+	int32_t max_error_hz;			/*!< Largest frequency error measured on a frame, either way */
+} afc_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Frequency Correction with no correction.
+ *
+ * @param[in]     own_address our address, peers below it are the frequency reference
+ * @return        0 for success or Error
+ */
+int32_t afc_init (uint8_t own_address);
+
+
+/**
+ * @brief   Record the frequency error of a frame received from a peer.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     frequency_error_hz carrier of the frame less the untrimmed link frequency
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t afc_on_frame_received (uint8_t source_address, int32_t frequency_error_hz, uint64_t now_ms);
+
+
+/**
+ * @brief   Get the correction to apply to the link frequency.
+ *
+ * @param[out]    reference_address peer the correction follows, our own address if none
+ * @return        correction in Hz
+ */
+int32_t afc_get_correction (uint8_t* reference_address);
+
+
+/**
+ * @brief   Get the frequency correction statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t afc_get_stats (afc_stats_t* stats);
+
+
+#endif /* AFC_H */
+
+/* End of file */
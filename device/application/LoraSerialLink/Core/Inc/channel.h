@@ -0,0 +1,264 @@
+/**
+ * @file    channel.h
+ *
+ * @brief   Channel Noise-Floor Scanning and Selection.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Steps through the channel plan in the background, sampling the RSSI of
+ *  each channel for a short dwell between the link traffic, and builds a
+ *  histogram of the noise on each. Once every channel has been sampled the
+ *  quietest is proposed to the peer if it beats the link channel by
+ *  CHANNEL_SWITCH_MARGIN_DB, and the plan is scanned again every
+ *  CHANNEL_RESCAN_PERIOD_MS to follow a changing RF environment.
+ *
+ *  A change is agreed the same way as a data rate change: one end proposes
+ *  and switches when the other acknowledges, the other switches once its
+ *  acknowledgement is on air. Both ends return to the home channel, which
+ *  is also the channel they start on, if the peer is not heard soon after a
+ *  switch or for too long on any other channel.
+ *
+ */
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define CHANNEL_COUNT					(8U)		/*!< Channels in the plan */
+#define CHANNEL_HOME					(0U)		/*!< Channel used at start and after losing contact */
+
+#define CHANNEL_HISTOGRAM_BINS			(16U)		/*!< Noise histogram bins of each channel */
+#define CHANNEL_HISTOGRAM_MIN_DBM		(-140)		/*!< Lower edge of the first bin, anything quieter is counted in it */
+#define CHANNEL_HISTOGRAM_BIN_DB		(4)			/*!< Width of a bin, anything louder than the last is counted in it */
+
+#define CHANNEL_SAMPLE_PERIOD_MS		(2U)		/*!< Time between RSSI samples in a dwell */
+#define CHANNEL_SAMPLES_PER_DWELL		(32U)		/*!< Samples taken in each dwell, the radio is deaf for the dwell */
+#define CHANNEL_SCAN_STEP_MS			(1000U)		/*!< Time back on the link channel between dwells */
+#define CHANNEL_RESCAN_PERIOD_MS		(600000U)	/*!< Time between scans of the whole plan */
+#define CHANNEL_SWITCH_MARGIN_DB		(6)			/*!< A channel must be this much quieter to be worth a switch */
+
+#define CHANNEL_POLL_PERIOD_MS			(1000U)		/*!< channel_poll is called this often */
+#define CHANNEL_SWITCH_RETRY_MS			(2000U)		/*!< Time to wait for an acknowledgement before proposing again */
+#define CHANNEL_SWITCH_MAX_ATTEMPTS		(3U)		/*!< Proposals sent before giving up on a change */
+#define CHANNEL_CONFIRM_TIMEOUT_MS		(5000U)		/*!< Return home if the peer is not heard this soon after a switch */
+#define CHANNEL_CONTACT_TIMEOUT_MS		(65000U)	/*!< Return home if the peer is not heard for this long on another channel */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Channel selection statistics.
+ */
+typedef struct channel_stats_t_
+{
+	uint32_t scans;					/*!< Scans of the whole plan completed */
+	uint32_t switches;				/*!< Agreed changes of channel */
+	uint32_t fallbacks;				/*!< Returns to the home channel after losing contact */
+	uint32_t proposals_failed;		/*!< Proposals given up on without an acknowledgement */
+} channel_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Channel selection on the home channel, with the first scan due.
+ *
+ * @param[in]     own_address our address, which settles proposals crossing on air
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_init (uint8_t own_address, uint64_t now_ms);
+
+
+/**
+ * @brief   Check whether to start the next dwell of a scan.
+ *
+ * Nothing is counted until the samples arrive, so a dwell the radio cannot start is asked for again.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    frequency_hz channel to sample
+ * @return        1 if a dwell should start now, 0 otherwise
+ */
+int32_t channel_get_scan_step (uint64_t now_ms, uint32_t* frequency_hz);
+
+
+/**
+ * @brief   Add an RSSI sample to the histogram of the channel in the dwell.
+ *
+ * Once the whole plan has been sampled the quietest channel is chosen, and proposed if it is worth a switch.
+ *
+ * @param[in]     rssi_dbm current RSSI of the channel
+ * @param[in]     now_ms current time
+ * @return        1 if the dwell is complete, 0 otherwise
+ */
+int32_t channel_on_sample (int32_t rssi_dbm, uint64_t now_ms);
+
+
+/**
+ * @brief   Record a frame received from the peer, which confirms the link channel.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_on_frame_received (uint64_t now_ms);
+
+
+/**
+ * @brief   Check whether to send a link report straight away, so each end hears the other on a new channel.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param         None
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t channel_get_report ();
+
+
+/**
+ * @brief   Check whether to propose a channel change, or to retry an unanswered proposal.
+ *
+ * On success the proposal is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    channel_index proposed channel
+ * @param[out]    switch_id identifies the proposal in the acknowledgement
+ * @return        1 if a proposal should be sent now, 0 otherwise
+ */
+int32_t channel_get_switch (uint64_t now_ms, uint8_t* channel_index, uint8_t* switch_id);
+
+
+/**
+ * @brief   Apply a channel change proposed by a peer. It is acknowledged on the current channel.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     channel_index proposed channel
+ * @param[in]     switch_id identifies the proposal
+ * @return        0 if accepted, Error if rejected
+ */
+int32_t channel_on_switch (uint8_t source_address, uint8_t channel_index, uint8_t switch_id);
+
+
+/**
+ * @brief   Check whether to acknowledge a channel change proposed by a peer.
+ *
+ * @param[out]    channel_index accepted channel
+ * @param[out]    switch_id identifies the proposal
+ * @return        1 if an acknowledgement should be sent now, 0 otherwise
+ */
+int32_t channel_get_ack (uint8_t* channel_index, uint8_t* switch_id);
+
+
+/**
+ * @brief   The acknowledgement is on air - switch to the accepted channel.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_on_ack_sent (uint64_t now_ms);
+
+
+/**
+ * @brief   Apply an acknowledgement of our proposal - switch to the proposed channel.
+ *
+ * @param[in]     channel_index acknowledged channel
+ * @param[in]     switch_id identifies the proposal
+ * @param[in]     now_ms current time
+ * @return        0 if it matched the proposal, Error otherwise
+ */
+int32_t channel_on_ack (uint8_t channel_index, uint8_t switch_id, uint64_t now_ms);
+
+
+/**
+ * @brief   Return to the home channel if the peer has not been heard in time.
+ *
+ * @param[in]     now_ms current time
+ * @return        1 if the channel changed, 0 otherwise
+ */
+int32_t channel_poll (uint64_t now_ms);
+
+
+/**
+ * @brief   Get the link channel.
+ *
+ * @param[out]    frequency_hz frequency of the channel
+ * @return        index of the channel in the plan
+ */
+uint8_t channel_get_current (uint32_t* frequency_hz);
+
+
+/**
+ * @brief   Get the frequency of a channel in the plan.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    frequency_hz frequency of the channel
+ * @return        0 for success or Error
+ */
+int32_t channel_get_frequency (uint8_t channel_index, uint32_t* frequency_hz);
+
+
+/**
+ * @brief   Get the channel of the plan furthest from a channel, for the other direction of a full
+ *          duplex link. Across this plan it is at least 800 kHz away, which leaves a guard band
+ *          between the two signals at every bandwidth the adaptive data rate uses, up to 500 kHz.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    pair_index the channel furthest from it
+ * @return        0 for success or Error
+ */
+int32_t channel_get_pair (uint8_t channel_index, uint8_t* pair_index);
+
+
+/**
+ * @brief   Get the noise floor of a channel from the last scan.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    noise_floor_dbm median of its RSSI samples
+ * @return        0 for success or Error if it has not been sampled
+ */
+int32_t channel_get_noise_floor (uint8_t channel_index, int32_t* noise_floor_dbm);
+
+
+/**
+ * @brief   Get the channel selection statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t channel_get_stats (channel_stats_t* stats);
+
+
+#endif /* CHANNEL_H */
+
+/* End of file */
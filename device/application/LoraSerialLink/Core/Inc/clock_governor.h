@@ -0,0 +1,152 @@
+/**
+ * @file    clock_governor.h
+ *
+ * @brief   System Clock Governor.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Runs the core from MSI at 8 MHz in voltage range 2 while the traffic is
+ *  light and from the PLL at 80 MHz in range 1 for bursts. The main loop
+ *  reports whether the current work needs the burst clock on every pass;
+ *  the governor switches up straight away and back down once the demand
+ *  has been gone for CLOCK_GOVERNOR_IDLE_HOLD_MS.
+ *
+ *  Everything clocked from the system clock is rescaled on each switch:
+ *  the TIM2 timebase, the SPI prescalers for the radios and the heartbeat
+ *  timer. The UARTs run from HSI16 so their baud rates are unaffected.
+ *
+ */
+
+#ifndef CLOCK_GOVERNOR_H
+#define CLOCK_GOVERNOR_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define CLOCK_GOVERNOR_IDLE_HOLD_MS		(200U)		/*!< Time without demand before dropping to the idle clock */
+#define CLOCK_GOVERNOR_SPI_MAX_HZ		(5000000U)	/*!< Fastest SPI clock, the rate the RFM95W has always been run at */
+#define CLOCK_GOVERNOR_MAX_SPI			(2U)		/*!< SPIs kept under CLOCK_GOVERNOR_SPI_MAX_HZ, one per radio */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Clock levels.
+ */
+typedef enum clock_governor_level_t_
+{
+	CLOCK_GOVERNOR_LEVEL_IDLE = 0,		/*!< MSI 8 MHz, voltage range 2 */
+	CLOCK_GOVERNOR_LEVEL_BURST,			/*!< PLL 80 MHz from the HSE, voltage range 1 */
+	CLOCK_GOVERNOR_LEVEL_COUNT
+} clock_governor_level_t;
+
+
+/**
+ * @brief   Statistics collected for each level.
+ */
+typedef struct clock_governor_stats_t_
+{
+	uint64_t residency_us[CLOCK_GOVERNOR_LEVEL_COUNT];				/*!< Time spent at each level */
+	uint32_t switches[CLOCK_GOVERNOR_LEVEL_COUNT];					/*!< Switches to each level */
+	uint64_t switch_time_total_us[CLOCK_GOVERNOR_LEVEL_COUNT];		/*!< Sum of the switch times to each level */
+	uint32_t switch_time_max_us[CLOCK_GOVERNOR_LEVEL_COUNT];		/*!< Longest switch to each level */
+} clock_governor_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Clock Governor at the burst level set by SystemClock_Config.
+ *
+ * Starts MSI locked to the LSE, so the software timer service must already be running.
+ *
+ * @param[in]     hspi SPI to keep under CLOCK_GOVERNOR_SPI_MAX_HZ
+ * @param[in]     heartbeat_htim timer to keep at its rate, may be 0
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_init (SPI_HandleTypeDef* hspi, TIM_HandleTypeDef* heartbeat_htim);
+
+
+/**
+ * @brief   Keep another SPI under CLOCK_GOVERNOR_SPI_MAX_HZ, for a second radio.
+ *
+ * The SPI must be on a bus clocked at the same rate as APB2, which holds while neither APB is divided.
+ *
+ * @param[in]     hspi SPI to keep under CLOCK_GOVERNOR_SPI_MAX_HZ
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_add_spi (SPI_HandleTypeDef* hspi);
+
+
+/**
+ * @brief   Switch level for the current demand. Called from the main loop on every pass.
+ *
+ * @param[in]     burst_demand 1 if the current work needs the burst clock
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_update (uint8_t burst_demand, uint32_t now_ms);
+
+
+/**
+ * @brief   Restore the clocks of the current level after STOP, for the power manager.
+ *
+ * @param         None
+ * @return        None
+ */
+void clock_governor_restore ();
+
+
+/**
+ * @brief   Get the current level.
+ *
+ * @param         None
+ * @return        the level
+ */
+clock_governor_level_t clock_governor_get_level ();
+
+
+/**
+ * @brief   Get the statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_get_stats (clock_governor_stats_t* stats);
+
+
+#endif /* CLOCK_GOVERNOR_H */
+
+/* End of file */
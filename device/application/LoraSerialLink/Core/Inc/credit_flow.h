@@ -0,0 +1,170 @@
+/**
+ * @file    credit_flow.h
+ *
+ * @brief   Credit Based Flow Control Between Radio and Serial Egress.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The receiver advertises the free space in its serial transmit buffer
+ *  together with the newest data packet it has received. The sender takes off
+ *  the bytes it has sent since that packet and holds data packets back when
+ *  the remaining credit would be exceeded, so nothing is sent that the
+ *  receiver would have to discard. A sender that stays blocked asks for a
+ *  fresh advertisement so lost packets cannot stall the link.
+ *
+ */
+
+#ifndef CREDIT_FLOW_H
+#define CREDIT_FLOW_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define CREDIT_FLOW_UPDATE_THRESHOLD		(250U)		/*!< Advertise once the sender's view is this many bytes short of the real free space */
+#define CREDIT_FLOW_REQUEST_TIMEOUT_MS		(1000U)		/*!< Blocked time before the sender asks for an advertisement */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Credit flow control statistics.
+ */
+typedef struct credit_flow_stats_t_
+{
+	uint32_t credits_sent;			/*!< Advertisements sent as receiver */
+	uint32_t credits_received;		/*!< Advertisements received as sender */
+	uint32_t requests_sent;			/*!< Advertisement requests sent while blocked */
+	uint32_t stalls;				/*!< Times a data packet was held back for lack of credit */
+} credit_flow_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise Credit Flow Control.
+ *
+ * @param[in]     initial_credit egress buffer space assumed at each end before the first advertisement
+ * @param[in]     next_sequence_number sequence number of the first data packet to be sent
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_init (uint32_t initial_credit, uint8_t next_sequence_number);
+
+
+/**
+ * @brief   Sender: check there is credit to send a data packet now.
+ *
+ * @param[in]     payload_length payload length of the data packet
+ * @param[in]     now_ms current time
+ * @return        1 if the packet may be sent, 0 to hold it back
+ */
+int32_t credit_flow_can_send (uint32_t payload_length, uint64_t now_ms);
+
+
+/**
+ * @brief   Sender: record a data packet handed to the radio.
+ *
+ * @param[in]     sequence_number sequence number of the data packet
+ * @param[in]     payload_length payload length of the data packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_data_sent (uint8_t sequence_number, uint32_t payload_length);
+
+
+/**
+ * @brief   Sender: apply a credit advertisement from the receiver.
+ *
+ * @param[in]     sequence_number newest data packet the receiver has received
+ * @param[in]     free_bytes receiver egress buffer space after that packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_credit (uint8_t sequence_number, uint32_t free_bytes);
+
+
+/**
+ * @brief   Sender: check whether to ask for an advertisement after being blocked too long.
+ *
+ * On success sequence_number is set to the newest data packet sent, and the request is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    sequence_number newest data packet sent, for the request payload
+ * @return        1 if a request should be sent now, 0 otherwise
+ */
+int32_t credit_flow_get_request (uint64_t now_ms, uint8_t* sequence_number);
+
+
+/**
+ * @brief   Receiver: record a data packet received from the sender.
+ *
+ * @param[in]     sequence_number sequence number of the data packet
+ * @param[in]     payload_length payload length of the data packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_data_received (uint8_t sequence_number, uint32_t payload_length);
+
+
+/**
+ * @brief   Receiver: answer an advertisement request from the sender.
+ *
+ * Every data packet the sender sent before the request has either arrived or been lost,
+ * so the advertisement can cover all of them.
+ *
+ * @param[in]     sequence_number newest data packet the sender has sent
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_request (uint8_t sequence_number);
+
+
+/**
+ * @brief   Receiver: check whether to send a credit advertisement.
+ *
+ * On success the advertisement is counted as sent.
+ *
+ * @param[in]     free_bytes current egress buffer space
+ * @param[out]    sequence_number newest data packet received, for the advertisement payload
+ * @return        1 if an advertisement should be sent now, 0 otherwise
+ */
+int32_t credit_flow_get_credit (uint32_t free_bytes, uint8_t* sequence_number);
+
+
+/**
+ * @brief   Get the credit flow control statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_get_stats (credit_flow_stats_t* stats);
+
+
+#endif /* CREDIT_FLOW_H */
+
+/* End of file */
@@ -132,6 +132,26 @@ int32_t dbg_output_write_str_blocking (char* str);
 int32_t dbg_output_process_on_interrupt();
 
 
+/**
+ * @brief   Debug output task - start sending anything written since the last transmission finished.
+ *
+ * The write functions only append to the fifo so they never touch the UART from the caller context.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t dbg_output_process();
+
+
+/**
+ * @brief   Has everything written been sent.
+ *
+ * @param         None
+ * @return        1 for idle, 0 for sending
+ */
+int32_t dbg_output_is_idle();
+
+
 
 #endif /* DBG_OUTPUT_H */
 
@@ -0,0 +1,114 @@
+/**
+ * @file    dedup_cache.h
+ *
+ * @brief   Duplicate LoRa Packet Suppression Cache.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Remembers the recent sequence numbers seen from each source address in a
+ *  sliding window bitmap so retransmitted or relayed copies of a packet can
+ *  be dropped before the payload is read from the radio.
+ *
+ */
+
+#ifndef DEDUP_CACHE_H
+#define DEDUP_CACHE_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define DEDUP_CACHE_MAX_PEERS		(8U)		/*!< Number of source addresses tracked, least recently heard is replaced */
+#define DEDUP_CACHE_WINDOW_SIZE		(32U)		/*!< Sequence numbers remembered behind the newest from each source */
+#define DEDUP_CACHE_PEER_TIMEOUT_MS	(10000U)	/*!< Window of a source not heard for this long is restarted, copies arrive well within it */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Duplicate suppression statistics.
+ */
+typedef struct dedup_cache_stats_t_
+{
+	uint32_t packets_checked;		/*!< Packets passed to dedup_cache_check */
+	uint32_t duplicates;			/*!< Packets reported as duplicates */
+	uint32_t resyncs;				/*!< Packets too far behind the window or after a silence, taken as a restarted source */
+	uint32_t peer_evictions;		/*!< Sources forgotten to make room for a new one */
+} dedup_cache_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Duplicate Cache. All sources are forgotten.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_init ();
+
+
+/**
+ * @brief   Check a packet against the cache. The cache is left unchanged, so a packet that
+ *          could not be passed on is not taken as seen and its retransmission gets through.
+ *
+ * @param[in]     source_address source address from the packet header
+ * @param[in]     sequence_number sequence number from the packet header
+ * @param[in]     now_ms current time
+ * @return        1 if the packet has been seen before, 0 if it is new
+ */
+int32_t dedup_cache_check (uint8_t source_address, uint8_t sequence_number, uint64_t now_ms);
+
+
+/**
+ * @brief   Record a packet as seen, once it has been passed on.
+ *
+ * @param[in]     source_address source address from the packet header
+ * @param[in]     sequence_number sequence number from the packet header
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_record (uint8_t source_address, uint8_t sequence_number, uint64_t now_ms);
+
+
+/**
+ * @brief   Get the duplicate suppression statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_get_stats (dedup_cache_stats_t* stats);
+
+
+#endif /* DEDUP_CACHE_H */
+
+/* End of file */
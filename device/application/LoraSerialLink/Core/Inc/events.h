@@ -0,0 +1,94 @@
+/**
+ * @file    events.h
+ *
+ * @brief   Event Flags Raised by Interrupts for the Main Loop.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Interrupt handlers set a flag for each kind of work they leave for the
+ *  main loop. The main loop takes all the pending flags at once, runs the
+ *  handlers for them, then the power manager sleeps until the next
+ *  interrupt if nothing new has been raised in the meantime.
+ *
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define EVENTS_RADIO				(1UL << 0)		/*!< Radio DIO0 - packet received or transmission done */
+#define EVENTS_SERIAL_RECEIVE		(1UL << 1)		/*!< Serial byte received or frame boundary detected */
+#define EVENTS_SERIAL_TRANSMIT		(1UL << 2)		/*!< Serial transmit segment done, fifo space freed */
+#define EVENTS_TIMER				(1UL << 3)		/*!< Software timer expired */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Raise events - ISR safe.
+ *
+ * @param[in]     events EVENTS_ flags to raise
+ * @return        None
+ */
+void events_set (uint32_t events);
+
+
+/**
+ * @brief   Take all the pending events, clearing them.
+ *
+ * @param         None
+ * @return        EVENTS_ flags raised since the last call
+ */
+uint32_t events_fetch_and_clear ();
+
+
+/**
+ * @brief   Get the pending events without clearing them - ISR safe.
+ *
+ * Called with interrupts masked before sleeping, so an event raised just before the
+ * sleep is not missed.
+ *
+ * @param         None
+ * @return        EVENTS_ flags raised since the last fetch
+ */
+uint32_t events_peek ();
+
+
+#endif /* EVENTS_H */
+
+/* End of file */
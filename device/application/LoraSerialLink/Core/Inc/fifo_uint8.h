@@ -76,7 +76,7 @@ typedef struct fifo_uint8_state_t_
  * @param[in]     buffer of length buffer_length for the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_init (fifo_uint8_state_t* fifo_state, uint32_t buffer_length, uint8_t buffer[buffer_length]);
+int32_t fifo_uint8_init (volatile fifo_uint8_state_t* fifo_state, uint32_t buffer_length, uint8_t buffer[buffer_length]);
 
 
 
@@ -88,7 +88,7 @@ int32_t fifo_uint8_init (fifo_uint8_state_t* fifo_state, uint32_t buffer_length,
  * @param[int]    fifo_state pointer to fifo state struct
  * @return        1 for True, 0 for False
  */
-int32_t fifo_uint8_is_empty (fifo_uint8_state_t* fifo_state);
+int32_t fifo_uint8_is_empty (volatile fifo_uint8_state_t* fifo_state);
 
 
 /**
@@ -99,7 +99,7 @@ int32_t fifo_uint8_is_empty (fifo_uint8_state_t* fifo_state);
  * @param[int]    fifo_state pointer to fifo state struct
  * @return        1 for True, 0 for False
  */
-int32_t fifo_uint8_is_full (fifo_uint8_state_t* fifo_state);
+int32_t fifo_uint8_is_full (volatile fifo_uint8_state_t* fifo_state);
 
 
 /**
@@ -111,7 +111,7 @@ int32_t fifo_uint8_is_full (fifo_uint8_state_t* fifo_state);
  * @param[in]     the_byte the value to write to the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_write_one (fifo_uint8_state_t* fifo_state, uint8_t the_byte);
+int32_t fifo_uint8_write_one (volatile fifo_uint8_state_t* fifo_state, uint8_t the_byte);
 
 
 /**
@@ -123,7 +123,76 @@ int32_t fifo_uint8_write_one (fifo_uint8_state_t* fifo_state, uint8_t the_byte);
  * @param[out]     the_byte the value to read from the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_read_one (fifo_uint8_state_t* fifo_state, uint8_t* the_byte);
+int32_t fifo_uint8_read_one (volatile fifo_uint8_state_t* fifo_state, uint8_t* the_byte);
+
+
+/**
+ * @brief   Get the number of values in the FIFO.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @return        count of values that can be read
+ */
+uint32_t fifo_uint8_get_count (volatile fifo_uint8_state_t* fifo_state);
+
+
+/**
+ * @brief   Get the free space in the FIFO.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @return        count of values that can be written
+ */
+uint32_t fifo_uint8_get_free (volatile fifo_uint8_state_t* fifo_state);
+
+
+/**
+ * @brief   Reserve space to write directly into the FIFO buffer.
+ *
+ * The space may wrap the end of the buffer so is returned as up to two segments.
+ * Nothing is visible to the reader until fifo_uint8_commit_write is called.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values to reserve
+ * @param[out]    first_segment start of the first segment
+ * @param[out]    first_length length of the first segment
+ * @param[out]    second_segment start of the second segment at the start of the buffer
+ * @param[out]    second_length length of the second segment, 0 if no wrap
+ * @return        0 for success or Error if there is not enough free space
+ */
+int32_t fifo_uint8_reserve_write (volatile fifo_uint8_state_t* fifo_state, uint32_t length,
+		volatile uint8_t** first_segment, uint32_t* first_length,
+		volatile uint8_t** second_segment, uint32_t* second_length);
+
+
+/**
+ * @brief   Commit values written directly into reserved space.
+ *
+ * @param[in/out]    fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values written
+ * @return        0 for success or Error
+ */
+int32_t fifo_uint8_commit_write (volatile fifo_uint8_state_t* fifo_state, uint32_t length);
+
+
+/**
+ * @brief   Get the contiguous run of values that can be read directly from the FIFO buffer.
+ *
+ * The values remain in the FIFO until fifo_uint8_commit_read is called.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @param[out]    segment start of the run
+ * @return        length of the run, 0 if empty
+ */
+uint32_t fifo_uint8_get_read_segment (volatile fifo_uint8_state_t* fifo_state, volatile uint8_t** segment);
+
+
+/**
+ * @brief   Release values read directly from the FIFO buffer.
+ *
+ * @param[in/out]    fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values read
+ * @return        0 for success or Error
+ */
+int32_t fifo_uint8_commit_read (volatile fifo_uint8_state_t* fifo_state, uint32_t length);
 
 
 #endif /* FIFO_UINT8_H */
@@ -39,7 +39,9 @@ extern "C" {
 void MX_GPIO_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+#if LORA_DUAL_RADIO_ENABLED
+void MX_GPIO_Radio2_Init(void);
+#endif
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
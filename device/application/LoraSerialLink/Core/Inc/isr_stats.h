@@ -0,0 +1,146 @@
+/**
+ * @file    isr_stats.h
+ *
+ * @brief   Interrupt Run Time and Latency Measurement.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Each interrupt handler calls isr_stats_enter on entry and isr_stats_exit
+ *  on exit, which time it with the DWT cycle counter. The worst case latency
+ *  of an interrupt is bounded by the longest run of each higher priority
+ *  interrupt, all of which can run back to back before it, plus the longest
+ *  run at its own priority, which may already be running. This is worked out
+ *  from the NVIC priorities in force, taking each interrupt once. The same
+ *  bound with every interrupt at one priority is also given, so the effect
+ *  of the priority plan can be compared from a single run.
+ *
+ */
+
+#ifndef ISR_STATS_H
+#define ISR_STATS_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Interrupts measured.
+ */
+typedef enum isr_stats_id_t_
+{
+	ISR_STATS_USART1 = 0,		/*!< Serial data port */
+	ISR_STATS_EXTI2,			/*!< Radio DIO0 */
+	ISR_STATS_EXTI1,			/*!< Second radio DIO0, with LORA_DUAL_RADIO_ENABLED */
+	ISR_STATS_TIM2,				/*!< Timebase overflow */
+	ISR_STATS_LPTIM1,			/*!< Software timers */
+	ISR_STATS_TIM15,			/*!< LED */
+	ISR_STATS_LPUART1,			/*!< Debug output */
+	ISR_STATS_COUNT
+} isr_stats_id_t;
+
+
+/**
+ * @brief   Statistics of an interrupt.
+ */
+typedef struct isr_stats_t_
+{
+	uint32_t count;					/*!< Times the handler has run */
+	uint32_t run_time_max_us;		/*!< Longest run, including any time preempted */
+	uint32_t latency_bound_us;		/*!< Longest runs of the higher priorities summed, plus the longest at its own, at the current priorities */
+	uint32_t latency_bound_flat_us;	/*!< Longest run of the other interrupts, as if all were at one priority */
+	uint8_t priority;				/*!< NVIC preemption priority */
+} isr_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Interrupt Statistics and enable the DWT cycle counter.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t isr_stats_init ();
+
+
+/**
+ * @brief   Forget the longest runs, for a change of core clock. The counts carry on.
+ *
+ * @param         None
+ * @return        None
+ */
+void isr_stats_reset_run_times ();
+
+
+/**
+ * @brief   Mark the entry of an interrupt handler.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        None
+ */
+void isr_stats_enter (isr_stats_id_t isr_id);
+
+
+/**
+ * @brief   Mark the exit of an interrupt handler.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        None
+ */
+void isr_stats_exit (isr_stats_id_t isr_id);
+
+
+/**
+ * @brief   Get the name of an interrupt.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        name, or 0 for an invalid id
+ */
+const char* isr_stats_get_name (isr_stats_id_t isr_id);
+
+
+/**
+ * @brief   Get the statistics of an interrupt, with the latency bounds worked out from the others.
+ *
+ * @param[in]     isr_id the interrupt
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t isr_stats_get (isr_stats_id_t isr_id, isr_stats_t* stats);
+
+
+#endif /* ISR_STATS_H */
+
+/* End of file */
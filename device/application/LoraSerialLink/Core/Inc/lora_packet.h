@@ -0,0 +1,151 @@
+/**
+ * @file    lora_packet.h
+ *
+ * @brief   LoRa Packet Structures.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Over the air layout is the header followed by the payload bytes.
+ *
+ */
+
+#ifndef LORA_PACKET_H
+#define LORA_PACKET_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define LORA_PACKET_MAX_PAYLOAD	(250U)
+
+/* ctrl_and_retry_count - packet type in the upper nibble, retry count in the lower */
+#define LORA_PACKET_TYPE_MASK				(0xF0U)
+#define LORA_PACKET_RETRY_COUNT_MASK		(0x0FU)
+
+#define LORA_PACKET_TYPE_DATA				(0x00U)		/*!< Serial payload */
+#define LORA_PACKET_TYPE_CREDIT				(0x10U)		/*!< Egress credit advertisement, lora_packet_credit_t payload */
+#define LORA_PACKET_TYPE_CREDIT_REQUEST		(0x20U)		/*!< Request for a credit advertisement, lora_packet_credit_t payload */
+#define LORA_PACKET_TYPE_LINK_REPORT		(0x30U)		/*!< Link quality measured at the receiver, lora_packet_link_report_t payload */
+#define LORA_PACKET_TYPE_ADR_SWITCH			(0x40U)		/*!< Proposed data rate change, lora_packet_adr_switch_t payload */
+#define LORA_PACKET_TYPE_ADR_ACK			(0x50U)		/*!< Accepted data rate change, lora_packet_adr_switch_t payload */
+#define LORA_PACKET_TYPE_CHANNEL_SWITCH		(0x60U)		/*!< Proposed channel change, lora_packet_channel_switch_t payload */
+#define LORA_PACKET_TYPE_CHANNEL_ACK		(0x70U)		/*!< Accepted channel change, lora_packet_channel_switch_t payload */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Header at the start of every LoRa Packet.
+ */
+typedef struct lora_packet_header_t_
+{
+	uint8_t destination_address;
+	uint8_t source_address;
+	uint8_t sequence_number;
+	uint8_t ctrl_and_retry_count;
+} lora_packet_header_t;
+
+
+/**
+ * @brief   Payload of the credit flow control packets. Multi-byte values are little endian.
+ *
+ * For LORA_PACKET_TYPE_CREDIT the sequence number is the newest data packet received and
+ * free bytes is the egress buffer space after it. For LORA_PACKET_TYPE_CREDIT_REQUEST the
+ * sequence number is the newest data packet sent and free bytes is unused.
+ */
+typedef struct lora_packet_credit_t_
+{
+	uint8_t sequence_number;
+	uint8_t free_bytes_lsb;
+	uint8_t free_bytes_msb;
+} lora_packet_credit_t;
+
+
+/**
+ * @brief   Payload of the link quality report.
+ *
+ * The weakest SNR the sender measures on the frames of its peers, referred to a 125 kHz bandwidth,
+ * for the data rate. Then the SNR margin and RSSI it measures on the frames of one peer, which
+ * that peer uses to set its transmit power. The RSSI is two's complement.
+ */
+typedef struct lora_packet_link_report_t_
+{
+	int8_t snr_ref_quarter_db;
+	uint8_t peer_address;
+	int8_t peer_margin_quarter_db;
+	uint8_t peer_rssi_dbm_lsb;
+	uint8_t peer_rssi_dbm_msb;
+} lora_packet_link_report_t;
+
+
+/**
+ * @brief   Payload of the data rate change proposal and its acknowledgement.
+ *
+ * The acknowledgement repeats the proposal. The proposer switches when it receives the
+ * acknowledgement, the other end once the acknowledgement is on air.
+ */
+typedef struct lora_packet_adr_switch_t_
+{
+	uint8_t rate_index;
+	uint8_t switch_id;
+} lora_packet_adr_switch_t;
+
+
+/**
+ * @brief   Payload of the channel change proposal and its acknowledgement.
+ *
+ * Agreed the same way as a data rate change.
+ */
+typedef struct lora_packet_channel_switch_t_
+{
+	uint8_t channel_index;
+	uint8_t switch_id;
+} lora_packet_channel_switch_t;
+
+
+/**
+ * @brief   LoRa Packet. Header and payload are contiguous so the packet can be sent as one buffer.
+ */
+typedef struct lora_packet_t_
+{
+	lora_packet_header_t header;
+	uint8_t payload[LORA_PACKET_MAX_PAYLOAD];
+	uint32_t payload_length;
+} lora_packet_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+
+#endif /* LORA_PACKET_H */
+
+/* End of file */
@@ -0,0 +1,134 @@
+/**
+ * @file    lora_packet_pool.h
+ *
+ * @brief   Fixed Block Pool of LoRa Packets.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Packets are passed between the radio, protocol and serial stages by handle.
+ *  Allocation and release are O(1) and safe to call from interrupts. Each
+ *  packet is reference counted so several queues (e.g. on air and awaiting
+ *  retransmission) can hold the same packet.
+ *
+ */
+
+#ifndef LORA_PACKET_POOL_H
+#define LORA_PACKET_POOL_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+#include "lora_packet.h"
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define LORA_PACKET_POOL_SIZE			(8U)		/*!< Number of packets in the pool */
+#define LORA_PACKET_HANDLE_INVALID		(0xFFU)		/*!< Returned when the pool is exhausted */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+typedef uint8_t lora_packet_handle_t;	/*!< Handle of a packet in the pool */
+
+
+/**
+ * @brief   Pool usage statistics for sizing RAM.
+ */
+typedef struct lora_packet_pool_stats_t_
+{
+	uint32_t in_use;				/*!< Packets currently allocated */
+	uint32_t high_water;			/*!< Most packets ever allocated at once */
+	uint32_t allocations;			/*!< Successful allocations */
+	uint32_t allocation_failures;	/*!< Allocations refused because the pool was empty */
+} lora_packet_pool_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Packet Pool. All packets are returned to the pool.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_init ();
+
+
+/**
+ * @brief   Allocate a packet with a reference count of one - ISR safe.
+ *
+ * The payload length is cleared, the rest of the packet is not.
+ *
+ * @param         None
+ * @return        handle of the packet, or LORA_PACKET_HANDLE_INVALID if the pool is empty
+ */
+lora_packet_handle_t lora_packet_pool_alloc ();
+
+
+/**
+ * @brief   Add a reference to an allocated packet - ISR safe.
+ *
+ * @param[in]     handle of the packet
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_retain (lora_packet_handle_t handle);
+
+
+/**
+ * @brief   Drop a reference, returning the packet to the pool on the last one - ISR safe.
+ *
+ * @param[in]     handle of the packet
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_release (lora_packet_handle_t handle);
+
+
+/**
+ * @brief   Get the packet of a handle.
+ *
+ * @param[in]     handle of the packet
+ * @return        pointer to the packet, or 0 for an invalid handle
+ */
+lora_packet_t* lora_packet_pool_get (lora_packet_handle_t handle);
+
+
+/**
+ * @brief   Get the pool usage statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_get_stats (lora_packet_pool_stats_t* stats);
+
+
+#endif /* LORA_PACKET_POOL_H */
+
+/* End of file */
@@ -73,6 +73,34 @@ void Error_Handler(void);
 
 /* USER CODE BEGIN Private defines */
 
+/* Interrupt priority plan - NVIC_PRIORITYGROUP_4, preemption only, lower values preempt higher ones.
+ * The generated MspInit code sets these from the .ioc, hand written code setting a priority follows the same plan.
+ *   0  USART1       - a character every 87 us at 115200 baud with no receive FIFO to absorb a late read
+ *   1  EXTI2, EXTI1 - radio DIO0 of each module, reads the packet header over SPI
+ *   2  TIM2, LPTIM1 - timebase overflow and software timers, only raise events
+ *   3  TIM15        - LED
+ *   4  LPUART1      - debug output
+ *   15 SysTick      - HAL tick
+ * State shared between the main loop and a handler, or between two handlers at different levels,
+ * must be a single word written by one side only, or be updated with interrupts masked.
+ */
+
+
+/* Second RFM95W on SPI2 for full duplex - the first module only transmits and the second only receives.
+ * Only used with a single peer at another address, towards the broadcast address the first module does both.
+ * Not in the .ioc, SPI2 and these pins are set up by hand in MX_SPI2_Init and MX_GPIO_Radio2_Init.
+ */
+#define LORA_DUAL_RADIO_ENABLED		(0)
+#define RFM95W_RX_EN_Pin GPIO_PIN_0
+#define RFM95W_RX_EN_GPIO_Port GPIOC
+#define RFM95W_RX_G0_Pin GPIO_PIN_1
+#define RFM95W_RX_G0_GPIO_Port GPIOC
+#define RFM95W_RX_G0_EXTI_IRQn EXTI1_IRQn
+#define RFM95W_RX_RST_Pin GPIO_PIN_2
+#define RFM95W_RX_RST_GPIO_Port GPIOC
+#define RFM95W_RX_CS_Pin GPIO_PIN_12
+#define RFM95W_RX_CS_GPIO_Port GPIOB
+
 /* USER CODE END Private defines */
 
 #ifdef __cplusplus
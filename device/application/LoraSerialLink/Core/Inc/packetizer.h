@@ -0,0 +1,251 @@
+/**
+ * @file    packetizer.h
+ *
+ * @brief   Serial to LoRa Packetization Policy.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Decides when the bytes collected from the serial port should be flushed
+ *  into a LoRa packet. Each policy is a set of hooks, called per byte, on a
+ *  serial frame boundary, and polled from the main loop along with the time
+ *  it next needs polling, so policies can be swapped at runtime and compared
+ *  using the per-policy latency and fill statistics. Whatever the policy, a
+ *  packet is not held for longer than the maximum hold time after its first
+ *  byte.
+ *
+ */
+
+#ifndef PACKETIZER_H
+#define PACKETIZER_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+#include "rfm95w.h"
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define PACKETIZER_INTER_CHAR_TIMEOUT_TENTHS	(35U)	/*!< Inter-character timeout in tenths of a character time (3.5 characters) */
+#define PACKETIZER_BITS_PER_CHARACTER			(10U)	/*!< Start + 8 data + stop bits */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Available packetization policies.
+ */
+typedef enum packetizer_policy_t_
+{
+	PACKETIZER_POLICY_FIXED_TIMEOUT = 0,	/*!< Flush when full or after a fixed serial silence */
+	PACKETIZER_POLICY_DELIMITER,			/*!< Flush immediately on the delimiter byte */
+	PACKETIZER_POLICY_INTER_CHAR_TIMEOUT,	/*!< Flush after 3.5 character times of serial silence */
+	PACKETIZER_POLICY_AIRTIME_FILL,			/*!< Hold until the payload outweighs the packet airtime overhead */
+	PACKETIZER_POLICY_RADIO_IDLE,			/*!< Flush whenever the radio is idle (Nagle-off) */
+	PACKETIZER_POLICY_COUNT
+} packetizer_policy_t;
+
+
+/**
+ * @brief   Reason a packet was flushed.
+ */
+typedef enum packetizer_flush_reason_t_
+{
+	PACKETIZER_FLUSH_NONE = 0,				/*!< Keep collecting */
+	PACKETIZER_FLUSH_FULL,					/*!< Maximum payload length reached */
+	PACKETIZER_FLUSH_DELIMITER,				/*!< Delimiter byte received */
+	PACKETIZER_FLUSH_TIMEOUT,				/*!< Fixed timeout since the last serial byte */
+	PACKETIZER_FLUSH_INTER_CHAR,			/*!< Inter-character timeout */
+	PACKETIZER_FLUSH_MIN_FILL,				/*!< Minimum fill target reached */
+	PACKETIZER_FLUSH_RADIO_IDLE,			/*!< Radio idle */
+	PACKETIZER_FLUSH_MAX_HOLD,				/*!< Maximum hold time since the first byte */
+	PACKETIZER_FLUSH_REASON_COUNT
+} packetizer_flush_reason_t;
+
+
+/**
+ * @brief   Frame boundaries detected by the serial hardware.
+ */
+typedef enum packetizer_boundary_t_
+{
+	PACKETIZER_BOUNDARY_IDLE = 0,			/*!< Receiver timeout - line idle for the inter-character timeout */
+	PACKETIZER_BOUNDARY_MATCH,				/*!< Character match on the delimiter byte */
+	PACKETIZER_BOUNDARY_COUNT
+} packetizer_boundary_t;
+
+
+/**
+ * @brief   Packetizer configuration.
+ */
+typedef struct packetizer_config_t_
+{
+	packetizer_policy_t policy;			/*!< Active policy */
+	uint8_t delimiter;					/*!< Delimiter byte for PACKETIZER_POLICY_DELIMITER */
+	uint32_t baud_rate;					/*!< Serial baud rate used to derive the inter-character timeout */
+	uint32_t max_payload_length;		/*!< Maximum payload length of a packet */
+	uint32_t timeout_ms;				/*!< Fixed timeout since the last byte */
+	uint32_t max_hold_ms;				/*!< Maximum time any policy holds the first byte of a packet, 0 for no limit */
+	rfm95w_state_t* radio;				/*!< Radio the packets are sent on, for their time on air */
+} packetizer_config_t;
+
+
+/**
+ * @brief   Statistics collected for each policy.
+ */
+typedef struct packetizer_stats_t_
+{
+	uint32_t packets;											/*!< Packets flushed */
+	uint32_t bytes;												/*!< Payload bytes flushed */
+	uint64_t latency_total_ms;									/*!< Sum of first byte to flush latencies */
+	uint32_t latency_max_ms;									/*!< Worst first byte to flush latency */
+	uint32_t flush_reason_count[PACKETIZER_FLUSH_REASON_COUNT];	/*!< Packets flushed per reason */
+} packetizer_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Packetizer.
+ *
+ * @param[in]     config packetizer configuration
+ * @return        0 for success or Error
+ */
+int32_t packetizer_init (const packetizer_config_t* config);
+
+
+/**
+ * @brief   Select the active packetization policy.
+ *
+ * @param[in]     policy the policy to use for subsequent packets
+ * @return        0 for success or Error
+ */
+int32_t packetizer_set_policy (packetizer_policy_t policy);
+
+
+/**
+ * @brief   Get the active packetization policy.
+ *
+ * @param         None
+ * @return        the active policy
+ */
+packetizer_policy_t packetizer_get_policy ();
+
+
+/**
+ * @brief   Get the name of a packetization policy.
+ *
+ * @param[in]     policy the policy
+ * @return        name, or 0 for an invalid policy
+ */
+const char* packetizer_get_policy_name (packetizer_policy_t policy);
+
+
+/**
+ * @brief   Update the serial baud rate used to derive the inter-character timeout.
+ *
+ * @param[in]     baud_rate serial baud rate
+ * @return        0 for success or Error
+ */
+int32_t packetizer_set_baud_rate (uint32_t baud_rate);
+
+
+/**
+ * @brief   Called for each serial byte appended to the packet being assembled.
+ *
+ * @param[in]     the_byte the byte just appended
+ * @param[in]     payload_length payload length including the_byte
+ * @param[in]     byte_time_ms time the byte was received
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_on_byte (uint8_t the_byte, uint32_t payload_length, uint64_t byte_time_ms);
+
+
+/**
+ * @brief   Called when the serial hardware reports a frame boundary after the last byte appended.
+ *
+ * Lets the policies that look for serial silence or a delimiter flush without waiting for
+ * the main loop to notice, so the flush latency does not depend on how fast it runs.
+ *
+ * @param[in]     boundary the boundary detected
+ * @param[in]     payload_length current payload length
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_on_boundary (packetizer_boundary_t boundary, uint32_t payload_length);
+
+
+/**
+ * @brief   Polled from the main loop to check the time based flush conditions.
+ *
+ * @param[in]     payload_length current payload length
+ * @param[in]     radio_idle 1 if the radio could transmit now
+ * @param[in]     last_byte_time_ms time the last serial byte was received
+ * @param[in]     now_ms current time
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_poll (uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms);
+
+
+/**
+ * @brief   Get the time at which packetizer_poll may next flush, so a timer can be set for it.
+ *
+ * @param[in]     payload_length current payload length
+ * @param[in]     last_byte_time_ms time the last serial byte was received
+ * @return        time in milliseconds, 0 if no time based flush is pending
+ */
+uint64_t packetizer_get_poll_time_ms (uint32_t payload_length, uint64_t last_byte_time_ms);
+
+
+/**
+ * @brief   Record a flushed packet against the active policy statistics.
+ *
+ * @param[in]     reason the flush reason
+ * @param[in]     payload_length payload length of the flushed packet
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t packetizer_on_flush (packetizer_flush_reason_t reason, uint32_t payload_length, uint64_t now_ms);
+
+
+/**
+ * @brief   Get the statistics of a policy.
+ *
+ * Average latency is latency_total_ms / packets.
+ * Fill ratio is bytes / (packets * max_payload_length).
+ *
+ * @param[in]     policy the policy
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t packetizer_get_stats (packetizer_policy_t policy, packetizer_stats_t* stats);
+
+
+#endif /* PACKETIZER_H */
+
+/* End of file */
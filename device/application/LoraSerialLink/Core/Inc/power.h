@@ -0,0 +1,168 @@
+/**
+ * @file    power.h
+ *
+ * @brief   Low Power Mode Manager.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Called from the main loop once the tasks have run, to sleep until the
+ *  next interrupt. When nothing in progress needs the high speed clocks and
+ *  no software timer is due soon the core enters STOP, otherwise it sleeps
+ *  in WFI. The wake sources in STOP are the radio DIO0 EXTI, the LPTIM1
+ *  software timers and the start bit of a serial character.
+ *
+ *  USART1 can only wake the core from STOP1, so STOP1 is used while a byte
+ *  from the host must wake it and STOP2 otherwise. LPUART1 wakes the core
+ *  from either. Both are clocked from HSI16, which is also the wake clock,
+ *  so a character is received at the right baud rate while the PLL is
+ *  restarted and the first byte is not lost.
+ *
+ *  The time spent in each mode is charged at typical currents, with the run
+ *  and sleep currents following the system clock, so the average current
+ *  and energy of the MCU can be estimated for the traffic over any period.
+ *
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define POWER_STOP_MIN_SLEEP_US		(2000U)		/*!< Sleep in WFI instead of STOP when a timer is due sooner than this */
+#define POWER_SUPPLY_MV				(3300U)		/*!< Supply voltage for the energy estimate */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Power modes, in order of decreasing current.
+ */
+typedef enum power_mode_t_
+{
+	POWER_MODE_RUN = 0,				/*!< Running at the full clock */
+	POWER_MODE_SLEEP,				/*!< WFI with the clocks running */
+	POWER_MODE_STOP1,				/*!< STOP1, USART1 able to wake the core */
+	POWER_MODE_STOP2,				/*!< STOP2 */
+	POWER_MODE_COUNT
+} power_mode_t;
+
+
+/**
+ * @brief   Restores the system clocks after STOP, e.g. SystemClock_Config.
+ */
+typedef void (*power_clock_restore_t)(void);
+
+
+/**
+ * @brief   Statistics collected since the last reset.
+ */
+typedef struct power_stats_t_
+{
+	uint64_t elapsed_us;							/*!< Time since the statistics were reset */
+	uint64_t residency_us[POWER_MODE_COUNT];		/*!< Time spent in each mode */
+	uint32_t entries[POWER_MODE_COUNT];				/*!< Times each low power mode was entered */
+	uint32_t wake_latency_max_us;					/*!< Longest time from waking from STOP to the clocks being restored */
+	uint64_t wake_latency_total_us;					/*!< Sum of the wake latencies */
+	uint64_t charge_ua_us;							/*!< MCU charge estimated from the residency and the currents of each mode */
+	uint32_t average_current_ua;					/*!< charge_ua_us / elapsed_us */
+	uint32_t energy_uj;								/*!< charge_ua_us at POWER_SUPPLY_MV */
+} power_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Power Manager.
+ *
+ * Selects HSI16 as the clock on waking from STOP, until the clock governor changes it, and
+ * sets both UARTs to wake on a start bit.
+ * The UARTs must already be clocked from HSI16 and the software timer service started.
+ *
+ * @param[in]     clock_restore restores the system clocks after STOP
+ * @param[in]     serial_uart USART1, the host serial link
+ * @param[in]     debug_uart LPUART1, the debug serial link
+ * @return        0 for success or Error
+ */
+int32_t power_init (power_clock_restore_t clock_restore, UART_HandleTypeDef* serial_uart, UART_HandleTypeDef* debug_uart);
+
+
+/**
+ * @brief   Sleep until an interrupt, unless events are already pending.
+ *
+ * Interrupts are masked while checking so an event raised just before the sleep still
+ * wakes the core. The clocks are restored with interrupts enabled, so the interrupt that
+ * woke the core is handled first.
+ *
+ * @param[in]     stop_allowed 1 if nothing in progress needs the high speed clocks
+ * @param[in]     serial_wake 1 if a character from the host must wake the core
+ * @return        mode entered, POWER_MODE_RUN if events were pending
+ */
+power_mode_t power_sleep (uint8_t stop_allowed, uint8_t serial_wake);
+
+
+/**
+ * @brief   Get the statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t power_get_stats (power_stats_t* stats);
+
+
+/**
+ * @brief   Set the run and sleep currents of the current system clock, for the estimate.
+ *
+ * Called by the clock governor as it switches, the time up to now is charged at the old currents.
+ *
+ * @param[in]     run_current_ua MCU current running
+ * @param[in]     sleep_current_ua MCU current in WFI sleep
+ * @return        0 for success or Error
+ */
+int32_t power_set_clock_currents (uint32_t run_current_ua, uint32_t sleep_current_ua);
+
+
+/**
+ * @brief   Reset the statistics, to start measuring a new traffic profile.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t power_reset_stats ();
+
+
+#endif /* POWER_H */
+
+/* End of file */
@@ -20,25 +20,160 @@
 #include "stm32l4xx_hal.h"
 #include "stm32l4xx_hal_spi.h"
 
+#include "soft_timer.h"
+
 /*
  * Public: Constants and Macros 
  */
 
-#define RFM95W_EN_GPIO_PIN 		GPIO_PIN_0		/*!< EN pin */
-#define RFM95W_EN_GPIO_PORT 	GPIOA			/*!< EN port */
-#define RFM95W_G0_GPIO_PIN 		GPIO_PIN_2		/*!< G0 pin */
-#define RFM95W_G0_GPIO_PORT 	GPIOA			/*!< G0 port */
-#define RFM95W_RST_GPIO_PIN 	GPIO_PIN_3		/*!< RST pin */
-#define RFM95W_RST_GPIO_PORT 	GPIOA			/*!< RST port */
-#define RFM95W_CS_GPIO_PIN 		GPIO_PIN_4		/*!< CS pin */
-#define RFM95W_CS_GPIO_PORT 	GPIOA			/*!< CS port */
+#define RFM95W_MAX_INSTANCES	(2U)			/*!< Modules that can be driven at once, each on its own SPI and pins */
 
 #define RFM95W_FREQ_RF			(868000000.0f)	/*!< RF Centre Frequency (868 MHz) */
+#define RFM95W_MIN_FREQUENCY_HZ	(862000000U)	/*!< High frequency port, where the RSSI offset applies */
+#define RFM95W_MAX_FREQUENCY_HZ	(1020000000U)
+#define RFM95W_MAX_FREQUENCY_CORRECTION_HZ	(25000)	/*!< About 29 ppm at 868 MHz, two crystals at their tolerance */
+
+#define RFM95W_RECEIVE_HEADER_LENGTH	(4U)	/*!< Bytes read from the module FIFO in the interrupt, the first is the destination address */
+#define RFM95W_ADDRESS_FILTER_MAX		(8U)	/*!< Maximum entries in the destination address allow-list */
+
+#define RFM95W_MIN_SPREADING_FACTOR		(7U)	/*!< SF6 needs implicit header mode */
+#define RFM95W_MAX_SPREADING_FACTOR		(12U)
+
+#define RFM95W_MIN_TX_POWER_DBM			(2)		/*!< Lowest PA_BOOST output */
+#define RFM95W_MAX_TX_POWER_DBM			(20)	/*!< PA_DAC above 17 dBm, duty cycled operation only */
+#define RFM95W_DEFAULT_TX_POWER_DBM		(10)	/*!< Output power set by rfm95w_init */
+
+#define RFM95W_DEFAULT_SYNC_WORD		(0x12U)	/*!< SX1276 reset value, used by every unit not configured otherwise */
 
 /*
  * Public: Typedefs
  */
 
+/**
+ * @brief   IQ inversion of each direction.
+ *
+ * A unit only demodulates frames sent with the opposite IQ to the one it receives with, so
+ * units sending the uplink only hear units sending the downlink and the other way around.
+ */
+typedef enum rfm95w_iq_mode_t_
+{
+	RFM95W_IQ_MODE_NORMAL = 0,		/*!< Normal IQ both ways, every unit hears every other */
+	RFM95W_IQ_MODE_UPLINK,			/*!< Transmit normal IQ, receive inverted */
+	RFM95W_IQ_MODE_DOWNLINK,		/*!< Transmit inverted IQ, receive normal */
+	RFM95W_IQ_MODE_COUNT
+} rfm95w_iq_mode_t;
+
+
+/**
+ * @brief   Receive address filter statistics.
+ */
+typedef struct rfm95w_filter_stats_t_
+{
+	uint32_t frames_accepted;		/*!< Frames passed to the user */
+	uint32_t frames_filtered;		/*!< Frames discarded in the interrupt by the address filter */
+	uint32_t bytes_filtered;		/*!< Bytes of discarded frames never read over SPI */
+} rfm95w_filter_stats_t;
+
+
+/**
+ * @brief   Signal quality of a received packet.
+ */
+typedef struct rfm95w_packet_quality_t_
+{
+	int16_t snr_quarter_db;			/*!< Packet SNR in 0.25 dB steps */
+	int16_t rssi_dbm;				/*!< Packet RSSI, corrected for the SNR below the noise floor */
+	int32_t frequency_error_hz;		/*!< Carrier of the packet less the untrimmed link frequency, from the FEI */
+} rfm95w_packet_quality_t;
+
+
+/**
+ * @brief   Wake-on-radio statistics.
+ */
+typedef struct rfm95w_sniff_stats_t_
+{
+	uint32_t cad_count;				/*!< Channel activity detections run */
+	uint32_t cad_detected;			/*!< Detections that found a preamble and entered RX */
+	uint32_t false_wakes;			/*!< Detections with no packet received before the RX fallback timeout */
+} rfm95w_sniff_stats_t;
+
+
+/**
+ * @brief   Wake-on-radio receive state.
+ */
+typedef enum rfm95w_sniff_state_t_
+{
+	RFM95W_SNIFF_STATE_SLEEP = 0,	/*!< Asleep until the next sniff, or listening continuously when disabled */
+	RFM95W_SNIFF_STATE_CAD,			/*!< Channel activity detection running */
+	RFM95W_SNIFF_STATE_RECEIVE		/*!< Preamble detected, in RX until a packet or the fallback timeout */
+} rfm95w_sniff_state_t;
+
+
+/**
+ * @brief   SPI and pins of a module.
+ */
+typedef struct rfm95w_config_t_
+{
+	SPI_HandleTypeDef* spi_handle;	/*!< SPI Handle, not shared with another module */
+	GPIO_TypeDef* en_port;			/*!< EN port */
+	uint16_t en_pin;				/*!< EN pin */
+	GPIO_TypeDef* rst_port;			/*!< RST port */
+	uint16_t rst_pin;				/*!< RST pin */
+	GPIO_TypeDef* cs_port;			/*!< CS port */
+	uint16_t cs_pin;				/*!< CS pin */
+	uint16_t g0_pin;				/*!< G0 pin, to match the EXTI callback to the module */
+	IRQn_Type g0_irqn;				/*!< G0 interrupt, masked around the SPI transfers of the main loop */
+	uint8_t receive_enabled;		/*!< 0 for a module that only transmits, it waits in standby instead of listening */
+} rfm95w_config_t;
+
+
+/**
+ * @brief   Struct to hold the state of the RFM95W instance.
+ *
+ * Owned by the caller and only changed through the rfm95w functions. The interrupt of each
+ * module touches only its own state, so two modules run independently.
+ *
+ */
+typedef struct rfm95w_state_t_
+{
+	rfm95w_config_t config;					/*!< SPI and pins */
+	uint8_t initialised;					/*!< Initialised flag */
+
+	volatile uint32_t receive_buffer_length;		/*!< Length of the packet waiting in the module FIFO */
+	volatile uint8_t receive_fifo_address;			/*!< Module FIFO address of the packet waiting */
+	volatile uint8_t receive_header[RFM95W_RECEIVE_HEADER_LENGTH];	/*!< Start of the packet waiting, read in the interrupt */
+	volatile uint32_t receive_header_length;		/*!< Bytes held in receive_header */
+	volatile rfm95w_packet_quality_t receive_quality;	/*!< SNR, RSSI and frequency error of the packet waiting */
+	volatile uint8_t packet_received;
+	volatile uint8_t transmit_in_progress;
+
+	uint8_t address_filter[RFM95W_ADDRESS_FILTER_MAX];	/*!< Destination addresses accepted */
+	volatile uint32_t address_filter_count;			/*!< Entries in address_filter, 0 accepts all */
+	volatile rfm95w_filter_stats_t filter_stats;
+
+	/* Modem configuration - must match the registers written in rfm95w_init */
+	uint8_t spreading_factor;				/*!< Spreading factor (SF7 = 128 chips) */
+	uint32_t bandwidth_hz;					/*!< Signal bandwidth in Hz */
+	uint8_t coding_rate;					/*!< Coding rate 4/(4+coding_rate) */
+	uint16_t preamble_length;				/*!< Programmed preamble length in symbols */
+	uint8_t payload_crc_on;					/*!< Payload CRC enabled */
+	uint8_t implicit_header_on;				/*!< Implicit header mode */
+	int8_t tx_power_dbm;					/*!< Output power on PA_BOOST */
+	uint8_t sync_word;						/*!< Network sync word */
+	rfm95w_iq_mode_t iq_mode;				/*!< IQ inversion of each direction */
+	volatile uint8_t invert_iq_written;		/*!< RFM95W_REG_33_INVERT_IQ value in the module */
+	uint32_t frequency_hz;					/*!< Link frequency */
+	int32_t frequency_correction_hz;		/*!< Trim of the link frequency to the peer */
+	volatile uint8_t noise_sampling;		/*!< In RX on another channel to sample its noise */
+
+	/* Wake-on-radio */
+	soft_timer_id_t sniff_timer;			/*!< Runs every sniff period while enabled */
+	uint32_t sniff_latency_ms;				/*!< Latency the sniff period and preamble were derived from */
+	uint32_t sniff_period_us;				/*!< Time between detections, 0 listens continuously */
+	uint32_t sniff_receive_timeout_ticks;	/*!< Longest packet on air, on the soft timer timebase */
+	volatile rfm95w_sniff_state_t sniff_state;
+	volatile uint32_t sniff_receive_start_ticks;	/*!< Time the last detection entered RX */
+	volatile rfm95w_sniff_stats_t sniff_stats;
+} rfm95w_state_t;
 
 
 
@@ -64,68 +199,305 @@
 /**
  * @brief   Initialise RFM95W module.
  *
- * @param[in]     spi_handle
+ * Each module needs its own SPI and pins, and its own state for as long as it is used.
+ *
+ * @param[out]    radio pointer to the module state struct
+ * @param[in]     config SPI and pins of the module
  * @return        0 for success or Error
  */
-int32_t rfm95w_init(SPI_HandleTypeDef* spi_handle);
+int32_t rfm95w_init(rfm95w_state_t* radio, const rfm95w_config_t* config);
 
 
 /**
  * @brief   Transmit a LoRa Packet with the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  buffer_length	length of the buffer to transmit.
+ * @param[in]	  buffer buffer to transmit.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_transmit_packet(rfm95w_state_t* radio, uint32_t buffer_length, uint8_t buffer[buffer_length]);
+
+
+/**
+ * @brief   Start transmitting a LoRa Packet with the RFM95W module - non-blocking.
+ *
+ * The buffer is copied into the module FIFO before returning so it may be reused immediately.
+ * Fails while a received packet is waiting to be collected.
+ *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]	  buffer_length	length of the buffer to transmit.
  * @param[in]	  buffer buffer to transmit.
  * @return        0 for success or Error
  */
-int32_t rfm95w_transmit_packet(uint32_t buffer_length, uint8_t buffer[buffer_length]);
+int32_t rfm95w_start_transmit_packet(rfm95w_state_t* radio, uint32_t buffer_length, uint8_t buffer[buffer_length]);
+
+
+/**
+ * @brief   Is a transmission in progress on the RFM95W module.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        1 for transmitting, 0 for idle
+ */
+int32_t rfm95w_is_transmitting(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Change the modem configuration.
+ *
+ * Fails while transmitting. Any wake-on-radio preamble is derived again for the new symbol time,
+ * falling back to listening continuously if the latency is too short for it.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  spreading_factor RFM95W_MIN_SPREADING_FACTOR to RFM95W_MAX_SPREADING_FACTOR.
+ * @param[in]	  bandwidth_hz one of the SX1276 bandwidths, 7800 to 500000.
+ * @param[in]	  coding_rate 1 to 4 for 4/5 to 4/8.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_modem_config(rfm95w_state_t* radio, uint8_t spreading_factor, uint32_t bandwidth_hz, uint8_t coding_rate);
+
+
+/**
+ * @brief   Change the transmit power, from the next transmission.
+ *
+ * Fails while transmitting. Writing the power already set costs no SPI transfers.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  power_dbm RFM95W_MIN_TX_POWER_DBM to RFM95W_MAX_TX_POWER_DBM.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_tx_power(rfm95w_state_t* radio, int8_t power_dbm);
+
+
+/**
+ * @brief   Set the network sync word and IQ direction, to reject foreign and same-direction frames in the modem.
+ *
+ * Fails while transmitting. Both ends of a link must use the same sync word, and opposite IQ
+ * modes unless both are RFM95W_IQ_MODE_NORMAL.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  sync_word network sync word, avoid 0x34 which is used by public LoRaWAN networks.
+ * @param[in]	  iq_mode IQ inversion of each direction.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_network(rfm95w_state_t* radio, uint8_t sync_word, rfm95w_iq_mode_t iq_mode);
+
+
+/**
+ * @brief   Change the link frequency, from the next transmission or reception.
+ *
+ * Fails while transmitting or sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  frequency_hz RFM95W_MIN_FREQUENCY_HZ to RFM95W_MAX_FREQUENCY_HZ.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_frequency(rfm95w_state_t* radio, uint32_t frequency_hz);
+
+
+/**
+ * @brief   Leave the link frequency to sample the noise on a channel with rfm95w_read_rssi.
+ *
+ * Fails while transmitting or while a received packet waits to be collected. Nothing is received
+ * and nothing can be transmitted until rfm95w_stop_noise_sample, so keep the dwell short.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  frequency_hz channel to sample, RFM95W_MIN_FREQUENCY_HZ to RFM95W_MAX_FREQUENCY_HZ.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_start_noise_sample(rfm95w_state_t* radio, uint32_t frequency_hz);
+
+
+/**
+ * @brief   Read the current RSSI of the channel being sampled.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  rssi_dbm current RSSI.
+ * @return        0 for success or Error if not sampling
+ */
+int32_t rfm95w_read_rssi(rfm95w_state_t* radio, int16_t* rssi_dbm);
+
+
+/**
+ * @brief   Return to the link frequency and to listening for packets.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_stop_noise_sample(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Gather a random value from the noise on the link frequency.
+ *
+ * Collects the least significant bit of the wideband RSSI in RX with no packet
+ * interrupt, then returns to listening. Fails while transmitting, while a received
+ * packet waits to be collected or while sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  random_value random bits.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_get_random(rfm95w_state_t* radio, uint32_t* random_value);
+
+
+/**
+ * @brief   Trim the link frequency and the data rate for the frequency offset of the peer.
+ *
+ * Fails while transmitting or sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  correction_hz added to the link frequency, at most RFM95W_MAX_FREQUENCY_CORRECTION_HZ either way.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_frequency_correction(rfm95w_state_t* radio, int32_t correction_hz);
+
 
+/**
+ * @brief   Calculate the time on air of a LoRa Packet with the current modem configuration.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[in]	  buffer_length	length of the buffer to transmit.
+ * @return        time on air in microseconds
+ */
+uint32_t rfm95w_get_time_on_air_us(rfm95w_state_t* radio, uint32_t buffer_length);
 
 
 /**
  * @brief   Listen for incoming LoRa Packets with the RFM95W module.
  *
- * @param	      None
+ * A module that only transmits waits in standby instead.
+ *
+ * @param[in/out] radio pointer to the module state struct
  * @return        0 for success or Error
  */
-int32_t rfm95w_listen_for_packets();
+int32_t rfm95w_listen_for_packets(rfm95w_state_t* radio);
 
 
 
 /**
  * @brief   Has a packet been received by the RFM95W module.
  *
- * @param	      None
+ * @param[in]     radio pointer to the module state struct
  * @return        1 for packet received, 0 for no packet received, or Error
  */
-int32_t rfm95w_is_packet_received();
+int32_t rfm95w_is_packet_received(rfm95w_state_t* radio);
 
 /**
- * @brief   Clear the last packet received flag.
+ * @brief   Clear the last packet received flag and resume listening.
  *
- * @param	      None
+ * @param[in/out] radio pointer to the module state struct
  * @return        0 for success, or Error
  */
-int32_t rfm95w_clear_is_packet_received();
+int32_t rfm95w_clear_is_packet_received(rfm95w_state_t* radio);
+
+/**
+ * @brief   Get the length of the received LoRa Packet waiting in the module FIFO.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        length in bytes, 0 if no packet is waiting
+ */
+uint32_t rfm95w_get_received_length(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Read the start of the received LoRa Packet from the module FIFO.
+ *
+ * Lets the caller inspect the packet header before deciding where, or whether, to read the rest.
+ * Up to RFM95W_RECEIVE_HEADER_LENGTH bytes come from the copy taken in the interrupt without another SPI read.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  header_length	number of bytes to read from the start of the packet.
+ * @param[out]	  buffer buffer to read into.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_read_received_header(rfm95w_state_t* radio, uint32_t header_length, volatile uint8_t buffer[header_length]);
+
+
+/**
+ * @brief   Get the signal quality of the received LoRa Packet waiting in the module FIFO.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  quality SNR, RSSI and frequency error latched with the packet.
+ * @return        0 for success or Error if no packet is waiting
+ */
+int32_t rfm95w_get_received_quality(rfm95w_state_t* radio, rfm95w_packet_quality_t* quality);
+
+
+/**
+ * @brief   Continue reading the received LoRa Packet from where the last read finished.
+ *
+ * May be called repeatedly to scatter the payload across several buffers.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  buffer_length	number of bytes to read.
+ * @param[out]	  buffer buffer to read into.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_read_received_payload(rfm95w_state_t* radio, uint32_t buffer_length, volatile uint8_t buffer[buffer_length]);
+
+
+
+/**
+ * @brief   Set the destination address allow-list checked in the interrupt.
+ *
+ * The first byte of each received frame is compared against the list and frames that do not match
+ * are discarded without reading the rest of the FIFO. Frames shorter than RFM95W_RECEIVE_HEADER_LENGTH
+ * are also discarded while the filter is enabled. An address_count of 0 disables the filter.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  address_count	number of addresses in the list.
+ * @param[in]	  addresses own, broadcast and multicast group addresses to accept.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_address_filter(rfm95w_state_t* radio, uint32_t address_count, const uint8_t addresses[address_count]);
+
+
+/**
+ * @brief   Get the receive address filter statistics.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  stats copy of the statistics.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_get_filter_stats(rfm95w_state_t* radio, rfm95w_filter_stats_t* stats);
+
+
+
+/**
+ * @brief   Set the wake-on-radio receive latency.
+ *
+ * A latency of 0 listens in RX continuous. Otherwise the module sleeps and wakes for a channel activity
+ * detection every sniff period, entering RX only when it detects a preamble. Packets are sent with a
+ * preamble that spans the sniff period, so both ends of the link must use the same latency. The sniff
+ * period and the preamble length are derived from the latency and the modem configuration.
+ * The software timer service must already be running.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  latency_ms time allowed for the preamble ahead of each packet, 0 to listen continuously.
+ * @return        0 for success or Error if the latency is too short for the modem configuration
+ */
+int32_t rfm95w_set_wake_on_radio(rfm95w_state_t* radio, uint32_t latency_ms);
+
 
 /**
- * @brief   Copy the last received LoRa Packet into the buffer.
+ * @brief   Get the wake-on-radio statistics.
  *
- * @param[in]	  max_buffer_length	length of the buffer to copy into.
- * @param[out]	  buffer buffer to copy into.
- * @param[out]	  received_buffer_length size of packet copied into the buffer
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  stats copy of the statistics.
  * @return        0 for success or Error
  */
-int32_t rfm95w_get_received_packet(uint32_t max_buffer_length, volatile uint8_t buffer[max_buffer_length], volatile uint32_t* received_buffer_length);
+int32_t rfm95w_get_sniff_stats(rfm95w_state_t* radio, rfm95w_sniff_stats_t* stats);
 
 
 
 /**
  * @brief   Process Interrupts from RFM95W module.
  *
- * @param         None
+ * @param[in/out] radio pointer to the module state struct
  * @return        0 for success or Error
  */
-int32_t rfm95w_process_interrupt();
+int32_t rfm95w_process_interrupt(rfm95w_state_t* radio);
 
 
 
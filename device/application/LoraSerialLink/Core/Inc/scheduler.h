@@ -0,0 +1,166 @@
+/**
+ * @file    scheduler.h
+ *
+ * @brief   Cooperative Run-to-Completion Task Scheduler.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Tasks are registered once into a static table and run from the main loop
+ *  in priority order. A task is ready when one of the events it listens for
+ *  has been raised or its period has elapsed since it last ran. Each task
+ *  runs to completion, so the run time of every task is measured and the
+ *  longest run is reported as the worst case added to the latency of the
+ *  others.
+ *
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define SCHEDULER_MAX_TASKS			(8U)		/*!< Size of the task table */
+#define SCHEDULER_TASK_ID_NONE		(0xFFU)		/*!< No task */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Task function, called when the task is ready and expected to return promptly.
+ */
+typedef void (*scheduler_task_function_t)(void);
+
+
+/**
+ * @brief   Task configuration.
+ */
+typedef struct scheduler_task_config_t_
+{
+	const char* name;					/*!< Name for the statistics output */
+	scheduler_task_function_t function;	/*!< Task function */
+	uint8_t priority;					/*!< 0 is the highest, tasks of equal priority run in the order added */
+	uint32_t event_mask;				/*!< EVENTS_ flags that make the task ready */
+	uint32_t period_ms;					/*!< Also ready this long after it last ran, 0 for events only */
+	uint32_t deadline_us;				/*!< Allowed delay from the start of the pass to the task running, 0 for none */
+} scheduler_task_config_t;
+
+
+/**
+ * @brief   Statistics collected for each task.
+ */
+typedef struct scheduler_task_stats_t_
+{
+	uint32_t runs;					/*!< Times the task has run */
+	uint32_t deadline_misses;		/*!< Runs started later than the deadline */
+	uint64_t run_time_total_us;		/*!< Sum of the run times */
+	uint32_t run_time_max_us;		/*!< Longest run */
+	uint32_t latency_max_us;		/*!< Longest delay from the start of the pass to the task running */
+} scheduler_task_stats_t;
+
+
+/**
+ * @brief   Statistics collected across all tasks.
+ */
+typedef struct scheduler_stats_t_
+{
+	uint32_t passes;				/*!< Passes with at least one task ready */
+	uint32_t longest_run_us;		/*!< Longest single task run */
+	uint8_t longest_run_task_id;	/*!< Task of the longest run, SCHEDULER_TASK_ID_NONE if none has run */
+} scheduler_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Scheduler with an empty task table.
+ *
+ * Enables the DWT cycle counter used for the run time accounting.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t scheduler_init ();
+
+
+/**
+ * @brief   Add a task to the table.
+ *
+ * @param[in]     config task configuration
+ * @param[out]    task_id id of the task for the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_add_task (const scheduler_task_config_t* config, uint8_t* task_id);
+
+
+/**
+ * @brief   Run every ready task once, highest priority first.
+ *
+ * @param[in]     events EVENTS_ flags taken since the last pass
+ * @param[in]     now_ms current time
+ * @return        number of tasks run
+ */
+uint32_t scheduler_run (uint32_t events, uint32_t now_ms);
+
+
+/**
+ * @brief   Get the name of a task.
+ *
+ * @param[in]     task_id id of the task
+ * @return        name of the task, or 0 for an invalid id
+ */
+const char* scheduler_get_task_name (uint8_t task_id);
+
+
+/**
+ * @brief   Get the statistics of a task.
+ *
+ * @param[in]     task_id id of the task
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_get_task_stats (uint8_t task_id, scheduler_task_stats_t* stats);
+
+
+/**
+ * @brief   Get the statistics across all tasks.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_get_stats (scheduler_stats_t* stats);
+
+
+#endif /* SCHEDULER_H */
+
+/* End of file */
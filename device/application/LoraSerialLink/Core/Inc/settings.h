@@ -0,0 +1,111 @@
+/**
+ * @file    settings.h
+ *
+ * @brief   Persistent Settings.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Settings that survive a reboot are kept in the last page of flash, which
+ *  is removed from the FLASH region in the linker script. A missing or
+ *  corrupt record, or one written by a build with a different layout, falls
+ *  back to the defaults.
+ *
+ */
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define SETTINGS_DEFAULT_SERIAL_BAUD_RATE	(9600U)		/*!< Serial baud rate until one is saved */
+#define SETTINGS_DEFAULT_SERIAL_AUTO_BAUD	(0U)		/*!< 1 to detect the serial baud rate after every reset until a setting is saved */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Persistent settings.
+ */
+typedef struct settings_t_
+{
+	uint32_t serial_baud_rate;		/*!< USART1 baud rate */
+	uint8_t serial_auto_baud;		/*!< 1 to detect the USART1 baud rate from the first character received after each reset */
+	uint8_t serial_wake;			/*!< 1 if a host character must wake the MCU (STOP1), 0 for a relay without a host (STOP2) */
+	uint32_t radio_wake_latency_ms;	/*!< Receive latency allowed for wake-on-radio sniffing, 0 to listen continuously */
+	uint8_t radio_sync_word;		/*!< LoRa sync word of this network */
+	uint8_t radio_iq_mode;			/*!< rfm95w_iq_mode_t, 0 for normal IQ both ways */
+} settings_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Settings from flash, or the defaults if none are saved.
+ *
+ * @param         None
+ * @return        0 if loaded from flash, Error if the defaults are in use
+ */
+int32_t settings_init ();
+
+
+/**
+ * @brief   Get the current settings.
+ *
+ * @param[out]    settings copy of the settings
+ * @return        0 for success or Error
+ */
+int32_t settings_get (settings_t* settings);
+
+
+/**
+ * @brief   Change the current settings. They are not persistent until settings_save is called.
+ *
+ * @param[in]     settings the new settings
+ * @return        0 for success or Error
+ */
+int32_t settings_set (const settings_t* settings);
+
+
+/**
+ * @brief   Write the current settings to flash. Blocks for the page erase (around 25 ms).
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t settings_save ();
+
+
+#endif /* SETTINGS_H */
+
+/* End of file */
@@ -0,0 +1,163 @@
+/**
+ * @file    soft_timer.h
+ *
+ * @brief   Tickless Software Timer Service on LPTIM1.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Any number of one-shot or periodic timers share LPTIM1, clocked from the
+ *  32.768 kHz LSE so they keep running in the low power modes. Running timers
+ *  are kept in a single list sorted by expiry and only the first is
+ *  programmed into the hardware compare, so there is no periodic tick. The
+ *  interrupt only raises EVENTS_TIMER; the callbacks run from
+ *  soft_timer_process in the main loop.
+ *
+ */
+
+#ifndef SOFT_TIMER_H
+#define SOFT_TIMER_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define SOFT_TIMER_MAX_TIMERS			(8U)		/*!< Size of the timer table */
+#define SOFT_TIMER_ID_INVALID			(0xFFU)		/*!< Returned when the table is full */
+#define SOFT_TIMER_TICK_FREQUENCY_HZ	(32768U)	/*!< LSE, about 30.5 us resolution */
+#define SOFT_TIMER_IRQ_PRIORITY			(2U)		/*!< LPTIM1 priority, with the other timers in the plan in main.h */
+#define SOFT_TIMER_NO_EXPIRY			(0xFFFFFFFFU)	/*!< No timer running */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+typedef uint8_t soft_timer_id_t;	/*!< Id of a timer in the table */
+
+
+/**
+ * @brief   Timer expiry callback, called from soft_timer_process.
+ */
+typedef void (*soft_timer_callback_t)(soft_timer_id_t timer_id);
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Timer Service. Starts the LSE and LPTIM1.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_init ();
+
+
+/**
+ * @brief   Add a timer to the table, stopped.
+ *
+ * @param[in]     callback called on each expiry
+ * @param[out]    timer_id id of the timer
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_create (soft_timer_callback_t callback, soft_timer_id_t* timer_id);
+
+
+/**
+ * @brief   Start, or restart, a timer.
+ *
+ * @param[in]     timer_id id of the timer
+ * @param[in]     delay_us time to the first expiry, rounded up to whole ticks
+ * @param[in]     period_us time between later expiries, 0 for one-shot
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_start (soft_timer_id_t timer_id, uint32_t delay_us, uint32_t period_us);
+
+
+/**
+ * @brief   Stop a timer. Stopping a stopped timer is not an error.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_stop (soft_timer_id_t timer_id);
+
+
+/**
+ * @brief   Is a timer running.
+ *
+ * A one-shot timer stops before its callback is called, so the callback may restart it.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        1 for running, 0 for stopped, or Error
+ */
+int32_t soft_timer_is_running (soft_timer_id_t timer_id);
+
+
+/**
+ * @brief   Get the time on the LPTIM1 timebase - ISR safe.
+ *
+ * @param         None
+ * @return        ticks of SOFT_TIMER_TICK_FREQUENCY_HZ, wraps every 36 hours
+ */
+uint32_t soft_timer_get_ticks ();
+
+
+/**
+ * @brief   Get the time to the first expiry of the running timers - ISR safe.
+ *
+ * @param         None
+ * @return        ticks, 0 if already due, SOFT_TIMER_NO_EXPIRY if no timer is running
+ */
+uint32_t soft_timer_get_ticks_to_next ();
+
+
+/**
+ * @brief   Call the callbacks of the expired timers and program the next expiry.
+ *
+ * Called from the main loop when EVENTS_TIMER is raised.
+ *
+ * @param         None
+ * @return        number of callbacks called
+ */
+uint32_t soft_timer_process ();
+
+
+/**
+ * @brief   Process the LPTIM1 interrupt. Call from LPTIM1_IRQHandler.
+ *
+ * @param         None
+ * @return        None
+ */
+void soft_timer_irq_handler ();
+
+
+#endif /* SOFT_TIMER_H */
+
+/* End of file */
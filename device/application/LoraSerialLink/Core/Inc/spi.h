@@ -35,13 +35,17 @@ extern "C" {
 extern SPI_HandleTypeDef hspi1;
 
 /* USER CODE BEGIN Private defines */
-
+#if LORA_DUAL_RADIO_ENABLED
+extern SPI_HandleTypeDef hspi2;
+#endif
 /* USER CODE END Private defines */
 
 void MX_SPI1_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+#if LORA_DUAL_RADIO_ENABLED
+void MX_SPI2_Init(void);
+#endif
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -32,16 +32,16 @@ extern "C" {
 
 /* USER CODE END Includes */
 
-extern TIM_HandleTypeDef htim15;
+extern TIM_HandleTypeDef htim2;
 
-extern TIM_HandleTypeDef htim16;
+extern TIM_HandleTypeDef htim15;
 
 /* USER CODE BEGIN Private defines */
 
 /* USER CODE END Private defines */
 
+void MX_TIM2_Init(void);
 void MX_TIM15_Init(void);
-void MX_TIM16_Init(void);
 
 /* USER CODE BEGIN Prototypes */
 
@@ -0,0 +1,140 @@
+/**
+ * @file    timebase.h
+ *
+ * @brief   Monotonic Microsecond Timebase.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  A free-running 32-bit timer counting at 1 MHz, extended to 64 bits by
+ *  counting its overflows. Reading the time costs a register read and a few
+ *  instructions with interrupts masked, and only one interrupt is taken every
+ *  71 minutes. The timer keeps counting while the core sleeps in WFI, which
+ *  rules out the DWT cycle counter for this. It stops in STOP mode, so the
+ *  time spent there is added back on wake, and the prescaler follows the
+ *  system clock when the clock governor changes it.
+ *
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define TIMEBASE_TICK_FREQUENCY_HZ		(1000000U)		/*!< Timer count rate */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Timebase and start the timer from zero.
+ *
+ * The timer must be a 32-bit timer with a prescaler giving TIMEBASE_TICK_FREQUENCY_HZ
+ * and an auto-reload of 0xFFFFFFFF.
+ *
+ * @param[in]     htim handle of the timer
+ * @return        0 for success or Error
+ */
+int32_t timebase_init (TIM_HandleTypeDef* htim);
+
+
+/**
+ * @brief   Get the time since initialisation in microseconds - ISR safe.
+ *
+ * @param         None
+ * @return        microseconds, does not wrap
+ */
+uint64_t timebase_get_us ();
+
+
+/**
+ * @brief   Get the low 32 bits of the time in microseconds - ISR safe.
+ *
+ * Cheapest read, for intervals under 71 minutes measured as the unsigned difference of two readings.
+ *
+ * @param         None
+ * @return        microseconds, wraps every 2^32 us
+ */
+uint32_t timebase_get_us32 ();
+
+
+/**
+ * @brief   Get the time since initialisation in milliseconds - ISR safe.
+ *
+ * @param         None
+ * @return        milliseconds, does not wrap
+ */
+uint64_t timebase_get_ms ();
+
+
+/**
+ * @brief   Move the time forward to account for a period the timer was stopped - ISR safe.
+ *
+ * The timer does not count in STOP mode, so the power manager measures the time
+ * spent there on the LPTIM1 timebase and adds it back on wake.
+ *
+ * @param[in]     microseconds time to add
+ * @return        None
+ */
+void timebase_advance_us (uint32_t microseconds);
+
+
+/**
+ * @brief   Keep the timer at TIMEBASE_TICK_FREQUENCY_HZ after its input clock has changed - ISR safe.
+ *
+ * Call straight after the system clock switch. The new prescaler only loads on an update
+ * event, which also clears the counter, so the count is put back afterwards.
+ *
+ * @param[in]     timer_clock_hz new timer input clock, a multiple of TIMEBASE_TICK_FREQUENCY_HZ
+ * @return        0 for success or Error
+ */
+int32_t timebase_set_timer_clock (uint32_t timer_clock_hz);
+
+
+/**
+ * @brief   Count a timer overflow. Call from the timer interrupt handler before the HAL handler.
+ *
+ * @param         None
+ * @return        None
+ */
+void timebase_irq_handler ();
+
+
+#endif /* TIMEBASE_H */
+
+/* End of file */
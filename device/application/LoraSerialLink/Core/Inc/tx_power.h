@@ -0,0 +1,173 @@
+/**
+ * @file    tx_power.h
+ *
+ * @brief   Closed-Loop Transmit Power Control Per Destination.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Each peer reports back the SNR margin and RSSI it measures on our frames,
+ *  and the power used towards it is stepped to hold that margin inside a
+ *  hysteresis band: raised quickly when the margin runs low, lowered a dB at
+ *  a time when there is plenty to spare, or when the peer is so close that
+ *  its receiver is near saturation.
+ *
+ *  The data rate is chosen first and the power second. Power is only lowered
+ *  while the link is already at its fastest rate, so surplus margin goes to
+ *  a faster rate before it goes to saving power. A peer that stops reporting
+ *  is sent to at no less than the default power again.
+ *
+ */
+
+#ifndef TX_POWER_H
+#define TX_POWER_H
+
+/*
+ * Includes
+ */
+#include <stdint.h>
+
+
+
+/*
+ * Public: Constants and Macros
+ */
+
+#define TX_POWER_MAX_PEERS				(4U)		/*!< Peers tracked, least recently heard is replaced */
+#define TX_POWER_MIN_DBM				(2)			/*!< Lowest power, RFM95W_MIN_TX_POWER_DBM */
+#define TX_POWER_MAX_DBM				(20)		/*!< Highest power, RFM95W_MAX_TX_POWER_DBM - check the regional limit */
+#define TX_POWER_DEFAULT_DBM			(10)		/*!< Power before a peer has reported, RFM95W_DEFAULT_TX_POWER_DBM */
+
+#define TX_POWER_RAISE_MARGIN_QDB		(20)		/*!< Raise below this SNR margin at the peer (5 dB), in 0.25 dB */
+#define TX_POWER_LOWER_MARGIN_QDB		(60)		/*!< Lower above this SNR margin at the peer (15 dB), in 0.25 dB */
+#define TX_POWER_RAISE_STEP_DB			(3)			/*!< Raise quickly, the link is at risk */
+#define TX_POWER_LOWER_STEP_DB			(1)			/*!< Lower slowly, one step per report */
+#define TX_POWER_MAX_RSSI_DBM			(-40)		/*!< Lower regardless of the margin above this RSSI at the peer */
+#define TX_POWER_MIN_SAMPLES			(4U)		/*!< Frames measured from a peer before reporting on it */
+
+#define TX_POWER_POLL_PERIOD_MS			(1000U)		/*!< tx_power_poll is called this often */
+#define TX_POWER_REPORT_PERIOD_MS		(20000U)	/*!< Link reports on the peers at any rate */
+#define TX_POWER_REPORT_TIMEOUT_MS		(60000U)	/*!< Back to at least the default power without a report for this long */
+
+#define TX_POWER_REPORT_MARGIN_UNKNOWN	(-128)		/*!< Link report sent before anything has been measured */
+#define TX_POWER_REPORT_RSSI_UNKNOWN	(0)			/*!< No RSSI measured yet, a real RSSI is always negative */
+
+
+
+/*
+ * Public: Typedefs
+ */
+
+/**
+ * @brief   Transmit power control statistics.
+ */
+typedef struct tx_power_stats_t_
+{
+	uint32_t raises;				/*!< Power raised for a low margin */
+	uint32_t lowers;				/*!< Power lowered for a high margin or RSSI */
+	uint32_t timeouts;				/*!< Power restored to the default for a peer that stopped reporting */
+} tx_power_stats_t;
+
+
+
+/*
+ * Public: Opaque Type Declarations
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables (Avoid global variables if possible)
+ */
+
+
+/*
+ * Public: Function Prototypes/Declarations
+ */
+
+
+/**
+ * @brief   Initialise the Transmit Power controller with every peer at the default power.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_init (uint64_t now_ms);
+
+
+/**
+ * @brief   Record a frame received from a peer, with its measured margin and RSSI.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     margin_quarter_db SNR margin at the current rate, from adr_get_margin, in 0.25 dB
+ * @param[in]     rssi_dbm packet RSSI
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_on_frame_received (uint8_t source_address, int32_t margin_quarter_db, int32_t rssi_dbm, uint64_t now_ms);
+
+
+/**
+ * @brief   Apply a link report from a peer, its measurement of our frames, and step the power towards it.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     margin_quarter_db SNR margin of our frames at the peer, in 0.25 dB
+ * @param[in]     rssi_dbm RSSI of our frames at the peer
+ * @param[in]     lower_allowed 1 if the data rate is already the fastest, so surplus margin may go to lowering power
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_on_report (uint8_t source_address, int32_t margin_quarter_db, int32_t rssi_dbm, uint8_t lower_allowed, uint64_t now_ms);
+
+
+/**
+ * @brief   Check whether to send a link report, taking the peers in turn.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param[in]     force 1 if a report is going anyway, to fill it in whether due or not
+ * @param[in]     now_ms current time
+ * @param[out]    peer_address peer the report is on
+ * @param[out]    margin_quarter_db average SNR margin of its frames, in 0.25 dB
+ * @param[out]    rssi_dbm average RSSI of its frames
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t tx_power_get_report (uint8_t force, uint64_t now_ms, uint8_t* peer_address, int32_t* margin_quarter_db, int32_t* rssi_dbm);
+
+
+/**
+ * @brief   Restore at least the default power towards peers that have stopped reporting.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_poll (uint64_t now_ms);
+
+
+/**
+ * @brief   Get the power to transmit at.
+ *
+ * A peer that has not reported is sent to at the default power. A broadcast, or any other
+ * destination not tracked, is sent at the highest power of the peers so they all hear it.
+ *
+ * @param[in]     destination_address destination of the packet
+ * @return        power in dBm
+ */
+int8_t tx_power_get_dbm (uint8_t destination_address);
+
+
+/**
+ * @brief   Get the transmit power control statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t tx_power_get_stats (tx_power_stats_t* stats);
+
+
+#endif /* TX_POWER_H */
+
+/* End of file */
@@ -38,6 +38,31 @@ extern UART_HandleTypeDef huart1;
 
 /* USER CODE BEGIN Private defines */
 
+/* USART1 flow control - set to 1 only if the host wires RTS/CTS, it takes PA11/PA12 from USB */
+#define USART1_FLOW_CONTROL_ENABLED		(0)
+
+/* RTS is a GPIO driven from the receive fifo watermarks, CTS is handled by the USART (both active low) */
+#define USART1_RTS_Pin					GPIO_PIN_12
+#define USART1_RTS_GPIO_Port			GPIOA
+#define USART1_CTS_Pin					GPIO_PIN_11
+#define USART1_CTS_GPIO_Port			GPIOA
+
+/* USART1 frame boundaries detected in hardware */
+typedef enum usart1_frame_boundary_t_
+{
+  USART1_FRAME_BOUNDARY_TIMEOUT = 0,	/*!< Receiver timeout (RTOF) - line idle after the last character */
+  USART1_FRAME_BOUNDARY_MATCH			/*!< Character match (CMF) - the match character has just been received */
+} usart1_frame_boundary_t;
+
+/* Receive error counters of a UART */
+typedef struct usart_error_stats_t_
+{
+  uint32_t overrun;		/*!< ORE - a character arrived before the last was read, reception was aborted */
+  uint32_t framing;		/*!< FE - stop bit missing, usually a baud rate mismatch or a break */
+  uint32_t noise;		/*!< NE - noise detected while sampling */
+  uint32_t parity;		/*!< PE - parity mismatch */
+} usart_error_stats_t;
+
 /* USER CODE END Private defines */
 
 void MX_LPUART1_UART_Init(void);
@@ -45,6 +70,74 @@ void MX_USART1_UART_Init(void);
 
 /* USER CODE BEGIN Prototypes */
 
+/**
+  * @brief  Change the USART1 baud rate, choosing the oversampling for the rate.
+  *         Any transfer in progress is aborted and must be restarted.
+  * @param  baud_rate up to the USART1 kernel clock / 8, 2 Mbaud from HSI16
+  * @retval 0 for success or Error
+  */
+int32_t usart1_set_baud_rate(uint32_t baud_rate);
+
+/**
+  * @brief  Detect the USART1 baud rate from the start bit of the next character received.
+  *         Any transfer in progress is aborted and must be restarted.
+  * @retval 0 for success or Error
+  */
+int32_t usart1_enable_auto_baud(void);
+
+/**
+  * @brief  Check whether auto baud detection has finished. ISR safe.
+  * @param  baud_rate set to the detected rate on success
+  * @retval 1 if detected, 0 if still waiting, or Error if detection failed and has been restarted
+  */
+int32_t usart1_get_auto_baud_result(uint32_t* baud_rate);
+
+/**
+  * @brief  Delimit frames in hardware with the receiver timeout and character match interrupts.
+  *         The timeout is in bit times so it stays correct across baud rate changes.
+  * @param  timeout_bits receiver timeout after the last character, 0 to disable
+  * @param  match_enable 1 to enable the character match
+  * @param  match_character character to match
+  * @retval 0 for success or Error
+  */
+int32_t usart1_enable_frame_delimiting(uint32_t timeout_bits, uint8_t match_enable, uint8_t match_character);
+
+/**
+  * @brief  Handle the frame boundary flags. Called from USART1_IRQHandler before HAL_UART_IRQHandler,
+  *         which would otherwise treat the receiver timeout as an error and abort the reception.
+  * @retval None
+  */
+void usart1_frame_boundary_irq_handler(void);
+
+/**
+  * @brief  Count the receive errors HAL has recorded in the handle. Called from HAL_UART_ErrorCallback.
+  * @param  huart UART handle
+  * @retval None
+  */
+void usart_record_errors(UART_HandleTypeDef* huart);
+
+/**
+  * @brief  Get the receive error counters of a UART.
+  * @param  huart UART handle
+  * @param  stats copy of the counters
+  * @retval 0 for success or Error
+  */
+int32_t usart_get_error_stats(UART_HandleTypeDef* huart, usart_error_stats_t* stats);
+
+/**
+  * @brief  Frame boundary detected on USART1, called from interrupt. Implemented by the application.
+  * @param  boundary the boundary detected
+  * @retval None
+  */
+void usart1_frame_boundary_callback(usart1_frame_boundary_t boundary);
+
+/**
+  * @brief  Tell the host whether it may send on USART1 (RTS). ISR safe.
+  * @param  ready 1 to assert RTS, 0 to deassert
+  * @retval None
+  */
+void usart1_set_rts(uint8_t ready);
+
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -0,0 +1,672 @@
+/**
+ * @file    adr.c
+ *
+ * @brief   Adaptive Data Rate Between Peers.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  SNR is kept referred to a 125 kHz bandwidth, so measurements taken at
+ *  different rates can be averaged together: doubling the bandwidth doubles
+ *  the noise and costs 3 dB of measured SNR. The SNR a rate needs is then its
+ *  demodulation floor plus the same bandwidth offset, and the margin of any
+ *  rate is the referred SNR less what it needs.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "adr.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define ADR_EWMA_SHIFT				(3U)		/*!< Each sample moves the average 1/8 of the way */
+#define ADR_EWMA_SCALE				(16)		/*!< Fraction bits of the average, in 0.25 dB / 16 */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* A rate in the table */
+typedef struct adr_rate_entry_t_
+{
+	adr_rate_t rate;
+	int16_t demod_snr_qdb;			/*!< Demodulation floor of the spreading factor, in 0.25 dB */
+	int16_t bandwidth_offset_qdb;	/*!< 10 log10(bandwidth / 125 kHz), in 0.25 dB */
+} adr_rate_entry_t;
+
+/* A peer */
+typedef struct adr_peer_t_
+{
+	uint8_t in_use;
+	uint8_t address;
+	uint32_t samples;				/*!< Frames measured */
+	int32_t snr_ref_average;		/*!< Average SNR of its frames referred to 125 kHz, in 0.25 dB * ADR_EWMA_SCALE */
+	uint8_t report_valid;
+	int32_t report_snr_ref_qdb;		/*!< Its last report of our frames, referred to 125 kHz */
+	uint64_t last_heard_ms;
+} adr_peer_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+/* Slowest first, each step roughly doubles the bit rate */
+static const adr_rate_entry_t g_rates[ADR_RATE_COUNT] =
+{
+	{ { 10, 125000U, 1 }, -60, 0 },
+	{ { 9, 125000U, 1 }, -50, 0 },
+	{ { 8, 125000U, 1 }, -40, 0 },
+	{ { 7, 125000U, 1 }, -30, 0 },
+	{ { 7, 250000U, 1 }, -30, 12 },
+	{ { 7, 500000U, 1 }, -30, 24 },
+};
+
+
+
+/*
+ * Private: Variables
+ */
+
+static uint8_t g_own_address = 0;
+static uint8_t g_rate_index = ADR_SAFE_RATE;
+static adr_peer_t g_peers[ADR_MAX_PEERS] = {0};
+static uint64_t g_last_heard_ms = 0;				/*!< Last frame from any peer */
+
+/* Our proposal */
+static uint8_t g_switch_pending = 0;
+static uint8_t g_switch_rate = 0;
+static uint8_t g_switch_id = 0;
+static uint32_t g_switch_attempts = 0;
+static uint64_t g_switch_sent_ms = 0;
+
+/* A peer's proposal, switched to once acknowledged */
+static uint8_t g_ack_pending = 0;
+static uint8_t g_ack_rate = 0;
+static uint8_t g_ack_id = 0;
+
+static uint64_t g_last_switch_ms = 0;
+static uint8_t g_confirm_pending = 0;				/*!< Not heard from the peers since the last switch */
+static uint8_t g_report_due = 0;					/*!< Report straight away, to confirm a switch */
+static uint64_t g_next_report_ms = 0;
+
+static adr_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static adr_peer_t* adr_get_peer (uint8_t address);
+
+
+/**
+ * @brief   Get the weakest SNR of the peers heard recently.
+ *
+ * @param[in]     now_ms current time
+ * @param[in]     include_reports 1 to include the peers' reports of our frames
+ * @param[out]    snr_ref_qdb weakest SNR referred to 125 kHz
+ * @return        1 if any peer has enough samples, 0 otherwise
+ */
+static int32_t adr_get_weakest_snr (uint64_t now_ms, uint8_t include_reports, int32_t* snr_ref_qdb);
+
+
+/**
+ * @brief   Change to a rate agreed with the peer.
+ *
+ * @param[in]     rate_index new rate
+ * @param[in]     now_ms current time
+ * @return        None
+ */
+static void adr_switch_to (uint8_t rate_index, uint64_t now_ms);
+
+
+/**
+ * @brief   Get the nominal bit rate of a rate.
+ *
+ * @param[in]     rate_index the rate
+ * @return        bits per second
+ */
+static uint32_t adr_get_bit_rate (uint8_t rate_index);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Adaptive Data Rate controller at the safe rate.
+ *
+ * @param[in]     own_address our address, which settles proposals crossing on air
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_init (uint8_t own_address, uint64_t now_ms)
+{
+	g_own_address = own_address;
+	g_rate_index = ADR_SAFE_RATE;
+	memset(g_peers, 0, sizeof(g_peers));
+	g_last_heard_ms = now_ms;
+
+	g_switch_pending = 0;
+	g_switch_id = 0;
+	g_ack_pending = 0;
+
+	g_last_switch_ms = now_ms;
+	g_confirm_pending = 0;
+	g_report_due = 0;
+	g_next_report_ms = now_ms + ADR_REPORT_PERIOD_MS;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Record a frame received from a peer, with its measured SNR.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     snr_quarter_db packet SNR at the current rate, in 0.25 dB
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_on_frame_received (uint8_t source_address, int32_t snr_quarter_db, uint64_t now_ms)
+{
+	adr_peer_t* peer = adr_get_peer(source_address);
+	int32_t sample = (snr_quarter_db + g_rates[g_rate_index].bandwidth_offset_qdb) * ADR_EWMA_SCALE;
+
+	if (peer->samples == 0)
+	{
+		peer->snr_ref_average = sample;
+	}
+	else
+	{
+		peer->snr_ref_average += (sample - peer->snr_ref_average) / (1 << ADR_EWMA_SHIFT);
+	}
+	peer->samples++;
+	peer->last_heard_ms = now_ms;
+
+	// Heard at the current rate, so any switch is confirmed
+	g_last_heard_ms = now_ms;
+	g_confirm_pending = 0;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Apply a link report from a peer, its measurement of our frames.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     snr_ref_quarter_db SNR referred to 125 kHz, from adr_get_report at the peer
+ * @return        0 for success or Error
+ */
+int32_t adr_on_report (uint8_t source_address, int32_t snr_ref_quarter_db)
+{
+	if (snr_ref_quarter_db == ADR_REPORT_SNR_UNKNOWN)
+	{
+		// Nothing measured yet
+		return 0;
+	}
+
+	adr_peer_t* peer = adr_get_peer(source_address);
+	peer->report_valid = 1;
+	peer->report_snr_ref_qdb = snr_ref_quarter_db;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to send a link report.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    snr_ref_quarter_db weakest SNR measured from the peers, referred to 125 kHz
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t adr_get_report (uint64_t now_ms, int32_t* snr_ref_quarter_db)
+{
+	// Reports keep contact above the safe rate, at the safe rate they would only cost airtime
+	if ((g_report_due == 0) && ((g_rate_index == ADR_SAFE_RATE) || (now_ms < g_next_report_ms)))
+	{
+		return 0;
+	}
+
+	if (adr_get_weakest_snr(now_ms, 0, snr_ref_quarter_db) == 0)
+	{
+		*snr_ref_quarter_db = ADR_REPORT_SNR_UNKNOWN;
+	}
+
+	g_report_due = 0;
+	g_next_report_ms = now_ms + ADR_REPORT_PERIOD_MS;
+
+	return 1;
+}
+
+
+/**
+ * @brief   Check whether to propose a rate change, from the margins or to retry an unanswered proposal.
+ *
+ * On success the proposal is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    rate_index proposed rate
+ * @param[out]    switch_id identifies the proposal in the acknowledgement
+ * @return        1 if a proposal should be sent now, 0 otherwise
+ */
+int32_t adr_get_switch (uint64_t now_ms, uint8_t* rate_index, uint8_t* switch_id)
+{
+	if (g_ack_pending)
+	{
+		// Answer the peer's proposal first
+		return 0;
+	}
+
+	if (g_switch_pending)
+	{
+		if ((now_ms - g_switch_sent_ms) < ADR_SWITCH_RETRY_MS)
+		{
+			return 0;
+		}
+
+		if (g_switch_attempts >= ADR_SWITCH_MAX_ATTEMPTS)
+		{
+			// No answer - stay at the current rate, the contact timeout covers a peer that has gone
+			g_switch_pending = 0;
+			g_stats.proposals_failed++;
+			return 0;
+		}
+
+		g_switch_attempts++;
+		g_switch_sent_ms = now_ms;
+		*rate_index = g_switch_rate;
+		*switch_id = g_switch_id;
+		return 1;
+	}
+
+	// Let the last switch settle before judging the new rate
+	if (g_confirm_pending || ((now_ms - g_last_switch_ms) < ADR_CONFIRM_TIMEOUT_MS))
+	{
+		return 0;
+	}
+
+	int32_t snr_ref_qdb = 0;
+	if (adr_get_weakest_snr(now_ms, 1, &snr_ref_qdb) == 0)
+	{
+		return 0;
+	}
+
+	// Slow down when the margin is nearly gone, speed up only when the faster rate keeps a healthy margin
+	uint8_t target = g_rate_index;
+	int32_t margin_qdb = snr_ref_qdb - (g_rates[g_rate_index].demod_snr_qdb + g_rates[g_rate_index].bandwidth_offset_qdb);
+	if ((margin_qdb < ADR_STEP_DOWN_MARGIN_QDB) && (g_rate_index > 0))
+	{
+		target = g_rate_index - 1U;
+	}
+	else if ((g_rate_index + 1U) < ADR_RATE_COUNT)
+	{
+		const adr_rate_entry_t* faster = &g_rates[g_rate_index + 1U];
+		if ((snr_ref_qdb - (faster->demod_snr_qdb + faster->bandwidth_offset_qdb)) >= ADR_STEP_UP_MARGIN_QDB)
+		{
+			target = g_rate_index + 1U;
+		}
+	}
+
+	if (target == g_rate_index)
+	{
+		return 0;
+	}
+
+	g_switch_pending = 1;
+	g_switch_rate = target;
+	g_switch_id++;
+	g_switch_attempts = 1;
+	g_switch_sent_ms = now_ms;
+
+	*rate_index = g_switch_rate;
+	*switch_id = g_switch_id;
+	return 1;
+}
+
+
+/**
+ * @brief   Apply a rate change proposed by a peer. It is acknowledged at the current rate.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     rate_index proposed rate
+ * @param[in]     switch_id identifies the proposal
+ * @return        0 if accepted, Error if rejected
+ */
+int32_t adr_on_switch (uint8_t source_address, uint8_t rate_index, uint8_t switch_id)
+{
+	if (rate_index >= ADR_RATE_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	if (g_switch_pending)
+	{
+		// Proposals crossed on air - the lower address wins, the other end gives way
+		if (g_own_address < source_address)
+		{
+			// Error
+			return -1;
+		}
+		g_switch_pending = 0;
+	}
+
+	g_ack_pending = 1;
+	g_ack_rate = rate_index;
+	g_ack_id = switch_id;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to acknowledge a rate change proposed by a peer.
+ *
+ * @param[out]    rate_index accepted rate
+ * @param[out]    switch_id identifies the proposal
+ * @return        1 if an acknowledgement should be sent now, 0 otherwise
+ */
+int32_t adr_get_ack (uint8_t* rate_index, uint8_t* switch_id)
+{
+	if (g_ack_pending == 0)
+	{
+		return 0;
+	}
+
+	*rate_index = g_ack_rate;
+	*switch_id = g_ack_id;
+	return 1;
+}
+
+
+/**
+ * @brief   The acknowledgement is on air - switch to the accepted rate.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t adr_on_ack_sent (uint64_t now_ms)
+{
+	if (g_ack_pending == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	g_ack_pending = 0;
+	adr_switch_to(g_ack_rate, now_ms);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Apply an acknowledgement of our proposal - switch to the proposed rate.
+ *
+ * @param[in]     rate_index acknowledged rate
+ * @param[in]     switch_id identifies the proposal
+ * @param[in]     now_ms current time
+ * @return        0 if it matched the proposal, Error otherwise
+ */
+int32_t adr_on_ack (uint8_t rate_index, uint8_t switch_id, uint64_t now_ms)
+{
+	if ((g_switch_pending == 0) || (rate_index != g_switch_rate) || (switch_id != g_switch_id))
+	{
+		// Error
+		return -1;
+	}
+
+	g_switch_pending = 0;
+	adr_switch_to(g_switch_rate, now_ms);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Fall back to the safe rate if the peers have not been heard in time.
+ *
+ * @param[in]     now_ms current time
+ * @return        1 if the rate changed, 0 otherwise
+ */
+int32_t adr_poll (uint64_t now_ms)
+{
+	if (g_rate_index == ADR_SAFE_RATE)
+	{
+		g_confirm_pending = 0;
+		return 0;
+	}
+
+	if ((g_confirm_pending && ((now_ms - g_last_switch_ms) >= ADR_CONFIRM_TIMEOUT_MS)) ||
+			((now_ms - g_last_heard_ms) >= ADR_CONTACT_TIMEOUT_MS))
+	{
+		// The peer does not hear us at this rate, or has fallen back already - meet it at the safe rate
+		g_rate_index = ADR_SAFE_RATE;
+		g_switch_pending = 0;
+		g_ack_pending = 0;
+		g_confirm_pending = 0;
+		g_last_switch_ms = now_ms;
+		g_stats.fallbacks++;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the current rate.
+ *
+ * @param[out]    rate modem configuration of the rate
+ * @return        index of the rate in the table
+ */
+uint8_t adr_get_rate (adr_rate_t* rate)
+{
+	*rate = g_rates[g_rate_index].rate;
+
+	return g_rate_index;
+}
+
+
+/**
+ * @brief   Get the SNR margin of a frame over the demodulation floor of the current rate.
+ *
+ * @param[in]     snr_quarter_db packet SNR at the current rate, in 0.25 dB
+ * @return        margin in 0.25 dB
+ */
+int32_t adr_get_margin (int32_t snr_quarter_db)
+{
+	// Measured at the current bandwidth, so no offset applies
+	return snr_quarter_db - g_rates[g_rate_index].demod_snr_qdb;
+}
+
+
+/**
+ * @brief   Record a data packet sent, for the throughput statistics.
+ *
+ * @param[in]     payload_length payload length of the data packet
+ * @param[in]     airtime_us measured time on air
+ * @return        0 for success or Error
+ */
+int32_t adr_on_data_sent (uint32_t payload_length, uint32_t airtime_us)
+{
+	g_stats.bytes_sent += payload_length;
+	g_stats.airtime_us += airtime_us;
+	g_stats.safe_airtime_us += ((uint64_t)airtime_us * adr_get_bit_rate(g_rate_index)) / adr_get_bit_rate(ADR_SAFE_RATE);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the adaptive data rate statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t adr_get_stats (adr_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static adr_peer_t* adr_get_peer (uint8_t address)
+{
+	adr_peer_t* oldest = &g_peers[0];
+
+	for (uint32_t idx = 0; idx < ADR_MAX_PEERS; idx++)
+	{
+		adr_peer_t* peer = &g_peers[idx];
+		if (peer->in_use && (peer->address == address))
+		{
+			return peer;
+		}
+
+		if ((peer->in_use == 0) || ((oldest->in_use != 0) && (peer->last_heard_ms < oldest->last_heard_ms)))
+		{
+			oldest = peer;
+		}
+	}
+
+	memset(oldest, 0, sizeof(adr_peer_t));
+	oldest->in_use = 1;
+	oldest->address = address;
+
+	return oldest;
+}
+
+
+/**
+ * @brief   Get the weakest SNR of the peers heard recently.
+ *
+ * @param[in]     now_ms current time
+ * @param[in]     include_reports 1 to include the peers' reports of our frames
+ * @param[out]    snr_ref_qdb weakest SNR referred to 125 kHz
+ * @return        1 if any peer has enough samples, 0 otherwise
+ */
+static int32_t adr_get_weakest_snr (uint64_t now_ms, uint8_t include_reports, int32_t* snr_ref_qdb)
+{
+	int32_t found = 0;
+
+	for (uint32_t idx = 0; idx < ADR_MAX_PEERS; idx++)
+	{
+		adr_peer_t* peer = &g_peers[idx];
+		if ((peer->in_use == 0) || (peer->samples < ADR_MIN_SAMPLES) ||
+				((now_ms - peer->last_heard_ms) >= ADR_CONTACT_TIMEOUT_MS))
+		{
+			continue;
+		}
+
+		int32_t snr = peer->snr_ref_average / ADR_EWMA_SCALE;
+		if (include_reports && peer->report_valid && (peer->report_snr_ref_qdb < snr))
+		{
+			snr = peer->report_snr_ref_qdb;
+		}
+
+		if ((found == 0) || (snr < *snr_ref_qdb))
+		{
+			*snr_ref_qdb = snr;
+		}
+		found = 1;
+	}
+
+	return found;
+}
+
+
+/**
+ * @brief   Change to a rate agreed with the peer.
+ *
+ * @param[in]     rate_index new rate
+ * @param[in]     now_ms current time
+ * @return        None
+ */
+static void adr_switch_to (uint8_t rate_index, uint64_t now_ms)
+{
+	if (rate_index > g_rate_index)
+	{
+		g_stats.switches_up++;
+	}
+	else if (rate_index < g_rate_index)
+	{
+		g_stats.switches_down++;
+	}
+
+	// Report straight away so each end hears the other at the new rate
+	g_rate_index = rate_index;
+	g_last_switch_ms = now_ms;
+	g_confirm_pending = 1;
+	g_report_due = 1;
+}
+
+
+/**
+ * @brief   Get the nominal bit rate of a rate.
+ *
+ * @param[in]     rate_index the rate
+ * @return        bits per second
+ */
+static uint32_t adr_get_bit_rate (uint8_t rate_index)
+{
+	// SF * BW / 2^SF bits of each 4 + CR coded
+	const adr_rate_t* rate = &g_rates[rate_index].rate;
+	return (uint32_t)(((uint64_t)rate->spreading_factor * rate->bandwidth_hz * 4U) /
+			((4U + rate->coding_rate) * ((uint64_t)1U << rate->spreading_factor)));
+}
+
+/* End of file */
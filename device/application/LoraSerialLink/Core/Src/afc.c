@@ -0,0 +1,249 @@
+/**
+ * @file    afc.c
+ *
+ * @brief   Automatic Frequency Correction From the Measured FEI.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The error of each frame is measured against the untrimmed link frequency,
+ *  so the estimate does not depend on the correction in force when it was
+ *  received and the loop cannot wind up.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "afc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define AFC_EWMA_SHIFT				(2U)		/*!< Each sample moves the average 1/4 of the way, drift is slow */
+#define AFC_EWMA_SCALE				(16)		/*!< Fraction bits of the average */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* A peer */
+typedef struct afc_peer_t_
+{
+	uint8_t in_use;
+	uint8_t address;
+	uint32_t samples;				/*!< Frames measured */
+	int32_t offset_average;			/*!< Average carrier offset of its frames, in Hz * AFC_EWMA_SCALE */
+	uint64_t last_heard_ms;
+} afc_peer_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+/*
+ * Private: Variables
+ */
+
+static uint8_t g_own_address = 0;
+static afc_peer_t g_peers[AFC_MAX_PEERS] = {0};
+static uint8_t g_reference_address = 0;
+static int32_t g_correction_hz = 0;
+
+static afc_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static afc_peer_t* afc_get_peer (uint8_t address);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Frequency Correction with no correction.
+ *
+ * @param[in]     own_address our address, peers below it are the frequency reference
+ * @return        0 for success or Error
+ */
+int32_t afc_init (uint8_t own_address)
+{
+	g_own_address = own_address;
+	memset(g_peers, 0, sizeof(g_peers));
+	g_reference_address = own_address;
+	g_correction_hz = 0;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Record the frequency error of a frame received from a peer.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     frequency_error_hz carrier of the frame less the untrimmed link frequency
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t afc_on_frame_received (uint8_t source_address, int32_t frequency_error_hz, uint64_t now_ms)
+{
+	if ((frequency_error_hz < -AFC_MAX_CORRECTION_HZ) || (frequency_error_hz > AFC_MAX_CORRECTION_HZ))
+	{
+		// Error
+		return -1;
+	}
+
+	afc_peer_t* peer = afc_get_peer(source_address);
+	int32_t sample = frequency_error_hz * AFC_EWMA_SCALE;
+
+	if (peer->samples == 0)
+	{
+		peer->offset_average = sample;
+	}
+	else
+	{
+		peer->offset_average += (sample - peer->offset_average) / (1 << AFC_EWMA_SHIFT);
+	}
+	peer->samples++;
+	peer->last_heard_ms = now_ms;
+
+	g_stats.frames++;
+	if (abs(frequency_error_hz) > abs(g_stats.max_error_hz))
+	{
+		g_stats.max_error_hz = frequency_error_hz;
+	}
+
+	// Follow the lowest address below ours that has been measured enough
+	afc_peer_t* reference = 0;
+	for (uint32_t idx = 0; idx < AFC_MAX_PEERS; idx++)
+	{
+		afc_peer_t* candidate = &g_peers[idx];
+		if (candidate->in_use && (candidate->samples >= AFC_MIN_SAMPLES) && (candidate->address < g_own_address) &&
+				((reference == 0) || (candidate->address < reference->address)))
+		{
+			reference = candidate;
+		}
+	}
+
+	if (reference == 0)
+	{
+		return 0;
+	}
+
+	int32_t estimate_hz = reference->offset_average / AFC_EWMA_SCALE;
+	if ((reference->address != g_reference_address) || (abs(estimate_hz - g_correction_hz) > AFC_DEADBAND_HZ))
+	{
+		g_reference_address = reference->address;
+		g_correction_hz = estimate_hz;
+		g_stats.retunes++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the correction to apply to the link frequency.
+ *
+ * @param[out]    reference_address peer the correction follows, our own address if none
+ * @return        correction in Hz
+ */
+int32_t afc_get_correction (uint8_t* reference_address)
+{
+	*reference_address = g_reference_address;
+
+	return g_correction_hz;
+}
+
+
+/**
+ * @brief   Get the frequency correction statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t afc_get_stats (afc_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static afc_peer_t* afc_get_peer (uint8_t address)
+{
+	afc_peer_t* oldest = &g_peers[0];
+
+	for (uint32_t idx = 0; idx < AFC_MAX_PEERS; idx++)
+	{
+		afc_peer_t* peer = &g_peers[idx];
+		if (peer->in_use && (peer->address == address))
+		{
+			return peer;
+		}
+
+		if ((peer->in_use == 0) || ((oldest->in_use != 0) && (peer->last_heard_ms < oldest->last_heard_ms)))
+		{
+			oldest = peer;
+		}
+	}
+
+	memset(oldest, 0, sizeof(afc_peer_t));
+	oldest->in_use = 1;
+	oldest->address = address;
+
+	return oldest;
+}
+
+/* End of file */
@@ -0,0 +1,683 @@
+/**
+ * @file    channel.c
+ *
+ * @brief   Channel Noise-Floor Scanning and Selection.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The noise floor of a channel is the median of its histogram, which is
+ *  not moved by the bursts of our own link traffic on the link channel, and
+ *  ties are broken on the 90th percentile so a channel with a busy
+ *  neighbour loses to one that is quiet all of the time.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "channel.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define CHANNEL_PERCENTILE_MEDIAN		(50U)
+#define CHANNEL_PERCENTILE_BUSY			(90U)
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+/* EU868 channels 200 kHz apart, the home channel first */
+static const uint32_t g_channel_plan[CHANNEL_COUNT] =
+{
+	868000000U,
+	867000000U,
+	867200000U,
+	867400000U,
+	867600000U,
+	867800000U,
+	868200000U,
+	868400000U,
+};
+
+
+
+/*
+ * Private: Variables
+ */
+
+static uint8_t g_own_address = 0;
+static uint8_t g_channel_index = CHANNEL_HOME;
+static uint64_t g_last_heard_ms = 0;				/*!< Last frame from the peer */
+
+/* Scan in progress */
+static uint16_t g_histograms[CHANNEL_COUNT][CHANNEL_HISTOGRAM_BINS] = {0};
+static uint8_t g_scan_active = 0;
+static uint8_t g_scan_channel = 0;					/*!< Channel of the next or current dwell */
+static uint32_t g_scan_samples = 0;					/*!< Samples taken in the current dwell */
+static uint64_t g_next_step_ms = 0;
+static uint64_t g_next_scan_ms = 0;
+
+/* Result of the last scan */
+static uint8_t g_noise_floor_valid = 0;
+static int32_t g_noise_floor_dbm[CHANNEL_COUNT] = {0};
+
+/* Our proposal */
+static uint8_t g_switch_pending = 0;
+static uint8_t g_switch_channel = 0;
+static uint8_t g_switch_id = 0;
+static uint32_t g_switch_attempts = 0;
+static uint64_t g_switch_sent_ms = 0;
+
+/* A peer's proposal, switched to once acknowledged */
+static uint8_t g_ack_pending = 0;
+static uint8_t g_ack_channel = 0;
+static uint8_t g_ack_id = 0;
+
+static uint64_t g_last_switch_ms = 0;
+static uint8_t g_confirm_pending = 0;				/*!< Not heard from the peer since the last switch */
+static uint8_t g_report_due = 0;					/*!< Report straight away, to confirm a switch */
+
+static channel_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Get a percentile of the noise histogram of a channel.
+ *
+ * @param[in]     channel_index the channel
+ * @param[in]     percent percentile, 1 to 100
+ * @return        centre of the bin holding the percentile, in dBm
+ */
+static int32_t channel_get_percentile (uint8_t channel_index, uint32_t percent);
+
+
+/**
+ * @brief   Choose the quietest channel of the completed scan, and propose it if it is worth a switch.
+ *
+ * @param         None
+ * @return        None
+ */
+static void channel_evaluate ();
+
+
+/**
+ * @brief   Change to a channel agreed with the peer.
+ *
+ * @param[in]     channel_index new channel
+ * @param[in]     now_ms current time
+ * @return        None
+ */
+static void channel_switch_to (uint8_t channel_index, uint64_t now_ms);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Channel selection on the home channel, with the first scan due.
+ *
+ * @param[in]     own_address our address, which settles proposals crossing on air
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_init (uint8_t own_address, uint64_t now_ms)
+{
+	g_own_address = own_address;
+	g_channel_index = CHANNEL_HOME;
+	g_last_heard_ms = now_ms;
+
+	g_scan_active = 0;
+	g_next_step_ms = now_ms;
+	g_next_scan_ms = now_ms + CHANNEL_SCAN_STEP_MS;
+	g_noise_floor_valid = 0;
+
+	g_switch_pending = 0;
+	g_switch_id = 0;
+	g_ack_pending = 0;
+
+	g_last_switch_ms = now_ms;
+	g_confirm_pending = 0;
+	g_report_due = 0;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to start the next dwell of a scan.
+ *
+ * Nothing is counted until the samples arrive, so a dwell the radio cannot start is asked for again.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    frequency_hz channel to sample
+ * @return        1 if a dwell should start now, 0 otherwise
+ */
+int32_t channel_get_scan_step (uint64_t now_ms, uint32_t* frequency_hz)
+{
+	// Leave the link channel alone while a change is being agreed or confirmed
+	if (g_switch_pending || g_ack_pending || g_confirm_pending)
+	{
+		return 0;
+	}
+
+	if (g_scan_active == 0)
+	{
+		if (now_ms < g_next_scan_ms)
+		{
+			return 0;
+		}
+
+		memset(g_histograms, 0, sizeof(g_histograms));
+		g_scan_active = 1;
+		g_scan_channel = 0;
+		g_scan_samples = 0;
+		g_next_step_ms = now_ms;
+	}
+
+	if (now_ms < g_next_step_ms)
+	{
+		return 0;
+	}
+
+	*frequency_hz = g_channel_plan[g_scan_channel];
+	return 1;
+}
+
+
+/**
+ * @brief   Add an RSSI sample to the histogram of the channel in the dwell.
+ *
+ * Once the whole plan has been sampled the quietest channel is chosen, and proposed if it is worth a switch.
+ *
+ * @param[in]     rssi_dbm current RSSI of the channel
+ * @param[in]     now_ms current time
+ * @return        1 if the dwell is complete, 0 otherwise
+ */
+int32_t channel_on_sample (int32_t rssi_dbm, uint64_t now_ms)
+{
+	if (g_scan_active == 0)
+	{
+		// The dwell is over
+		return 1;
+	}
+
+	int32_t bin = (rssi_dbm - CHANNEL_HISTOGRAM_MIN_DBM) / CHANNEL_HISTOGRAM_BIN_DB;
+	if (bin < 0)
+	{
+		bin = 0;
+	}
+	else if (bin >= (int32_t)CHANNEL_HISTOGRAM_BINS)
+	{
+		bin = CHANNEL_HISTOGRAM_BINS - 1U;
+	}
+	g_histograms[g_scan_channel][bin]++;
+
+	g_scan_samples++;
+	if (g_scan_samples < CHANNEL_SAMPLES_PER_DWELL)
+	{
+		return 0;
+	}
+
+	// Back to the link channel for a while before the next dwell
+	g_scan_samples = 0;
+	g_scan_channel++;
+	g_next_step_ms = now_ms + CHANNEL_SCAN_STEP_MS;
+
+	if (g_scan_channel >= CHANNEL_COUNT)
+	{
+		g_scan_active = 0;
+		g_next_scan_ms = now_ms + CHANNEL_RESCAN_PERIOD_MS;
+		g_stats.scans++;
+		channel_evaluate();
+	}
+
+	return 1;
+}
+
+
+/**
+ * @brief   Record a frame received from the peer, which confirms the link channel.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_on_frame_received (uint64_t now_ms)
+{
+	g_last_heard_ms = now_ms;
+	g_confirm_pending = 0;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to send a link report straight away, so each end hears the other on a new channel.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param         None
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t channel_get_report ()
+{
+	if (g_report_due == 0)
+	{
+		return 0;
+	}
+
+	g_report_due = 0;
+
+	return 1;
+}
+
+
+/**
+ * @brief   Check whether to propose a channel change, or to retry an unanswered proposal.
+ *
+ * On success the proposal is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    channel_index proposed channel
+ * @param[out]    switch_id identifies the proposal in the acknowledgement
+ * @return        1 if a proposal should be sent now, 0 otherwise
+ */
+int32_t channel_get_switch (uint64_t now_ms, uint8_t* channel_index, uint8_t* switch_id)
+{
+	if (g_ack_pending)
+	{
+		// Answer the peer's proposal first
+		return 0;
+	}
+
+	if (g_switch_pending == 0)
+	{
+		return 0;
+	}
+
+	if ((g_switch_attempts != 0) && ((now_ms - g_switch_sent_ms) < CHANNEL_SWITCH_RETRY_MS))
+	{
+		return 0;
+	}
+
+	if (g_switch_attempts >= CHANNEL_SWITCH_MAX_ATTEMPTS)
+	{
+		// No answer - stay on the current channel, the contact timeout covers a peer that has gone
+		g_switch_pending = 0;
+		g_stats.proposals_failed++;
+		return 0;
+	}
+
+	g_switch_attempts++;
+	g_switch_sent_ms = now_ms;
+	*channel_index = g_switch_channel;
+	*switch_id = g_switch_id;
+
+	return 1;
+}
+
+
+/**
+ * @brief   Apply a channel change proposed by a peer. It is acknowledged on the current channel.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     channel_index proposed channel
+ * @param[in]     switch_id identifies the proposal
+ * @return        0 if accepted, Error if rejected
+ */
+int32_t channel_on_switch (uint8_t source_address, uint8_t channel_index, uint8_t switch_id)
+{
+	if (channel_index >= CHANNEL_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	if (g_switch_pending)
+	{
+		// Proposals crossed on air - the lower address wins, the other end gives way
+		if (g_own_address < source_address)
+		{
+			// Error
+			return -1;
+		}
+		g_switch_pending = 0;
+	}
+
+	g_ack_pending = 1;
+	g_ack_channel = channel_index;
+	g_ack_id = switch_id;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to acknowledge a channel change proposed by a peer.
+ *
+ * @param[out]    channel_index accepted channel
+ * @param[out]    switch_id identifies the proposal
+ * @return        1 if an acknowledgement should be sent now, 0 otherwise
+ */
+int32_t channel_get_ack (uint8_t* channel_index, uint8_t* switch_id)
+{
+	if (g_ack_pending == 0)
+	{
+		return 0;
+	}
+
+	*channel_index = g_ack_channel;
+	*switch_id = g_ack_id;
+	return 1;
+}
+
+
+/**
+ * @brief   The acknowledgement is on air - switch to the accepted channel.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t channel_on_ack_sent (uint64_t now_ms)
+{
+	if (g_ack_pending == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	g_ack_pending = 0;
+	channel_switch_to(g_ack_channel, now_ms);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Apply an acknowledgement of our proposal - switch to the proposed channel.
+ *
+ * @param[in]     channel_index acknowledged channel
+ * @param[in]     switch_id identifies the proposal
+ * @param[in]     now_ms current time
+ * @return        0 if it matched the proposal, Error otherwise
+ */
+int32_t channel_on_ack (uint8_t channel_index, uint8_t switch_id, uint64_t now_ms)
+{
+	if ((g_switch_pending == 0) || (channel_index != g_switch_channel) || (switch_id != g_switch_id))
+	{
+		// Error
+		return -1;
+	}
+
+	g_switch_pending = 0;
+	channel_switch_to(g_switch_channel, now_ms);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Return to the home channel if the peer has not been heard in time.
+ *
+ * @param[in]     now_ms current time
+ * @return        1 if the channel changed, 0 otherwise
+ */
+int32_t channel_poll (uint64_t now_ms)
+{
+	if (g_channel_index == CHANNEL_HOME)
+	{
+		g_confirm_pending = 0;
+		return 0;
+	}
+
+	if ((g_confirm_pending && ((now_ms - g_last_switch_ms) >= CHANNEL_CONFIRM_TIMEOUT_MS)) ||
+			((now_ms - g_last_heard_ms) >= CHANNEL_CONTACT_TIMEOUT_MS))
+	{
+		// The peer does not hear us on this channel, or has gone home already - meet it there
+		g_channel_index = CHANNEL_HOME;
+		g_switch_pending = 0;
+		g_ack_pending = 0;
+		g_confirm_pending = 0;
+		g_last_switch_ms = now_ms;
+		g_stats.fallbacks++;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the link channel.
+ *
+ * @param[out]    frequency_hz frequency of the channel
+ * @return        index of the channel in the plan
+ */
+uint8_t channel_get_current (uint32_t* frequency_hz)
+{
+	*frequency_hz = g_channel_plan[g_channel_index];
+
+	return g_channel_index;
+}
+
+
+/**
+ * @brief   Get the frequency of a channel in the plan.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    frequency_hz frequency of the channel
+ * @return        0 for success or Error
+ */
+int32_t channel_get_frequency (uint8_t channel_index, uint32_t* frequency_hz)
+{
+	if (channel_index >= CHANNEL_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	*frequency_hz = g_channel_plan[channel_index];
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the channel of the plan furthest from a channel, for the other direction of a full
+ *          duplex link. Across this plan it is at least 800 kHz away, which leaves a guard band
+ *          between the two signals at every bandwidth the adaptive data rate uses, up to 500 kHz.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    pair_index the channel furthest from it
+ * @return        0 for success or Error
+ */
+int32_t channel_get_pair (uint8_t channel_index, uint8_t* pair_index)
+{
+	if (channel_index >= CHANNEL_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t frequency_hz = g_channel_plan[channel_index];
+	uint32_t widest_hz = 0;
+
+	for (uint8_t idx = 0; idx < CHANNEL_COUNT; idx++)
+	{
+		uint32_t separation_hz = (g_channel_plan[idx] > frequency_hz) ? (g_channel_plan[idx] - frequency_hz) : (frequency_hz - g_channel_plan[idx]);
+		if (separation_hz > widest_hz)
+		{
+			widest_hz = separation_hz;
+			*pair_index = idx;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the noise floor of a channel from the last scan.
+ *
+ * @param[in]     channel_index the channel
+ * @param[out]    noise_floor_dbm median of its RSSI samples
+ * @return        0 for success or Error if it has not been sampled
+ */
+int32_t channel_get_noise_floor (uint8_t channel_index, int32_t* noise_floor_dbm)
+{
+	if ((g_noise_floor_valid == 0) || (channel_index >= CHANNEL_COUNT))
+	{
+		// Error
+		return -1;
+	}
+
+	*noise_floor_dbm = g_noise_floor_dbm[channel_index];
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the channel selection statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t channel_get_stats (channel_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Get a percentile of the noise histogram of a channel.
+ *
+ * @param[in]     channel_index the channel
+ * @param[in]     percent percentile, 1 to 100
+ * @return        centre of the bin holding the percentile, in dBm
+ */
+static int32_t channel_get_percentile (uint8_t channel_index, uint32_t percent)
+{
+	uint32_t target = ((CHANNEL_SAMPLES_PER_DWELL * percent) + 99U) / 100U;
+	uint32_t count = 0;
+	uint32_t bin = 0;
+
+	for (bin = 0; bin < (CHANNEL_HISTOGRAM_BINS - 1U); bin++)
+	{
+		count += g_histograms[channel_index][bin];
+		if (count >= target)
+		{
+			break;
+		}
+	}
+
+	return CHANNEL_HISTOGRAM_MIN_DBM + ((int32_t)bin * CHANNEL_HISTOGRAM_BIN_DB) + (CHANNEL_HISTOGRAM_BIN_DB / 2);
+}
+
+
+/**
+ * @brief   Choose the quietest channel of the completed scan, and propose it if it is worth a switch.
+ *
+ * @param         None
+ * @return        None
+ */
+static void channel_evaluate ()
+{
+	uint8_t best = g_channel_index;
+	int32_t best_busy_dbm = channel_get_percentile(best, CHANNEL_PERCENTILE_BUSY);
+
+	for (uint8_t idx = 0; idx < CHANNEL_COUNT; idx++)
+	{
+		g_noise_floor_dbm[idx] = channel_get_percentile(idx, CHANNEL_PERCENTILE_MEDIAN);
+	}
+	g_noise_floor_valid = 1;
+
+	for (uint8_t idx = 0; idx < CHANNEL_COUNT; idx++)
+	{
+		int32_t busy_dbm = channel_get_percentile(idx, CHANNEL_PERCENTILE_BUSY);
+		if ((g_noise_floor_dbm[idx] < g_noise_floor_dbm[best]) ||
+				((g_noise_floor_dbm[idx] == g_noise_floor_dbm[best]) && (busy_dbm < best_busy_dbm)))
+		{
+			best = idx;
+			best_busy_dbm = busy_dbm;
+		}
+	}
+
+	if ((best == g_channel_index) || (g_switch_pending) || (g_ack_pending) ||
+			((g_noise_floor_dbm[g_channel_index] - g_noise_floor_dbm[best]) < CHANNEL_SWITCH_MARGIN_DB))
+	{
+		return;
+	}
+
+	g_switch_pending = 1;
+	g_switch_channel = best;
+	g_switch_id++;
+	g_switch_attempts = 0;
+}
+
+
+/**
+ * @brief   Change to a channel agreed with the peer.
+ *
+ * @param[in]     channel_index new channel
+ * @param[in]     now_ms current time
+ * @return        None
+ */
+static void channel_switch_to (uint8_t channel_index, uint64_t now_ms)
+{
+	if (channel_index != g_channel_index)
+	{
+		g_stats.switches++;
+	}
+
+	// Report straight away so each end hears the other on the new channel
+	g_channel_index = channel_index;
+	g_last_switch_ms = now_ms;
+	g_confirm_pending = 1;
+	g_report_due = 1;
+}
+
+/* End of file */
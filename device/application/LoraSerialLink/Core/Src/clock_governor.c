@@ -0,0 +1,498 @@
+/**
+ * @file    clock_governor.c
+ *
+ * @brief   System Clock Governor.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The slow parts of a switch - the regulator settling and the HSE and PLL
+ *  starting - run with interrupts enabled. The system clock switch itself is
+ *  done with interrupts masked, together with the rescaling of the timers,
+ *  so nothing measures time across it. The radio SPIs are slowed down before
+ *  the clock goes up and sped up after it comes down, so they never run above
+ *  CLOCK_GOVERNOR_SPI_MAX_HZ.
+ *
+ *  MSI runs in PLL mode locked to the LSE, which keeps it within 0.25 % and
+ *  so good enough for the timebase. At the idle level it is also the wake
+ *  clock from STOP, so there is nothing to restore on wake.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "clock_governor.h"
+
+#include "power.h"
+#include "soft_timer.h"
+#include "timebase.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define CLOCK_GOVERNOR_SPI_PRESCALER_MAX	(7U)	/*!< SPI_CR1_BR value for divide by 256 */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* Configuration of a level */
+typedef struct clock_governor_level_config_t_
+{
+	uint32_t sysclk_hz;				/*!< System clock, the AHB and APB buses are not divided */
+	uint32_t voltage_scale;			/*!< PWR_REGULATOR_VOLTAGE_SCALE */
+	uint32_t flash_latency;			/*!< FLASH_LATENCY for the system clock in the voltage range */
+	uint32_t wake_clock;			/*!< RCC_STOP_WAKEUPCLOCK */
+	uint32_t run_current_ua;		/*!< Typical MCU current running, for the power estimate */
+	uint32_t sleep_current_ua;		/*!< Typical MCU current in WFI sleep */
+} clock_governor_level_config_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+static const clock_governor_level_config_t g_level_configs[CLOCK_GOVERNOR_LEVEL_COUNT] =
+{
+	[CLOCK_GOVERNOR_LEVEL_IDLE] =
+	{
+		.sysclk_hz = 8000000U,
+		.voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE2,
+		.flash_latency = FLASH_LATENCY_1,
+		.wake_clock = RCC_STOP_WAKEUPCLOCK_MSI,
+		.run_current_ua = 750U,
+		.sleep_current_ua = 220U,
+	},
+	[CLOCK_GOVERNOR_LEVEL_BURST] =
+	{
+		.sysclk_hz = 80000000U,
+		.voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE1,
+		.flash_latency = FLASH_LATENCY_4,
+		.wake_clock = RCC_STOP_WAKEUPCLOCK_HSI,
+		.run_current_ua = 9500U,
+		.sleep_current_ua = 2600U,
+	},
+};
+
+
+
+/*
+ * Private: Variables
+ */
+
+static SPI_HandleTypeDef* g_spis[CLOCK_GOVERNOR_MAX_SPI] = {0};
+static uint32_t g_spi_count = 0;
+static TIM_HandleTypeDef* g_heartbeat_timer = 0;
+static uint32_t g_heartbeat_divider = 0;	/*!< Heartbeat prescaler + 1 at g_heartbeat_clock_hz */
+static uint32_t g_heartbeat_clock_hz = 0;	/*!< Heartbeat timer clock when initialised */
+static uint8_t g_initialised = 0;
+
+static clock_governor_level_t g_level = CLOCK_GOVERNOR_LEVEL_BURST;
+static uint32_t g_last_demand_ms = 0;		/*!< Time the burst clock was last needed */
+static uint64_t g_level_start_us = 0;		/*!< Time the current level was entered */
+
+static clock_governor_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static int32_t clock_governor_set_level (clock_governor_level_t level);
+static int32_t clock_governor_apply (clock_governor_level_t level);
+static int32_t clock_governor_switch_sysclk (clock_governor_level_t level);
+static void clock_governor_set_spi_prescaler (uint32_t pclk_hz);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Clock Governor at the burst level set by SystemClock_Config.
+ *
+ * Starts MSI locked to the LSE, so the software timer service must already be running.
+ *
+ * @param[in]     hspi SPI to keep under CLOCK_GOVERNOR_SPI_MAX_HZ
+ * @param[in]     heartbeat_htim timer to keep at its rate, may be 0
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_init (SPI_HandleTypeDef* hspi, TIM_HandleTypeDef* heartbeat_htim)
+{
+	if (hspi == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	g_spis[0] = hspi;
+	g_spi_count = 1;
+	g_heartbeat_timer = heartbeat_htim;
+	if (g_heartbeat_timer != 0)
+	{
+		g_heartbeat_divider = g_heartbeat_timer->Instance->PSC + 1U;
+		g_heartbeat_clock_hz = HAL_RCC_GetPCLK2Freq();
+	}
+
+	// MSI ready for the idle level, trimmed continuously from the LSE
+	RCC_OscInitTypeDef osc_init = {0};
+	osc_init.OscillatorType = RCC_OSCILLATORTYPE_MSI;
+	osc_init.MSIState = RCC_MSI_ON;
+	osc_init.MSICalibrationValue = RCC_MSICALIBRATION_DEFAULT;
+	osc_init.MSIClockRange = RCC_MSIRANGE_7;
+	osc_init.PLL.PLLState = RCC_PLL_NONE;
+	if (HAL_RCC_OscConfig(&osc_init) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+	HAL_RCCEx_EnableMSIPLLMode();
+
+	memset(&g_stats, 0, sizeof(g_stats));
+	g_level = CLOCK_GOVERNOR_LEVEL_BURST;
+	g_level_start_us = timebase_get_us();
+	g_last_demand_ms = (uint32_t)timebase_get_ms();
+
+	clock_governor_set_spi_prescaler(HAL_RCC_GetPCLK2Freq());
+	power_set_clock_currents(g_level_configs[g_level].run_current_ua, g_level_configs[g_level].sleep_current_ua);
+
+	g_initialised = 1;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Keep another SPI under CLOCK_GOVERNOR_SPI_MAX_HZ, for a second radio.
+ *
+ * The SPI must be on a bus clocked at the same rate as APB2, which holds while neither APB is divided.
+ *
+ * @param[in]     hspi SPI to keep under CLOCK_GOVERNOR_SPI_MAX_HZ
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_add_spi (SPI_HandleTypeDef* hspi)
+{
+	if ((g_initialised == 0) || (hspi == 0) || (g_spi_count >= CLOCK_GOVERNOR_MAX_SPI))
+	{
+		// Error
+		return -1;
+	}
+
+	g_spis[g_spi_count] = hspi;
+	g_spi_count++;
+
+	clock_governor_set_spi_prescaler(HAL_RCC_GetPCLK2Freq());
+
+	return 0;
+}
+
+
+/**
+ * @brief   Switch level for the current demand. Called from the main loop on every pass.
+ *
+ * @param[in]     burst_demand 1 if the current work needs the burst clock
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_update (uint8_t burst_demand, uint32_t now_ms)
+{
+	if (g_initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	if (burst_demand)
+	{
+		g_last_demand_ms = now_ms;
+		if (g_level != CLOCK_GOVERNOR_LEVEL_BURST)
+		{
+			return clock_governor_set_level(CLOCK_GOVERNOR_LEVEL_BURST);
+		}
+	}
+	else if ((g_level != CLOCK_GOVERNOR_LEVEL_IDLE) && ((now_ms - g_last_demand_ms) >= CLOCK_GOVERNOR_IDLE_HOLD_MS))
+	{
+		return clock_governor_set_level(CLOCK_GOVERNOR_LEVEL_IDLE);
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Restore the clocks of the current level after STOP, for the power manager.
+ *
+ * @param         None
+ * @return        None
+ */
+void clock_governor_restore ()
+{
+	if (g_initialised == 0)
+	{
+		return;
+	}
+
+	clock_governor_apply(g_level);
+}
+
+
+/**
+ * @brief   Get the current level.
+ *
+ * @param         None
+ * @return        the level
+ */
+clock_governor_level_t clock_governor_get_level ()
+{
+	return g_level;
+}
+
+
+/**
+ * @brief   Get the statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t clock_governor_get_stats (clock_governor_stats_t* stats)
+{
+	if (stats == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	*stats = g_stats;
+	stats->residency_us[g_level] += timebase_get_us() - g_level_start_us;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Switch to a level and record the time taken.
+ *
+ * @param[in]     level the new level
+ * @return        0 for success or Error
+ */
+static int32_t clock_governor_set_level (clock_governor_level_t level)
+{
+	// Timed on LPTIM1 as the timebase is rescaled part way through
+	uint32_t start_ticks = soft_timer_get_ticks();
+	uint64_t now_us = timebase_get_us();
+	g_stats.residency_us[g_level] += now_us - g_level_start_us;
+	g_level_start_us = now_us;
+
+	if (clock_governor_apply(level) != 0)
+	{
+		// Error - left where the failure happened, the next update tries again
+		return -1;
+	}
+
+	g_level = level;
+
+	uint32_t switch_time_us = (uint32_t)(((uint64_t)(soft_timer_get_ticks() - start_ticks) * 1000000U) / SOFT_TIMER_TICK_FREQUENCY_HZ);
+	g_stats.switches[level]++;
+	g_stats.switch_time_total_us[level] += switch_time_us;
+	if (switch_time_us > g_stats.switch_time_max_us[level])
+	{
+		g_stats.switch_time_max_us[level] = switch_time_us;
+	}
+
+	// The switch itself is charged at the old currents
+	power_set_clock_currents(g_level_configs[level].run_current_ua, g_level_configs[level].sleep_current_ua);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Bring the oscillators, regulator and system clock to a level.
+ *
+ * @param[in]     level the level
+ * @return        0 for success or Error
+ */
+static int32_t clock_governor_apply (clock_governor_level_t level)
+{
+	const clock_governor_level_config_t* config = &g_level_configs[level];
+	RCC_OscInitTypeDef osc_init = {0};
+
+	if (level == CLOCK_GOVERNOR_LEVEL_BURST)
+	{
+		// Range 1 and slower SPIs before the clock goes up
+		if (HAL_PWREx_ControlVoltageScaling(config->voltage_scale) != HAL_OK)
+		{
+			// Error
+			return -1;
+		}
+		clock_governor_set_spi_prescaler(config->sysclk_hz);
+
+		// 4 MHz HSE x 40 / 2, as SystemClock_Config
+		osc_init.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+		osc_init.HSEState = RCC_HSE_ON;
+		osc_init.PLL.PLLState = RCC_PLL_ON;
+		osc_init.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+		osc_init.PLL.PLLM = 1;
+		osc_init.PLL.PLLN = 40;
+		osc_init.PLL.PLLP = RCC_PLLP_DIV2;
+		osc_init.PLL.PLLQ = RCC_PLLQ_DIV2;
+		osc_init.PLL.PLLR = RCC_PLLR_DIV2;
+		if (HAL_RCC_OscConfig(&osc_init) != HAL_OK)
+		{
+			// Error
+			return -1;
+		}
+
+		return clock_governor_switch_sysclk(level);
+	}
+
+	// MSI may have been stopped by STOP at the burst level
+	osc_init.OscillatorType = RCC_OSCILLATORTYPE_MSI;
+	osc_init.MSIState = RCC_MSI_ON;
+	osc_init.MSICalibrationValue = RCC_MSICALIBRATION_DEFAULT;
+	osc_init.MSIClockRange = RCC_MSIRANGE_7;
+	osc_init.PLL.PLLState = RCC_PLL_NONE;
+	if (HAL_RCC_OscConfig(&osc_init) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+
+	if (clock_governor_switch_sysclk(level) != 0)
+	{
+		// Error
+		return -1;
+	}
+
+	// Then the PLL and HSE off and range 2
+	osc_init.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+	osc_init.HSEState = RCC_HSE_OFF;
+	osc_init.PLL.PLLState = RCC_PLL_OFF;
+	if (HAL_RCC_OscConfig(&osc_init) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+
+	if (HAL_PWREx_ControlVoltageScaling(config->voltage_scale) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Switch the system clock and rescale what it drives, with interrupts masked.
+ *
+ * @param[in]     level the level, its oscillator already running
+ * @return        0 for success or Error
+ */
+static int32_t clock_governor_switch_sysclk (clock_governor_level_t level)
+{
+	const clock_governor_level_config_t* config = &g_level_configs[level];
+	RCC_ClkInitTypeDef clk_init = {0};
+	clk_init.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+	clk_init.SYSCLKSource = (level == CLOCK_GOVERNOR_LEVEL_BURST) ? RCC_SYSCLKSOURCE_PLLCLK : RCC_SYSCLKSOURCE_MSI;
+	clk_init.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	clk_init.APB1CLKDivider = RCC_HCLK_DIV1;
+	clk_init.APB2CLKDivider = RCC_HCLK_DIV1;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (HAL_RCC_ClockConfig(&clk_init, config->flash_latency) != HAL_OK)
+	{
+		__set_PRIMASK(primask);
+		// Error
+		return -1;
+	}
+
+	// The buses are not divided, so the timer clocks are the bus clocks
+	timebase_set_timer_clock(HAL_RCC_GetPCLK1Freq());
+
+	if (g_heartbeat_timer != 0)
+	{
+		// Loads at the next update of the heartbeat, which is soon enough for an LED
+		uint32_t divider = (uint32_t)(((uint64_t)g_heartbeat_divider * HAL_RCC_GetPCLK2Freq()) / g_heartbeat_clock_hz);
+		__HAL_TIM_SET_PRESCALER(g_heartbeat_timer, (divider > 0) ? (divider - 1U) : 0U);
+	}
+
+	if (level == CLOCK_GOVERNOR_LEVEL_IDLE)
+	{
+		clock_governor_set_spi_prescaler(HAL_RCC_GetPCLK2Freq());
+	}
+
+	__HAL_RCC_WAKEUPSTOP_CLK_CONFIG(config->wake_clock);
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Set the SPI prescalers to the fastest rate under CLOCK_GOVERNOR_SPI_MAX_HZ.
+ *
+ * @param[in]     pclk_hz SPI bus clock the prescalers are for
+ * @return        None
+ */
+static void clock_governor_set_spi_prescaler (uint32_t pclk_hz)
+{
+	uint32_t prescaler = 0;
+	while (((pclk_hz >> (prescaler + 1U)) > CLOCK_GOVERNOR_SPI_MAX_HZ) && (prescaler < CLOCK_GOVERNOR_SPI_PRESCALER_MAX))
+	{
+		prescaler++;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	// Only changed between transfers, HAL enables the SPI again for the next one
+	for (uint32_t idx = 0; idx < g_spi_count; idx++)
+	{
+		SPI_HandleTypeDef* spi = g_spis[idx];
+		spi->Init.BaudRatePrescaler = prescaler << SPI_CR1_BR_Pos;
+		__HAL_SPI_DISABLE(spi);
+		MODIFY_REG(spi->Instance->CR1, SPI_CR1_BR, spi->Init.BaudRatePrescaler);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+/* End of file */
@@ -0,0 +1,330 @@
+/**
+ * @file    credit_flow.c
+ *
+ * @brief   Credit Based Flow Control Between Radio and Serial Egress.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The sender keeps the payload length of each data packet by sequence number
+ *  so the bytes still unaccounted for by the receiver can be worked out from
+ *  the sequence number in each advertisement. The receiver keeps its own copy
+ *  of the credit the sender believes it has and advertises again once that
+ *  falls far enough behind the real free space.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "credit_flow.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define CREDIT_FLOW_SEQUENCE_COUNT	(256U)		/*!< Every 8 bit sequence number */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+/* Sender */
+static uint8_t g_sent_length[CREDIT_FLOW_SEQUENCE_COUNT] = {0};	/*!< Payload length of each data packet not yet covered by an advertisement */
+static uint8_t g_newest_sent_sequence = 0;			/*!< Newest data packet sent */
+static uint8_t g_credited_sequence = 0;				/*!< Newest data packet covered by an advertisement */
+static uint32_t g_credited_free_bytes = 0;			/*!< Free bytes in the last advertisement */
+static uint32_t g_bytes_in_flight = 0;				/*!< Bytes sent since g_credited_sequence */
+static uint8_t g_blocked = 0;						/*!< A data packet is being held back */
+static uint64_t g_blocked_since_ms = 0;				/*!< Time blocked, or of the last request while blocked */
+
+/* Receiver */
+static uint8_t g_received_sequence = 0;				/*!< Newest data packet received */
+static uint8_t g_received_sequence_valid = 0;		/*!< g_received_sequence has been set */
+static uint32_t g_sender_credit = 0;				/*!< Credit the sender believes it has */
+static uint8_t g_credit_requested = 0;				/*!< Sender asked for an advertisement */
+
+static credit_flow_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise Credit Flow Control.
+ *
+ * @param[in]     initial_credit egress buffer space assumed at each end before the first advertisement
+ * @param[in]     next_sequence_number sequence number of the first data packet to be sent
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_init (uint32_t initial_credit, uint8_t next_sequence_number)
+{
+	memset(g_sent_length, 0, sizeof(g_sent_length));
+	g_newest_sent_sequence = (uint8_t)(next_sequence_number - 1U);
+	g_credited_sequence = g_newest_sent_sequence;
+	g_credited_free_bytes = initial_credit;
+	g_bytes_in_flight = 0;
+	g_blocked = 0;
+	g_blocked_since_ms = 0;
+
+	g_received_sequence = 0;
+	g_received_sequence_valid = 0;
+	g_sender_credit = initial_credit;
+	g_credit_requested = 0;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sender: check there is credit to send a data packet now.
+ *
+ * @param[in]     payload_length payload length of the data packet
+ * @param[in]     now_ms current time
+ * @return        1 if the packet may be sent, 0 to hold it back
+ */
+int32_t credit_flow_can_send (uint32_t payload_length, uint64_t now_ms)
+{
+	if ((g_bytes_in_flight + payload_length) <= g_credited_free_bytes)
+	{
+		g_blocked = 0;
+		return 1;
+	}
+
+	if (g_blocked == 0)
+	{
+		g_blocked = 1;
+		g_blocked_since_ms = now_ms;
+		g_stats.stalls++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sender: record a data packet handed to the radio.
+ *
+ * @param[in]     sequence_number sequence number of the data packet
+ * @param[in]     payload_length payload length of the data packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_data_sent (uint8_t sequence_number, uint32_t payload_length)
+{
+	if (payload_length > UINT8_MAX)
+	{
+		// Error
+		return -1;
+	}
+
+	g_sent_length[sequence_number] = (uint8_t)payload_length;
+	g_newest_sent_sequence = sequence_number;
+	g_bytes_in_flight += payload_length;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sender: apply a credit advertisement from the receiver.
+ *
+ * @param[in]     sequence_number newest data packet the receiver has received
+ * @param[in]     free_bytes receiver egress buffer space after that packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_credit (uint8_t sequence_number, uint32_t free_bytes)
+{
+	// Ignore advertisements older than the one already applied
+	if ((int8_t)(uint8_t)(sequence_number - g_credited_sequence) < 0)
+	{
+		return -1;
+	}
+
+	// Never credit packets that have not been sent
+	if ((int8_t)(uint8_t)(g_newest_sent_sequence - sequence_number) < 0)
+	{
+		sequence_number = g_newest_sent_sequence;
+	}
+
+	// Bytes up to and including sequence_number are now in the free space figure
+	while (g_credited_sequence != sequence_number)
+	{
+		g_credited_sequence++;
+		g_bytes_in_flight -= g_sent_length[g_credited_sequence];
+		g_sent_length[g_credited_sequence] = 0;
+	}
+
+	g_credited_free_bytes = free_bytes;
+	g_stats.credits_received++;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sender: check whether to ask for an advertisement after being blocked too long.
+ *
+ * On success sequence_number is set to the newest data packet sent, and the request is counted as sent.
+ *
+ * @param[in]     now_ms current time
+ * @param[out]    sequence_number newest data packet sent, for the request payload
+ * @return        1 if a request should be sent now, 0 otherwise
+ */
+int32_t credit_flow_get_request (uint64_t now_ms, uint8_t* sequence_number)
+{
+	if ((g_blocked == 0) || ((now_ms - g_blocked_since_ms) < CREDIT_FLOW_REQUEST_TIMEOUT_MS))
+	{
+		return 0;
+	}
+
+	// Restart the timeout in case the request or its answer is lost
+	g_blocked_since_ms = now_ms;
+	g_stats.requests_sent++;
+
+	*sequence_number = g_newest_sent_sequence;
+	return 1;
+}
+
+
+/**
+ * @brief   Receiver: record a data packet received from the sender.
+ *
+ * @param[in]     sequence_number sequence number of the data packet
+ * @param[in]     payload_length payload length of the data packet
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_data_received (uint8_t sequence_number, uint32_t payload_length)
+{
+	if ((g_received_sequence_valid == 0) ||
+			((int8_t)(uint8_t)(sequence_number - g_received_sequence) > 0))
+	{
+		g_received_sequence = sequence_number;
+		g_received_sequence_valid = 1;
+	}
+
+	if (payload_length > g_sender_credit)
+	{
+		g_sender_credit = 0;
+	}
+	else
+	{
+		g_sender_credit -= payload_length;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Receiver: answer an advertisement request from the sender.
+ *
+ * Every data packet the sender sent before the request has either arrived or been lost,
+ * so the advertisement can cover all of them.
+ *
+ * @param[in]     sequence_number newest data packet the sender has sent
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_on_request (uint8_t sequence_number)
+{
+	g_received_sequence = sequence_number;
+	g_received_sequence_valid = 1;
+	g_credit_requested = 1;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Receiver: check whether to send a credit advertisement.
+ *
+ * On success the advertisement is counted as sent.
+ *
+ * @param[in]     free_bytes current egress buffer space
+ * @param[out]    sequence_number newest data packet received, for the advertisement payload
+ * @return        1 if an advertisement should be sent now, 0 otherwise
+ */
+int32_t credit_flow_get_credit (uint32_t free_bytes, uint8_t* sequence_number)
+{
+	if (g_received_sequence_valid == 0)
+	{
+		// Nothing received yet - the sender is still on its initial credit
+		return 0;
+	}
+
+	if ((g_credit_requested == 0) && (free_bytes < (g_sender_credit + CREDIT_FLOW_UPDATE_THRESHOLD)))
+	{
+		return 0;
+	}
+
+	g_credit_requested = 0;
+	g_sender_credit = free_bytes;
+	g_stats.credits_sent++;
+
+	*sequence_number = g_received_sequence;
+	return 1;
+}
+
+
+/**
+ * @brief   Get the credit flow control statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t credit_flow_get_stats (credit_flow_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+
+/* End of file */
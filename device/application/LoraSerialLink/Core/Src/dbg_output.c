@@ -32,7 +32,7 @@
 //#define U	(1)		/*!<  */
 #define TRANSMIT_BUFFER_SIZE (128U)
 
-#define TRANSMIT_FIFO_BUFFER_SIZE	(2048U)
+#define TRANSMIT_FIFO_BUFFER_SIZE	(4096U)		/*!< Holds a whole statistics report, written before the debug output task sends any */
 
 
 /*
@@ -80,11 +80,13 @@ static uint32_t g_transmit_length = 0;
 static volatile fifo_uint8_state_t g_transmit_fifo = {0};
 static volatile uint8_t g_transmit_fifo_buffer[TRANSMIT_FIFO_BUFFER_SIZE] = {0};
 static volatile uint8_t g_transmit_fifo_in_process = 0;
+static volatile uint8_t g_transmit_byte = 0;	/*!< Byte being sent, must outlive the transmit call */
 
 /*
  * Private: Function Prototypes/Declarations
  */
 
+static void dbg_output_transmit_next ();
 
 
 /*
@@ -162,15 +164,7 @@ int32_t dbg_output_write_buffer (uint32_t buffer_length, uint8_t buffer[buffer_l
 		fifo_uint8_write_one(&g_transmit_fifo, buffer[idx]);
 	}
 
-	// if transmission not in process then kick it off
-	if (g_transmit_fifo_in_process == 0)
-	{
-		// Send the next byte
-		uint8_t next_byte = 0;
-		fifo_uint8_read_one(&g_transmit_fifo, &next_byte);
-		HAL_UART_Transmit_IT(g_phuart, &next_byte, 1);
-		g_transmit_fifo_in_process = 1;
-	}
+	// Sent from the fifo by the debug output task
 
 
 	return (0);
@@ -204,15 +198,7 @@ int32_t dbg_output_write_hex_encoded_csv_buffer (uint32_t buffer_length, uint8_t
 		}
 	}
 
-	// if transmission not in process then kick it off
-	if (g_transmit_fifo_in_process == 0)
-	{
-		// Send the next byte
-		uint8_t next_byte = 0;
-		fifo_uint8_read_one(&g_transmit_fifo, &next_byte);
-		HAL_UART_Transmit_IT(g_phuart, &next_byte, 1);
-		g_transmit_fifo_in_process = 1;
-	}
+	// Sent from the fifo by the debug output task
 
 
 	return (0);
@@ -236,15 +222,7 @@ int32_t dbg_output_write_str (char* str)
 		fifo_uint8_write_one(&g_transmit_fifo, str[idx]);
 	}
 
-	// if transmission not in process then kick it off
-	if (g_transmit_fifo_in_process == 0)
-	{
-		// Send the next byte
-		uint8_t next_byte = 0;
-		fifo_uint8_read_one(&g_transmit_fifo, &next_byte);
-		HAL_UART_Transmit_IT(g_phuart, &next_byte, 1);
-		g_transmit_fifo_in_process = 1;
-	}
+	// Sent from the fifo by the debug output task
 
 	return (0);
 }
@@ -268,11 +246,54 @@ int32_t dbg_output_process_on_interrupt()
 	}
 	else
 	{
-		// Send the next byte
-		uint8_t next_byte = 0;
-		fifo_uint8_read_one(&g_transmit_fifo, &next_byte);
-		HAL_UART_Transmit_IT(g_phuart, &next_byte, 1);
-		g_transmit_fifo_in_process = 1;
+		dbg_output_transmit_next();
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Debug output task - start sending anything written since the last transmission finished.
+ *
+ * The write functions only append to the fifo so they never touch the UART from the caller context.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t dbg_output_process()
+{
+	if (g_initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if ((g_transmit_fifo_in_process == 0) && (fifo_uint8_is_empty(&g_transmit_fifo) == 0))
+	{
+		dbg_output_transmit_next();
+	}
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Has everything written been sent.
+ *
+ * @param         None
+ * @return        1 for idle, 0 for sending
+ */
+int32_t dbg_output_is_idle()
+{
+	if ((g_transmit_fifo_in_process == 0) && (fifo_uint8_is_empty(&g_transmit_fifo) == 1))
+	{
+		return 1;
 	}
 
 	return 0;
@@ -283,5 +304,20 @@ int32_t dbg_output_process_on_interrupt()
  * Private: Function Definitions
  */
 
+/**
+ * @brief   Send the next byte from the fifo.
+ *
+ * @param         None
+ * @return        None
+ */
+static void dbg_output_transmit_next ()
+{
+	uint8_t next_byte = 0;
+	fifo_uint8_read_one(&g_transmit_fifo, &next_byte);
+	g_transmit_byte = next_byte;
+	HAL_UART_Transmit_IT(g_phuart, (uint8_t*)&g_transmit_byte, 1);
+	g_transmit_fifo_in_process = 1;
+}
+
 
 /* End of file */
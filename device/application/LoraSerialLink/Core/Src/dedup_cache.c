@@ -0,0 +1,305 @@
+/**
+ * @file    dedup_cache.c
+ *
+ * @brief   Duplicate LoRa Packet Suppression Cache.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Each source has a window bitmap where bit n is set if the sequence number
+ *  n behind the newest has been seen. A table indexed by source address finds
+ *  the window directly so each check is O(1). A source that has been quiet
+ *  for longer than any copy could be delayed starts a new window, so one that
+ *  restarted its sequence numbers is not dropped for landing in the old one.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "dedup_cache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define DEDUP_CACHE_ADDRESS_COUNT	(256U)		/*!< Every 8 bit source address */
+#define DEDUP_CACHE_SLOT_NONE		(0xFFU)		/*!< Source address not tracked */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/**
+ * @brief   Sequence window of one source.
+ */
+typedef struct dedup_cache_peer_t_
+{
+	uint8_t source_address;			/*!< Source address tracked by this slot */
+	uint8_t in_use;					/*!< Slot holds a source */
+	uint8_t newest_sequence;		/*!< Newest sequence number seen */
+	uint32_t window;				/*!< Bit n set if newest_sequence - n has been seen */
+	uint32_t last_heard;			/*!< Value of g_check_counter when last recorded, for replacement */
+	uint64_t last_heard_ms;			/*!< Time last heard, for the timeout */
+} dedup_cache_peer_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static dedup_cache_peer_t g_peers[DEDUP_CACHE_MAX_PEERS] = {0};
+static uint8_t g_peer_slot[DEDUP_CACHE_ADDRESS_COUNT] = {0};	/*!< Slot of each source address, or DEDUP_CACHE_SLOT_NONE */
+static uint32_t g_check_counter = 0;
+
+static dedup_cache_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Take a slot for a new source, replacing the least recently heard if all are in use.
+ *
+ * @param[in]     source_address the new source address
+ * @return        the slot
+ */
+static uint8_t dedup_cache_allocate_slot (uint8_t source_address);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Duplicate Cache. All sources are forgotten.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_init ()
+{
+	memset(g_peers, 0, sizeof(g_peers));
+	memset(g_peer_slot, DEDUP_CACHE_SLOT_NONE, sizeof(g_peer_slot));
+	g_check_counter = 0;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check a packet against the cache. The cache is left unchanged, so a packet that
+ *          could not be passed on is not taken as seen and its retransmission gets through.
+ *
+ * @param[in]     source_address source address from the packet header
+ * @param[in]     sequence_number sequence number from the packet header
+ * @param[in]     now_ms current time
+ * @return        1 if the packet has been seen before, 0 if it is new
+ */
+int32_t dedup_cache_check (uint8_t source_address, uint8_t sequence_number, uint64_t now_ms)
+{
+	g_stats.packets_checked++;
+
+	uint8_t slot = g_peer_slot[source_address];
+	if (slot == DEDUP_CACHE_SLOT_NONE)
+	{
+		// First packet from this source
+		return 0;
+	}
+
+	dedup_cache_peer_t* peer = &g_peers[slot];
+	if ((now_ms - peer->last_heard_ms) >= DEDUP_CACHE_PEER_TIMEOUT_MS)
+	{
+		// Quiet for too long for this to be a copy - the source may have restarted its sequence numbers
+		return 0;
+	}
+
+	// Signed distance ahead of the newest, wrapping at 8 bits
+	int8_t ahead = (int8_t)(uint8_t)(sequence_number - peer->newest_sequence);
+	if (ahead > 0)
+	{
+		// Newer than any seen
+		return 0;
+	}
+
+	uint32_t behind = (uint32_t)(-ahead);
+	if (behind >= DEDUP_CACHE_WINDOW_SIZE)
+	{
+		// Too old to judge - most likely the source restarted its sequence numbers
+		return 0;
+	}
+
+	if (peer->window & (1UL << behind))
+	{
+		g_stats.duplicates++;
+		return 1;
+	}
+
+	// Late but not seen before
+	return 0;
+}
+
+
+/**
+ * @brief   Record a packet as seen, once it has been passed on.
+ *
+ * @param[in]     source_address source address from the packet header
+ * @param[in]     sequence_number sequence number from the packet header
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_record (uint8_t source_address, uint8_t sequence_number, uint64_t now_ms)
+{
+	g_check_counter++;
+
+	uint8_t slot = g_peer_slot[source_address];
+	if (slot == DEDUP_CACHE_SLOT_NONE)
+	{
+		// First packet from this source
+		slot = dedup_cache_allocate_slot(source_address);
+		g_peers[slot].newest_sequence = sequence_number;
+		g_peers[slot].window = 1U;
+		g_peers[slot].last_heard = g_check_counter;
+		g_peers[slot].last_heard_ms = now_ms;
+		return 0;
+	}
+
+	dedup_cache_peer_t* peer = &g_peers[slot];
+	uint64_t quiet_ms = now_ms - peer->last_heard_ms;
+	peer->last_heard = g_check_counter;
+	peer->last_heard_ms = now_ms;
+
+	if (quiet_ms >= DEDUP_CACHE_PEER_TIMEOUT_MS)
+	{
+		// Quiet for too long for this to be a copy - the source may have restarted its sequence numbers
+		g_stats.resyncs++;
+		peer->window = 1U;
+		peer->newest_sequence = sequence_number;
+		return 0;
+	}
+
+	// Signed distance ahead of the newest, wrapping at 8 bits
+	int8_t ahead = (int8_t)(uint8_t)(sequence_number - peer->newest_sequence);
+
+	if (ahead > 0)
+	{
+		// Newer - slide the window forward
+		if ((uint32_t)ahead >= DEDUP_CACHE_WINDOW_SIZE)
+		{
+			peer->window = 0;
+		}
+		else
+		{
+			peer->window <<= ahead;
+		}
+		peer->window |= 1U;
+		peer->newest_sequence = sequence_number;
+		return 0;
+	}
+
+	uint32_t behind = (uint32_t)(-ahead);
+	if (behind >= DEDUP_CACHE_WINDOW_SIZE)
+	{
+		// Too old to judge - most likely the source restarted its sequence numbers
+		g_stats.resyncs++;
+		peer->window = 1U;
+		peer->newest_sequence = sequence_number;
+		return 0;
+	}
+
+	// Late, or a copy already in the window
+	peer->window |= (1UL << behind);
+	return 0;
+}
+
+
+/**
+ * @brief   Get the duplicate suppression statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t dedup_cache_get_stats (dedup_cache_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Take a slot for a new source, replacing the least recently heard if all are in use.
+ *
+ * @param[in]     source_address the new source address
+ * @return        the slot
+ */
+static uint8_t dedup_cache_allocate_slot (uint8_t source_address)
+{
+	uint8_t slot = 0;
+
+	for (uint8_t idx = 0; idx < DEDUP_CACHE_MAX_PEERS; idx++)
+	{
+		if (g_peers[idx].in_use == 0)
+		{
+			slot = idx;
+			break;
+		}
+
+		if ((g_check_counter - g_peers[idx].last_heard) > (g_check_counter - g_peers[slot].last_heard))
+		{
+			slot = idx;
+		}
+	}
+
+	if (g_peers[slot].in_use)
+	{
+		g_stats.peer_evictions++;
+		g_peer_slot[g_peers[slot].source_address] = DEDUP_CACHE_SLOT_NONE;
+	}
+
+	g_peers[slot].source_address = source_address;
+	g_peers[slot].in_use = 1;
+	g_peer_slot[source_address] = slot;
+
+	return slot;
+}
+
+
+/* End of file */
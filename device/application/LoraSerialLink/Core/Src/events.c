@@ -0,0 +1,132 @@
+/**
+ * @file    events.c
+ *
+ * @brief   Event Flags Raised by Interrupts for the Main Loop.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The flags are a single word updated with interrupts masked, which is only
+ *  a couple of instructions.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "events.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static volatile uint32_t g_events = 0;
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Raise events - ISR safe.
+ *
+ * @param[in]     events EVENTS_ flags to raise
+ * @return        None
+ */
+void events_set (uint32_t events)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	g_events |= events;
+
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ * @brief   Take all the pending events, clearing them.
+ *
+ * @param         None
+ * @return        EVENTS_ flags raised since the last call
+ */
+uint32_t events_fetch_and_clear ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t events = g_events;
+	g_events = 0;
+
+	__set_PRIMASK(primask);
+
+	return events;
+}
+
+
+/**
+ * @brief   Get the pending events without clearing them - ISR safe.
+ *
+ * Called with interrupts masked before sleeping, so an event raised just before the
+ * sleep is not missed.
+ *
+ * @param         None
+ * @return        EVENTS_ flags raised since the last fetch
+ */
+uint32_t events_peek ()
+{
+	return g_events;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+
+/* End of file */
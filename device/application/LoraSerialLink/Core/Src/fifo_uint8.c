@@ -80,7 +80,7 @@
  * @param[in]     buffer of length buffer_length for the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_init (fifo_uint8_state_t* fifo_state, uint32_t buffer_length, uint8_t buffer[buffer_length])
+int32_t fifo_uint8_init (volatile fifo_uint8_state_t* fifo_state, uint32_t buffer_length, uint8_t buffer[buffer_length])
 {
 	fifo_state->read_idx = 0U;
 	fifo_state->write_idx = 0U;
@@ -99,7 +99,7 @@ int32_t fifo_uint8_init (fifo_uint8_state_t* fifo_state, uint32_t buffer_length,
  * @param[int]    fifo_state pointer to fifo state struct
  * @return        1 for True, 0 for False
  */
-int32_t fifo_uint8_is_empty (fifo_uint8_state_t* fifo_state)
+int32_t fifo_uint8_is_empty (volatile fifo_uint8_state_t* fifo_state)
 {
 	if (fifo_state->read_idx == fifo_state->write_idx)
 	{
@@ -120,7 +120,7 @@ int32_t fifo_uint8_is_empty (fifo_uint8_state_t* fifo_state)
  * @param[int]    fifo_state pointer to fifo state struct
  * @return        1 for True, 0 for False
  */
-int32_t fifo_uint8_is_full (fifo_uint8_state_t* fifo_state)
+int32_t fifo_uint8_is_full (volatile fifo_uint8_state_t* fifo_state)
 {
 	if (fifo_state->read_idx == fifo_state->write_idx)
 	{
@@ -152,7 +152,7 @@ int32_t fifo_uint8_is_full (fifo_uint8_state_t* fifo_state)
  * @param[in]     the_byte the value to write to the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_write_one (fifo_uint8_state_t* fifo_state, uint8_t the_byte)
+int32_t fifo_uint8_write_one (volatile fifo_uint8_state_t* fifo_state, uint8_t the_byte)
 {
 	if (fifo_uint8_is_full(fifo_state))
 	{
@@ -160,14 +160,17 @@ int32_t fifo_uint8_write_one (fifo_uint8_state_t* fifo_state, uint8_t the_byte)
 	}
 	else
 	{
-		// Write into current write index, then increment the index
-		fifo_state->buffer[fifo_state->write_idx] = the_byte;
-		fifo_state->write_idx++;
-		if (fifo_state->write_idx >= fifo_state->buffer_length)
+		// Write into current write index, then publish the next index in a single store
+		// so a reader in an interrupt never sees it past the end of the buffer
+		uint32_t write_idx = fifo_state->write_idx;
+		fifo_state->buffer[write_idx] = the_byte;
+		write_idx++;
+		if (write_idx >= fifo_state->buffer_length)
 		{
 			// Wrap
-			fifo_state->write_idx = 0;
+			write_idx = 0;
 		}
+		fifo_state->write_idx = write_idx;
 
 		return 0;
 	}
@@ -183,7 +186,7 @@ int32_t fifo_uint8_write_one (fifo_uint8_state_t* fifo_state, uint8_t the_byte)
  * @param[out]     the_byte the value to read from the fifo
  * @return        0 for success or Error
  */
-int32_t fifo_uint8_read_one (fifo_uint8_state_t* fifo_state, uint8_t* the_byte)
+int32_t fifo_uint8_read_one (volatile fifo_uint8_state_t* fifo_state, uint8_t* the_byte)
 {
 	if (fifo_uint8_is_empty(fifo_state))
 	{
@@ -191,18 +194,179 @@ int32_t fifo_uint8_read_one (fifo_uint8_state_t* fifo_state, uint8_t* the_byte)
 	}
 	else
 	{
-		// Read from current index, then increment the index
-		*the_byte = fifo_state->buffer[fifo_state->read_idx];
-		fifo_state->read_idx++;
-		if (fifo_state->read_idx >= fifo_state->buffer_length)
+		// Read from current index, then publish the next index in a single store
+		uint32_t read_idx = fifo_state->read_idx;
+		*the_byte = fifo_state->buffer[read_idx];
+		read_idx++;
+		if (read_idx >= fifo_state->buffer_length)
 		{
 			// Wrap
-			fifo_state->read_idx = 0;
+			read_idx = 0;
 		}
+		fifo_state->read_idx = read_idx;
+
+		return 0;
+	}
+}
+
+/**
+ * @brief   Get the number of values in the FIFO.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @return        count of values that can be read
+ */
+uint32_t fifo_uint8_get_count (volatile fifo_uint8_state_t* fifo_state)
+{
+	uint32_t read_idx = fifo_state->read_idx;
+	uint32_t write_idx = fifo_state->write_idx;
+
+	if (write_idx >= read_idx)
+	{
+		return write_idx - read_idx;
+	}
+	else
+	{
+		return fifo_state->buffer_length - read_idx + write_idx;
 	}
 }
 
 
+/**
+ * @brief   Get the free space in the FIFO.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @return        count of values that can be written
+ */
+uint32_t fifo_uint8_get_free (volatile fifo_uint8_state_t* fifo_state)
+{
+	// One slot is always left empty so full and empty can be told apart
+	return fifo_state->buffer_length - 1U - fifo_uint8_get_count(fifo_state);
+}
+
+
+/**
+ * @brief   Reserve space to write directly into the FIFO buffer.
+ *
+ * The space may wrap the end of the buffer so is returned as up to two segments.
+ * Nothing is visible to the reader until fifo_uint8_commit_write is called.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values to reserve
+ * @param[out]    first_segment start of the first segment
+ * @param[out]    first_length length of the first segment
+ * @param[out]    second_segment start of the second segment at the start of the buffer
+ * @param[out]    second_length length of the second segment, 0 if no wrap
+ * @return        0 for success or Error if there is not enough free space
+ */
+int32_t fifo_uint8_reserve_write (volatile fifo_uint8_state_t* fifo_state, uint32_t length,
+		volatile uint8_t** first_segment, uint32_t* first_length,
+		volatile uint8_t** second_segment, uint32_t* second_length)
+{
+	if (fifo_uint8_get_free(fifo_state) < length)
+	{
+		return -1; // Error, not enough space.
+	}
+
+	uint32_t write_idx = fifo_state->write_idx;
+	uint32_t to_end = fifo_state->buffer_length - write_idx;
+
+	*first_segment = &fifo_state->buffer[write_idx];
+	if (length <= to_end)
+	{
+		*first_length = length;
+		*second_segment = &fifo_state->buffer[0];
+		*second_length = 0;
+	}
+	else
+	{
+		// Wrap
+		*first_length = to_end;
+		*second_segment = &fifo_state->buffer[0];
+		*second_length = length - to_end;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Commit values written directly into reserved space.
+ *
+ * @param[in/out]    fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values written
+ * @return        0 for success or Error
+ */
+int32_t fifo_uint8_commit_write (volatile fifo_uint8_state_t* fifo_state, uint32_t length)
+{
+	if (fifo_uint8_get_free(fifo_state) < length)
+	{
+		return -1; // Error, more than could have been reserved.
+	}
+
+	uint32_t write_idx = fifo_state->write_idx + length;
+	if (write_idx >= fifo_state->buffer_length)
+	{
+		// Wrap
+		write_idx -= fifo_state->buffer_length;
+	}
+	fifo_state->write_idx = write_idx;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the contiguous run of values that can be read directly from the FIFO buffer.
+ *
+ * The values remain in the FIFO until fifo_uint8_commit_read is called.
+ *
+ * @param[in]     fifo_state pointer to fifo state struct
+ * @param[out]    segment start of the run
+ * @return        length of the run, 0 if empty
+ */
+uint32_t fifo_uint8_get_read_segment (volatile fifo_uint8_state_t* fifo_state, volatile uint8_t** segment)
+{
+	uint32_t read_idx = fifo_state->read_idx;
+	uint32_t write_idx = fifo_state->write_idx;
+
+	*segment = &fifo_state->buffer[read_idx];
+
+	if (write_idx >= read_idx)
+	{
+		return write_idx - read_idx;
+	}
+	else
+	{
+		// Only up to the end of the buffer, the rest is read after the wrap
+		return fifo_state->buffer_length - read_idx;
+	}
+}
+
+
+/**
+ * @brief   Release values read directly from the FIFO buffer.
+ *
+ * @param[in/out]    fifo_state pointer to fifo state struct
+ * @param[in]     length the number of values read
+ * @return        0 for success or Error
+ */
+int32_t fifo_uint8_commit_read (volatile fifo_uint8_state_t* fifo_state, uint32_t length)
+{
+	if (fifo_uint8_get_count(fifo_state) < length)
+	{
+		return -1; // Error, more than is in the fifo.
+	}
+
+	uint32_t read_idx = fifo_state->read_idx + length;
+	if (read_idx >= fifo_state->buffer_length)
+	{
+		// Wrap
+		read_idx -= fifo_state->buffer_length;
+	}
+	fifo_state->read_idx = read_idx;
+
+	return 0;
+}
 
 
 
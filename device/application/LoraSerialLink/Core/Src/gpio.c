@@ -90,11 +90,59 @@ void MX_GPIO_Init(void)
   HAL_GPIO_Init(LED_GPIO_Port, &GPIO_InitStruct);
 
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI2_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(EXTI2_IRQn, 1, 0);
   HAL_NVIC_EnableIRQ(EXTI2_IRQn);
 
 }
 
 /* USER CODE BEGIN 2 */
+#if LORA_DUAL_RADIO_ENABLED
 
+/** Configure the pins of the second radio, not in the .ioc
+*/
+void MX_GPIO_Radio2_Init(void)
+{
+
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  /* GPIO Ports Clock Enable */
+  __HAL_RCC_GPIOC_CLK_ENABLE();
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+
+  /*Configure GPIO pin Output Level */
+  HAL_GPIO_WritePin(RFM95W_RX_EN_GPIO_Port, RFM95W_RX_EN_Pin, GPIO_PIN_SET);
+
+  /*Configure GPIO pin Output Level */
+  HAL_GPIO_WritePin(RFM95W_RX_CS_GPIO_Port, RFM95W_RX_CS_Pin, GPIO_PIN_SET);
+
+  /*Configure GPIO pin Output Level */
+  HAL_GPIO_WritePin(RFM95W_RX_RST_GPIO_Port, RFM95W_RX_RST_Pin, GPIO_PIN_RESET);
+
+  /*Configure GPIO pins : RFM95W_RX_EN_Pin RFM95W_RX_RST_Pin */
+  GPIO_InitStruct.Pin = RFM95W_RX_EN_Pin|RFM95W_RX_RST_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+  /*Configure GPIO pin : RFM95W_RX_CS_Pin */
+  GPIO_InitStruct.Pin = RFM95W_RX_CS_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_Init(RFM95W_RX_CS_GPIO_Port, &GPIO_InitStruct);
+
+  /*Configure GPIO pin : RFM95W_RX_G0_Pin */
+  GPIO_InitStruct.Pin = RFM95W_RX_G0_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  HAL_GPIO_Init(RFM95W_RX_G0_GPIO_Port, &GPIO_InitStruct);
+
+  /* EXTI interrupt init, at the level of the first radio */
+  HAL_NVIC_SetPriority(EXTI1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
+}
+
+#endif
 /* USER CODE END 2 */
@@ -0,0 +1,272 @@
+/**
+ * @file    isr_stats.c
+ *
+ * @brief   Interrupt Run Time and Latency Measurement.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Entry and exit only store a cycle count and compare the run time, so the
+ *  handlers can keep calling them in the release build. The run is converted
+ *  to microseconds at exit, at the core clock it ran at. A handler that is preempted has
+ *  the preempting handler's run counted in its own, so summing the runs of
+ *  nested handlers counts the inner one twice, which errs towards a longer
+ *  bound for the interrupts below them.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "isr_stats.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+static const IRQn_Type g_irq_numbers[ISR_STATS_COUNT] =
+{
+	[ISR_STATS_USART1] = USART1_IRQn,
+	[ISR_STATS_EXTI2] = EXTI2_IRQn,
+	[ISR_STATS_EXTI1] = EXTI1_IRQn,
+	[ISR_STATS_TIM2] = TIM2_IRQn,
+	[ISR_STATS_LPTIM1] = LPTIM1_IRQn,
+	[ISR_STATS_TIM15] = TIM1_BRK_TIM15_IRQn,
+	[ISR_STATS_LPUART1] = LPUART1_IRQn,
+};
+
+static const char* g_names[ISR_STATS_COUNT] =
+{
+	[ISR_STATS_USART1] = "usart1",
+	[ISR_STATS_EXTI2] = "exti2",
+	[ISR_STATS_EXTI1] = "exti1",
+	[ISR_STATS_TIM2] = "tim2",
+	[ISR_STATS_LPTIM1] = "lptim1",
+	[ISR_STATS_TIM15] = "tim15",
+	[ISR_STATS_LPUART1] = "lpuart1",
+};
+
+
+
+/*
+ * Private: Variables
+ */
+
+static volatile uint32_t g_entry_cycles[ISR_STATS_COUNT] = {0};
+static volatile uint32_t g_count[ISR_STATS_COUNT] = {0};
+static volatile uint32_t g_run_time_max_us[ISR_STATS_COUNT] = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static uint32_t isr_stats_cycles_to_us (uint32_t cycles);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Interrupt Statistics and enable the DWT cycle counter.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t isr_stats_init ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	memset((void*)g_count, 0, sizeof(g_count));
+	memset((void*)g_run_time_max_us, 0, sizeof(g_run_time_max_us));
+
+	__set_PRIMASK(primask);
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Forget the longest runs, for a change of core clock. The counts carry on.
+ *
+ * @param         None
+ * @return        None
+ */
+void isr_stats_reset_run_times ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	memset((void*)g_run_time_max_us, 0, sizeof(g_run_time_max_us));
+
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ * @brief   Mark the entry of an interrupt handler.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        None
+ */
+void isr_stats_enter (isr_stats_id_t isr_id)
+{
+	g_entry_cycles[isr_id] = DWT->CYCCNT;
+}
+
+
+/**
+ * @brief   Mark the exit of an interrupt handler.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        None
+ */
+void isr_stats_exit (isr_stats_id_t isr_id)
+{
+	// The core clock only changes in the main loop, so it is the one the handler ran at
+	uint32_t run_time_us = isr_stats_cycles_to_us(DWT->CYCCNT - g_entry_cycles[isr_id]);
+
+	g_count[isr_id]++;
+	if (run_time_us > g_run_time_max_us[isr_id])
+	{
+		g_run_time_max_us[isr_id] = run_time_us;
+	}
+}
+
+
+/**
+ * @brief   Get the name of an interrupt.
+ *
+ * @param[in]     isr_id the interrupt
+ * @return        name, or 0 for an invalid id
+ */
+const char* isr_stats_get_name (isr_stats_id_t isr_id)
+{
+	if (isr_id >= ISR_STATS_COUNT)
+	{
+		return 0;
+	}
+
+	return g_names[isr_id];
+}
+
+
+/**
+ * @brief   Get the statistics of an interrupt, with the latency bounds worked out from the others.
+ *
+ * @param[in]     isr_id the interrupt
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t isr_stats_get (isr_stats_id_t isr_id, isr_stats_t* stats)
+{
+	if ((isr_id >= ISR_STATS_COUNT) || (stats == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t priority = NVIC_GetPriority(g_irq_numbers[isr_id]);
+	uint32_t higher_us = 0;
+	uint32_t equal_us = 0;
+	uint32_t bound_flat_us = 0;
+
+	for (uint32_t idx = 0; idx < ISR_STATS_COUNT; idx++)
+	{
+		if (idx == isr_id)
+		{
+			continue;
+		}
+
+		uint32_t run_time_us = g_run_time_max_us[idx];
+		if (run_time_us > bound_flat_us)
+		{
+			bound_flat_us = run_time_us;
+		}
+
+		// Higher priorities (lower values) preempt this one and can each run before it, one at the
+		// same priority may already be running and is not preempted
+		uint32_t other_priority = NVIC_GetPriority(g_irq_numbers[idx]);
+		if (other_priority < priority)
+		{
+			higher_us += run_time_us;
+		}
+		else if ((other_priority == priority) && (run_time_us > equal_us))
+		{
+			equal_us = run_time_us;
+		}
+	}
+
+	stats->count = g_count[isr_id];
+	stats->run_time_max_us = g_run_time_max_us[isr_id];
+	stats->latency_bound_us = higher_us + equal_us;
+	stats->latency_bound_flat_us = bound_flat_us;
+	stats->priority = (uint8_t)priority;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Convert DWT cycles to microseconds at the current core clock, rounding up.
+ *
+ * @param[in]     cycles core clock cycles
+ * @return        microseconds
+ */
+static uint32_t isr_stats_cycles_to_us (uint32_t cycles)
+{
+	uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+	if (cycles_per_us == 0)
+	{
+		cycles_per_us = 1;
+	}
+
+	return (cycles + cycles_per_us - 1U) / cycles_per_us;
+}
+
+
+/* End of file */
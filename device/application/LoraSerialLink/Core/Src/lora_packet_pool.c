@@ -0,0 +1,262 @@
+/**
+ * @file    lora_packet_pool.c
+ *
+ * @brief   Fixed Block Pool of LoRa Packets.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Free packets are kept on a stack of indexes so allocation and release are
+ *  O(1). Interrupts are masked around each update, which is only a handful
+ *  of instructions.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "lora_packet_pool.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static lora_packet_t g_packets[LORA_PACKET_POOL_SIZE] = {0};
+static volatile uint8_t g_reference_count[LORA_PACKET_POOL_SIZE] = {0};
+
+static volatile lora_packet_handle_t g_free_stack[LORA_PACKET_POOL_SIZE] = {0};
+static volatile uint32_t g_free_count = 0;
+
+static volatile lora_packet_pool_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Packet Pool. All packets are returned to the pool.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_init ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	for (uint32_t idx = 0; idx < LORA_PACKET_POOL_SIZE; idx++)
+	{
+		g_reference_count[idx] = 0;
+		g_free_stack[idx] = (lora_packet_handle_t)(LORA_PACKET_POOL_SIZE - 1U - idx);
+	}
+	g_free_count = LORA_PACKET_POOL_SIZE;
+
+	memset((void*)&g_stats, 0, sizeof(g_stats));
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Allocate a packet with a reference count of one - ISR safe.
+ *
+ * The payload length is cleared, the rest of the packet is not.
+ *
+ * @param         None
+ * @return        handle of the packet, or LORA_PACKET_HANDLE_INVALID if the pool is empty
+ */
+lora_packet_handle_t lora_packet_pool_alloc ()
+{
+	lora_packet_handle_t handle = LORA_PACKET_HANDLE_INVALID;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (g_free_count == 0)
+	{
+		g_stats.allocation_failures++;
+	}
+	else
+	{
+		g_free_count--;
+		handle = g_free_stack[g_free_count];
+		g_reference_count[handle] = 1;
+
+		g_stats.allocations++;
+		g_stats.in_use++;
+		if (g_stats.in_use > g_stats.high_water)
+		{
+			g_stats.high_water = g_stats.in_use;
+		}
+	}
+
+	__set_PRIMASK(primask);
+
+	if (handle != LORA_PACKET_HANDLE_INVALID)
+	{
+		g_packets[handle].payload_length = 0;
+	}
+
+	return handle;
+}
+
+
+/**
+ * @brief   Add a reference to an allocated packet - ISR safe.
+ *
+ * @param[in]     handle of the packet
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_retain (lora_packet_handle_t handle)
+{
+	int32_t result = -1;
+
+	if (handle >= LORA_PACKET_POOL_SIZE)
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if ((g_reference_count[handle] > 0) && (g_reference_count[handle] < UINT8_MAX))
+	{
+		g_reference_count[handle]++;
+		result = 0;
+	}
+
+	__set_PRIMASK(primask);
+
+	return result;
+}
+
+
+/**
+ * @brief   Drop a reference, returning the packet to the pool on the last one - ISR safe.
+ *
+ * @param[in]     handle of the packet
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_release (lora_packet_handle_t handle)
+{
+	int32_t result = -1;
+
+	if (handle >= LORA_PACKET_POOL_SIZE)
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (g_reference_count[handle] > 0)
+	{
+		g_reference_count[handle]--;
+		if (g_reference_count[handle] == 0)
+		{
+			g_free_stack[g_free_count] = handle;
+			g_free_count++;
+			g_stats.in_use--;
+		}
+		result = 0;
+	}
+
+	__set_PRIMASK(primask);
+
+	return result;
+}
+
+
+/**
+ * @brief   Get the packet of a handle.
+ *
+ * @param[in]     handle of the packet
+ * @return        pointer to the packet, or 0 for an invalid handle
+ */
+lora_packet_t* lora_packet_pool_get (lora_packet_handle_t handle)
+{
+	if (handle >= LORA_PACKET_POOL_SIZE)
+	{
+		return 0;
+	}
+
+	return &g_packets[handle];
+}
+
+
+/**
+ * @brief   Get the pool usage statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t lora_packet_pool_get_stats (lora_packet_pool_stats_t* stats)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	*stats = g_stats;
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+
+/* End of file */
@@ -31,34 +31,67 @@
 #include "dbg_output.h"
 #include "rfm95w.h"
 #include "fifo_uint8.h"
+#include "packetizer.h"
+#include "lora_packet.h"
+#include "lora_packet_pool.h"
+#include "dedup_cache.h"
+#include "credit_flow.h"
+#include "settings.h"
+#include "events.h"
+#include "scheduler.h"
+#include "timebase.h"
+#include "soft_timer.h"
+#include "isr_stats.h"
+#include "power.h"
+#include "clock_governor.h"
+#include "adr.h"
+#include "channel.h"
+#include "tx_power.h"
+#include "afc.h"
 
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
 
-/* Definition of the LoRa Packet Structures */
-typedef struct lora_packet_header_t_
+/* Ownership of a transmit frame buffer */
+typedef enum lora_tx_frame_state_t_
 {
-	uint8_t destination_address;
-	uint8_t source_address;
-	uint8_t sequence_number;
-	uint8_t ctrl_and_retry_count;
-} lora_packet_header_t;
+	LORA_TX_FRAME_FREE = 0,		/*!< Available to the packetizer */
+	LORA_TX_FRAME_FILLING,		/*!< Owned by the packetizer, collecting serial bytes */
+	LORA_TX_FRAME_READY,		/*!< Complete, queued for the radio */
+	LORA_TX_FRAME_ON_AIR		/*!< Owned by the radio until TX done */
+} lora_tx_frame_state_t;
+
+/* Frame boundary reported by the USART, at a position in the serial receive stream */
+typedef struct uart_frame_boundary_t_
+{
+	uint32_t byte_count;				/*!< Serial bytes received up to and including the last byte of the frame */
+	packetizer_boundary_t boundary;
+} uart_frame_boundary_t;
 
-#define LORA_PACKET_MAX_PAYLOAD	(250U)
+/* Arrival time of the first serial byte after a pause, the bytes behind it follow back to back */
+typedef struct uart_arrival_mark_t_
+{
+	uint32_t byte_index;				/*!< Position of the byte in the serial receive stream */
+	uint32_t time_us;					/*!< Low 32 bits of the timebase when it arrived */
+} uart_arrival_mark_t;
 
-typedef struct lora_packet_t_
+typedef struct lora_tx_frame_t_
 {
-	lora_packet_header_t header;
-	uint8_t payload[LORA_PACKET_MAX_PAYLOAD];
-	uint32_t payload_length;
-} lora_packet_t;
+	lora_packet_handle_t handle;	/*!< Packet from the pool, valid unless LORA_TX_FRAME_FREE */
+	lora_tx_frame_state_t state;
+} lora_tx_frame_t;
 
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#define LORA_PACKETIZER_POLICY		PACKETIZER_POLICY_INTER_CHAR_TIMEOUT	/*!< Policy used to flush serial bytes into packets */
+#define LORA_PACKETIZER_DELIMITER	('\n')									/*!< Delimiter for PACKETIZER_POLICY_DELIMITER */
+#define LORA_PACKETIZER_TIMEOUT_MS	(200U)									/*!< Fixed timeout since the last serial byte */
+#define LORA_PACKETIZER_MAX_HOLD_MS	(1000U)									/*!< Longest any policy holds the first byte of a packet */
+#define LORA_PACKETIZER_POLICY_CYCLE_ENABLED	(0)							/*!< Move to the next policy after each statistics report to compare them on live traffic */
 
 /* USER CODE END PD */
 
@@ -67,6 +100,19 @@ typedef struct lora_packet_t_
 #define MAIN_STRING_BUFFER_MAXLEN	(1024)
 
 #define UART_FIFO_BUFFER_SIZE	(2048U)
+
+#define UART_RECEIVE_FIFO_MAX_SIZE			(16384U)	/*!< Receive fifo buffer, the part used is sized from the baud rate */
+#define UART_RECEIVE_FIFO_RTS_HEADROOM		(512U)		/*!< Room left above the high watermark for the bytes the host sends before it reacts to RTS */
+#define UART_FRAME_BOUNDARY_QUEUE_SIZE		(8U)		/*!< Frame boundaries waiting for the main loop to reach them */
+#define UART_ARRIVAL_MARK_QUEUE_SIZE		(32U)		/*!< Arrival times waiting for the main loop to reach their bytes */
+#define UART_ARRIVAL_MARK_GAP_CHARACTERS	(2U)		/*!< Pause between serial bytes, in character times, that starts a new arrival mark */
+
+#define LORA_TX_FRAME_COUNT		(3U)	/*!< One filling, one on air, one spare to absorb the turnaround */
+#define LORA_RADIO_COUNT		(LORA_DUAL_RADIO_ENABLED ? 2U : 1U)	/*!< RFM95W modules */
+
+#define MAIN_STATS_REPORT_PERIOD_MS			(10000U)	/*!< Scheduler, interrupt, power and radio statistics written to the debug output this often */
+#define MAIN_CLOCK_IDLE_MAX_BAUD			(38400U)	/*!< Fastest serial rate the idle clock services a byte interrupt for comfortably */
+#define MAIN_CLOCK_BURST_FIFO_FILL			(64U)		/*!< Serial fifo backlog that needs the burst clock */
 /* USER CODE END PM */
 
 /* Private variables ---------------------------------------------------------*/
@@ -76,7 +122,6 @@ static uint8_t g_main_string_buffer[MAIN_STRING_BUFFER_MAXLEN] = {0U}; /* Buffer
 static uint32_t g_main_string_buffer_length = 0U;
 
 static volatile uint32_t g_main_half_second_counter = 0U; /*!< Counter incremented by TIM15 callback at 2Hz */
-static volatile uint64_t g_main_millisecond_counter = 0U; /*!< Counter incremented by TIM16 callback at 1kHz */
 
 
 
@@ -84,29 +129,103 @@ static volatile uint64_t g_main_millisecond_counter = 0U; /*!< Counter increment
 static volatile fifo_uint8_state_t g_uart_transmit_fifo = {0};
 static volatile uint8_t g_uart_transmit_fifo_buffer[UART_FIFO_BUFFER_SIZE] = {0};
 static volatile uint8_t g_uart_transmit_fifo_in_process = 0;
+static volatile uint32_t g_uart_transmit_segment_length = 0; /*!< Bytes handed to the UART, released from the fifo on Tx complete */
+static uint32_t g_uart_transmit_fifo_overflow_count = 0; /*!< Received packets dropped for lack of serial transmit fifo space */
 
 /* UART Receive Variables */
 static volatile fifo_uint8_state_t g_uart_receive_fifo = {0};
-static volatile uint8_t g_uart_receive_fifo_buffer[UART_FIFO_BUFFER_SIZE] = {0};
+static volatile uint8_t g_uart_receive_fifo_buffer[UART_RECEIVE_FIFO_MAX_SIZE] = {0};
+static uint32_t g_uart_receive_fifo_high_watermark = 0; /*!< Deassert RTS at this fill */
+static uint32_t g_uart_receive_fifo_low_watermark = 0; /*!< Reassert RTS once drained to this fill */
+static volatile uint32_t g_uart_receive_byte_count = 0; /*!< Bytes written to the receive fifo, wraps */
+static uint32_t g_uart_receive_consumed_count = 0; /*!< Bytes read from the receive fifo, wraps */
+static volatile uart_frame_boundary_t g_uart_frame_boundaries[UART_FRAME_BOUNDARY_QUEUE_SIZE] = {0};
+static volatile uint32_t g_uart_frame_boundary_write_idx = 0; /*!< Written by the USART1 interrupt only */
+static volatile uint32_t g_uart_frame_boundary_read_idx = 0; /*!< Written by the main loop only */
+static volatile uint8_t g_uart_frame_match_pending = 0; /*!< Character match raised, placed once the character is in the fifo */
+static volatile uart_arrival_mark_t g_uart_arrival_marks[UART_ARRIVAL_MARK_QUEUE_SIZE] = {0};
+static volatile uint32_t g_uart_arrival_mark_write_idx = 0; /*!< Written by the USART1 interrupt only */
+static volatile uint32_t g_uart_arrival_mark_read_idx = 0; /*!< Written by the main loop only */
+static uart_arrival_mark_t g_uart_arrival_mark = {0}; /*!< Latest mark the main loop has reached */
+static volatile uint32_t g_uart_character_time_us = 0; /*!< One serial character at the current baud rate */
+static volatile uint8_t g_uart_auto_baud_pending = 0; /*!< Waiting for the first character to set the baud rate */
+static volatile uint32_t g_uart_auto_baud_detected_rate = 0; /*!< Detected baud rate not yet applied by the main loop */
 static volatile uint8_t g_uart_receive_fifo_in_process = 0;
 static volatile uint8_t g_main_serial_byte_to_receive = 0;
-static volatile uint64_t g_main_last_received_serial_byte_time_ms = 0;
+static volatile uint32_t g_main_last_received_serial_byte_time_us = 0; /*!< Low 32 bits of the timebase, a single word so the ISR write is atomic */
 
 /* Lora packet variables*/
-static lora_packet_t g_lora_packet_to_transmit = {0};
-static lora_packet_t g_lora_packet_received = {0};
-static uint64_t g_lora_packet_transmit_serial_timeout = 200; // 200ms
+static lora_tx_frame_t g_lora_tx_frames[LORA_TX_FRAME_COUNT] = {0};
+static uint32_t g_lora_tx_fill_idx = 0; /*!< Frame the packetizer fills next */
+static uint32_t g_lora_tx_send_idx = 0; /*!< Oldest frame queued for or owned by the radio */
+static lora_tx_frame_t g_lora_control_frame = {0}; /*!< Flow control packet, sent ahead of queued data */
+static uint32_t g_lora_tx_start_time_us = 0; /*!< Time the frame on air was handed to the radio */
+static uint64_t g_lora_airtime_total_us = 0; /*!< Measured time on air of all transmissions */
+static uint8_t g_lora_rate_index = 0xFF; /*!< Adaptive data rate applied to the radio, none yet */
+static uint8_t g_lora_channel_index = 0xFF; /*!< Channel applied to the radio, none yet */
+static int32_t g_lora_frequency_correction_hz = 0; /*!< Frequency correction applied to the radio */
+
+static rfm95w_state_t g_lora_radios[LORA_RADIO_COUNT] = {0};
+static uint32_t g_lora_radio_count = 1; /*!< Modules in use, fewer than LORA_RADIO_COUNT if full duplex was refused */
+static rfm95w_state_t* g_lora_tx_radio = &g_lora_radios[0]; /*!< Module packets are sent on */
+static rfm95w_state_t* g_lora_rx_radio = &g_lora_radios[0]; /*!< Module packets are received on, the second one in full duplex */
 
 static uint8_t g_lora_source_address = 0; // Set these manually for now
 static uint8_t g_lora_destination_address = 255; // Set these manually for now
 static uint8_t g_lora_broadcast_address = 255;
 
 static uint8_t g_lora_sequence_number = 0;
+
+/* Timers */
+static soft_timer_id_t g_main_packetizer_timer = SOFT_TIMER_ID_INVALID; /*!< Next time based flush of the packet being assembled */
+static soft_timer_id_t g_main_credit_request_timer = SOFT_TIMER_ID_INVALID; /*!< Ask for credit while blocked */
+static soft_timer_id_t g_main_stats_report_timer = SOFT_TIMER_ID_INVALID; /*!< Write the scheduler, interrupt and power statistics */
+static soft_timer_id_t g_main_link_timer = SOFT_TIMER_ID_INVALID; /*!< Link reports, data rate and channel proposals and fallback, transmit power timeouts */
+static soft_timer_id_t g_main_scan_timer = SOFT_TIMER_ID_INVALID; /*!< RSSI samples while dwelling on a channel to scan it */
+
+/* Power */
+static uint8_t g_main_serial_wake = 1; /*!< A host character must wake the MCU, from the settings */
+static clock_governor_level_t g_main_clock_level = CLOCK_GOVERNOR_LEVEL_BURST; /*!< Clock level the interrupt run times were measured at */
+static uint32_t g_main_bytes_delivered = 0; /*!< Payload bytes sent on air or passed to the host since the last report */
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
+static lora_packet_t* main_lora_get_fill_packet(void);
+static void main_lora_queue_packet(packetizer_flush_reason_t reason);
+static void main_lora_service_transmit(void);
+static void main_uart_start_transmit(void);
+static void main_lora_handle_receive(void);
+static void main_uart_handle_receive(void);
+static void main_uart_handle_flush(void);
+static void main_lora_handle_flow_control(void);
+static void main_lora_handle_link_control(void);
+static void main_lora_apply_rate(void);
+static void main_lora_apply_channel(void);
+static void main_lora_apply_frequency_correction(void);
+static void main_lora_start_scan_step(void);
+static void main_lora_task(void);
+static void main_packetizer_task(void);
+static void main_uart_egress_task(void);
+static void main_dbg_output_task(void);
+static void main_scheduler_init(void);
+static void main_timer_task(void);
+static void main_packetizer_timer_callback(soft_timer_id_t timer_id);
+static void main_credit_request_timer_callback(soft_timer_id_t timer_id);
+static void main_stats_report_timer_callback(soft_timer_id_t timer_id);
+static void main_link_timer_callback(soft_timer_id_t timer_id);
+static void main_scan_timer_callback(soft_timer_id_t timer_id);
+static uint64_t main_uart_get_last_byte_time_ms(void);
+static uint64_t main_uart_get_byte_time_ms(uint32_t byte_index);
+static uint64_t main_uart_extend_time_ms(uint32_t time_us);
+static uint32_t main_uart_get_receive_fifo_size(uint32_t baud_rate);
+static packetizer_flush_reason_t main_uart_check_frame_boundary(uint32_t payload_length);
+static int32_t main_uart_set_baud_rate(uint32_t baud_rate);
+static void main_uart_queue_frame_boundary(uint32_t byte_count, packetizer_boundary_t boundary);
+static void main_lora_queue_control(uint8_t packet_type, uint32_t payload_length, const void* payload);
+static uint8_t main_power_can_stop(void);
+static uint8_t main_clock_get_demand(void);
 
 /* USER CODE END PFP */
 
@@ -148,19 +267,138 @@ int main(void)
   MX_SPI1_Init();
   MX_USART1_UART_Init();
   MX_LPUART1_UART_Init();
-  MX_TIM16_Init();
+  MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
+#if LORA_DUAL_RADIO_ENABLED
+  MX_GPIO_Radio2_Init(); // Pins and SPI of the receiving radio, not in the .ioc
+  MX_SPI2_Init();
+#endif
+  isr_stats_init(); // Time the interrupt handlers from the first one
+
   HAL_GPIO_WritePin(LED_GPIO_Port, LED_Pin, 1U); // Light the LED
 
   HAL_TIM_Base_Start_IT(&htim15); // Start the timer TIM15 which will toggle the LED
-  HAL_TIM_Base_Start_IT(&htim16); // Start the timer TIM16 for ms counter
+  timebase_init(&htim2); // Start the microsecond timebase on TIM2
+  soft_timer_init(); // Start the timer service on LPTIM1 for the protocol timeouts
 
   dbg_output_init(&hlpuart1); // Initialise the debug stream using LPUART1
+  clock_governor_init(&hspi1, &htim15); // Drop to MSI 8 MHz while the traffic is light
+#if LORA_DUAL_RADIO_ENABLED
+  clock_governor_add_spi(&hspi2);
+#endif
+  power_init(clock_governor_restore, &huart1, &hlpuart1); // Sleep in STOP between events, woken by the radio, the timers or a serial start bit
+
+
+  // Apply the saved serial baud rate, or wait to detect it from the first character
+  settings_t settings;
+  settings_init();
+  settings_get(&settings);
+  g_main_serial_wake = settings.serial_wake;
+  if (settings.serial_auto_baud)
+  {
+	  usart1_enable_auto_baud();
+	  g_uart_auto_baud_pending = 1;
+  }
+  else if (usart1_set_baud_rate(settings.serial_baud_rate) != 0)
+  {
+	  usart1_set_baud_rate(SETTINGS_DEFAULT_SERIAL_BAUD_RATE);
+  }
+
+  // Full duplex splits the channel pair by comparing our address with the peer's, so it needs a single peer
+  // at another address. Towards the broadcast address both ends would pick the same direction.
+  g_lora_radio_count = LORA_RADIO_COUNT;
+  if ((g_lora_radio_count > 1U) &&
+		  ((g_lora_destination_address == g_lora_broadcast_address) || (g_lora_destination_address == g_lora_source_address)))
+  {
+	  g_lora_radio_count = 1;
+	  dbg_output_write_str("lora: full duplex needs a peer address, using one radio\r\n");
+  }
+  g_lora_rx_radio = &g_lora_radios[g_lora_radio_count - 1U];
+
+  // Initialise each RFM95W on the saved network, sniffing for packets with a long preamble if a wake-on-radio latency is saved.
+  // Before the fifos, which are sized from the time on air.
+  const rfm95w_config_t radio_configs[LORA_RADIO_COUNT] =
+  {
+	  {
+		  .spi_handle = &hspi1,
+		  .en_port = RFM95W_EN_GPIO_Port, .en_pin = RFM95W_EN_Pin,
+		  .rst_port = RFM95W_RST_GPIO_Port, .rst_pin = RFM95W_RST_Pin,
+		  .cs_port = RFM95W_CS_GPIO_Port, .cs_pin = RFM95W_CS_Pin,
+		  .g0_pin = RFM95W_G0_Pin, .g0_irqn = RFM95W_G0_EXTI_IRQn,
+		  .receive_enabled = (g_lora_radio_count == 1U),
+	  },
+#if LORA_DUAL_RADIO_ENABLED
+	  {
+		  .spi_handle = &hspi2,
+		  .en_port = RFM95W_RX_EN_GPIO_Port, .en_pin = RFM95W_RX_EN_Pin,
+		  .rst_port = RFM95W_RX_RST_GPIO_Port, .rst_pin = RFM95W_RX_RST_Pin,
+		  .cs_port = RFM95W_RX_CS_GPIO_Port, .cs_pin = RFM95W_RX_CS_Pin,
+		  .g0_pin = RFM95W_RX_G0_Pin, .g0_irqn = RFM95W_RX_G0_EXTI_IRQn,
+		  .receive_enabled = 1,
+	  },
+#endif
+  };
+  for (uint32_t idx = 0; idx < g_lora_radio_count; idx++)
+  {
+	  rfm95w_init(&g_lora_radios[idx], &radio_configs[idx]);
+	  if (rfm95w_set_network(&g_lora_radios[idx], settings.radio_sync_word, (rfm95w_iq_mode_t)settings.radio_iq_mode) != 0)
+	  {
+		  rfm95w_set_network(&g_lora_radios[idx], RFM95W_DEFAULT_SYNC_WORD, RFM95W_IQ_MODE_NORMAL);
+	  }
+  }
+  // Start the sequence numbers somewhere new each boot, so the peer does not drop the first packets
+  // after a restart as copies of those it remembers from before
+  uint32_t sequence_seed = 0;
+  if (rfm95w_get_random(g_lora_rx_radio, &sequence_seed) == 0)
+  {
+	  g_lora_sequence_number = (uint8_t)sequence_seed;
+  }
+  adr_init(g_lora_source_address, timebase_get_ms()); // Start at the safe data rate, as the peer does
+  tx_power_init(timebase_get_ms()); // Every peer at the default power until it reports
+  channel_init(g_lora_source_address, timebase_get_ms()); // Start on the home channel, as the peer does
+  afc_init(g_lora_source_address); // Untrimmed until a lower address is heard
+  main_lora_apply_rate();
+  main_lora_apply_channel();
+  for (uint32_t idx = 0; idx < g_lora_radio_count; idx++)
+  {
+	  // The module that sends needs the long preamble as much as the one that sniffs
+	  if (rfm95w_set_wake_on_radio(&g_lora_radios[idx], settings.radio_wake_latency_ms) != 0)
+	  {
+		  rfm95w_set_wake_on_radio(&g_lora_radios[idx], 0);
+	  }
+  }
 
+  // Only take packets for our address or the broadcast address off the radio
+  uint8_t lora_accepted_addresses[] = { g_lora_source_address, g_lora_broadcast_address };
+  rfm95w_set_address_filter(g_lora_rx_radio, sizeof(lora_accepted_addresses), lora_accepted_addresses);
 
-  // Initialise the UART FIFOs
+  // Initialise the UART FIFOs - the receive fifo holds the serial bytes that arrive while a packet is on air
+  uint32_t receive_fifo_size = main_uart_get_receive_fifo_size(g_uart_auto_baud_pending ? (HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_USART1) / 8U) : huart1.Init.BaudRate);
   fifo_uint8_init(&g_uart_transmit_fifo, UART_FIFO_BUFFER_SIZE, g_uart_transmit_fifo_buffer);
-  fifo_uint8_init(&g_uart_receive_fifo, UART_FIFO_BUFFER_SIZE, g_uart_receive_fifo_buffer);
+  fifo_uint8_init(&g_uart_receive_fifo, receive_fifo_size, g_uart_receive_fifo_buffer);
+  g_uart_receive_fifo_high_watermark = receive_fifo_size - UART_RECEIVE_FIFO_RTS_HEADROOM;
+  g_uart_receive_fifo_low_watermark = receive_fifo_size / 4U;
+  g_uart_character_time_us = 10000000U / huart1.Init.BaudRate;
+
+  // Initialise the packet pool used by the transmit path
+  lora_packet_pool_init();
+
+  // Initialise the duplicate cache for received packets
+  dedup_cache_init();
+
+  // Initialise the credit flow control - both ends start with an empty serial transmit fifo
+  credit_flow_init(UART_FIFO_BUFFER_SIZE - 1U, g_lora_sequence_number);
+
+  // Initialise the packetization policy for serial bytes into lora packets
+  packetizer_config_t packetizer_config = {0};
+  packetizer_config.policy = LORA_PACKETIZER_POLICY;
+  packetizer_config.delimiter = LORA_PACKETIZER_DELIMITER;
+  packetizer_config.baud_rate = huart1.Init.BaudRate;
+  packetizer_config.max_payload_length = LORA_PACKET_MAX_PAYLOAD;
+  packetizer_config.timeout_ms = LORA_PACKETIZER_TIMEOUT_MS;
+  packetizer_config.max_hold_ms = LORA_PACKETIZER_MAX_HOLD_MS;
+  packetizer_config.radio = g_lora_tx_radio;
+  packetizer_init(&packetizer_config);
 
 
   // Send Message To Debug UART
@@ -170,10 +408,6 @@ int main(void)
   //HAL_UART_Transmit(&huart1, g_main_string_buffer, g_main_string_buffer_length, 100);
 
 
-  // Initialise the RFM95W
-  rfm95w_init(&hspi1);
-
-
   // Send Test Packet
 
   //g_main_string_buffer_length = sprintf(&g_main_string_buffer[0], "HelloWorld\r\n");
@@ -181,19 +415,19 @@ int main(void)
 
 
   // start listening
-  rfm95w_listen_for_packets();
+  rfm95w_listen_for_packets(g_lora_rx_radio);
+
+  // Register the subsystem tasks run by the main loop
+  main_scheduler_init();
+
+  // Delimit frames in hardware - receiver timeout after the inter-character gap, character match on the delimiter
+  usart1_enable_frame_delimiting((PACKETIZER_INTER_CHAR_TIMEOUT_TENTHS * PACKETIZER_BITS_PER_CHARACTER) / 10U, 1U, LORA_PACKETIZER_DELIMITER);
 
   // Start the UART1 Serial listening for incoming bytes
   HAL_UART_Receive_IT(&huart1, &g_main_serial_byte_to_receive, 1);
   g_uart_receive_fifo_in_process = 1;
 
 
-  // Initialise the header in the packet for transmitting
-  g_lora_packet_to_transmit.header.source_address = g_lora_source_address;
-  g_lora_packet_to_transmit.header.destination_address = g_lora_destination_address;
-  g_lora_packet_to_transmit.header.sequence_number = g_lora_sequence_number;
-  g_lora_sequence_number++; // increment for the next packet
-
   /*
   // Send test packet
   g_lora_packet_to_transmit.payload[0] = 'H';
@@ -213,92 +447,20 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
-
-	  // 1
-	  // Check for Received packet flag
-	  if (rfm95w_is_packet_received() == 1)
-	  {
-		  // Get the received packet into the packet structure (set the payload length)
-		  uint32_t packet_received_length = 0;
-		  rfm95w_get_received_packet(sizeof(lora_packet_t), &g_lora_packet_received, &packet_received_length);
-
-		  // clear the received packet flag
-		  rfm95w_clear_is_packet_received();
-
-		  // Check it is a valid lora packet
-		  if (packet_received_length > 0)
-		  {
-			  // Set the payload length field
-			  g_lora_packet_received.payload_length = packet_received_length - sizeof(lora_packet_header_t);
-
-			  // check the received packet header - our address or broadcast address
-			  if ((g_lora_packet_received.header.destination_address == g_lora_source_address) ||
-					  (g_lora_packet_received.header.destination_address == g_lora_broadcast_address) )
-			  {
-				// If is for us then put the payload bytes into the serial transmit fifo
-				for (uint32_t idx = 0; idx < g_lora_packet_received.payload_length; idx++)
-				{
-					fifo_uint8_write_one(&g_uart_transmit_fifo, g_lora_packet_received.payload[idx]);
-				}
-				  // if serial transmit is not currently in progress then kick it off
-				if (g_uart_transmit_fifo_in_process == 0)
-				{
-					// Send the next byte
-					uint8_t next_byte = 0;
-					fifo_uint8_read_one(&g_uart_transmit_fifo, &next_byte);
-					HAL_UART_Transmit_IT(&huart1, &next_byte, 1);
-					g_uart_transmit_fifo_in_process = 1;
-				}
-			  }
-		  }
-	  }
-
-	  //2
-	  // Check for serial bytes in the receive fifo
-	  while (fifo_uint8_is_empty(&g_uart_receive_fifo) == 0)
-	  {
-		  // take each byte and add into current transmit packet payload
-		  uint8_t next_byte = 0;
-		  fifo_uint8_read_one(&g_uart_receive_fifo, &next_byte);
-
-		  g_lora_packet_to_transmit.payload[g_lora_packet_to_transmit.payload_length] = next_byte;
-		  g_lora_packet_to_transmit.payload_length++;
-
-		  // if we have reached the max payload length then transmit the packet and then clear the structures and start afresh
-		  if (g_lora_packet_to_transmit.payload_length >= LORA_PACKET_MAX_PAYLOAD)
-		  {
-			  rfm95w_transmit_packet(sizeof(lora_packet_header_t) + g_lora_packet_to_transmit.payload_length, &g_lora_packet_to_transmit);
-
-			  // Clear and start the packet again
-			  g_lora_packet_to_transmit.payload_length = 0;
-			  g_lora_packet_to_transmit.header.source_address = g_lora_source_address;
-			  g_lora_packet_to_transmit.header.destination_address = g_lora_destination_address;
-			  g_lora_packet_to_transmit.header.sequence_number = g_lora_sequence_number;
-			  g_lora_sequence_number++; // increment for the next packet
-		  }
-	  }
-
-
-	  // 3
-	  // Check for timeout since last serial byte received.
-	  if (g_main_millisecond_counter >= (g_main_last_received_serial_byte_time_ms + g_lora_packet_transmit_serial_timeout))
+	  // Run the tasks of the subsystems with work to do, highest priority first
+	  uint32_t events = events_fetch_and_clear();
+	  scheduler_run(events, (uint32_t)timebase_get_ms());
+
+	  // Run at the clock the work needs, then sleep until the next interrupt unless it has already raised
+	  // more events, in STOP if nothing is in progress
+	  clock_governor_update(main_clock_get_demand(), (uint32_t)timebase_get_ms());
+	  if (clock_governor_get_level() != g_main_clock_level)
 	  {
-		  // If we currently have a packet being assembled for transmission then transmit the packet and then clear the structures and start afresh
-		  if (g_lora_packet_to_transmit.payload_length > 0)
-		  {
-			  rfm95w_transmit_packet(sizeof(lora_packet_header_t) + g_lora_packet_to_transmit.payload_length, &g_lora_packet_to_transmit);
-
-			  // Clear and start the packet again
-			  g_lora_packet_to_transmit.payload_length = 0;
-			  g_lora_packet_to_transmit.header.source_address = g_lora_source_address;
-			  g_lora_packet_to_transmit.header.destination_address = g_lora_destination_address;
-			  g_lora_packet_to_transmit.header.sequence_number = g_lora_sequence_number;
-			  g_lora_sequence_number++; // increment for the next packet
-		  }
+		  // Interrupt run times measured at the other clock no longer apply
+		  g_main_clock_level = clock_governor_get_level();
+		  isr_stats_reset_run_times();
 	  }
-
-
-
+	  power_sleep(main_power_can_stop(), g_main_serial_wake);
 
     /* USER CODE END WHILE */
 
@@ -326,8 +488,10 @@ void SystemClock_Config(void)
   /** Initializes the RCC Oscillators according to the specified parameters
   * in the RCC_OscInitTypeDef structure.
   */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSE;
   RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+  RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+  RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
   RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
   RCC_OscInitStruct.PLL.PLLM = 1;
@@ -357,94 +521,1435 @@ void SystemClock_Config(void)
 
 /* USER CODE BEGIN 4 */
 
+/**
+  * @brief  Pass a received packet on to the serial port or the flow control.
+  * @retval None
+  */
+static void main_lora_handle_receive(void)
+{
+	// Check for Received packet flag
+	if (rfm95w_is_packet_received(g_lora_rx_radio) == 1)
+	{
+		// The radio has already filtered on our address or broadcast address using the header
+		uint32_t packet_received_length = rfm95w_get_received_length(g_lora_rx_radio);
+		lora_packet_header_t received_header = {0};
+
+		// Check it is a valid lora packet and not a retransmitted copy of one already passed on
+		if ((packet_received_length >= sizeof(lora_packet_header_t)) &&
+				(rfm95w_read_received_header(g_lora_rx_radio, sizeof(lora_packet_header_t), (uint8_t*)&received_header) == 0) &&
+				(dedup_cache_check(received_header.source_address, received_header.sequence_number, timebase_get_ms()) == 0))
+		{
+			uint32_t payload_length = packet_received_length - sizeof(lora_packet_header_t);
+
+			// Every frame from the peer measures the link for the adaptive data rate, its transmit power and our frequency correction
+			rfm95w_packet_quality_t quality;
+			if (rfm95w_get_received_quality(g_lora_rx_radio, &quality) == 0)
+			{
+				adr_on_frame_received(received_header.source_address, quality.snr_quarter_db, timebase_get_ms());
+				tx_power_on_frame_received(received_header.source_address, adr_get_margin(quality.snr_quarter_db), quality.rssi_dbm, timebase_get_ms());
+				afc_on_frame_received(received_header.source_address, quality.frequency_error_hz, timebase_get_ms());
+			}
+			channel_on_frame_received(timebase_get_ms());
+
+			// Only a packet passed on is recorded as seen, so the retransmission of one dropped here gets through
+			uint8_t is_delivered = 1;
+
+			switch (received_header.ctrl_and_retry_count & LORA_PACKET_TYPE_MASK)
+			{
+			case LORA_PACKET_TYPE_DATA:
+			{
+				// Read the payload straight from the radio into the serial transmit fifo
+				volatile uint8_t* first_segment;
+				volatile uint8_t* second_segment;
+				uint32_t first_length;
+				uint32_t second_length;
+				if (fifo_uint8_reserve_write(&g_uart_transmit_fifo, payload_length, &first_segment, &first_length, &second_segment, &second_length) == 0)
+				{
+					rfm95w_read_received_payload(g_lora_rx_radio, first_length, first_segment);
+					rfm95w_read_received_payload(g_lora_rx_radio, second_length, second_segment);
+					fifo_uint8_commit_write(&g_uart_transmit_fifo, payload_length);
+					g_main_bytes_delivered += payload_length;
+					credit_flow_on_data_received(received_header.sequence_number, payload_length);
+				}
+				else
+				{
+					// Serial transmit fifo full - drop the whole packet rather than part of it
+					g_uart_transmit_fifo_overflow_count++;
+					is_delivered = 0;
+				}
+				break;
+			}
+
+			case LORA_PACKET_TYPE_CREDIT:
+			case LORA_PACKET_TYPE_CREDIT_REQUEST:
+			{
+				lora_packet_credit_t credit = {0};
+				if ((payload_length >= sizeof(lora_packet_credit_t)) &&
+						(rfm95w_read_received_payload(g_lora_rx_radio, sizeof(lora_packet_credit_t), (uint8_t*)&credit) == 0))
+				{
+					if ((received_header.ctrl_and_retry_count & LORA_PACKET_TYPE_MASK) == LORA_PACKET_TYPE_CREDIT)
+					{
+						uint32_t free_bytes = (uint32_t)credit.free_bytes_lsb | ((uint32_t)credit.free_bytes_msb << 8);
+						credit_flow_on_credit(credit.sequence_number, free_bytes);
+					}
+					else
+					{
+						credit_flow_on_request(credit.sequence_number);
+					}
+				}
+				break;
+			}
+
+			case LORA_PACKET_TYPE_LINK_REPORT:
+			{
+				lora_packet_link_report_t link_report = {0};
+				if ((payload_length >= sizeof(lora_packet_link_report_t)) &&
+						(rfm95w_read_received_payload(g_lora_rx_radio, sizeof(lora_packet_link_report_t), (uint8_t*)&link_report) == 0))
+				{
+					adr_on_report(received_header.source_address, link_report.snr_ref_quarter_db);
+
+					// Our power towards the sender follows its measurement of our frames, once the rate is at its fastest
+					if (link_report.peer_address == g_lora_source_address)
+					{
+						adr_rate_t rate;
+						int16_t peer_rssi_dbm = (int16_t)((uint16_t)link_report.peer_rssi_dbm_lsb | ((uint16_t)link_report.peer_rssi_dbm_msb << 8));
+						tx_power_on_report(received_header.source_address, link_report.peer_margin_quarter_db, peer_rssi_dbm,
+								(adr_get_rate(&rate) == (ADR_RATE_COUNT - 1U)), timebase_get_ms());
+					}
+				}
+				break;
+			}
+
+			case LORA_PACKET_TYPE_ADR_SWITCH:
+			case LORA_PACKET_TYPE_ADR_ACK:
+			{
+				lora_packet_adr_switch_t adr_switch = {0};
+				if ((payload_length >= sizeof(lora_packet_adr_switch_t)) &&
+						(rfm95w_read_received_payload(g_lora_rx_radio, sizeof(lora_packet_adr_switch_t), (uint8_t*)&adr_switch) == 0))
+				{
+					if ((received_header.ctrl_and_retry_count & LORA_PACKET_TYPE_MASK) == LORA_PACKET_TYPE_ADR_SWITCH)
+					{
+						adr_on_switch(received_header.source_address, adr_switch.rate_index, adr_switch.switch_id);
+					}
+					else
+					{
+						// Switches now, the radio follows before the next transmission
+						adr_on_ack(adr_switch.rate_index, adr_switch.switch_id, timebase_get_ms());
+					}
+				}
+				break;
+			}
+
+			case LORA_PACKET_TYPE_CHANNEL_SWITCH:
+			case LORA_PACKET_TYPE_CHANNEL_ACK:
+			{
+				lora_packet_channel_switch_t channel_switch = {0};
+				if ((payload_length >= sizeof(lora_packet_channel_switch_t)) &&
+						(rfm95w_read_received_payload(g_lora_rx_radio, sizeof(lora_packet_channel_switch_t), (uint8_t*)&channel_switch) == 0))
+				{
+					if ((received_header.ctrl_and_retry_count & LORA_PACKET_TYPE_MASK) == LORA_PACKET_TYPE_CHANNEL_SWITCH)
+					{
+						channel_on_switch(received_header.source_address, channel_switch.channel_index, channel_switch.switch_id);
+					}
+					else
+					{
+						// Switches now, the radio retunes once nothing is on air
+						channel_on_ack(channel_switch.channel_index, channel_switch.switch_id, timebase_get_ms());
+					}
+				}
+				break;
+			}
+
+			default:
+				// Unknown packet type - ignore
+				break;
+			}
+
+			if (is_delivered)
+			{
+				dedup_cache_record(received_header.source_address, received_header.sequence_number, timebase_get_ms());
+			}
+		}
+
+		// clear the received packet flag
+		rfm95w_clear_is_packet_received(g_lora_rx_radio);
+	}
+}
 
 /**
-  * @brief  Period elapsed callback in non-blocking mode
-  * @param  htim TIM handle
+  * @brief  Move serial bytes from the receive fifo into the packet being assembled.
+  *         Bytes stay in the fifo while every transmit frame is queued or on air.
   * @retval None
   */
-void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+static void main_uart_handle_receive(void)
 {
-	if (htim->Instance == TIM15)
+	// Lock in the baud rate detected from the first character until the next reset
+	if (g_uart_auto_baud_detected_rate != 0)
 	{
-		g_main_half_second_counter++; // Increment the 2Hz counter
-		HAL_GPIO_TogglePin(LED_GPIO_Port, LED_Pin);
+		main_uart_set_baud_rate(g_uart_auto_baud_detected_rate);
+		g_uart_auto_baud_detected_rate = 0;
 	}
 
-	if (htim->Instance == TIM16)
+	lora_packet_t* fill_packet = main_lora_get_fill_packet();
+	while ((fill_packet != 0) && (fifo_uint8_is_empty(&g_uart_receive_fifo) == 0))
 	{
-		g_main_millisecond_counter++; // Increment the counter
+		// take each byte and add into current transmit packet payload
+		uint8_t next_byte = 0;
+		fifo_uint8_read_one(&g_uart_receive_fifo, &next_byte);
+		uint64_t byte_time_ms = main_uart_get_byte_time_ms(g_uart_receive_consumed_count);
+		g_uart_receive_consumed_count++;
+
+		fill_packet->payload[fill_packet->payload_length] = next_byte;
+		fill_packet->payload_length++;
+
+		// Ask the packetization policy if this byte completes the packet (full, delimiter or hardware frame boundary)
+		packetizer_flush_reason_t reason = packetizer_on_byte(next_byte, fill_packet->payload_length, byte_time_ms);
+		if (reason == PACKETIZER_FLUSH_NONE)
+		{
+			reason = main_uart_check_frame_boundary(fill_packet->payload_length);
+		}
+		if (reason != PACKETIZER_FLUSH_NONE)
+		{
+			main_lora_queue_packet(reason);
+			main_lora_service_transmit();
+			fill_packet = main_lora_get_fill_packet();
+		}
+	}
+
+	// Let the host send again once the receive fifo has drained below the low watermark
+	if (fifo_uint8_get_count(&g_uart_receive_fifo) <= g_uart_receive_fifo_low_watermark)
+	{
+		usart1_set_rts(1);
 	}
 }
 
 /**
-  * @brief  EXTI line detection callback.
-  * @param  GPIO_Pin Specifies the port pin connected to corresponding EXTI line.
+  * @brief  Flush the packet being assembled on a frame boundary or time based condition.
   * @retval None
   */
-void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+static void main_uart_handle_flush(void)
 {
-	if (GPIO_Pin == RFM95W_G0_GPIO_PIN)
+	lora_packet_t* fill_packet = main_lora_get_fill_packet();
+
+	// Check for a frame boundary reported after the last byte, then the time based flush conditions
+	// of the packetization policy. The radio counts as idle when nothing is on air or queued for it.
+	if (fill_packet != 0)
+	{
+		uint8_t radio_idle = (g_lora_tx_frames[g_lora_tx_send_idx].state == LORA_TX_FRAME_FILLING) ? 1U : 0U;
+		packetizer_flush_reason_t reason = main_uart_check_frame_boundary(fill_packet->payload_length);
+		if (reason == PACKETIZER_FLUSH_NONE)
+		{
+			reason = packetizer_poll(fill_packet->payload_length, radio_idle, main_uart_get_last_byte_time_ms(), timebase_get_ms());
+		}
+		if (reason != PACKETIZER_FLUSH_NONE)
+		{
+			main_lora_queue_packet(reason);
+			main_lora_service_transmit();
+			fill_packet = main_lora_get_fill_packet();
+		}
+	}
+
+	// Wake again when the time based flush of what is left is due
+	uint64_t poll_time_ms = 0;
+	if (fill_packet != 0)
+	{
+		poll_time_ms = packetizer_get_poll_time_ms(fill_packet->payload_length, main_uart_get_last_byte_time_ms());
+	}
+	if (poll_time_ms != 0)
 	{
-		// Interrupt from RFM95W
-		rfm95w_process_interrupt();
+		uint64_t now_ms = timebase_get_ms();
+		uint32_t delay_ms = (poll_time_ms > now_ms) ? (uint32_t)(poll_time_ms - now_ms) : 0U;
+		soft_timer_start(g_main_packetizer_timer, delay_ms * 1000U, 0);
+	}
+	else
+	{
+		soft_timer_stop(g_main_packetizer_timer);
 	}
 }
 
 /**
-  * @brief Tx Transfer completed callback.
-  * @param huart UART handle.
+  * @brief  Queue a credit advertisement or request when one is due.
   * @retval None
   */
-void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+static void main_lora_handle_flow_control(void)
 {
-	// Debug Serial
-	if (huart->Instance == LPUART1)
+	// Advertise serial transmit fifo space to the sender, or ask the receiver for credit when blocked.
+	if (g_lora_control_frame.state == LORA_TX_FRAME_FREE)
 	{
-		dbg_output_process_on_interrupt();
+		lora_packet_credit_t credit = {0};
+		uint32_t free_bytes = fifo_uint8_get_free(&g_uart_transmit_fifo);
+		if (credit_flow_get_credit(free_bytes, &credit.sequence_number) == 1)
+		{
+			credit.free_bytes_lsb = (uint8_t)(free_bytes & 0xFFU);
+			credit.free_bytes_msb = (uint8_t)((free_bytes >> 8) & 0xFFU);
+			main_lora_queue_control(LORA_PACKET_TYPE_CREDIT, sizeof(credit), &credit);
+		}
+		else if (credit_flow_get_request(timebase_get_ms(), &credit.sequence_number) == 1)
+		{
+			main_lora_queue_control(LORA_PACKET_TYPE_CREDIT_REQUEST, sizeof(credit), &credit);
+		}
 	}
+}
 
-	// Main Serial
-	if (huart->Instance == USART1)
+/**
+  * @brief  Queue a data rate or channel acknowledgement, proposal or link report when one is due.
+  *         Flow control goes first, these wait for the control frame to be free. A link report
+  *         carries both the data rate and the transmit power measurements, whichever made it due,
+  *         and is also sent straight after a channel change so each end hears the other on it.
+  * @retval None
+  */
+static void main_lora_handle_link_control(void)
+{
+	if (g_lora_control_frame.state == LORA_TX_FRAME_FREE)
 	{
-		// Check transmit fifo to continue transmissions
-		if (fifo_uint8_is_empty(&g_uart_transmit_fifo) == 1)
+		lora_packet_adr_switch_t adr_switch = {0};
+		lora_packet_channel_switch_t channel_switch = {0};
+		lora_packet_link_report_t link_report = {0};
+		int32_t snr_ref_quarter_db = 0;
+		uint8_t peer_address = 0;
+		int32_t peer_margin_quarter_db = 0;
+		int32_t peer_rssi_dbm = 0;
+		uint64_t now_ms = timebase_get_ms();
+		if (adr_get_ack(&adr_switch.rate_index, &adr_switch.switch_id) == 1)
+		{
+			main_lora_queue_control(LORA_PACKET_TYPE_ADR_ACK, sizeof(adr_switch), &adr_switch);
+		}
+		else if (channel_get_ack(&channel_switch.channel_index, &channel_switch.switch_id) == 1)
+		{
+			main_lora_queue_control(LORA_PACKET_TYPE_CHANNEL_ACK, sizeof(channel_switch), &channel_switch);
+		}
+		else if (adr_get_switch(now_ms, &adr_switch.rate_index, &adr_switch.switch_id) == 1)
+		{
+			main_lora_queue_control(LORA_PACKET_TYPE_ADR_SWITCH, sizeof(adr_switch), &adr_switch);
+		}
+		else if (channel_get_switch(now_ms, &channel_switch.channel_index, &channel_switch.switch_id) == 1)
 		{
-			// Transmission complete as fifo is empty
-			g_uart_transmit_fifo_in_process = 0;
+			main_lora_queue_control(LORA_PACKET_TYPE_CHANNEL_SWITCH, sizeof(channel_switch), &channel_switch);
 		}
 		else
 		{
-			// Send the next byte
-			uint8_t next_byte = 0;
-			fifo_uint8_read_one(&g_uart_transmit_fifo, &next_byte);
-			HAL_UART_Transmit_IT(&huart1, &next_byte, 1);
-			g_uart_transmit_fifo_in_process = 1;
+			uint8_t adr_report_due = (uint8_t)adr_get_report(now_ms, &snr_ref_quarter_db);
+			uint8_t channel_report_due = (uint8_t)channel_get_report();
+			uint8_t power_report_due = (uint8_t)tx_power_get_report((adr_report_due || channel_report_due), now_ms,
+					&peer_address, &peer_margin_quarter_db, &peer_rssi_dbm);
+			if ((adr_report_due == 0) && (channel_report_due == 0) && (power_report_due == 0))
+			{
+				return;
+			}
+
+			if (adr_report_due == 0)
+			{
+				snr_ref_quarter_db = ADR_REPORT_SNR_UNKNOWN;
+			}
+
+			if (power_report_due == 0)
+			{
+				peer_margin_quarter_db = TX_POWER_REPORT_MARGIN_UNKNOWN;
+				peer_rssi_dbm = TX_POWER_REPORT_RSSI_UNKNOWN;
+			}
+			else if (peer_margin_quarter_db <= TX_POWER_REPORT_MARGIN_UNKNOWN)
+			{
+				peer_margin_quarter_db = TX_POWER_REPORT_MARGIN_UNKNOWN + 1;
+			}
+
+			link_report.snr_ref_quarter_db = (int8_t)((snr_ref_quarter_db < INT8_MIN) ? INT8_MIN : ((snr_ref_quarter_db > INT8_MAX) ? INT8_MAX : snr_ref_quarter_db));
+			link_report.peer_address = peer_address;
+			link_report.peer_margin_quarter_db = (int8_t)((peer_margin_quarter_db > INT8_MAX) ? INT8_MAX : peer_margin_quarter_db);
+			link_report.peer_rssi_dbm_lsb = (uint8_t)((uint16_t)peer_rssi_dbm & 0xFFU);
+			link_report.peer_rssi_dbm_msb = (uint8_t)(((uint16_t)peer_rssi_dbm >> 8) & 0xFFU);
+			main_lora_queue_control(LORA_PACKET_TYPE_LINK_REPORT, sizeof(link_report), &link_report);
 		}
 	}
 }
 
 /**
-  * @brief  Rx Transfer completed callback.
-  * @param  huart UART handle.
+  * @brief  Put the radios on the rate the adaptive data rate controller has agreed with the peer.
+  *         A radio refuses while transmitting, so this is tried again before each transmission.
   * @retval None
   */
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+static void main_lora_apply_rate(void)
 {
-	if (huart->Instance == USART1)
+	adr_rate_t rate;
+	uint8_t rate_index = adr_get_rate(&rate);
+
+	if (rate_index != g_lora_rate_index)
 	{
-		// just received data into g_main_serial_byte_to_receive
-		// put into fifo so it can be processed by the main loop to construc a lora packet to transmit.
-		fifo_uint8_write_one(&g_uart_receive_fifo, g_main_serial_byte_to_receive);
+		uint8_t applied = 1;
+		for (uint32_t idx = 0; idx < g_lora_radio_count; idx++)
+		{
+			if (rfm95w_set_modem_config(&g_lora_radios[idx], rate.spreading_factor, rate.bandwidth_hz, rate.coding_rate) != 0)
+			{
+				applied = 0;
+			}
+		}
 
-		// last byte received at:
-		g_main_last_received_serial_byte_time_ms = g_main_millisecond_counter;
+		if (applied)
+		{
+			g_lora_rate_index = rate_index;
+		}
+	}
+}
 
+/**
+  * @brief  Put the radios on the channel agreed with the peer. With two radios the link runs full duplex
+  *         on the channel and its pair, the channel of the plan furthest from it: of our address and the peer's,
+  *         the lower sends on the channel and the higher on the pair, so neither receiver sits next to its own
+  *         transmitter.
+  *         A radio refuses while transmitting or scanning, so this is tried again before each transmission.
+  * @retval None
+  */
+static void main_lora_apply_channel(void)
+{
+	uint32_t frequency_hz = 0;
+	uint8_t channel_index = channel_get_current(&frequency_hz);
 
-		// Start another receive
-		HAL_UART_Receive_IT(&huart1, &g_main_serial_byte_to_receive, 1);
-		g_uart_receive_fifo_in_process = 1;
+	uint32_t tx_frequency_hz = frequency_hz;
+	uint32_t rx_frequency_hz = frequency_hz;
+	if (g_lora_tx_radio != g_lora_rx_radio)
+	{
+		uint8_t pair_index = channel_index;
+		uint32_t pair_frequency_hz = frequency_hz;
+		channel_get_pair(channel_index, &pair_index);
+		channel_get_frequency(pair_index, &pair_frequency_hz);
+		if (g_lora_source_address < g_lora_destination_address)
+		{
+			rx_frequency_hz = pair_frequency_hz;
+		}
+		else
+		{
+			tx_frequency_hz = pair_frequency_hz;
+		}
+	}
+
+	if ((channel_index != g_lora_channel_index) &&
+			(rfm95w_set_frequency(g_lora_tx_radio, tx_frequency_hz) == 0) &&
+			(rfm95w_set_frequency(g_lora_rx_radio, rx_frequency_hz) == 0))
+	{
+		g_lora_channel_index = channel_index;
+	}
+}
+
+/**
+  * @brief  Trim the radios to the carrier of the frequency reference peer.
+  *         A radio refuses while transmitting or scanning, so this is tried again before each transmission.
+  * @retval None
+  */
+static void main_lora_apply_frequency_correction(void)
+{
+	uint8_t reference_address = 0;
+	int32_t correction_hz = afc_get_correction(&reference_address);
+
+	if ((correction_hz != g_lora_frequency_correction_hz) &&
+			(rfm95w_set_frequency_correction(g_lora_tx_radio, correction_hz) == 0) &&
+			(rfm95w_set_frequency_correction(g_lora_rx_radio, correction_hz) == 0))
+	{
+		g_lora_frequency_correction_hz = correction_hz;
+	}
+}
+
+/**
+  * @brief  Start the next dwell of a channel scan, only while the link is idle: nothing on air,
+  *         nothing waiting to be sent and no received packet waiting to be collected.
+  * @retval None
+  */
+static void main_lora_start_scan_step(void)
+{
+	uint32_t frequency_hz = 0;
+
+	if ((soft_timer_is_running(g_main_scan_timer) == 0) &&
+			(rfm95w_is_transmitting(g_lora_tx_radio) == 0) && (rfm95w_is_packet_received(g_lora_rx_radio) == 0) &&
+			(g_lora_control_frame.state == LORA_TX_FRAME_FREE) &&
+			(g_lora_tx_frames[g_lora_tx_send_idx].state == LORA_TX_FRAME_FREE) &&
+			(channel_get_scan_step(timebase_get_ms(), &frequency_hz) == 1) &&
+			(rfm95w_start_noise_sample(g_lora_rx_radio, frequency_hz) == 0))
+	{
+		soft_timer_start(g_main_scan_timer, CHANNEL_SAMPLE_PERIOD_MS * 1000U, CHANNEL_SAMPLE_PERIOD_MS * 1000U);
+	}
+}
+
+/**
+  * @brief  Radio task - received packets, flow control and the next transmission.
+  * @retval None
+  */
+static void main_lora_task(void)
+{
+	main_lora_handle_receive();
+	main_lora_handle_flow_control();
+	main_lora_handle_link_control();
+
+	// Hand the next queued frame to the radio once the previous one is done.
+	main_lora_service_transmit();
+}
+
+/**
+  * @brief  Packetizer task - serial bytes into packets and the flush conditions.
+  * @retval None
+  */
+static void main_packetizer_task(void)
+{
+	main_uart_handle_receive();
+	main_uart_handle_flush();
+}
+
+/**
+  * @brief  UART egress task - start sending the serial transmit fifo if it is idle.
+  *         The Tx complete interrupt carries on from there until the fifo is empty.
+  * @retval None
+  */
+static void main_uart_egress_task(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if ((g_uart_transmit_fifo_in_process == 0) && (fifo_uint8_is_empty(&g_uart_transmit_fifo) == 0))
+	{
+		main_uart_start_transmit();
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Debug output task - send anything the other tasks have written.
+  * @retval None
+  */
+static void main_dbg_output_task(void)
+{
+	dbg_output_process();
+}
+
+/**
+  * @brief  Timer task - call the callbacks of the expired software timers.
+  * @retval None
+  */
+static void main_timer_task(void)
+{
+	soft_timer_process();
+}
+
+/**
+  * @brief  Time based flush of the packet being assembled is due.
+  * @param  timer_id the timer
+  * @retval None
+  */
+static void main_packetizer_timer_callback(soft_timer_id_t timer_id)
+{
+	(void)timer_id;
+
+	main_uart_handle_flush();
+}
+
+/**
+  * @brief  Blocked for credit for the request timeout.
+  * @param  timer_id the timer
+  * @retval None
+  */
+static void main_credit_request_timer_callback(soft_timer_id_t timer_id)
+{
+	(void)timer_id;
+
+	main_lora_handle_flow_control();
+	main_lora_service_transmit();
+}
+
+/**
+  * @brief  Write the scheduler, interrupt, power and radio statistics to the debug output.
+  *         The power statistics are reset each time, so each report covers the traffic since the last.
+  * @param  timer_id the timer
+  * @retval None
+  */
+static void main_stats_report_timer_callback(soft_timer_id_t timer_id)
+{
+	(void)timer_id;
+
+	// The longest run is the worst delay any task has added to the others
+	scheduler_stats_t stats;
+	scheduler_get_stats(&stats);
+	if (stats.longest_run_task_id != SCHEDULER_TASK_ID_NONE)
+	{
+		g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "sched: longest run %s %luus\r\n",
+				scheduler_get_task_name(stats.longest_run_task_id), (unsigned long)stats.longest_run_us);
+		dbg_output_write_str((char*)&g_main_string_buffer[0]);
+	}
+
+	// Worst case latency of each interrupt at the current priorities, and as it was with all at one priority
+	for (uint32_t isr_id = 0; isr_id < ISR_STATS_COUNT; isr_id++)
+	{
+		if ((isr_id == ISR_STATS_EXTI1) && (g_lora_radio_count == 1U))
+		{
+			// No second radio
+			continue;
+		}
+
+		isr_stats_t isr_stats;
+		isr_stats_get((isr_stats_id_t)isr_id, &isr_stats);
+		g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "isr: %s prio %u run %luus latency %luus (flat %luus)\r\n",
+				isr_stats_get_name((isr_stats_id_t)isr_id), (unsigned int)isr_stats.priority, (unsigned long)isr_stats.run_time_max_us,
+				(unsigned long)isr_stats.latency_bound_us, (unsigned long)isr_stats.latency_bound_flat_us);
+		dbg_output_write_str((char*)&g_main_string_buffer[0]);
+	}
+
+	// Time in each power mode, the estimated MCU current and the time taken to wake from STOP
+	power_stats_t power_stats;
+	power_get_stats(&power_stats);
+	uint32_t stop_entries = power_stats.entries[POWER_MODE_STOP1] + power_stats.entries[POWER_MODE_STOP2];
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "power: run %lums sleep %lums stop1 %lums stop2 %lums est %luuA wake %luus max %luus\r\n",
+			(unsigned long)(power_stats.residency_us[POWER_MODE_RUN] / 1000U), (unsigned long)(power_stats.residency_us[POWER_MODE_SLEEP] / 1000U),
+			(unsigned long)(power_stats.residency_us[POWER_MODE_STOP1] / 1000U), (unsigned long)(power_stats.residency_us[POWER_MODE_STOP2] / 1000U),
+			(unsigned long)power_stats.average_current_ua,
+			(unsigned long)((stop_entries != 0) ? (power_stats.wake_latency_total_us / stop_entries) : 0U),
+			(unsigned long)power_stats.wake_latency_max_us);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Time at each clock level, the cost of switching and the MCU energy per payload byte delivered
+	clock_governor_stats_t clock_stats;
+	clock_governor_get_stats(&clock_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "clock: idle %lums burst %lums up %lu max %luus down %lu max %luus energy %luuJ %lu bytes %lunJ/byte\r\n",
+			(unsigned long)(clock_stats.residency_us[CLOCK_GOVERNOR_LEVEL_IDLE] / 1000U), (unsigned long)(clock_stats.residency_us[CLOCK_GOVERNOR_LEVEL_BURST] / 1000U),
+			(unsigned long)clock_stats.switches[CLOCK_GOVERNOR_LEVEL_BURST], (unsigned long)clock_stats.switch_time_max_us[CLOCK_GOVERNOR_LEVEL_BURST],
+			(unsigned long)clock_stats.switches[CLOCK_GOVERNOR_LEVEL_IDLE], (unsigned long)clock_stats.switch_time_max_us[CLOCK_GOVERNOR_LEVEL_IDLE],
+			(unsigned long)power_stats.energy_uj, (unsigned long)g_main_bytes_delivered,
+			(unsigned long)((g_main_bytes_delivered != 0) ? (((uint64_t)power_stats.energy_uj * 1000U) / g_main_bytes_delivered) : 0U));
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Wake-on-radio detections, and those that found no packet
+	rfm95w_sniff_stats_t sniff_stats;
+	rfm95w_get_sniff_stats(g_lora_rx_radio, &sniff_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "radio: sniff %lu detected %lu false %lu\r\n",
+			(unsigned long)sniff_stats.cad_count, (unsigned long)sniff_stats.cad_detected, (unsigned long)sniff_stats.false_wakes);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Data rate changes and the airtime saved against running everything at the safe rate
+	adr_stats_t adr_stats;
+	adr_rate_t adr_rate;
+	adr_get_stats(&adr_stats);
+	adr_get_rate(&adr_rate);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "adr: sf%u bw%lu up %lu down %lu fallback %lu failed %lu gain %lu%%\r\n",
+			(unsigned int)adr_rate.spreading_factor, (unsigned long)adr_rate.bandwidth_hz,
+			(unsigned long)adr_stats.switches_up, (unsigned long)adr_stats.switches_down,
+			(unsigned long)adr_stats.fallbacks, (unsigned long)adr_stats.proposals_failed,
+			(unsigned long)((adr_stats.airtime_us != 0) ? ((adr_stats.safe_airtime_us * 100U) / adr_stats.airtime_us) : 100U));
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Link channel, its noise floor from the last scan and the channel changes
+	channel_stats_t channel_stats;
+	uint32_t channel_frequency_hz = 0;
+	int32_t noise_floor_dbm = 0;
+	channel_get_stats(&channel_stats);
+	channel_get_noise_floor(channel_get_current(&channel_frequency_hz), &noise_floor_dbm);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "channel: %lukHz floor %lddBm scans %lu switches %lu fallback %lu failed %lu\r\n",
+			(unsigned long)(channel_frequency_hz / 1000U), (long)noise_floor_dbm,
+			(unsigned long)channel_stats.scans, (unsigned long)channel_stats.switches,
+			(unsigned long)channel_stats.fallbacks, (unsigned long)channel_stats.proposals_failed);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Transmit power changes and the power the next broadcast would go at
+	tx_power_stats_t tx_power_stats;
+	tx_power_get_stats(&tx_power_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "txpower: %ddBm raise %lu lower %lu timeout %lu\r\n",
+			(int)tx_power_get_dbm(g_lora_broadcast_address),
+			(unsigned long)tx_power_stats.raises, (unsigned long)tx_power_stats.lowers, (unsigned long)tx_power_stats.timeouts);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Frequency correction, the peer it follows and the largest error measured
+	afc_stats_t afc_stats;
+	uint8_t afc_reference_address = 0;
+	int32_t afc_correction_hz = afc_get_correction(&afc_reference_address);
+	afc_get_stats(&afc_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "afc: %ldHz ref %u frames %lu retunes %lu max %ldHz\r\n",
+			(long)afc_correction_hz, (unsigned int)afc_reference_address,
+			(unsigned long)afc_stats.frames, (unsigned long)afc_stats.retunes, (long)afc_stats.max_error_hz);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Packet pool use and the allocations refused because it was exhausted
+	lora_packet_pool_stats_t pool_stats;
+	lora_packet_pool_get_stats(&pool_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "pool: in use %lu high %lu allocs %lu exhausted %lu\r\n",
+			(unsigned long)pool_stats.in_use, (unsigned long)pool_stats.high_water,
+			(unsigned long)pool_stats.allocations, (unsigned long)pool_stats.allocation_failures);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Received packets dropped for lack of serial transmit fifo space, and the USART1 receive errors
+	usart_error_stats_t usart_error_stats;
+	usart_get_error_stats(&huart1, &usart_error_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "serial: dropped %lu overrun %lu framing %lu noise %lu parity %lu\r\n",
+			(unsigned long)g_uart_transmit_fifo_overflow_count,
+			(unsigned long)usart_error_stats.overrun, (unsigned long)usart_error_stats.framing,
+			(unsigned long)usart_error_stats.noise, (unsigned long)usart_error_stats.parity);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Frames rejected by the destination address filter before their payload was read
+	rfm95w_filter_stats_t filter_stats;
+	rfm95w_get_filter_stats(g_lora_rx_radio, &filter_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "filter: accepted %lu rejected %lu bytes %lu\r\n",
+			(unsigned long)filter_stats.frames_accepted, (unsigned long)filter_stats.frames_filtered, (unsigned long)filter_stats.bytes_filtered);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Received copies dropped, and sources taken as restarted or forgotten
+	dedup_cache_stats_t dedup_stats;
+	dedup_cache_get_stats(&dedup_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "dedup: checked %lu dropped %lu resyncs %lu evictions %lu\r\n",
+			(unsigned long)dedup_stats.packets_checked, (unsigned long)dedup_stats.duplicates,
+			(unsigned long)dedup_stats.resyncs, (unsigned long)dedup_stats.peer_evictions);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Credit advertisements each way, and the data packets held back waiting for credit
+	credit_flow_stats_t credit_stats;
+	credit_flow_get_stats(&credit_stats);
+	g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "credit: sent %lu received %lu requests %lu stalls %lu\r\n",
+			(unsigned long)credit_stats.credits_sent, (unsigned long)credit_stats.credits_received,
+			(unsigned long)credit_stats.requests_sent, (unsigned long)credit_stats.stalls);
+	dbg_output_write_str((char*)&g_main_string_buffer[0]);
+
+	// Packets, fill and first byte to flush latency of each policy that has flushed any, the active one marked
+	packetizer_policy_t active_policy = packetizer_get_policy();
+	for (uint32_t policy = 0; policy < PACKETIZER_POLICY_COUNT; policy++)
+	{
+		packetizer_stats_t packetizer_stats;
+		packetizer_get_stats((packetizer_policy_t)policy, &packetizer_stats);
+		if ((packetizer_stats.packets == 0) && (policy != active_policy))
+		{
+			continue;
+		}
+
+		g_main_string_buffer_length = sprintf((char*)&g_main_string_buffer[0], "packetizer: %s%s packets %lu fill %lu%% latency %lums max %lums hold %lu\r\n",
+				packetizer_get_policy_name((packetizer_policy_t)policy), (policy == active_policy) ? "*" : "",
+				(unsigned long)packetizer_stats.packets,
+				(unsigned long)((packetizer_stats.packets != 0) ? (((uint64_t)packetizer_stats.bytes * 100U) / ((uint64_t)packetizer_stats.packets * LORA_PACKET_MAX_PAYLOAD)) : 0U),
+				(unsigned long)((packetizer_stats.packets != 0) ? (packetizer_stats.latency_total_ms / packetizer_stats.packets) : 0U),
+				(unsigned long)packetizer_stats.latency_max_ms, (unsigned long)packetizer_stats.flush_reason_count[PACKETIZER_FLUSH_MAX_HOLD]);
+		dbg_output_write_str((char*)&g_main_string_buffer[0]);
 	}
+
+#if LORA_PACKETIZER_POLICY_CYCLE_ENABLED
+	// Each policy gets a report period of the same traffic in turn
+	packetizer_set_policy((packetizer_policy_t)((active_policy + 1U) % PACKETIZER_POLICY_COUNT));
+#endif
+
+	power_reset_stats();
+	g_main_bytes_delivered = 0;
+}
+
+/**
+  * @brief  Link poll - fall back to the safe rate, the home channel and the default power if the peer
+  *         has gone quiet, send what is due, then scan the next channel if the link is idle.
+  * @param  timer_id the timer
+  * @retval None
+  */
+static void main_link_timer_callback(soft_timer_id_t timer_id)
+{
+	(void)timer_id;
+
+	adr_poll(timebase_get_ms());
+	channel_poll(timebase_get_ms());
+	tx_power_poll(timebase_get_ms());
+	main_lora_handle_link_control();
+	main_lora_service_transmit();
+	main_lora_start_scan_step();
+}
+
+/**
+  * @brief  Channel scan sample - add the RSSI to the noise histogram and return to the link channel
+  *         once the dwell is complete.
+  * @param  timer_id the timer
+  * @retval None
+  */
+static void main_scan_timer_callback(soft_timer_id_t timer_id)
+{
+	(void)timer_id;
+
+	int16_t rssi_dbm = 0;
+
+	if ((rfm95w_read_rssi(g_lora_rx_radio, &rssi_dbm) != 0) || (channel_on_sample(rssi_dbm, timebase_get_ms()) == 1))
+	{
+		soft_timer_stop(g_main_scan_timer);
+		rfm95w_stop_noise_sample(g_lora_rx_radio);
+		main_lora_service_transmit();
+	}
+}
+
+/**
+  * @brief  Check whether the current work needs the burst clock: a serial rate too fast to service
+  *         at the idle clock, or a backlog building up in either serial fifo.
+  * @retval 1 for the burst clock
+  */
+static uint8_t main_clock_get_demand(void)
+{
+	if (huart1.Init.BaudRate > MAIN_CLOCK_IDLE_MAX_BAUD)
+	{
+		return 1;
+	}
+
+	if ((fifo_uint8_get_count(&g_uart_receive_fifo) >= MAIN_CLOCK_BURST_FIFO_FILL) ||
+			(fifo_uint8_get_count(&g_uart_transmit_fifo) >= MAIN_CLOCK_BURST_FIFO_FILL))
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+  * @brief  Check that nothing in progress needs the high speed clocks, so the MCU may enter STOP.
+  *         Packets waiting on the radio or for credit are left to the DIO0 interrupt and the timers.
+  * @retval 1 if STOP is allowed
+  */
+static uint8_t main_power_can_stop(void)
+{
+	// Serial bytes to pass on, or still going out to the host or the debug port
+	if ((fifo_uint8_is_empty(&g_uart_receive_fifo) == 0) || (fifo_uint8_is_empty(&g_uart_transmit_fifo) == 0) ||
+			(g_uart_transmit_fifo_in_process != 0) || (dbg_output_is_idle() == 0))
+	{
+		return 0;
+	}
+
+	// USART1 must be listening to wake on a start bit, and the receiver timeout that ends a frame does not count in STOP
+	if ((g_uart_receive_fifo_in_process == 0) || (g_uart_auto_baud_pending != 0))
+	{
+		return 0;
+	}
+
+	lora_tx_frame_t* frame = &g_lora_tx_frames[g_lora_tx_fill_idx];
+	if (frame->state == LORA_TX_FRAME_FILLING)
+	{
+		lora_packet_t* packet = lora_packet_pool_get(frame->handle);
+		if ((packet != 0) && (packet->payload_length != 0))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+  * @brief  Register the subsystem tasks with the scheduler.
+  * @retval None
+  */
+static void main_scheduler_init(void)
+{
+	scheduler_init();
+
+	// Software timers first, their callbacks do the time based work of the tasks below
+	scheduler_task_config_t task_config = {0};
+	task_config.name = "timer";
+	task_config.function = main_timer_task;
+	task_config.priority = 0;
+	task_config.event_mask = EVENTS_TIMER;
+	task_config.period_ms = 0;
+	task_config.deadline_us = 500;
+	scheduler_add_task(&task_config, 0);
+
+	// Radio next, a received packet or TX done has the tightest deadline
+	task_config.name = "radio";
+	task_config.function = main_lora_task;
+	task_config.priority = 1;
+	task_config.event_mask = EVENTS_RADIO | EVENTS_SERIAL_TRANSMIT;
+	task_config.period_ms = 0;
+	task_config.deadline_us = 500;
+	scheduler_add_task(&task_config, 0);
+
+	// Serial bytes received, or a transmission done that may free a frame for bytes left waiting
+	task_config.name = "packetizer";
+	task_config.function = main_packetizer_task;
+	task_config.priority = 2;
+	task_config.event_mask = EVENTS_SERIAL_RECEIVE | EVENTS_RADIO;
+	task_config.period_ms = 0;
+	task_config.deadline_us = 1000;
+	scheduler_add_task(&task_config, 0);
+
+	// Received payload written to the serial transmit fifo
+	task_config.name = "uart_egress";
+	task_config.function = main_uart_egress_task;
+	task_config.priority = 3;
+	task_config.event_mask = EVENTS_RADIO | EVENTS_SERIAL_TRANSMIT;
+	task_config.period_ms = 0;
+	task_config.deadline_us = 2000;
+	scheduler_add_task(&task_config, 0);
+
+	// Debug output last, after any pass in which the other tasks may have written to it
+	task_config.name = "dbg_output";
+	task_config.function = main_dbg_output_task;
+	task_config.priority = 4;
+	task_config.event_mask = EVENTS_TIMER | EVENTS_RADIO | EVENTS_SERIAL_RECEIVE | EVENTS_SERIAL_TRANSMIT;
+	task_config.period_ms = 0;
+	task_config.deadline_us = 0;
+	scheduler_add_task(&task_config, 0);
+
+	soft_timer_create(main_packetizer_timer_callback, &g_main_packetizer_timer);
+	soft_timer_create(main_credit_request_timer_callback, &g_main_credit_request_timer);
+	soft_timer_create(main_stats_report_timer_callback, &g_main_stats_report_timer);
+	soft_timer_start(g_main_stats_report_timer, MAIN_STATS_REPORT_PERIOD_MS * 1000U, MAIN_STATS_REPORT_PERIOD_MS * 1000U);
+	soft_timer_create(main_link_timer_callback, &g_main_link_timer);
+	soft_timer_start(g_main_link_timer, ADR_POLL_PERIOD_MS * 1000U, ADR_POLL_PERIOD_MS * 1000U); // TX_POWER_POLL_PERIOD_MS and CHANNEL_POLL_PERIOD_MS are the same
+	soft_timer_create(main_scan_timer_callback, &g_main_scan_timer);
+}
+
+/**
+  * @brief  Time the last serial byte was received, on the millisecond timebase.
+  *         The ISR stores the low 32 bits of the microsecond timebase.
+  * @retval time in milliseconds
+  */
+static uint64_t main_uart_get_last_byte_time_ms(void)
+{
+	return main_uart_extend_time_ms(g_main_last_received_serial_byte_time_us);
+}
+
+/**
+  * @brief  Time a serial byte was received, on the millisecond timebase.
+  *         Taken from the arrival mark at or before the byte, advanced one character time per byte
+  *         since the mark. Bytes between marks were never further apart than the mark gap, so the
+  *         estimate is never later than the real arrival.
+  *         Called in stream order for each byte read from the receive fifo.
+  * @param  byte_index position of the byte in the serial receive stream
+  * @retval time in milliseconds
+  */
+static uint64_t main_uart_get_byte_time_ms(uint32_t byte_index)
+{
+	// Move up to the last mark at or before the byte
+	while (g_uart_arrival_mark_read_idx != g_uart_arrival_mark_write_idx)
+	{
+		volatile uart_arrival_mark_t* arrival_mark = &g_uart_arrival_marks[g_uart_arrival_mark_read_idx];
+
+		// Signed distance so the counts may wrap
+		if ((int32_t)(arrival_mark->byte_index - byte_index) > 0)
+		{
+			// Not reached yet
+			break;
+		}
+
+		g_uart_arrival_mark.byte_index = arrival_mark->byte_index;
+		g_uart_arrival_mark.time_us = arrival_mark->time_us;
+		g_uart_arrival_mark_read_idx = (g_uart_arrival_mark_read_idx + 1U) % UART_ARRIVAL_MARK_QUEUE_SIZE;
+	}
+
+	uint32_t time_us = g_uart_arrival_mark.time_us + ((byte_index - g_uart_arrival_mark.byte_index) * g_uart_character_time_us);
+
+	// Never later than the newest byte
+	if ((int32_t)(g_main_last_received_serial_byte_time_us - time_us) < 0)
+	{
+		time_us = g_main_last_received_serial_byte_time_us;
+	}
+
+	return main_uart_extend_time_ms(time_us);
+}
+
+/**
+  * @brief  Extend a time on the low 32 bits of the microsecond timebase to the millisecond timebase.
+  *         Assumes the time is within the last 71 minutes. Any packet still being assembled is
+  *         flushed by its timeout long before then.
+  * @param  time_us low 32 bits of the microsecond timebase
+  * @retval time in milliseconds, 0 if it would be before the timebase started
+  */
+static uint64_t main_uart_extend_time_ms(uint32_t time_us)
+{
+	uint64_t now_us = timebase_get_us();
+	uint32_t elapsed_us = (uint32_t)now_us - time_us;
+
+	if (elapsed_us > now_us)
+	{
+		// Nothing received yet
+		return 0;
+	}
+
+	return (now_us - elapsed_us) / 1000U;
+}
+
+/**
+  * @brief  Send the next contiguous run of the serial transmit fifo straight from the fifo buffer.
+  * @retval None
+  */
+static void main_uart_start_transmit(void)
+{
+	volatile uint8_t* segment;
+	uint32_t segment_length = fifo_uint8_get_read_segment(&g_uart_transmit_fifo, &segment);
+
+	if (segment_length == 0)
+	{
+		// Transmission complete as fifo is empty
+		g_uart_transmit_segment_length = 0;
+		g_uart_transmit_fifo_in_process = 0;
+	}
+	else
+	{
+		g_uart_transmit_segment_length = segment_length;
+		g_uart_transmit_fifo_in_process = 1;
+		HAL_UART_Transmit_IT(&huart1, (const uint8_t*)segment, segment_length);
+	}
+}
+
+/**
+  * @brief  Size the serial receive fifo to hold the bytes that arrive while the radio is busy.
+  * @param  baud_rate serial baud rate
+  * @retval fifo size in bytes
+  */
+static uint32_t main_uart_get_receive_fifo_size(uint32_t baud_rate)
+{
+	// One full packet on air and the next waiting to go, at 10 bits per character
+	uint64_t busy_time_us = 2U * (uint64_t)rfm95w_get_time_on_air_us(g_lora_tx_radio, sizeof(lora_packet_header_t) + LORA_PACKET_MAX_PAYLOAD);
+	uint64_t fifo_size = ((baud_rate / 10U) * busy_time_us) / 1000000U;
+
+	if (fifo_size < UART_FIFO_BUFFER_SIZE)
+	{
+		fifo_size = UART_FIFO_BUFFER_SIZE;
+	}
+	if (fifo_size > UART_RECEIVE_FIFO_MAX_SIZE)
+	{
+		fifo_size = UART_RECEIVE_FIFO_MAX_SIZE;
+	}
+
+	return (uint32_t)fifo_size;
+}
+
+/**
+  * @brief  Pass any frame boundary at the current position in the serial receive stream to the packetizer.
+  *         Boundaries the main loop has already moved past are discarded.
+  * @param  payload_length current payload length
+  * @retval flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+  */
+static packetizer_flush_reason_t main_uart_check_frame_boundary(uint32_t payload_length)
+{
+	packetizer_flush_reason_t reason = PACKETIZER_FLUSH_NONE;
+
+	while ((reason == PACKETIZER_FLUSH_NONE) && (g_uart_frame_boundary_read_idx != g_uart_frame_boundary_write_idx))
+	{
+		volatile uart_frame_boundary_t* frame_boundary = &g_uart_frame_boundaries[g_uart_frame_boundary_read_idx];
+
+		// Signed distance so the counts may wrap
+		int32_t ahead = (int32_t)(frame_boundary->byte_count - g_uart_receive_consumed_count);
+		if (ahead > 0)
+		{
+			// Not reached yet
+			break;
+		}
+
+		if (ahead == 0)
+		{
+			reason = packetizer_on_boundary(frame_boundary->boundary, payload_length);
+		}
+
+		g_uart_frame_boundary_read_idx = (g_uart_frame_boundary_read_idx + 1U) % UART_FRAME_BOUNDARY_QUEUE_SIZE;
+	}
+
+	return reason;
+}
+
+/**
+  * @brief  Change the serial baud rate at runtime, used once auto baud has detected the host's rate.
+  *         Not saved - auto baud stays on so a host that changes its rate is followed after the next reset.
+  * @param  baud_rate serial baud rate, up to the USART1 kernel clock / 8
+  * @retval 0 for success or Error
+  */
+static int32_t main_uart_set_baud_rate(uint32_t baud_rate)
+{
+	// Stop the transmission first and release the bytes already handed to the UART, so the restart
+	// carries on after them rather than sending the whole segment again
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (g_uart_transmit_fifo_in_process)
+	{
+		uint32_t sent_length = g_uart_transmit_segment_length - huart1.TxXferCount;
+		HAL_UART_AbortTransmit(&huart1);
+		fifo_uint8_commit_read(&g_uart_transmit_fifo, sent_length);
+		g_uart_transmit_segment_length = 0;
+		g_uart_transmit_fifo_in_process = 0;
+	}
+
+	__set_PRIMASK(primask);
+
+	// Let the last character out before the USART is reprogrammed
+	while (__HAL_UART_GET_FLAG(&huart1, UART_FLAG_TC) == 0)
+	{
+	}
+
+	if (usart1_set_baud_rate(baud_rate) != 0)
+	{
+		// Error
+		return -1;
+	}
+
+	// The change aborted the reception - restart both directions.
+	// Masked so a USART1 interrupt cannot restart them at the same time.
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	HAL_UART_Receive_IT(&huart1, &g_main_serial_byte_to_receive, 1);
+	g_uart_receive_fifo_in_process = 1;
+	main_uart_start_transmit();
+
+	__set_PRIMASK(primask);
+
+	packetizer_set_baud_rate(baud_rate);
+	g_uart_character_time_us = 10000000U / baud_rate;
+
+	return 0;
+}
+
+/**
+  * @brief  Get the packet the packetizer is filling, claiming the next free frame if needed.
+  * @retval pointer to the packet, or 0 if every frame is queued or on air
+  */
+static lora_packet_t* main_lora_get_fill_packet(void)
+{
+	lora_tx_frame_t* frame = &g_lora_tx_frames[g_lora_tx_fill_idx];
+
+	if (frame->state == LORA_TX_FRAME_FREE)
+	{
+		frame->handle = lora_packet_pool_alloc();
+		lora_packet_t* packet = lora_packet_pool_get(frame->handle);
+		if (packet == 0)
+		{
+			// Pool exhausted - leave the bytes in the serial fifo and try again later
+			return 0;
+		}
+
+		// Initialise the header in the packet for transmitting, the sequence number is set when queued
+		packet->header.source_address = g_lora_source_address;
+		packet->header.destination_address = g_lora_destination_address;
+		packet->header.ctrl_and_retry_count = LORA_PACKET_TYPE_DATA;
+		frame->state = LORA_TX_FRAME_FILLING;
+	}
+
+	if (frame->state == LORA_TX_FRAME_FILLING)
+	{
+		return lora_packet_pool_get(frame->handle);
+	}
+
+	return 0;
+}
+
+/**
+  * @brief  Queue the packet being assembled for the radio and move on to the next frame.
+  * @param  reason why the packetization policy flushed the packet
+  * @retval None
+  */
+static void main_lora_queue_packet(packetizer_flush_reason_t reason)
+{
+	lora_tx_frame_t* frame = &g_lora_tx_frames[g_lora_tx_fill_idx];
+	lora_packet_t* packet = lora_packet_pool_get(frame->handle);
+
+	packetizer_on_flush(reason, packet->payload_length, timebase_get_ms());
+
+	// Numbered in queue order so data packets go on air in sequence order
+	packet->header.sequence_number = g_lora_sequence_number;
+	g_lora_sequence_number++; // increment for the next packet
+
+	frame->state = LORA_TX_FRAME_READY;
+	g_lora_tx_fill_idx = (g_lora_tx_fill_idx + 1U) % LORA_TX_FRAME_COUNT;
+}
+
+/**
+  * @brief  Queue a control packet to go ahead of the queued data packets.
+  * @param  packet_type LORA_PACKET_TYPE_CREDIT, LORA_PACKET_TYPE_ADR_SWITCH or another control type
+  * @param  payload_length length of the payload
+  * @param  payload the payload for the packet type
+  * @retval None
+  */
+static void main_lora_queue_control(uint8_t packet_type, uint32_t payload_length, const void* payload)
+{
+	if (g_lora_control_frame.state != LORA_TX_FRAME_FREE)
+	{
+		return;
+	}
+
+	g_lora_control_frame.handle = lora_packet_pool_alloc();
+	lora_packet_t* packet = lora_packet_pool_get(g_lora_control_frame.handle);
+	if (packet == 0)
+	{
+		// Pool exhausted - the next pass will try again
+		return;
+	}
+
+	packet->header.source_address = g_lora_source_address;
+	packet->header.destination_address = g_lora_destination_address;
+	packet->header.sequence_number = g_lora_sequence_number;
+	packet->header.ctrl_and_retry_count = packet_type;
+	g_lora_sequence_number++; // increment for the next packet
+
+	memcpy(&packet->payload[0], payload, payload_length);
+	packet->payload_length = payload_length;
+
+	g_lora_control_frame.state = LORA_TX_FRAME_READY;
+}
+
+/**
+  * @brief  Release the frame on air once TX is done and start the next queued frame.
+  *         Flow control packets go first, data packets wait for credit from the receiver.
+  * @retval None
+  */
+static void main_lora_service_transmit(void)
+{
+	if (rfm95w_is_transmitting(g_lora_tx_radio))
+	{
+		return;
+	}
+
+	// TX done - account the airtime, then hand the packet back to the pool and the frame back to its owner
+	uint32_t airtime_us = 0;
+	if ((g_lora_control_frame.state == LORA_TX_FRAME_ON_AIR) || (g_lora_tx_frames[g_lora_tx_send_idx].state == LORA_TX_FRAME_ON_AIR))
+	{
+		airtime_us = timebase_get_us32() - g_lora_tx_start_time_us;
+		g_lora_airtime_total_us += airtime_us;
+	}
+
+	if (g_lora_control_frame.state == LORA_TX_FRAME_ON_AIR)
+	{
+		// An acknowledged data rate or channel change takes effect once the acknowledgement is on air
+		uint8_t packet_type = lora_packet_pool_get(g_lora_control_frame.handle)->header.ctrl_and_retry_count & LORA_PACKET_TYPE_MASK;
+		if (packet_type == LORA_PACKET_TYPE_ADR_ACK)
+		{
+			adr_on_ack_sent(timebase_get_ms());
+		}
+		else if (packet_type == LORA_PACKET_TYPE_CHANNEL_ACK)
+		{
+			channel_on_ack_sent(timebase_get_ms());
+		}
+		lora_packet_pool_release(g_lora_control_frame.handle);
+		g_lora_control_frame.state = LORA_TX_FRAME_FREE;
+	}
+
+	lora_tx_frame_t* frame = &g_lora_tx_frames[g_lora_tx_send_idx];
+
+	if (frame->state == LORA_TX_FRAME_ON_AIR)
+	{
+		g_main_bytes_delivered += lora_packet_pool_get(frame->handle)->payload_length;
+		adr_on_data_sent(lora_packet_pool_get(frame->handle)->payload_length, airtime_us);
+		lora_packet_pool_release(frame->handle);
+		frame->state = LORA_TX_FRAME_FREE;
+		g_lora_tx_send_idx = (g_lora_tx_send_idx + 1U) % LORA_TX_FRAME_COUNT;
+		frame = &g_lora_tx_frames[g_lora_tx_send_idx];
+	}
+
+	// Change data rate, channel and frequency correction between transmissions
+	main_lora_apply_rate();
+	main_lora_apply_channel();
+	main_lora_apply_frequency_correction();
+
+	if (g_lora_control_frame.state == LORA_TX_FRAME_READY)
+	{
+		lora_packet_t* packet = lora_packet_pool_get(g_lora_control_frame.handle);
+		if ((rfm95w_set_tx_power(g_lora_tx_radio, tx_power_get_dbm(packet->header.destination_address)) == 0) &&
+				(rfm95w_start_transmit_packet(g_lora_tx_radio, sizeof(lora_packet_header_t) + packet->payload_length, (uint8_t*)packet) == 0))
+		{
+			g_lora_control_frame.state = LORA_TX_FRAME_ON_AIR;
+			g_lora_tx_start_time_us = timebase_get_us32();
+		}
+		return;
+	}
+
+	if (frame->state == LORA_TX_FRAME_READY)
+	{
+		lora_packet_t* packet = lora_packet_pool_get(frame->handle);
+		if (credit_flow_can_send(packet->payload_length, timebase_get_ms()) == 0)
+		{
+			// Blocked for credit - ask for it if none arrives within the timeout
+			if (soft_timer_is_running(g_main_credit_request_timer) == 0)
+			{
+				soft_timer_start(g_main_credit_request_timer, (CREDIT_FLOW_REQUEST_TIMEOUT_MS + 1U) * 1000U, 0);
+			}
+		}
+		else if ((rfm95w_set_tx_power(g_lora_tx_radio, tx_power_get_dbm(packet->header.destination_address)) == 0) &&
+				(rfm95w_start_transmit_packet(g_lora_tx_radio, sizeof(lora_packet_header_t) + packet->payload_length, (uint8_t*)packet) == 0))
+		{
+			credit_flow_on_data_sent(packet->header.sequence_number, packet->payload_length);
+			frame->state = LORA_TX_FRAME_ON_AIR;
+			g_lora_tx_start_time_us = timebase_get_us32();
+		}
+	}
+}
+
+
+/**
+  * @brief  Period elapsed callback in non-blocking mode
+  * @param  htim TIM handle
+  * @retval None
+  */
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if (htim->Instance == TIM15)
+	{
+		g_main_half_second_counter++; // Increment the 2Hz counter
+		HAL_GPIO_TogglePin(LED_GPIO_Port, LED_Pin);
+	}
+}
+
+/**
+  * @brief  EXTI line detection callback.
+  * @param  GPIO_Pin Specifies the port pin connected to corresponding EXTI line.
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+	for (uint32_t idx = 0; idx < g_lora_radio_count; idx++)
+	{
+		if (GPIO_Pin == g_lora_radios[idx].config.g0_pin)
+		{
+			// Interrupt from RFM95W
+			rfm95w_process_interrupt(&g_lora_radios[idx]);
+			events_set(EVENTS_RADIO);
+		}
+	}
+}
+
+/**
+  * @brief Tx Transfer completed callback.
+  * @param huart UART handle.
+  * @retval None
+  */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	// Debug Serial
+	if (huart->Instance == LPUART1)
+	{
+		dbg_output_process_on_interrupt();
+	}
+
+	// Main Serial
+	if (huart->Instance == USART1)
+	{
+		// Release the bytes just sent and continue with the next run in the fifo
+		fifo_uint8_commit_read(&g_uart_transmit_fifo, g_uart_transmit_segment_length);
+		main_uart_start_transmit();
+		events_set(EVENTS_SERIAL_TRANSMIT);
+	}
+}
+
+/**
+  * @brief  Rx Transfer completed callback.
+  * @param  huart UART handle.
+  * @retval None
+  */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if (huart->Instance == USART1)
+	{
+		uint32_t byte_time_us = timebase_get_us32();
+		uint8_t was_empty = fifo_uint8_is_empty(&g_uart_receive_fifo);
+
+		// just received data into g_main_serial_byte_to_receive
+		// put into fifo so it can be processed by the main loop to construc a lora packet to transmit.
+		if (fifo_uint8_write_one(&g_uart_receive_fifo, g_main_serial_byte_to_receive) == 0)
+		{
+			// Mark the arrival time of the first byte after a pause, the main loop counts on from it.
+			// With the mark queue full the bytes are timed from an earlier mark, so flush sooner.
+			uint32_t gap_us = byte_time_us - g_main_last_received_serial_byte_time_us;
+			uint32_t next_write_idx = (g_uart_arrival_mark_write_idx + 1U) % UART_ARRIVAL_MARK_QUEUE_SIZE;
+			if ((was_empty || (gap_us > (UART_ARRIVAL_MARK_GAP_CHARACTERS * g_uart_character_time_us))) &&
+					(next_write_idx != g_uart_arrival_mark_read_idx))
+			{
+				g_uart_arrival_marks[g_uart_arrival_mark_write_idx].byte_index = g_uart_receive_byte_count;
+				g_uart_arrival_marks[g_uart_arrival_mark_write_idx].time_us = byte_time_us;
+				g_uart_arrival_mark_write_idx = next_write_idx;
+			}
+
+			g_uart_receive_byte_count++;
+
+			// The matching character ends the frame
+			if (g_uart_frame_match_pending)
+			{
+				main_uart_queue_frame_boundary(g_uart_receive_byte_count, PACKETIZER_BOUNDARY_MATCH);
+			}
+		}
+
+		// A matching character dropped for lack of fifo space takes its boundary with it,
+		// the packetizer falls back on its polled timeouts
+		g_uart_frame_match_pending = 0;
+
+		// Ask the host to pause before the fifo overflows, the main loop reasserts RTS once drained
+		if (fifo_uint8_get_count(&g_uart_receive_fifo) >= g_uart_receive_fifo_high_watermark)
+		{
+			usart1_set_rts(0);
+		}
+
+		// last byte received at:
+		g_main_last_received_serial_byte_time_us = byte_time_us;
+
+		// The first character sets the baud rate in auto baud mode
+		if (g_uart_auto_baud_pending)
+		{
+			uint32_t baud_rate = 0;
+			if (usart1_get_auto_baud_result(&baud_rate) == 1)
+			{
+				g_uart_auto_baud_detected_rate = baud_rate;
+				g_uart_auto_baud_pending = 0;
+			}
+		}
+
+
+		// Start another receive
+		HAL_UART_Receive_IT(&huart1, &g_main_serial_byte_to_receive, 1);
+		g_uart_receive_fifo_in_process = 1;
+
+		events_set(EVENTS_SERIAL_RECEIVE);
+	}
+}
+
+/**
+  * @brief  UART error callback.
+  * @param  huart UART handle.
+  * @retval None
+  */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	usart_record_errors(huart);
+
+	// Main Serial
+	if (huart->Instance == USART1)
+	{
+		// HAL aborts the reception on an overrun but carries on after framing, noise and parity errors.
+		// Restart it straight away so the link keeps running.
+		if (huart->RxState == HAL_UART_STATE_READY)
+		{
+			// The character that raised any match was lost with the reception
+			g_uart_frame_match_pending = 0;
+
+			HAL_UART_Receive_IT(&huart1, &g_main_serial_byte_to_receive, 1);
+			g_uart_receive_fifo_in_process = 1;
+		}
+	}
+}
+
+/**
+  * @brief  Frame boundary detected on USART1, called from interrupt.
+  * @param  boundary the boundary detected
+  * @retval None
+  */
+void usart1_frame_boundary_callback(usart1_frame_boundary_t boundary)
+{
+	events_set(EVENTS_SERIAL_RECEIVE);
+
+	if (boundary == USART1_FRAME_BOUNDARY_MATCH)
+	{
+		// Raised before HAL has taken the matching character, placed once it is in the fifo
+		g_uart_frame_match_pending = 1;
+	}
+	else
+	{
+		main_uart_queue_frame_boundary(g_uart_receive_byte_count, PACKETIZER_BOUNDARY_IDLE);
+	}
+}
+
+/**
+  * @brief  Queue a frame boundary for the main loop, called from the USART1 interrupt.
+  * @param  byte_count serial bytes in the fifo stream up to and including the last byte of the frame
+  * @param  boundary the boundary detected
+  * @retval None
+  */
+static void main_uart_queue_frame_boundary(uint32_t byte_count, packetizer_boundary_t boundary)
+{
+	uint32_t next_write_idx = (g_uart_frame_boundary_write_idx + 1U) % UART_FRAME_BOUNDARY_QUEUE_SIZE;
+	if (next_write_idx == g_uart_frame_boundary_read_idx)
+	{
+		// Queue full - the packetizer falls back on its polled timeouts
+		return;
+	}
+
+	volatile uart_frame_boundary_t* frame_boundary = &g_uart_frame_boundaries[g_uart_frame_boundary_write_idx];
+	frame_boundary->byte_count = byte_count;
+	frame_boundary->boundary = boundary;
+
+	g_uart_frame_boundary_write_idx = next_write_idx;
 }
 
 /* USER CODE END 4 */
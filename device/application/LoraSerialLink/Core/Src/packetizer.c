@@ -0,0 +1,618 @@
+/**
+ * @file    packetizer.c
+ *
+ * @brief   Serial to LoRa Packetization Policy.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  Decides when the bytes collected from the serial port should be flushed
+ *  into a LoRa packet. Each policy is a set of hooks, called per byte, on a
+ *  serial frame boundary, and polled from the main loop along with the time
+ *  it next needs polling, so policies can be swapped at runtime and compared
+ *  using the per-policy latency and fill statistics. Whatever the policy, a
+ *  packet is not held for longer than the maximum hold time after its first
+ *  byte.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "packetizer.h"
+#include "rfm95w.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define PACKETIZER_TICK_GRANULARITY_MS	(1U)	/*!< Byte timestamps may be up to one tick stale */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/**
+ * @brief   Hooks implementing a packetization policy.
+ */
+typedef struct packetizer_policy_ops_t_
+{
+	packetizer_flush_reason_t (*on_byte)(uint8_t the_byte, uint32_t payload_length);		/*!< Per byte check */
+	packetizer_flush_reason_t (*on_boundary)(packetizer_boundary_t boundary);				/*!< Serial hardware frame boundary */
+	packetizer_flush_reason_t (*poll)(uint32_t payload_length, uint8_t radio_idle,
+			uint64_t last_byte_time_ms, uint64_t now_ms);									/*!< Time based check */
+	uint64_t (*poll_time)(uint32_t payload_length, uint64_t last_byte_time_ms);			/*!< When the time based check may next flush */
+} packetizer_policy_ops_t;
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static packetizer_flush_reason_t packetizer_on_byte_none(uint8_t the_byte, uint32_t payload_length);
+static packetizer_flush_reason_t packetizer_on_byte_delimiter(uint8_t the_byte, uint32_t payload_length);
+
+static packetizer_flush_reason_t packetizer_on_boundary_none(packetizer_boundary_t boundary);
+static packetizer_flush_reason_t packetizer_on_boundary_match(packetizer_boundary_t boundary);
+static packetizer_flush_reason_t packetizer_on_boundary_idle(packetizer_boundary_t boundary);
+
+static packetizer_flush_reason_t packetizer_poll_fixed_timeout(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms);
+static packetizer_flush_reason_t packetizer_poll_inter_char_timeout(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms);
+static packetizer_flush_reason_t packetizer_poll_airtime_fill(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms);
+static packetizer_flush_reason_t packetizer_poll_radio_idle(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms);
+
+static uint64_t packetizer_poll_time_fixed_timeout(uint32_t payload_length, uint64_t last_byte_time_ms);
+static uint64_t packetizer_poll_time_inter_char_timeout(uint32_t payload_length, uint64_t last_byte_time_ms);
+static uint64_t packetizer_poll_time_airtime_fill(uint32_t payload_length, uint64_t last_byte_time_ms);
+static uint64_t packetizer_poll_time_none(uint32_t payload_length, uint64_t last_byte_time_ms);
+
+/**
+ * @brief   Calculate the minimum fill at which payload airtime matches the fixed packet airtime overhead.
+ *
+ * @param         None
+ * @return        minimum fill in bytes
+ */
+static uint32_t packetizer_calculate_min_fill();
+
+/**
+ * @brief   Get the time the packet being assembled reaches the maximum hold time.
+ *
+ * @param         None
+ * @return        time in milliseconds, 0 if there is no limit
+ */
+static uint64_t packetizer_get_max_hold_time_ms();
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+static const packetizer_policy_ops_t g_policy_ops[PACKETIZER_POLICY_COUNT] =
+{
+	[PACKETIZER_POLICY_FIXED_TIMEOUT] = { packetizer_on_byte_none, packetizer_on_boundary_none, packetizer_poll_fixed_timeout, packetizer_poll_time_fixed_timeout },
+	[PACKETIZER_POLICY_DELIMITER] = { packetizer_on_byte_delimiter, packetizer_on_boundary_match, packetizer_poll_fixed_timeout, packetizer_poll_time_fixed_timeout },
+	[PACKETIZER_POLICY_INTER_CHAR_TIMEOUT] = { packetizer_on_byte_none, packetizer_on_boundary_idle, packetizer_poll_inter_char_timeout, packetizer_poll_time_inter_char_timeout },
+	[PACKETIZER_POLICY_AIRTIME_FILL] = { packetizer_on_byte_none, packetizer_on_boundary_none, packetizer_poll_airtime_fill, packetizer_poll_time_airtime_fill },
+	[PACKETIZER_POLICY_RADIO_IDLE] = { packetizer_on_byte_none, packetizer_on_boundary_none, packetizer_poll_radio_idle, packetizer_poll_time_none },
+};
+
+static const char* g_policy_names[PACKETIZER_POLICY_COUNT] =
+{
+	[PACKETIZER_POLICY_FIXED_TIMEOUT] = "timeout",
+	[PACKETIZER_POLICY_DELIMITER] = "delimiter",
+	[PACKETIZER_POLICY_INTER_CHAR_TIMEOUT] = "interchar",
+	[PACKETIZER_POLICY_AIRTIME_FILL] = "airtime",
+	[PACKETIZER_POLICY_RADIO_IDLE] = "radioidle",
+};
+
+
+/*
+ * Private: Variables
+ */
+static uint8_t g_initialised = 0;           /*!< Initialised flag */
+
+static packetizer_config_t g_config = {0};
+
+static uint32_t g_inter_char_timeout_ms = 0;	/*!< Derived from the baud rate */
+static uint32_t g_min_fill = 1;					/*!< Derived from the time on air at the start of each packet */
+static uint64_t g_first_byte_time_ms = 0;		/*!< Time of the first byte of the packet being assembled */
+
+static packetizer_stats_t g_stats[PACKETIZER_POLICY_COUNT] = {0};
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Packetizer.
+ *
+ * @param[in]     config packetizer configuration
+ * @return        0 for success or Error
+ */
+int32_t packetizer_init (const packetizer_config_t* config)
+{
+	if ((config->policy >= PACKETIZER_POLICY_COUNT) || (config->max_payload_length == 0) || (config->radio == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	g_config = *config;
+	memset(&g_stats[0], 0, sizeof(g_stats));
+
+	g_initialised = 1;
+
+	packetizer_set_baud_rate(config->baud_rate);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Select the active packetization policy.
+ *
+ * @param[in]     policy the policy to use for subsequent packets
+ * @return        0 for success or Error
+ */
+int32_t packetizer_set_policy (packetizer_policy_t policy)
+{
+	if (policy >= PACKETIZER_POLICY_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	g_config.policy = policy;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the active packetization policy.
+ *
+ * @param         None
+ * @return        the active policy
+ */
+packetizer_policy_t packetizer_get_policy ()
+{
+	return g_config.policy;
+}
+
+
+/**
+ * @brief   Get the name of a packetization policy.
+ *
+ * @param[in]     policy the policy
+ * @return        name, or 0 for an invalid policy
+ */
+const char* packetizer_get_policy_name (packetizer_policy_t policy)
+{
+	if (policy >= PACKETIZER_POLICY_COUNT)
+	{
+		return 0;
+	}
+
+	return g_policy_names[policy];
+}
+
+
+/**
+ * @brief   Update the serial baud rate used to derive the inter-character timeout.
+ *
+ * @param[in]     baud_rate serial baud rate
+ * @return        0 for success or Error
+ */
+int32_t packetizer_set_baud_rate (uint32_t baud_rate)
+{
+	if ((g_initialised == 0) || (baud_rate == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	g_config.baud_rate = baud_rate;
+
+	// Round the character times up to whole milliseconds
+	uint32_t bit_times = (PACKETIZER_INTER_CHAR_TIMEOUT_TENTHS * PACKETIZER_BITS_PER_CHARACTER * 1000U) / 10U;
+	g_inter_char_timeout_ms = ((bit_times + baud_rate - 1U) / baud_rate) + PACKETIZER_TICK_GRANULARITY_MS;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Called for each serial byte appended to the packet being assembled.
+ *
+ * @param[in]     the_byte the byte just appended
+ * @param[in]     payload_length payload length including the_byte
+ * @param[in]     byte_time_ms time the byte was received
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_on_byte (uint8_t the_byte, uint32_t payload_length, uint64_t byte_time_ms)
+{
+	if (g_initialised == 0)
+	{
+		return PACKETIZER_FLUSH_FULL;
+	}
+
+	if (payload_length == 1)
+	{
+		// First byte of a new packet
+		g_first_byte_time_ms = byte_time_ms;
+		g_min_fill = packetizer_calculate_min_fill();
+	}
+
+	if (payload_length >= g_config.max_payload_length)
+	{
+		return PACKETIZER_FLUSH_FULL;
+	}
+
+	return g_policy_ops[g_config.policy].on_byte(the_byte, payload_length);
+}
+
+
+/**
+ * @brief   Called when the serial hardware reports a frame boundary after the last byte appended.
+ *
+ * Lets the policies that look for serial silence or a delimiter flush without waiting for
+ * the main loop to notice, so the flush latency does not depend on how fast it runs.
+ *
+ * @param[in]     boundary the boundary detected
+ * @param[in]     payload_length current payload length
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_on_boundary (packetizer_boundary_t boundary, uint32_t payload_length)
+{
+	if ((g_initialised == 0) || (payload_length == 0) || (boundary >= PACKETIZER_BOUNDARY_COUNT))
+	{
+		return PACKETIZER_FLUSH_NONE;
+	}
+
+	return g_policy_ops[g_config.policy].on_boundary(boundary);
+}
+
+
+/**
+ * @brief   Polled from the main loop to check the time based flush conditions.
+ *
+ * @param[in]     payload_length current payload length
+ * @param[in]     radio_idle 1 if the radio could transmit now
+ * @param[in]     last_byte_time_ms time the last serial byte was received
+ * @param[in]     now_ms current time
+ * @return        flush reason, PACKETIZER_FLUSH_NONE to keep collecting
+ */
+packetizer_flush_reason_t packetizer_poll (uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms)
+{
+	if ((g_initialised == 0) || (payload_length == 0))
+	{
+		return PACKETIZER_FLUSH_NONE;
+	}
+
+	packetizer_flush_reason_t reason = g_policy_ops[g_config.policy].poll(payload_length, radio_idle, last_byte_time_ms, now_ms);
+
+	// A policy waiting for silence, a fill target or the radio gives up at the maximum hold time
+	uint64_t max_hold_time_ms = packetizer_get_max_hold_time_ms();
+	if ((reason == PACKETIZER_FLUSH_NONE) && (max_hold_time_ms != 0) && (now_ms >= max_hold_time_ms))
+	{
+		reason = PACKETIZER_FLUSH_MAX_HOLD;
+	}
+
+	return reason;
+}
+
+
+/**
+ * @brief   Get the time at which packetizer_poll may next flush, so a timer can be set for it.
+ *
+ * @param[in]     payload_length current payload length
+ * @param[in]     last_byte_time_ms time the last serial byte was received
+ * @return        time in milliseconds, 0 if no time based flush is pending
+ */
+uint64_t packetizer_get_poll_time_ms (uint32_t payload_length, uint64_t last_byte_time_ms)
+{
+	if ((g_initialised == 0) || (payload_length == 0))
+	{
+		return 0;
+	}
+
+	uint64_t poll_time_ms = g_policy_ops[g_config.policy].poll_time(payload_length, last_byte_time_ms);
+	uint64_t max_hold_time_ms = packetizer_get_max_hold_time_ms();
+	if ((max_hold_time_ms != 0) && ((poll_time_ms == 0) || (max_hold_time_ms < poll_time_ms)))
+	{
+		poll_time_ms = max_hold_time_ms;
+	}
+
+	return poll_time_ms;
+}
+
+
+/**
+ * @brief   Record a flushed packet against the active policy statistics.
+ *
+ * @param[in]     reason the flush reason
+ * @param[in]     payload_length payload length of the flushed packet
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t packetizer_on_flush (packetizer_flush_reason_t reason, uint32_t payload_length, uint64_t now_ms)
+{
+	if ((g_initialised == 0) || (reason >= PACKETIZER_FLUSH_REASON_COUNT))
+	{
+		// Error
+		return -1;
+	}
+
+	packetizer_stats_t* stats = &g_stats[g_config.policy];
+
+	uint32_t latency_ms = 0;
+	if (now_ms > g_first_byte_time_ms)
+	{
+		latency_ms = (uint32_t)(now_ms - g_first_byte_time_ms);
+	}
+
+	stats->packets++;
+	stats->bytes += payload_length;
+	stats->latency_total_ms += latency_ms;
+	if (latency_ms > stats->latency_max_ms)
+	{
+		stats->latency_max_ms = latency_ms;
+	}
+	stats->flush_reason_count[reason]++;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the statistics of a policy.
+ *
+ * Average latency is latency_total_ms / packets.
+ * Fill ratio is bytes / (packets * max_payload_length).
+ *
+ * @param[in]     policy the policy
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t packetizer_get_stats (packetizer_policy_t policy, packetizer_stats_t* stats)
+{
+	if (policy >= PACKETIZER_POLICY_COUNT)
+	{
+		// Error
+		return -1;
+	}
+
+	*stats = g_stats[policy];
+
+	return 0;
+}
+
+
+
+/*
+ * Private: Function Definitions
+ */
+
+static packetizer_flush_reason_t packetizer_on_byte_none(uint8_t the_byte, uint32_t payload_length)
+{
+	(void)the_byte;
+	(void)payload_length;
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_on_byte_delimiter(uint8_t the_byte, uint32_t payload_length)
+{
+	(void)payload_length;
+
+	if (the_byte == g_config.delimiter)
+	{
+		return PACKETIZER_FLUSH_DELIMITER;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_on_boundary_none(packetizer_boundary_t boundary)
+{
+	(void)boundary;
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_on_boundary_match(packetizer_boundary_t boundary)
+{
+	if (boundary == PACKETIZER_BOUNDARY_MATCH)
+	{
+		return PACKETIZER_FLUSH_DELIMITER;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_on_boundary_idle(packetizer_boundary_t boundary)
+{
+	if (boundary == PACKETIZER_BOUNDARY_IDLE)
+	{
+		return PACKETIZER_FLUSH_INTER_CHAR;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_poll_fixed_timeout(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms)
+{
+	(void)payload_length;
+	(void)radio_idle;
+
+	if (now_ms >= (last_byte_time_ms + g_config.timeout_ms))
+	{
+		return PACKETIZER_FLUSH_TIMEOUT;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_poll_inter_char_timeout(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms)
+{
+	(void)payload_length;
+	(void)radio_idle;
+
+	if (now_ms >= (last_byte_time_ms + g_inter_char_timeout_ms))
+	{
+		return PACKETIZER_FLUSH_INTER_CHAR;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_poll_airtime_fill(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms)
+{
+	// Below the fill target keep holding short messages until the fixed timeout
+	if (payload_length < g_min_fill)
+	{
+		return packetizer_poll_fixed_timeout(payload_length, radio_idle, last_byte_time_ms, now_ms);
+	}
+
+	if (now_ms >= (last_byte_time_ms + g_inter_char_timeout_ms))
+	{
+		return PACKETIZER_FLUSH_MIN_FILL;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static packetizer_flush_reason_t packetizer_poll_radio_idle(uint32_t payload_length, uint8_t radio_idle, uint64_t last_byte_time_ms, uint64_t now_ms)
+{
+	(void)payload_length;
+	(void)last_byte_time_ms;
+	(void)now_ms;
+
+	if (radio_idle)
+	{
+		return PACKETIZER_FLUSH_RADIO_IDLE;
+	}
+
+	return PACKETIZER_FLUSH_NONE;
+}
+
+
+static uint64_t packetizer_poll_time_fixed_timeout(uint32_t payload_length, uint64_t last_byte_time_ms)
+{
+	(void)payload_length;
+
+	return last_byte_time_ms + g_config.timeout_ms;
+}
+
+
+static uint64_t packetizer_poll_time_inter_char_timeout(uint32_t payload_length, uint64_t last_byte_time_ms)
+{
+	(void)payload_length;
+
+	return last_byte_time_ms + g_inter_char_timeout_ms;
+}
+
+
+static uint64_t packetizer_poll_time_airtime_fill(uint32_t payload_length, uint64_t last_byte_time_ms)
+{
+	if (payload_length < g_min_fill)
+	{
+		return packetizer_poll_time_fixed_timeout(payload_length, last_byte_time_ms);
+	}
+
+	return packetizer_poll_time_inter_char_timeout(payload_length, last_byte_time_ms);
+}
+
+
+static uint64_t packetizer_poll_time_none(uint32_t payload_length, uint64_t last_byte_time_ms)
+{
+	(void)payload_length;
+	(void)last_byte_time_ms;
+
+	// Flushed on radio events only
+	return 0;
+}
+
+
+/**
+ * @brief   Calculate the minimum fill at which payload airtime matches the fixed packet airtime overhead.
+ *
+ * @param         None
+ * @return        minimum fill in bytes
+ */
+static uint32_t packetizer_calculate_min_fill()
+{
+	uint32_t overhead_us = rfm95w_get_time_on_air_us(g_config.radio, 0);
+	uint32_t full_us = rfm95w_get_time_on_air_us(g_config.radio, g_config.max_payload_length);
+
+	if (full_us <= overhead_us)
+	{
+		return 1;
+	}
+
+	uint32_t per_byte_us = (full_us - overhead_us) / g_config.max_payload_length;
+	if (per_byte_us == 0)
+	{
+		return 1;
+	}
+
+	uint32_t min_fill = (overhead_us + per_byte_us - 1U) / per_byte_us;
+	if (min_fill > g_config.max_payload_length)
+	{
+		min_fill = g_config.max_payload_length;
+	}
+
+	return min_fill;
+}
+
+
+/**
+ * @brief   Get the time the packet being assembled reaches the maximum hold time.
+ *
+ * @param         None
+ * @return        time in milliseconds, 0 if there is no limit
+ */
+static uint64_t packetizer_get_max_hold_time_ms()
+{
+	if (g_config.max_hold_ms == 0)
+	{
+		return 0;
+	}
+
+	return g_first_byte_time_ms + g_config.max_hold_ms;
+}
+
+
+/* End of file */
@@ -0,0 +1,414 @@
+/**
+ * @file    power.c
+ *
+ * @brief   Low Power Mode Manager.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  WFI with interrupts masked still wakes on a pending interrupt, which then
+ *  runs as soon as they are unmasked. The core wakes from STOP on HSI16, or
+ *  MSI when the clock governor is at its idle level, with the HSE and PLL
+ *  off, so the clocks are restored before returning.
+ *
+ *  TIM2 does not count in STOP and counts slowly until the PLL is back, so
+ *  the time from entering STOP to the clocks being restored is measured on
+ *  LPTIM1 and the difference added to the timebase. The residency and wake
+ *  latency are measured the same way, to the 30.5 us LSE resolution, while
+ *  WFI sleep is measured on the timebase.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "power.h"
+
+#include "events.h"
+#include "soft_timer.h"
+#include "timebase.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+/* Typical MCU supply currents at 3 V and 25 C from the datasheet, excluding the radio */
+#define POWER_CURRENT_RUN_UA		(9500U)		/*!< Run at 80 MHz, range 1, from flash, until the clock governor says otherwise */
+#define POWER_CURRENT_SLEEP_UA		(2600U)		/*!< Sleep at 80 MHz, likewise */
+#define POWER_CURRENT_STOP1_UA		(6U)		/*!< STOP1 with LSE and LPTIM1 */
+#define POWER_CURRENT_STOP2_UA		(2U)		/*!< STOP2 with LSE and LPTIM1 */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static power_clock_restore_t g_clock_restore = 0;
+static UART_HandleTypeDef* g_serial_uart = 0;
+static UART_HandleTypeDef* g_debug_uart = 0;
+static uint8_t g_initialised = 0;
+
+static uint32_t g_mode_current_ua[POWER_MODE_COUNT] =
+{
+	POWER_CURRENT_RUN_UA,
+	POWER_CURRENT_SLEEP_UA,
+	POWER_CURRENT_STOP1_UA,
+	POWER_CURRENT_STOP2_UA,
+};
+
+static power_stats_t g_stats = {0};
+static uint64_t g_stats_start_us = 0;		/*!< Timebase when the statistics were reset */
+static uint64_t g_run_start_us = 0;			/*!< Timebase when the core last started running */
+
+static uint32_t g_stop_entry_ticks = 0;		/*!< LPTIM1 time entering STOP */
+static uint64_t g_stop_entry_us = 0;		/*!< Timebase entering STOP */
+static uint32_t g_stop_wake_ticks = 0;		/*!< LPTIM1 time on waking from STOP */
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static void power_enter_stop (power_mode_t mode);
+static void power_restore_after_stop (power_mode_t mode);
+static void power_uart_wake_enable (UART_HandleTypeDef* huart, uint8_t enable);
+static void power_account (power_mode_t mode, uint64_t duration_us);
+static uint32_t power_ticks_to_us (uint32_t ticks);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Power Manager.
+ *
+ * Selects HSI16 as the clock on waking from STOP, until the clock governor changes it, and
+ * sets both UARTs to wake on a start bit.
+ * The UARTs must already be clocked from HSI16 and the software timer service started.
+ *
+ * @param[in]     clock_restore restores the system clocks after STOP
+ * @param[in]     serial_uart USART1, the host serial link
+ * @param[in]     debug_uart LPUART1, the debug serial link
+ * @return        0 for success or Error
+ */
+int32_t power_init (power_clock_restore_t clock_restore, UART_HandleTypeDef* serial_uart, UART_HandleTypeDef* debug_uart)
+{
+	if (clock_restore == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	g_clock_restore = clock_restore;
+	g_serial_uart = serial_uart;
+	g_debug_uart = debug_uart;
+
+	// Wake on HSI16, which is running within a few microseconds and already clocks the UARTs
+	__HAL_RCC_WAKEUPSTOP_CLK_CONFIG(RCC_STOP_WAKEUPCLOCK_HSI);
+
+	UART_WakeUpTypeDef wake_up = {0};
+	wake_up.WakeUpEvent = UART_WAKEUP_ON_STARTBIT;
+	if ((g_serial_uart != 0) && (HAL_UARTEx_StopModeWakeUpSourceConfig(g_serial_uart, wake_up) != HAL_OK))
+	{
+		// Error
+		return -1;
+	}
+	if ((g_debug_uart != 0) && (HAL_UARTEx_StopModeWakeUpSourceConfig(g_debug_uart, wake_up) != HAL_OK))
+	{
+		// Error
+		return -1;
+	}
+
+	g_initialised = 1;
+
+	power_reset_stats();
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sleep until an interrupt, unless events are already pending.
+ *
+ * Interrupts are masked while checking so an event raised just before the sleep still
+ * wakes the core. The clocks are restored with interrupts enabled, so the interrupt that
+ * woke the core is handled first.
+ *
+ * @param[in]     stop_allowed 1 if nothing in progress needs the high speed clocks
+ * @param[in]     serial_wake 1 if a character from the host must wake the core
+ * @return        mode entered, POWER_MODE_RUN if events were pending
+ */
+power_mode_t power_sleep (uint8_t stop_allowed, uint8_t serial_wake)
+{
+	power_mode_t mode = POWER_MODE_RUN;
+
+	__disable_irq();
+
+	if (events_peek() == 0)
+	{
+		mode = POWER_MODE_SLEEP;
+		if ((g_initialised != 0) && stop_allowed &&
+				(soft_timer_get_ticks_to_next() > ((POWER_STOP_MIN_SLEEP_US * SOFT_TIMER_TICK_FREQUENCY_HZ) / 1000000U)))
+		{
+			mode = serial_wake ? POWER_MODE_STOP1 : POWER_MODE_STOP2;
+		}
+
+		// The HAL tick is only needed for timeouts while awake, stop it waking the core every millisecond
+		HAL_SuspendTick();
+
+		uint64_t sleep_start_us = timebase_get_us();
+		power_account(POWER_MODE_RUN, sleep_start_us - g_run_start_us);
+
+		if (mode == POWER_MODE_SLEEP)
+		{
+			__DSB();
+			__WFI();
+			g_run_start_us = timebase_get_us();
+			power_account(POWER_MODE_SLEEP, g_run_start_us - sleep_start_us);
+			g_stats.entries[POWER_MODE_SLEEP]++;
+		}
+		else
+		{
+			power_enter_stop(mode);
+		}
+
+		HAL_ResumeTick();
+	}
+
+	__enable_irq();
+
+	if ((mode == POWER_MODE_STOP1) || (mode == POWER_MODE_STOP2))
+	{
+		power_restore_after_stop(mode);
+	}
+
+	return mode;
+}
+
+
+/**
+ * @brief   Get the statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t power_get_stats (power_stats_t* stats)
+{
+	if (stats == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	// Include the run so far
+	uint64_t now_us = timebase_get_us();
+	power_account(POWER_MODE_RUN, now_us - g_run_start_us);
+	g_run_start_us = now_us;
+
+	*stats = g_stats;
+	stats->elapsed_us = now_us - g_stats_start_us;
+	stats->average_current_ua = (stats->elapsed_us != 0) ? (uint32_t)(stats->charge_ua_us / stats->elapsed_us) : 0U;
+	stats->energy_uj = (uint32_t)((stats->charge_ua_us * POWER_SUPPLY_MV) / 1000000000ULL);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Reset the statistics, to start measuring a new traffic profile.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t power_reset_stats ()
+{
+	memset(&g_stats, 0, sizeof(g_stats));
+	g_stats_start_us = timebase_get_us();
+	g_run_start_us = g_stats_start_us;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Set the run and sleep currents of the current system clock, for the estimate.
+ *
+ * Called by the clock governor as it switches, the time up to now is charged at the old currents.
+ *
+ * @param[in]     run_current_ua MCU current running
+ * @param[in]     sleep_current_ua MCU current in WFI sleep
+ * @return        0 for success or Error
+ */
+int32_t power_set_clock_currents (uint32_t run_current_ua, uint32_t sleep_current_ua)
+{
+	uint64_t now_us = timebase_get_us();
+	power_account(POWER_MODE_RUN, now_us - g_run_start_us);
+	g_run_start_us = now_us;
+
+	g_mode_current_ua[POWER_MODE_RUN] = run_current_ua;
+	g_mode_current_ua[POWER_MODE_SLEEP] = sleep_current_ua;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Enter STOP with interrupts masked, returning once woken.
+ *
+ * @param[in]     mode POWER_MODE_STOP1 or POWER_MODE_STOP2
+ * @return        None
+ */
+static void power_enter_stop (power_mode_t mode)
+{
+	// USART1 is not functional in STOP2, LPUART1 is in both
+	power_uart_wake_enable(g_serial_uart, (mode == POWER_MODE_STOP1) ? 1U : 0U);
+	power_uart_wake_enable(g_debug_uart, 1U);
+
+	g_stop_entry_us = timebase_get_us();
+	g_stop_entry_ticks = soft_timer_get_ticks();
+
+	if (mode == POWER_MODE_STOP1)
+	{
+		HAL_PWREx_EnterSTOP1Mode(PWR_STOPENTRY_WFI);
+	}
+	else
+	{
+		HAL_PWREx_EnterSTOP2Mode(PWR_STOPENTRY_WFI);
+	}
+
+	g_stop_wake_ticks = soft_timer_get_ticks();
+
+	power_uart_wake_enable(g_serial_uart, 0U);
+	power_uart_wake_enable(g_debug_uart, 0U);
+}
+
+
+/**
+ * @brief   Restore the clocks and the timebase after STOP, and record the residency and wake latency.
+ *
+ * @param[in]     mode the STOP mode left
+ * @return        None
+ */
+static void power_restore_after_stop (power_mode_t mode)
+{
+	g_clock_restore();
+
+	uint32_t ready_ticks = soft_timer_get_ticks();
+
+	// TIM2 stood still in STOP and ran slow on the wake clock, make up the difference
+	uint32_t elapsed_us = power_ticks_to_us(ready_ticks - g_stop_entry_ticks);
+	uint64_t counted_us = timebase_get_us() - g_stop_entry_us;
+	if (elapsed_us > counted_us)
+	{
+		timebase_advance_us(elapsed_us - (uint32_t)counted_us);
+	}
+
+	// Restoring the clocks counts as running
+	uint32_t wake_latency_us = power_ticks_to_us(ready_ticks - g_stop_wake_ticks);
+	power_account(mode, power_ticks_to_us(g_stop_wake_ticks - g_stop_entry_ticks));
+	g_run_start_us = timebase_get_us() - wake_latency_us;
+	g_stats.entries[mode]++;
+	g_stats.wake_latency_total_us += wake_latency_us;
+	if (wake_latency_us > g_stats.wake_latency_max_us)
+	{
+		g_stats.wake_latency_max_us = wake_latency_us;
+	}
+}
+
+
+/**
+ * @brief   Let a UART wake the core from STOP on a start bit, or stop it doing so.
+ *
+ * @param[in]     huart UART handle, may be 0
+ * @param[in]     enable 1 to enable the wake up
+ * @return        None
+ */
+static void power_uart_wake_enable (UART_HandleTypeDef* huart, uint8_t enable)
+{
+	if (huart == 0)
+	{
+		return;
+	}
+
+	__HAL_UART_CLEAR_FLAG(huart, UART_CLEAR_WUF);
+	if (enable)
+	{
+		__HAL_UART_ENABLE_IT(huart, UART_IT_WUF);
+		HAL_UARTEx_EnableStopMode(huart);
+	}
+	else
+	{
+		HAL_UARTEx_DisableStopMode(huart);
+		__HAL_UART_DISABLE_IT(huart, UART_IT_WUF);
+	}
+}
+
+
+/**
+ * @brief   Add time spent in a mode to the residency and charge.
+ *
+ * @param[in]     mode the mode
+ * @param[in]     duration_us time spent
+ * @return        None
+ */
+static void power_account (power_mode_t mode, uint64_t duration_us)
+{
+	g_stats.residency_us[mode] += duration_us;
+	g_stats.charge_ua_us += duration_us * g_mode_current_ua[mode];
+}
+
+
+/**
+ * @brief   Convert LPTIM1 ticks to microseconds.
+ *
+ * @param[in]     ticks ticks of SOFT_TIMER_TICK_FREQUENCY_HZ
+ * @return        microseconds
+ */
+static uint32_t power_ticks_to_us (uint32_t ticks)
+{
+	return (uint32_t)(((uint64_t)ticks * 1000000U) / SOFT_TIMER_TICK_FREQUENCY_HZ);
+}
+
+
+/* End of file */
@@ -15,6 +15,7 @@
  */
 #include "rfm95w.h"
 #include "dbg_output.h"
+#include "soft_timer.h"
 
 #include "stm32l4xx_hal.h"
 #include "stm32l4xx_hal_gpio.h"
@@ -31,7 +32,7 @@
 
 //#define U	(1)		/*!<  */
 
-#define RFM95W_FXOSC	(32000000.0f)		/*!< 32MHz */
+#define RFM95W_FXOSC	(32000000U)		/*!< 32MHz */
 
 /*
  * Register Names (LoRa Mode) SX1276 Datasheet 4.1, Table 41
@@ -77,7 +78,7 @@
 #define RFM95W_REG_24_HOP_PERIOD                        0x24
 #define RFM95W_REG_25_FIFO_RX_BYTE_ADDR                 0x25
 #define RFM95W_REG_26_MODEM_CONFIG3                     0x26
-#define RFM95W_REG_27_RESERVED                          0x27
+#define RFM95W_REG_27_PPM_CORRECTION                    0x27
 #define RFM95W_REG_28_FEI_MSB                           0x28
 #define RFM95W_REG_29_FEI_MID                           0x29
 #define RFM95W_REG_2A_FEI_LSB                           0x2a
@@ -170,6 +171,8 @@
 // RFM95W_REG_0B_OCP
 #define RFM95W_REGVAL_0B_OCP_ON							0x20	/*!< bits 5 */
 //#define RFM95W_REGVAL_0B_OCP_TRIM						0x00	/*!< bits 4-0 */
+#define RFM95W_REGVAL_0B_OCP_TRIM_100MA					0x0b	/*!< bits 4-0, 45 + 5 * trim mA - the reset value */
+#define RFM95W_REGVAL_0B_OCP_TRIM_140MA					0x11	/*!< bits 4-0, -30 + 10 * trim mA - needed at +20 dBm */
 
 
 // RFM95W_REG_0C_LNA
@@ -247,6 +250,20 @@
 #define RFM95W_REGVAL_26_LOW_DATA_RATE_OPTIMIZE				0x08	/*!< bits 3 */
 #define RFM95W_REGVAL_26_AGC_AUTO_ON						0x04	/*!< bits 2 */
 
+// RFM95W_REG_33_INVERT_IQ - the TX bit is set for normal IQ, so the reset value 0x27 is normal both ways
+#define RFM95W_REGVAL_33_RESERVED							0x26	/*!< bits 5-1, kept at the reset value */
+#define RFM95W_REGVAL_33_INVERT_IQ_RX_ON					0x40	/*!< bits 6 */
+#define RFM95W_REGVAL_33_INVERT_IQ_TX_OFF					0x01	/*!< bits 0 */
+
+// RFM95W_REG_3B_INVERT_IQ2 - written to match the inversion of the direction in use
+#define RFM95W_REGVAL_3B_INVERT_IQ2_ON						0x19
+#define RFM95W_REGVAL_3B_INVERT_IQ2_OFF						0x1d
+
+// RFM95W_REG_36_HIGH_BW_OPTIMIZE1 and RFM95W_REG_3A_HIGH_BW_OPTIMIZE2 - Errata 2.1 Sensitivity Optimization with a 500 kHz Bandwidth
+#define RFM95W_REGVAL_36_BW_500KHZ_OPTIMIZE					0x02	/*!< 500 kHz bandwidth */
+#define RFM95W_REGVAL_36_BW_OTHER_OPTIMIZE					0x03	/*!< Every other bandwidth */
+#define RFM95W_REGVAL_3A_BW_500KHZ_HF_OPTIMIZE				0x64	/*!< 500 kHz bandwidth above 862 MHz */
+
 // RFM95W_REG_40_DIO_MAPPING1 - Table 18 DIO Mapping LoRa Mode
 #define RFM95W_REGVAL_40_DIO0_RX_DONE						0x00	/*!< bits 7-6 */
 #define RFM95W_REGVAL_40_DIO0_TX_DONE						0x40	/*!< bits 7-6 */
@@ -267,6 +284,7 @@
 
 
 // RFM95W_REG_4D_PA_DAC
+#define RFM95W_REGVAL_4D_PA_DAC_RESERVED					0x80	/*!< bits 7-3, kept at the reset value */
 #define RFM95W_REGVAL_4D_PA_DAC_0_DBM						0x04	/*!< bits 2-0 */
 #define RFM95W_REGVAL_4D_PA_DAC_1_DBM						0x05	/*!< bits 2-0 */
 #define RFM95W_REGVAL_4D_PA_DAC_2_DBM						0x06	/*!< bits 2-0 */
@@ -278,6 +296,17 @@
 
 #define MAX_SPI_BUFFER_LENGTH	(255U)
 
+#define RFM95W_LDRO_SYMBOL_TIME_US	(16000U)	/*!< Low Data Rate Optimise is mandated above 16ms symbol time */
+
+#define RFM95W_CAD_SYMBOLS					(2U)		/*!< CAD takes about 1.75 symbols, plus the wake from sleep */
+#define RFM95W_SNIFF_LOCK_SYMBOLS			(4U)		/*!< Preamble left after the last possible CAD for the receiver to lock on */
+#define RFM95W_SNIFF_MIN_PREAMBLE_SYMBOLS	(16U)		/*!< Shortest wake-on-radio preamble, a sniff period of 10 symbols */
+#define RFM95W_MAX_PREAMBLE_SYMBOLS			(0xFFFFU)	/*!< RegPreambleMsb/Lsb */
+
+#define RFM95W_RSSI_OFFSET_HF				(-157)		/*!< RSSI = offset + register value on the high frequency port */
+#define RFM95W_FEI_SIGN_BIT					(0x80000)	/*!< FEI is a 20 bit two's complement value */
+#define RFM95W_BANDWIDTH_COUNT				(10U)		/*!< Entries in g_bandwidths */
+
 
 /*
  * Public: Opaque Type Definitions
@@ -288,6 +317,12 @@
  * Private: Typedefs
  */
 
+/* Bandwidth and its RFM95W_REG_1D_MODEM_CONFIG1 value */
+typedef struct rfm95w_bandwidth_t_
+{
+	uint32_t bandwidth_hz;
+	uint8_t regval;
+} rfm95w_bandwidth_t;
 
 
 /*
@@ -306,21 +341,28 @@
 
 static const uint8_t g_null_buffer[MAX_SPI_BUFFER_LENGTH] = {0U};	/*!< Buffer of zeros for transmission on SPI when we are only interested in receiving */
 
-static const uint32_t g_receive_buffer_max_length = MAX_SPI_BUFFER_LENGTH;
+static const rfm95w_bandwidth_t g_bandwidths[RFM95W_BANDWIDTH_COUNT] =
+{
+	{ 7800U, RFM95W_REGVAL_1D_BW_7_8KHZ },
+	{ 10400U, RFM95W_REGVAL_1D_BW_10_4KHZ },
+	{ 15600U, RFM95W_REGVAL_1D_BW_15_6KHZ },
+	{ 20800U, RFM95W_REGVAL_1D_BW_20_8KHZ },
+	{ 31250U, RFM95W_REGVAL_1D_BW_31_25KHZ },
+	{ 41700U, RFM95W_REGVAL_1D_BW_41_7KHZ },
+	{ 62500U, RFM95W_REGVAL_1D_BW_62_5KHZ },
+	{ 125000U, RFM95W_REGVAL_1D_BW_125KHZ },
+	{ 250000U, RFM95W_REGVAL_1D_BW_250KHZ },
+	{ 500000U, RFM95W_REGVAL_1D_BW_500KHZ },
+};
 
 
 /*
  * Private: Variables
  */
-static uint8_t g_initialised = 0;           /*!< Initialised flag */
-
-static SPI_HandleTypeDef* g_spi_handle = 0;		/*!< SPI Handle */
-
 static volatile uint8_t g_regval = 0;
 
-static volatile uint8_t g_receive_buffer[MAX_SPI_BUFFER_LENGTH] = {0};
-static volatile uint32_t g_receive_buffer_length = 0;
-static volatile uint8_t g_packet_received = 0;
+static rfm95w_state_t* g_radios[RFM95W_MAX_INSTANCES] = {0};	/*!< Initialised modules, to find the one a sniff timer belongs to */
+static uint32_t g_radio_count = 0;
 
 /*
  * Private: Function Prototypes/Declarations
@@ -329,50 +371,142 @@ static volatile uint8_t g_packet_received = 0;
 /**
  * @brief   Write burst data to the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     buffer_length the length of the data buffer to send.
  * @param[in]     buffer the data buffer to send.
  * @return        0 for success or Error
  */
-static int32_t rfm95w_write_burst(const uint8_t register_address, const uint8_t buffer_length, const uint8_t buffer[buffer_length]);
+static int32_t rfm95w_write_burst(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t buffer_length, const uint8_t buffer[buffer_length]);
 
 /**
  * @brief   Write single data to the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     data_byte the data byte to send.
  * @return        0 for success or Error
  */
-static int32_t rfm95w_write_single(const uint8_t register_address, const uint8_t data_byte);
+static int32_t rfm95w_write_single(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t data_byte);
 
 /**
  * @brief   Read burst data from the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     buffer_length the length of the data buffer to receive.
  * @param[out]    buffer the data buffer to receive into.
  * @return        0 for success or Error
  */
-static volatile int32_t rfm95w_read_burst(const uint8_t register_address, const uint8_t buffer_length, volatile uint8_t buffer[buffer_length]);
+static volatile int32_t rfm95w_read_burst(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t buffer_length, volatile uint8_t buffer[buffer_length]);
 
 /**
  * @brief   Read single data from the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[out]    data_byte the data byte to receive into.
  * @return        0 for success or Error
  */
-static volatile int32_t rfm95w_read_single(const uint8_t register_address, volatile uint8_t* data_byte);
+static volatile int32_t rfm95w_read_single(rfm95w_state_t* radio, const uint8_t register_address, volatile uint8_t* data_byte);
 
 
 /**
- * @brief   Receive a LoRa Packet into the buffer with the RFM95W module.
+ * @brief   Latch the length and FIFO address of a received LoRa Packet, leaving the payload in the module FIFO.
  *
- * @param[in]	  buffer_length	length of the buffer to transmit.
- * @param[in]	  buffer buffer to transmit.
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  received_buffer_length count of bytes received, 0 if none or in error.
+ * @param[out]	  fifo_address module FIFO address of the packet.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_receive_packet(rfm95w_state_t* radio, volatile uint32_t* received_buffer_length, volatile uint8_t* fifo_address);
+
+
+/**
+ * @brief   Check the latched header of a received LoRa Packet against the address filter.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        1 to accept the packet, 0 to discard it
+ */
+static int32_t rfm95w_is_address_accepted(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Get the symbol time of the current modem configuration.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        symbol time in microseconds
+ */
+static uint32_t rfm95w_get_symbol_time_us(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Write the PA, PA_DAC and over current protection registers for an output power.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     power_dbm RFM95W_MIN_TX_POWER_DBM to RFM95W_MAX_TX_POWER_DBM.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_tx_power(rfm95w_state_t* radio, int8_t power_dbm);
+
+
+/**
+ * @brief   Write the IQ inversion of the direction about to be used, if it differs from the module.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     transmit 1 before transmitting, 0 before receiving or channel activity detection.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_invert_iq(rfm95w_state_t* radio, uint8_t transmit);
+
+
+/**
+ * @brief   Write the carrier frequency, in sleep or standby.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     frequency_hz carrier frequency.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_frequency(rfm95w_state_t* radio, uint32_t frequency_hz);
+
+
+/**
+ * @brief   Write the link frequency with its correction, and the matching data rate correction.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_link_frequency(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Derive the preamble length and sniff period from the wake-on-radio latency and write the preamble.
+ *
+ * Called in standby with the DIO0 interrupt disabled. Nothing is changed if the latency is too short.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     latency_ms time allowed for the preamble ahead of each packet, 0 to listen continuously.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_configure_wake_on_radio(rfm95w_state_t* radio, uint32_t latency_ms);
+
+
+/**
+ * @brief   Start a channel activity detection, with DIO0 on CAD done.
+ *
+ * @param[in/out] radio pointer to the module state struct
  * @return        0 for success or Error
  */
-static volatile int32_t rfm95w_receive_packet(uint32_t max_buffer_length, volatile uint8_t buffer[max_buffer_length], volatile uint32_t* received_buffer_length);
+static int32_t rfm95w_start_cad(rfm95w_state_t* radio);
+
+
+/**
+ * @brief   Sniff period elapsed - start the next detection, or give up on a detection that received nothing.
+ *
+ * @param[in]     timer_id the timer
+ * @return        None
+ */
+static void rfm95w_sniff_timer_callback(soft_timer_id_t timer_id);
 
 
 
@@ -383,73 +517,87 @@ static volatile int32_t rfm95w_receive_packet(uint32_t max_buffer_length, volati
 /**
  * @brief   Initialise RFM95W module.
  *
- * @param[in]     spi_handle
+ * Each module needs its own SPI and pins, and its own state for as long as it is used.
+ *
+ * @param[out]    radio pointer to the module state struct
+ * @param[in]     config SPI and pins of the module
  * @return        0 for success or Error
  */
-int32_t rfm95w_init(SPI_HandleTypeDef* spi_handle)
+int32_t rfm95w_init(rfm95w_state_t* radio, const rfm95w_config_t* config)
 {
+	if ((radio == 0) || (config == 0) || (config->spi_handle == 0) || (g_radio_count >= RFM95W_MAX_INSTANCES))
+	{
+		// Error
+		return -1;
+	}
 
-	g_spi_handle = spi_handle;
+	memset(radio, 0, sizeof(rfm95w_state_t));
+	radio->config = *config;
 
+	// Modem configuration of the registers written below
+	radio->spreading_factor = 7;
+	radio->bandwidth_hz = 125000;
+	radio->coding_rate = 1;
+	radio->preamble_length = 8;
+	radio->payload_crc_on = 1;
+	radio->implicit_header_on = 0;
+	radio->sniff_timer = SOFT_TIMER_ID_INVALID;
+	radio->sniff_state = RFM95W_SNIFF_STATE_SLEEP;
 
 	// Initialise the external RFM95W module.
 
 	// Power Up the module if it isn't already
 	HAL_Delay(200); // 200ms delay
-	HAL_GPIO_WritePin(RFM95W_EN_GPIO_PORT, RFM95W_EN_GPIO_PIN, 1U);
+	HAL_GPIO_WritePin(radio->config.en_port, radio->config.en_pin, 1U);
 	HAL_Delay(200); // 200ms delay
 
 
 	// Hard Reset
 	HAL_Delay(200); // 200ms delay
-	HAL_GPIO_WritePin(RFM95W_RST_GPIO_PORT, RFM95W_RST_GPIO_PIN, 0U);
+	HAL_GPIO_WritePin(radio->config.rst_port, radio->config.rst_pin, 0U);
 	HAL_Delay(200); // 200ms delay
-	HAL_GPIO_WritePin(RFM95W_RST_GPIO_PORT, RFM95W_RST_GPIO_PIN, 1U);
+	HAL_GPIO_WritePin(radio->config.rst_port, radio->config.rst_pin, 1U);
 	HAL_Delay(200); // 200ms delay
 
 	// Set Sleep Mode to allow us to change to LoRa mode.
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_SLEEP));
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_SLEEP));
 
 
 	// Debug read back the register value
-	//rfm95w_read_single(RFM95W_REG_01_OP_MODE, &g_regval);
+	//rfm95w_read_single(radio, RFM95W_REG_01_OP_MODE, &g_regval);
 	//asm("nop");
 
 	// Setup the FIFO to use the entire 256 bytes for transmit and receive packets
-	rfm95w_write_single(RFM95W_REG_0E_FIFO_TX_BASE_ADDR, 0);
-	rfm95w_write_single(RFM95W_REG_0F_FIFO_RX_BASE_ADDR, 0);
+	rfm95w_write_single(radio, RFM95W_REG_0E_FIFO_TX_BASE_ADDR, 0);
+	rfm95w_write_single(radio, RFM95W_REG_0F_FIFO_RX_BASE_ADDR, 0);
 
 	// Set to standby mode
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
 
 	// Set the modem configuration - Modem PHY config 1,2,3.
-	rfm95w_write_single(RFM95W_REG_1D_MODEM_CONFIG1, (RFM95W_REGVAL_1D_BW_125KHZ | RFM95W_REGVAL_1D_CODING_RATE_4_5));
-	rfm95w_write_single(RFM95W_REG_1E_MODEM_CONFIG2, (RFM95W_REGVAL_1E_SPREADING_FACTOR_128_CHIPS | RFM95W_REGVAL_1E_RX_PAYLOAD_CRC_ON));
-	rfm95w_write_single(RFM95W_REG_26_MODEM_CONFIG3, (RFM95W_REGVAL_26_AGC_AUTO_ON));
+	rfm95w_write_single(radio, RFM95W_REG_1D_MODEM_CONFIG1, (RFM95W_REGVAL_1D_BW_125KHZ | RFM95W_REGVAL_1D_CODING_RATE_4_5));
+	rfm95w_write_single(radio, RFM95W_REG_1E_MODEM_CONFIG2, (RFM95W_REGVAL_1E_SPREADING_FACTOR_128_CHIPS | RFM95W_REGVAL_1E_RX_PAYLOAD_CRC_ON));
+	rfm95w_write_single(radio, RFM95W_REG_26_MODEM_CONFIG3, (RFM95W_REGVAL_26_AGC_AUTO_ON));
 
 	// https://www.thethingsnetwork.org/docs/lorawan/lora-phy-format/
 	// Preamble is used to synchronize the receiver with the transmitter.
 	// It MUST consist of 8 symbols for all regions as mentioned in the LoRaWAN Regional Parameters document.
 	// However, the radio transmitter will add another 4.25 symbols resulting in a final preamble length of 8 + 4.25 = 12.25 symbols.
 	// Set the preamble length = length + 4.25 symbols
-	uint16_t preamble_length = 8;
-	uint8_t preamble_length_msb = (uint8_t)(preamble_length >> 8U);
-	uint8_t preamble_length_lsb =  (uint8_t)(preamble_length & 0xFF);
-	rfm95w_write_single(RFM95W_REG_20_PREAMBLE_MSB, preamble_length_msb);
-	rfm95w_write_single(RFM95W_REG_21_PREAMBLE_LSB, preamble_length_lsb);
+	uint8_t preamble_length_msb = (uint8_t)(radio->preamble_length >> 8U);
+	uint8_t preamble_length_lsb =  (uint8_t)(radio->preamble_length & 0xFF);
+	rfm95w_write_single(radio, RFM95W_REG_20_PREAMBLE_MSB, preamble_length_msb);
+	rfm95w_write_single(radio, RFM95W_REG_21_PREAMBLE_LSB, preamble_length_lsb);
 
 	// Set the frequency to 868MHz
 	//RFM95W_FREQ_RF 868MHz
 	//RFM95W_FXOSC 32MHz
 	// Frf = FREQ_RF * 2^19 / FXOSC
-
-	uint32_t frf = (uint32_t)((RFM95W_FREQ_RF * 524288.0f) / RFM95W_FXOSC);
-	uint8_t frf_msb = (uint8_t)((frf >> 16U) & 0xFF);
-	uint8_t frf_mid = (uint8_t)((frf >> 8U) & 0xFF);
-	uint8_t frf_lsb =  (uint8_t)(frf & 0xFF);
-	rfm95w_write_single(RFM95W_REG_06_FRF_MSB, frf_msb);
-	rfm95w_write_single(RFM95W_REG_07_FRF_MID, frf_mid);
-	rfm95w_write_single(RFM95W_REG_08_FRF_LSB, frf_lsb);
+	// The channel is changed later with rfm95w_set_frequency.
+	radio->frequency_hz = (uint32_t)RFM95W_FREQ_RF;
+	radio->frequency_correction_hz = 0;
+	rfm95w_write_link_frequency(radio);
+	radio->noise_sampling = 0;
 
 	// Set the tx power - page 83.
 	// -4 dBm to +15 dBm from PA_HF/PA_LF.
@@ -460,44 +608,86 @@ int32_t rfm95w_init(SPI_HandleTypeDef* spi_handle)
 	// PA_CONFIG:
 	// - MaxPower. Pmax=10.8+0.6*MaxPower [dBm]
 	// - OutputPower. RFO: Pout=Pmax-(15-OutputPower). PA_BOOST: Pout=17-(15-OutputPower).
+	// The power is changed per destination later with rfm95w_set_tx_power.
+	rfm95w_write_tx_power(radio, RFM95W_DEFAULT_TX_POWER_DBM);
 
+	// Sync word and IQ - changed per network later with rfm95w_set_network
+	radio->sync_word = RFM95W_DEFAULT_SYNC_WORD;
+	radio->iq_mode = RFM95W_IQ_MODE_NORMAL;
+	rfm95w_write_single(radio, RFM95W_REG_39_SYNC_WORD, radio->sync_word);
+	radio->invert_iq_written = 0;
+	rfm95w_write_invert_iq(radio, 0);
 
-	int8_t power_dbm = 10;
-	if (power_dbm > 17)
+    g_radios[g_radio_count] = radio;
+    g_radio_count++;
+    radio->initialised = 1;
+
+    return (0);
+}
+
+
+
+/**
+ * @brief   Transmit a LoRa Packet with the RFM95W module.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  buffer_length	length of the buffer to transmit.
+ * @param[in]	  buffer buffer to transmit.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_transmit_packet(rfm95w_state_t* radio, uint32_t buffer_length, uint8_t buffer[buffer_length])
+{
+	if (rfm95w_start_transmit_packet(radio, buffer_length, buffer) != 0)
 	{
-		// Enable the DAC mode - add an additional max +3dBm
-		rfm95w_write_single(RFM95W_REG_4D_PA_DAC, RFM95W_REGVAL_4D_PA_DAC_3_DBM);
-		rfm95w_write_single(RFM95W_REG_09_PA_CONFIG, RFM95W_REGVAL_09_PA_SELECT_BOOST | ((power_dbm-3)-2));
+		// Error
+		return -1;
 	}
-	else
+
+	// Wait for the TX done interrupt to return us to listening
+	while (radio->transmit_in_progress)
 	{
-		// Disable the DAC mode 0dBm
-		rfm95w_write_single(RFM95W_REG_4D_PA_DAC, RFM95W_REGVAL_4D_PA_DAC_0_DBM);
-		rfm95w_write_single(RFM95W_REG_09_PA_CONFIG, RFM95W_REGVAL_09_PA_SELECT_BOOST | (power_dbm-2));
 	}
 
-    g_initialised = 1;
-
-    return (0);
+	return (0);
 }
 
 
-
 /**
- * @brief   Transmit a LoRa Packet with the RFM95W module.
+ * @brief   Start transmitting a LoRa Packet with the RFM95W module - non-blocking.
+ *
+ * The buffer is copied into the module FIFO before returning so it may be reused immediately.
+ * Completion is signalled by the TX done interrupt, after which the module returns to listening.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]	  buffer_length	length of the buffer to transmit.
  * @param[in]	  buffer buffer to transmit.
  * @return        0 for success or Error
  */
-int32_t rfm95w_transmit_packet(uint32_t buffer_length, uint8_t buffer[buffer_length])
+int32_t rfm95w_start_transmit_packet(rfm95w_state_t* radio, uint32_t buffer_length, uint8_t buffer[buffer_length])
 {
-	if (g_initialised == 0)
+	if ((radio->initialised == 0) || (radio->transmit_in_progress) || (buffer_length > MAX_SPI_BUFFER_LENGTH))
 	{
 		// Error
 		return -1;
 	}
 
+	// Keep the radio interrupt from interleaving SPI transfers with ours
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->packet_received)
+	{
+		// A received packet is still waiting in the module FIFO - collect it first
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	if (radio->noise_sampling)
+	{
+		// Off the link channel - send once the noise sample is done
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
 	// Explicit Mode:
 	// Preamble (8 symbols)
 	// PHDR (Physical Header) - Information about Payload Size and CRC Coding Rate.
@@ -511,230 +701,1005 @@ int32_t rfm95w_transmit_packet(uint32_t buffer_length, uint8_t buffer[buffer_len
 	// Preamble (8 symbols)
 	// BCNPayload - Beacon Payload - used for time synchronisation from gateways to end devices.
 
-	// Set to standby
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+	// Set to standby, which may be from sleep between sniffs so keep LoRa mode
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
 
 	// Set the FIFO to address zero
-	rfm95w_write_single(RFM95W_REG_0D_FIFO_ADDR_PTR, 0);
+	rfm95w_write_single(radio, RFM95W_REG_0D_FIFO_ADDR_PTR, 0);
 
 	// Write the LoRa payload
-	rfm95w_write_burst(RFM95W_REG_00_FIFO, buffer_length, &buffer[0]);
+	rfm95w_write_burst(radio, RFM95W_REG_00_FIFO, buffer_length, &buffer[0]);
 
 	// Write the length
-	rfm95w_write_single(RFM95W_REG_22_PAYLOAD_LENGTH, buffer_length);
-
-	// Now transmit
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_TX);
+	rfm95w_write_single(radio, RFM95W_REG_22_PAYLOAD_LENGTH, buffer_length);
 
-	uint8_t irq_flags;
-	rfm95w_read_single(RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
-	while ((irq_flags & RFM95W_REGVAL_12_TX_DONE) != RFM95W_REGVAL_12_TX_DONE)
-	{
-		rfm95w_read_single(RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
-	}
+	// Clear IRQ Flags and set interrupt for DIO0 on Tx Done
+	rfm95w_write_single(radio, RFM95W_REG_12_IRQ_FLAGS, 0xFF);
+	rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_TX_DONE);
 
-	// Transmission Complete
-	// Clear IRQ Flags
-	rfm95w_write_single(RFM95W_REG_12_IRQ_FLAGS, 0xFF);
+	// Downlink or uplink IQ
+	rfm95w_write_invert_iq(radio, 1);
 
-	// Back into Standby
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+	// Now transmit
+	radio->transmit_in_progress = 1;
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_TX);
 
-	rfm95w_listen_for_packets(); // return to listening for packets
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
 
 	return (0);
 }
 
 
 /**
- * @brief   Listen for incoming LoRa Packets with the RFM95W module.
+ * @brief   Is a transmission in progress on the RFM95W module.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        1 for transmitting, 0 for idle
+ */
+int32_t rfm95w_is_transmitting(rfm95w_state_t* radio)
+{
+	return radio->transmit_in_progress;
+}
+
+
+/**
+ * @brief   Change the modem configuration.
+ *
+ * Fails while transmitting. Any wake-on-radio preamble is derived again for the new symbol time,
+ * falling back to listening continuously if the latency is too short for it.
  *
- * @param	      None
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  spreading_factor RFM95W_MIN_SPREADING_FACTOR to RFM95W_MAX_SPREADING_FACTOR.
+ * @param[in]	  bandwidth_hz one of the SX1276 bandwidths, 7800 to 500000.
+ * @param[in]	  coding_rate 1 to 4 for 4/5 to 4/8.
  * @return        0 for success or Error
  */
-int32_t rfm95w_listen_for_packets()
+int32_t rfm95w_set_modem_config(rfm95w_state_t* radio, uint8_t spreading_factor, uint32_t bandwidth_hz, uint8_t coding_rate)
 {
-	if (g_initialised == 0)
+	const rfm95w_bandwidth_t* bandwidth = 0;
+	for (uint32_t idx = 0; idx < RFM95W_BANDWIDTH_COUNT; idx++)
+	{
+		if (g_bandwidths[idx].bandwidth_hz == bandwidth_hz)
+		{
+			bandwidth = &g_bandwidths[idx];
+		}
+	}
+
+	if ((radio->initialised == 0) || (bandwidth == 0) ||
+			(spreading_factor < RFM95W_MIN_SPREADING_FACTOR) || (spreading_factor > RFM95W_MAX_SPREADING_FACTOR) ||
+			(coding_rate < 1U) || (coding_rate > 4U))
 	{
 		// Error
 		return -1;
 	}
 
-	// Back into Standby
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
 
-	// Read the IRQ flags
-	uint8_t irq_flags;
-	rfm95w_read_single(RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
+	if (radio->transmit_in_progress || radio->noise_sampling)
+	{
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
 
-	rfm95w_write_single(RFM95W_REG_12_IRQ_FLAGS, 0xFF); // Clear IRQ flags
+	// Standby to change the modem, a packet waiting to be collected stays in the FIFO
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
 
+	radio->spreading_factor = spreading_factor;
+	radio->bandwidth_hz = bandwidth_hz;
+	radio->coding_rate = coding_rate;
 
-	// Rx Continuous Mode
-	rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_RXCONTINUOUS);
+	uint8_t modem_config3 = RFM95W_REGVAL_26_AGC_AUTO_ON;
+	if (rfm95w_get_symbol_time_us(radio) > RFM95W_LDRO_SYMBOL_TIME_US)
+	{
+		modem_config3 |= RFM95W_REGVAL_26_LOW_DATA_RATE_OPTIMIZE;
+	}
 
-	// Set interrupt for DIO0 on Rx Done
-	rfm95w_write_single(RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_RX_DONE);
+	rfm95w_write_single(radio, RFM95W_REG_1D_MODEM_CONFIG1, (uint8_t)(bandwidth->regval | (coding_rate << 1U)));
+	rfm95w_write_single(radio, RFM95W_REG_1E_MODEM_CONFIG2, (uint8_t)((spreading_factor << 4U) | (radio->payload_crc_on ? RFM95W_REGVAL_1E_RX_PAYLOAD_CRC_ON : 0U)));
+	rfm95w_write_single(radio, RFM95W_REG_26_MODEM_CONFIG3, modem_config3);
 
-	// Enable Interrupt on GPIO
+	if (bandwidth_hz == 500000U)
+	{
+		rfm95w_write_single(radio, RFM95W_REG_36_HIGH_BW_OPTIMIZE1, RFM95W_REGVAL_36_BW_500KHZ_OPTIMIZE);
+		rfm95w_write_single(radio, RFM95W_REG_3A_HIGH_BW_OPTIMIZE2, RFM95W_REGVAL_3A_BW_500KHZ_HF_OPTIMIZE);
+	}
+	else
+	{
+		rfm95w_write_single(radio, RFM95W_REG_36_HIGH_BW_OPTIMIZE1, RFM95W_REGVAL_36_BW_OTHER_OPTIMIZE);
+	}
+
+	// The wake-on-radio preamble is a number of symbols, so follows the symbol time
+	int32_t result = 0;
+	if ((radio->sniff_latency_ms != 0) && (rfm95w_configure_wake_on_radio(radio, radio->sniff_latency_ms) != 0))
+	{
+		rfm95w_configure_wake_on_radio(radio, 0);
+		result = -1;
+	}
 
+	if (radio->packet_received == 0)
+	{
+		rfm95w_listen_for_packets(radio);
+	}
 
-	return (0);
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return result;
 }
 
 
 /**
- * @brief   Receive a LoRa Packet with the RFM95W module.
+ * @brief   Change the transmit power, from the next transmission.
+ *
+ * Fails while transmitting. Writing the power already set costs no SPI transfers.
  *
- * @param[in]	  max_buffer_length	length of the buffer to receive into.
- * @param[out]	  buffer buffer to receive into.
- * @param[out]	  received_buffer_length count of bytes received.
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  power_dbm RFM95W_MIN_TX_POWER_DBM to RFM95W_MAX_TX_POWER_DBM.
  * @return        0 for success or Error
  */
-int32_t rfm95w_receive_packet(uint32_t max_buffer_length, volatile uint8_t buffer[max_buffer_length], volatile uint32_t* received_buffer_length)
+int32_t rfm95w_set_tx_power(rfm95w_state_t* radio, int8_t power_dbm)
 {
-	if (g_initialised == 0)
+	if ((radio->initialised == 0) || (power_dbm < RFM95W_MIN_TX_POWER_DBM) || (power_dbm > RFM95W_MAX_TX_POWER_DBM))
 	{
 		// Error
 		return -1;
 	}
 
-	uint8_t irq_flags;
-	rfm95w_read_single(RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
-
-	// Check for Rx Timeout or CRC error
-	if (irq_flags & (RFM95W_REGVAL_12_RX_TIMEOUT | RFM95W_REGVAL_12_PAYLOAD_CRC_ERROR))
+	if (power_dbm == radio->tx_power_dbm)
 	{
-		// Back into Standby
-		rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
-
-		*received_buffer_length = 0;
+		return 0;
 	}
-	else if (irq_flags & (RFM95W_REGVAL_12_RX_DONE | RFM95W_REGVAL_12_VALID_HEADER))
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress)
 	{
-		// Read the payload length
-		rfm95w_read_single(RFM95W_REG_13_RX_NB_BYTES, received_buffer_length);
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
 
-		// Read the start address of the current rx packet
-		uint8_t rx_current_address;
-		rfm95w_read_single(RFM95W_REG_10_FIFO_RX_CURRENT_ADDR, &rx_current_address);
+	rfm95w_write_tx_power(radio, power_dbm);
 
-		// Set the fifo pointer address for this packet
-		rfm95w_write_single(RFM95W_REG_0D_FIFO_ADDR_PTR, rx_current_address);
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
 
-		// Read the lora payload into the buffer
-		rfm95w_read_burst(RFM95W_REG_00_FIFO, *received_buffer_length, &buffer[0]);
+	return 0;
+}
 
-		// Read SNR and RSSI values of the last packet
-		uint8_t snr;
-		uint8_t rssi;
-		rfm95w_read_single(RFM95W_REG_19_PKT_SNR_VALUE, &snr);
-		rfm95w_read_single(RFM95W_REG_1A_PKT_RSSI_VALUE, &rssi);
 
-		// Back into Standby
-		rfm95w_write_single(RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+/**
+ * @brief   Set the network sync word and IQ direction, to reject foreign and same-direction frames in the modem.
+ *
+ * Fails while transmitting. Both ends of a link must use the same sync word, and opposite IQ
+ * modes unless both are RFM95W_IQ_MODE_NORMAL.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  sync_word network sync word, avoid 0x34 which is used by public LoRaWAN networks.
+ * @param[in]	  iq_mode IQ inversion of each direction.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_network(rfm95w_state_t* radio, uint8_t sync_word, rfm95w_iq_mode_t iq_mode)
+{
+	if ((radio->initialised == 0) || (iq_mode >= RFM95W_IQ_MODE_COUNT))
+	{
+		// Error
+		return -1;
 	}
-	else
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->noise_sampling)
 	{
-		*received_buffer_length = 0;
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
 	}
 
+	// Standby to change the modem, a packet waiting to be collected stays in the FIFO
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
 
-	return (0);
+	radio->sync_word = sync_word;
+	radio->iq_mode = iq_mode;
+	rfm95w_write_single(radio, RFM95W_REG_39_SYNC_WORD, radio->sync_word);
+	rfm95w_write_invert_iq(radio, 0);
+
+	if (radio->packet_received == 0)
+	{
+		rfm95w_listen_for_packets(radio);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
 }
 
 
 /**
- * @brief   Has a packet been received by the RFM95W module.
+ * @brief   Change the link frequency, from the next transmission or reception.
  *
- * @param	      None
- * @return        1 for packet received, 0 for no packet received, or Error
+ * Fails while transmitting or sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  frequency_hz RFM95W_MIN_FREQUENCY_HZ to RFM95W_MAX_FREQUENCY_HZ.
+ * @return        0 for success or Error
  */
-int32_t rfm95w_is_packet_received()
+int32_t rfm95w_set_frequency(rfm95w_state_t* radio, uint32_t frequency_hz)
 {
-	return g_packet_received;
+	if ((radio->initialised == 0) || (frequency_hz < RFM95W_MIN_FREQUENCY_HZ) || (frequency_hz > RFM95W_MAX_FREQUENCY_HZ))
+	{
+		// Error
+		return -1;
+	}
+
+	if (frequency_hz == radio->frequency_hz)
+	{
+		return 0;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->noise_sampling)
+	{
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	// Standby to retune, a packet waiting to be collected stays in the FIFO
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+
+	radio->frequency_hz = frequency_hz;
+	rfm95w_write_link_frequency(radio);
+
+	if (radio->packet_received == 0)
+	{
+		rfm95w_listen_for_packets(radio);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
 }
 
+
 /**
- * @brief   Clear the last packet received flag.
+ * @brief   Leave the link frequency to sample the noise on a channel with rfm95w_read_rssi.
  *
- * @param	      None
- * @return        0 for success, or Error
+ * Fails while transmitting or while a received packet waits to be collected. Nothing is received
+ * and nothing can be transmitted until rfm95w_stop_noise_sample, so keep the dwell short.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  frequency_hz channel to sample, RFM95W_MIN_FREQUENCY_HZ to RFM95W_MAX_FREQUENCY_HZ.
+ * @return        0 for success or Error
  */
-int32_t rfm95w_clear_is_packet_received()
+int32_t rfm95w_start_noise_sample(rfm95w_state_t* radio, uint32_t frequency_hz)
 {
-	g_packet_received = 0;
+	if ((radio->initialised == 0) || (frequency_hz < RFM95W_MIN_FREQUENCY_HZ) || (frequency_hz > RFM95W_MAX_FREQUENCY_HZ))
+	{
+		// Error
+		return -1;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->packet_received || radio->noise_sampling)
+	{
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	// Standby to retune, then RX with DIO0 on CAD done so a packet on the channel raises no interrupt
+	radio->noise_sampling = 1;
+	radio->sniff_state = RFM95W_SNIFF_STATE_SLEEP;
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+	rfm95w_write_frequency(radio, frequency_hz);
+	rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_CAD_DONE);
+	rfm95w_write_single(radio, RFM95W_REG_12_IRQ_FLAGS, 0xFF);
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_RXCONTINUOUS));
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
 
 	return 0;
 }
 
+
 /**
- * @brief   Copy the last received LoRa Packet into the buffer.
+ * @brief   Read the current RSSI of the channel being sampled.
  *
- * @param[in]	  max_buffer_length	length of the buffer to copy into.
- * @param[out]	  buffer buffer to copy into.
- * @param[out]	  received_buffer_length size of packet copied into the buffer
- * @return        0 for success or Error
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  rssi_dbm current RSSI.
+ * @return        0 for success or Error if not sampling
  */
-int32_t rfm95w_get_received_packet(uint32_t max_buffer_length, volatile uint8_t buffer[max_buffer_length], volatile uint32_t* received_buffer_length)
+int32_t rfm95w_read_rssi(rfm95w_state_t* radio, int16_t* rssi_dbm)
 {
-	if (g_packet_received)
+	if ((radio->initialised == 0) || (radio->noise_sampling == 0))
 	{
-		if (max_buffer_length < g_receive_buffer_length)
-		{
-			// Error
-			return -1;
-		}
-		else
-		{
-			memcpy(&buffer[0], &g_receive_buffer[0], g_receive_buffer_length);
-			*received_buffer_length = g_receive_buffer_length;
-			return 0;
-		}
+		// Error
+		return -1;
 	}
-	return -1;
-}
 
+	// RegRssiValue is the current RSSI averaged over a few samples. RegRssiWideband is not
+	// calibrated and only useful as a source of entropy, so is not used here.
+	uint8_t rssi;
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+	rfm95w_read_single(radio, RFM95W_REG_1B_RSSI_VALUE, &rssi);
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	*rssi_dbm = (int16_t)(RFM95W_RSSI_OFFSET_HF + (int16_t)rssi);
+
+	return 0;
+}
 
 
 /**
- * @brief   Process Interrupts from RFM95W module.
+ * @brief   Return to the link frequency and to listening for packets.
  *
- * @param         None
+ * @param[in/out] radio pointer to the module state struct
  * @return        0 for success or Error
  */
-int32_t rfm95w_process_interrupt()
+int32_t rfm95w_stop_noise_sample(rfm95w_state_t* radio)
 {
-	if (g_initialised == 0)
+	if ((radio->initialised == 0) || (radio->noise_sampling == 0))
 	{
 		// Error
 		return -1;
 	}
 
-	// Store into the receive buffer for user to get.
-	rfm95w_receive_packet(g_receive_buffer_max_length, g_receive_buffer, &g_receive_buffer_length);
-	if (g_receive_buffer_length > 0)
-	{
-		g_packet_received = 1;
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
 
-#if 0
-		// debug
-		char strbuffer[10];
-		uint32_t strbufferlen = sprintf("%d", g_receive_buffer_length);
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+	rfm95w_write_link_frequency(radio);
+	radio->noise_sampling = 0;
+	rfm95w_listen_for_packets(radio);
 
-		dbg_output_write_str(" Packet[");
-		dbg_output_write_buffer(strbufferlen, &strbuffer[0]);
-		dbg_output_write_str("]:");
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
 
-		dbg_output_write_buffer(g_receive_buffer_length, &g_receive_buffer[0]);
-		// Or output as hex encoded values
-		//dbg_output_write_hex_encoded_csv_buffer(g_receive_buffer_length, &g_receive_buffer[0]);
-		dbg_output_write_str("\r\n");
+	return 0;
+}
+
+
+/**
+ * @brief   Gather a random value from the noise on the link frequency.
+ *
+ * Collects the least significant bit of the wideband RSSI in RX with no packet
+ * interrupt, then returns to listening. Fails while transmitting, while a received
+ * packet waits to be collected or while sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  random_value random bits.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_get_random(rfm95w_state_t* radio, uint32_t* random_value)
+{
+	if (radio->initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->packet_received || radio->noise_sampling)
+	{
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	// RX with DIO0 on CAD done so a packet arriving meanwhile raises no interrupt
+	radio->sniff_state = RFM95W_SNIFF_STATE_SLEEP;
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+	rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_CAD_DONE);
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_RXCONTINUOUS));
+
+	// One bit of receiver noise from each reading of the wideband RSSI
+	uint32_t value = 0;
+	for (uint32_t bit = 0; bit < 32U; bit++)
+	{
+		uint8_t rssi_wideband;
+		rfm95w_read_single(radio, RFM95W_REG_2C_RSSI_WIDEBAND, &rssi_wideband);
+		value = (value << 1) | (rssi_wideband & 0x01U);
+	}
+	*random_value = value;
+
+	rfm95w_listen_for_packets(radio);
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Trim the link frequency and the data rate for the frequency offset of the peer.
+ *
+ * Fails while transmitting or sampling the noise on another channel.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  correction_hz added to the link frequency, at most RFM95W_MAX_FREQUENCY_CORRECTION_HZ either way.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_frequency_correction(rfm95w_state_t* radio, int32_t correction_hz)
+{
+	if ((radio->initialised == 0) || (correction_hz < -RFM95W_MAX_FREQUENCY_CORRECTION_HZ) || (correction_hz > RFM95W_MAX_FREQUENCY_CORRECTION_HZ))
+	{
+		// Error
+		return -1;
+	}
+
+	if (correction_hz == radio->frequency_correction_hz)
+	{
+		return 0;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->noise_sampling)
+	{
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	// Standby to retune, a packet waiting to be collected stays in the FIFO
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+
+	radio->frequency_correction_hz = correction_hz;
+	rfm95w_write_link_frequency(radio);
+
+	if (radio->packet_received == 0)
+	{
+		rfm95w_listen_for_packets(radio);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Calculate the time on air of a LoRa Packet with the current modem configuration.
+ *
+ * SX1276 Datasheet 4.1.1.7 Time on air.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[in]	  buffer_length	length of the buffer to transmit.
+ * @return        time on air in microseconds
+ */
+uint32_t rfm95w_get_time_on_air_us(rfm95w_state_t* radio, uint32_t buffer_length)
+{
+	uint32_t symbol_time_us = rfm95w_get_symbol_time_us(radio);
+
+	// Preamble time = (preamble length + 4.25) * symbol time
+	uint32_t preamble_time_us = (((4U * radio->preamble_length) + 17U) * symbol_time_us) / 4U;
+
+	// Payload symbols = 8 + max(ceil((8PL - 4SF + 28 + 16CRC - 20IH) / (4(SF - 2DE))) * (CR + 4), 0)
+	int32_t low_data_rate_optimise = (symbol_time_us > RFM95W_LDRO_SYMBOL_TIME_US) ? 1 : 0;
+	int32_t numerator = (8 * (int32_t)buffer_length) - (4 * (int32_t)radio->spreading_factor) + 28
+			+ (16 * (int32_t)radio->payload_crc_on) - (20 * (int32_t)radio->implicit_header_on);
+	int32_t denominator = 4 * ((int32_t)radio->spreading_factor - (2 * low_data_rate_optimise));
+
+	uint32_t payload_symbols = 8U;
+	if (numerator > 0)
+	{
+		payload_symbols += (uint32_t)((numerator + denominator - 1) / denominator) * (radio->coding_rate + 4U);
+	}
+
+	return preamble_time_us + (payload_symbols * symbol_time_us);
+}
+
+
+/**
+ * @brief   Listen for incoming LoRa Packets with the RFM95W module.
+ *
+ * A module that only transmits waits in standby instead.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_listen_for_packets(rfm95w_state_t* radio)
+{
+	if (radio->initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	// Back into Standby, which may be from sleep between sniffs so keep LoRa mode
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+
+	// Read the IRQ flags
+	uint8_t irq_flags;
+	rfm95w_read_single(radio, RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
+
+	rfm95w_write_single(radio, RFM95W_REG_12_IRQ_FLAGS, 0xFF); // Clear IRQ flags
+
+	// Receive IQ, also used by channel activity detection
+	rfm95w_write_invert_iq(radio, 0);
+
+	radio->sniff_state = RFM95W_SNIFF_STATE_SLEEP;
+	if (radio->config.receive_enabled == 0)
+	{
+		// Transmit only - wait in standby for the next packet
+		return (0);
+	}
+
+	if (radio->sniff_period_us != 0)
+	{
+		// Wake-on-radio - sleep until the sniff timer starts the next detection
+		rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_SLEEP));
+		return (0);
+	}
+
+
+	// Rx Continuous Mode
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_RXCONTINUOUS);
+
+	// Set interrupt for DIO0 on Rx Done
+	rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_RX_DONE);
+
+	// Enable Interrupt on GPIO
+
+
+	return (0);
+}
+
+
+/**
+ * @brief   Latch the length and FIFO address of a received LoRa Packet, leaving the payload in the module FIFO.
+ *
+ * The module is left in standby so the packet cannot be overwritten before it is collected.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[out]	  received_buffer_length count of bytes received, 0 if none or in error.
+ * @param[out]	  fifo_address module FIFO address of the packet.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_receive_packet(rfm95w_state_t* radio, volatile uint32_t* received_buffer_length, volatile uint8_t* fifo_address)
+{
+	if (radio->initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	uint8_t irq_flags;
+	rfm95w_read_single(radio, RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
+
+	// Check for Rx Timeout or CRC error
+	if (irq_flags & (RFM95W_REGVAL_12_RX_TIMEOUT | RFM95W_REGVAL_12_PAYLOAD_CRC_ERROR))
+	{
+		// Back into Standby
+		rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+
+		*received_buffer_length = 0;
+	}
+	else if (irq_flags & (RFM95W_REGVAL_12_RX_DONE | RFM95W_REGVAL_12_VALID_HEADER))
+	{
+		// Back into Standby
+		rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, RFM95W_REGVAL_01_MODE_STDBY);
+
+		// Read the payload length
+		uint8_t rx_nb_bytes;
+		rfm95w_read_single(radio, RFM95W_REG_13_RX_NB_BYTES, &rx_nb_bytes);
+		*received_buffer_length = rx_nb_bytes;
+
+		// Read the start address of the current rx packet
+		rfm95w_read_single(radio, RFM95W_REG_10_FIFO_RX_CURRENT_ADDR, fifo_address);
+
+		// Read SNR and RSSI values of the last packet, the RSSI reads high below the noise floor
+		uint8_t snr;
+		uint8_t rssi;
+		rfm95w_read_single(radio, RFM95W_REG_19_PKT_SNR_VALUE, &snr);
+		rfm95w_read_single(radio, RFM95W_REG_1A_PKT_RSSI_VALUE, &rssi);
+		radio->receive_quality.snr_quarter_db = (int8_t)snr;
+		radio->receive_quality.rssi_dbm = RFM95W_RSSI_OFFSET_HF + rssi;
+		if (radio->receive_quality.snr_quarter_db < 0)
+		{
+			radio->receive_quality.rssi_dbm += radio->receive_quality.snr_quarter_db / 4;
+		}
+
+		// Frequency error - Ferr = FEI * 2^24 / Fxosc * BW / 500 kHz, relative to the trimmed receiver
+		uint8_t fei[3];
+		rfm95w_read_burst(radio, RFM95W_REG_28_FEI_MSB, sizeof(fei), &fei[0]);
+		int32_t fei_value = (int32_t)((((uint32_t)fei[0] & 0x0FU) << 16U) | ((uint32_t)fei[1] << 8U) | (uint32_t)fei[2]);
+		if (fei_value & RFM95W_FEI_SIGN_BIT)
+		{
+			fei_value -= (2 * RFM95W_FEI_SIGN_BIT);
+		}
+		int64_t error_hz = ((int64_t)fei_value * (int64_t)(radio->bandwidth_hz / 100U) * (1LL << 24)) / ((int64_t)RFM95W_FXOSC * 5000LL);
+		radio->receive_quality.frequency_error_hz = (int32_t)error_hz + radio->frequency_correction_hz;
+	}
+	else
+	{
+		*received_buffer_length = 0;
+	}
+
+
+	return (0);
+}
+
+
+/**
+ * @brief   Has a packet been received by the RFM95W module.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        1 for packet received, 0 for no packet received, or Error
+ */
+int32_t rfm95w_is_packet_received(rfm95w_state_t* radio)
+{
+	return radio->packet_received;
+}
+
+/**
+ * @brief   Clear the last packet received flag.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success, or Error
+ */
+int32_t rfm95w_clear_is_packet_received(rfm95w_state_t* radio)
+{
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->packet_received)
+	{
+		radio->packet_received = 0;
+
+		// The module waited in standby for the packet to be collected - start listening again
+		rfm95w_listen_for_packets(radio);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+/**
+ * @brief   Get the length of the received LoRa Packet waiting in the module FIFO.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        length in bytes, 0 if no packet is waiting
+ */
+uint32_t rfm95w_get_received_length(rfm95w_state_t* radio)
+{
+	if (radio->packet_received)
+	{
+		return radio->receive_buffer_length;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief   Read the start of the received LoRa Packet from the module FIFO.
+ *
+ * Lets the caller inspect the packet header before deciding where, or whether, to read the rest.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  header_length	number of bytes to read from the start of the packet.
+ * @param[out]	  buffer buffer to read into.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_read_received_header(rfm95w_state_t* radio, uint32_t header_length, volatile uint8_t buffer[header_length])
+{
+	if ((radio->packet_received == 0) || (header_length > radio->receive_buffer_length))
+	{
+		// Error
+		return -1;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (header_length <= radio->receive_header_length)
+	{
+		// Already read in the interrupt - just move the fifo pointer to the first payload byte
+		for (uint32_t idx = 0; idx < header_length; idx++)
+		{
+			buffer[idx] = radio->receive_header[idx];
+		}
+		rfm95w_write_single(radio, RFM95W_REG_0D_FIFO_ADDR_PTR, (uint8_t)(radio->receive_fifo_address + header_length));
+	}
+	else
+	{
+		// Set the fifo pointer address for this packet
+		rfm95w_write_single(radio, RFM95W_REG_0D_FIFO_ADDR_PTR, radio->receive_fifo_address);
+
+		// Read the header, the fifo pointer is left on the first payload byte
+		rfm95w_read_burst(radio, RFM95W_REG_00_FIFO, header_length, &buffer[0]);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the signal quality of the received LoRa Packet waiting in the module FIFO.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  quality SNR, RSSI and frequency error latched with the packet.
+ * @return        0 for success or Error if no packet is waiting
+ */
+int32_t rfm95w_get_received_quality(rfm95w_state_t* radio, rfm95w_packet_quality_t* quality)
+{
+	if (radio->packet_received == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	quality->snr_quarter_db = radio->receive_quality.snr_quarter_db;
+	quality->rssi_dbm = radio->receive_quality.rssi_dbm;
+	quality->frequency_error_hz = radio->receive_quality.frequency_error_hz;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Continue reading the received LoRa Packet from where the last read finished.
+ *
+ * May be called repeatedly to scatter the payload across several buffers.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  buffer_length	number of bytes to read.
+ * @param[out]	  buffer buffer to read into.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_read_received_payload(rfm95w_state_t* radio, uint32_t buffer_length, volatile uint8_t buffer[buffer_length])
+{
+	if ((radio->packet_received == 0) || (buffer_length > radio->receive_buffer_length))
+	{
+		// Error
+		return -1;
+	}
+
+	if (buffer_length == 0)
+	{
+		return 0;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	rfm95w_read_burst(radio, RFM95W_REG_00_FIFO, buffer_length, &buffer[0]);
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+
+/**
+ * @brief   Set the destination address allow-list checked in the interrupt.
+ *
+ * The first byte of each received frame is compared against the list and frames that do not match
+ * are discarded without reading the rest of the FIFO. Frames shorter than RFM95W_RECEIVE_HEADER_LENGTH
+ * are also discarded while the filter is enabled. An address_count of 0 disables the filter.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  address_count	number of addresses in the list.
+ * @param[in]	  addresses own, broadcast and multicast group addresses to accept.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_set_address_filter(rfm95w_state_t* radio, uint32_t address_count, const uint8_t addresses[address_count])
+{
+	if (address_count > RFM95W_ADDRESS_FILTER_MAX)
+	{
+		// Error
+		return -1;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	for (uint32_t idx = 0; idx < address_count; idx++)
+	{
+		radio->address_filter[idx] = addresses[idx];
+	}
+	radio->address_filter_count = address_count;
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the receive address filter statistics.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  stats copy of the statistics.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_get_filter_stats(rfm95w_state_t* radio, rfm95w_filter_stats_t* stats)
+{
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	*stats = radio->filter_stats;
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+
+/**
+ * @brief   Set the wake-on-radio receive latency.
+ *
+ * A latency of 0 listens in RX continuous. Otherwise the module sleeps and wakes for a channel activity
+ * detection every sniff period, entering RX only when it detects a preamble. Packets are sent with a
+ * preamble that spans the sniff period, so both ends of the link must use the same latency. The sniff
+ * period and the preamble length are derived from the latency and the modem configuration.
+ * The software timer service must already be running.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]	  latency_ms time allowed for the preamble ahead of each packet, 0 to listen continuously.
+ * @return        0 for success or Error if the latency is too short for the modem configuration
+ */
+int32_t rfm95w_set_wake_on_radio(rfm95w_state_t* radio, uint32_t latency_ms)
+{
+	if (radio->initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	if (radio->sniff_timer == SOFT_TIMER_ID_INVALID)
+	{
+		if (soft_timer_create(rfm95w_sniff_timer_callback, &radio->sniff_timer) != 0)
+		{
+			// Error
+			return -1;
+		}
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	if (radio->transmit_in_progress || radio->noise_sampling)
+	{
+		// The packet on air has the old preamble - change after TX done
+		HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+		return -1;
+	}
+
+	// Standby to write the preamble length, a packet waiting to be collected stays in the FIFO
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+	int32_t result = rfm95w_configure_wake_on_radio(radio, latency_ms);
+
+	if (radio->packet_received == 0)
+	{
+		rfm95w_listen_for_packets(radio);
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return result;
+}
+
+
+/**
+ * @brief   Get the wake-on-radio statistics.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @param[out]	  stats copy of the statistics.
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_get_sniff_stats(rfm95w_state_t* radio, rfm95w_sniff_stats_t* stats)
+{
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	*stats = radio->sniff_stats;
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+
+	return 0;
+}
+
+
+
+/**
+ * @brief   Process Interrupts from RFM95W module.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+int32_t rfm95w_process_interrupt(rfm95w_state_t* radio)
+{
+	if (radio->initialised == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	if (radio->transmit_in_progress)
+	{
+		uint8_t irq_flags;
+		rfm95w_read_single(radio, RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
+		if (irq_flags & RFM95W_REGVAL_12_TX_DONE)
+		{
+			// Transmission Complete - return to listening for packets (clears the IRQ flags)
+			radio->transmit_in_progress = 0;
+			rfm95w_listen_for_packets(radio);
+		}
+
+		return (0);
+	}
+
+	if (radio->packet_received || radio->noise_sampling)
+	{
+		// Previous packet not collected yet - the module is in standby so nothing new to report.
+		// Or sampling noise, with DIO0 on CAD done which cannot fire in RX.
+		return (0);
+	}
+
+	if (radio->sniff_state == RFM95W_SNIFF_STATE_CAD)
+	{
+		// CAD done - receive the packet behind a detected preamble, otherwise back to sleep
+		uint8_t irq_flags;
+		rfm95w_read_single(radio, RFM95W_REG_12_IRQ_FLAGS, &irq_flags);
+		rfm95w_write_single(radio, RFM95W_REG_12_IRQ_FLAGS, 0xFF);
+
+		if (irq_flags & RFM95W_REGVAL_12_CAD_DETECTED)
+		{
+			radio->sniff_stats.cad_detected++;
+			radio->sniff_state = RFM95W_SNIFF_STATE_RECEIVE;
+			radio->sniff_receive_start_ticks = soft_timer_get_ticks();
+
+			rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_RX_DONE);
+			rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_RXCONTINUOUS));
+		}
+		else
+		{
+			radio->sniff_state = RFM95W_SNIFF_STATE_SLEEP;
+			rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_SLEEP));
+		}
+
+		return (0);
+	}
+
+	// Latch the packet in the module FIFO for the user to read.
+	rfm95w_receive_packet(radio, &radio->receive_buffer_length, &radio->receive_fifo_address);
+	if (radio->receive_buffer_length > 0)
+	{
+		// Read just the header to decide whether the rest of the packet is wanted
+		radio->receive_header_length = radio->receive_buffer_length;
+		if (radio->receive_header_length > RFM95W_RECEIVE_HEADER_LENGTH)
+		{
+			radio->receive_header_length = RFM95W_RECEIVE_HEADER_LENGTH;
+		}
+		rfm95w_write_single(radio, RFM95W_REG_0D_FIFO_ADDR_PTR, radio->receive_fifo_address);
+		rfm95w_read_burst(radio, RFM95W_REG_00_FIFO, radio->receive_header_length, &radio->receive_header[0]);
+
+		if (rfm95w_is_address_accepted(radio) == 0)
+		{
+			// Not for us - discard and go straight back to listening
+			radio->filter_stats.frames_filtered++;
+			radio->filter_stats.bytes_filtered += radio->receive_buffer_length - radio->receive_header_length;
+			radio->receive_buffer_length = 0;
+			radio->receive_header_length = 0;
+
+			rfm95w_listen_for_packets(radio);
+			return (0);
+		}
+
+		radio->filter_stats.frames_accepted++;
+		radio->packet_received = 1;
+
+#if 0
+		// debug
+		char strbuffer[10];
+		uint32_t strbufferlen = sprintf("%d", radio->receive_buffer_length);
+
+		dbg_output_write_str(" Packet[");
+		dbg_output_write_buffer(strbufferlen, &strbuffer[0]);
+		dbg_output_write_str("]:");
+
+		dbg_output_write_str("\r\n");
 #endif
+
+		// Stay in standby until the packet is collected
+		return (0);
 	}
 
 	 // start listening
-	 rfm95w_listen_for_packets();
+	 rfm95w_listen_for_packets(radio);
 
 
 	return (0);
@@ -745,26 +1710,320 @@ int32_t rfm95w_process_interrupt()
  */
 
 
+/**
+ * @brief   Check the latched header of a received LoRa Packet against the address filter.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        1 to accept the packet, 0 to discard it
+ */
+static int32_t rfm95w_is_address_accepted(rfm95w_state_t* radio)
+{
+	if (radio->address_filter_count == 0)
+	{
+		// Filter disabled
+		return 1;
+	}
+
+	if (radio->receive_header_length < RFM95W_RECEIVE_HEADER_LENGTH)
+	{
+		// Too short to carry a header
+		return 0;
+	}
+
+	for (uint32_t idx = 0; idx < radio->address_filter_count; idx++)
+	{
+		if (radio->receive_header[0] == radio->address_filter[idx])
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the symbol time of the current modem configuration.
+ *
+ * @param[in]     radio pointer to the module state struct
+ * @return        symbol time in microseconds
+ */
+static uint32_t rfm95w_get_symbol_time_us(rfm95w_state_t* radio)
+{
+	// Symbol time = 2^SF / BW
+	return (uint32_t)((((uint64_t)1U << radio->spreading_factor) * 1000000U) / radio->bandwidth_hz);
+}
+
+
+/**
+ * @brief   Write the PA, PA_DAC and over current protection registers for an output power.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     power_dbm RFM95W_MIN_TX_POWER_DBM to RFM95W_MAX_TX_POWER_DBM.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_tx_power(rfm95w_state_t* radio, int8_t power_dbm)
+{
+	if (power_dbm > 17)
+	{
+		// Enable the DAC mode - add an additional max +3dBm, drawing up to 120mA so raise the current limit
+		rfm95w_write_single(radio, RFM95W_REG_0B_OCP, (RFM95W_REGVAL_0B_OCP_ON | RFM95W_REGVAL_0B_OCP_TRIM_140MA));
+		rfm95w_write_single(radio, RFM95W_REG_4D_PA_DAC, (RFM95W_REGVAL_4D_PA_DAC_RESERVED | RFM95W_REGVAL_4D_PA_DAC_3_DBM));
+		rfm95w_write_single(radio, RFM95W_REG_09_PA_CONFIG, RFM95W_REGVAL_09_PA_SELECT_BOOST | ((power_dbm-3)-2));
+	}
+	else
+	{
+		// Disable the DAC mode 0dBm, the default current limit is enough
+		rfm95w_write_single(radio, RFM95W_REG_4D_PA_DAC, (RFM95W_REGVAL_4D_PA_DAC_RESERVED | RFM95W_REGVAL_4D_PA_DAC_0_DBM));
+		rfm95w_write_single(radio, RFM95W_REG_09_PA_CONFIG, RFM95W_REGVAL_09_PA_SELECT_BOOST | (power_dbm-2));
+		rfm95w_write_single(radio, RFM95W_REG_0B_OCP, (RFM95W_REGVAL_0B_OCP_ON | RFM95W_REGVAL_0B_OCP_TRIM_100MA));
+	}
+
+	radio->tx_power_dbm = power_dbm;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Write the IQ inversion of the direction about to be used, if it differs from the module.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     transmit 1 before transmitting, 0 before receiving or channel activity detection.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_invert_iq(rfm95w_state_t* radio, uint8_t transmit)
+{
+	uint8_t inverted = 0;
+	if (transmit)
+	{
+		inverted = (radio->iq_mode == RFM95W_IQ_MODE_DOWNLINK);
+	}
+	else
+	{
+		inverted = (radio->iq_mode == RFM95W_IQ_MODE_UPLINK);
+	}
+
+	uint8_t regval = RFM95W_REGVAL_33_RESERVED | RFM95W_REGVAL_33_INVERT_IQ_TX_OFF;
+	if (inverted && transmit)
+	{
+		regval = RFM95W_REGVAL_33_RESERVED;
+	}
+	else if (inverted)
+	{
+		regval |= RFM95W_REGVAL_33_INVERT_IQ_RX_ON;
+	}
+
+	// Normal IQ both ways never changes, so only the inverted modes cost SPI transfers on each turnaround
+	if (regval != radio->invert_iq_written)
+	{
+		rfm95w_write_single(radio, RFM95W_REG_33_INVERT_IQ, regval);
+		rfm95w_write_single(radio, RFM95W_REG_3B_INVERT_IQ2, (inverted ? RFM95W_REGVAL_3B_INVERT_IQ2_ON : RFM95W_REGVAL_3B_INVERT_IQ2_OFF));
+		radio->invert_iq_written = regval;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Write the carrier frequency, in sleep or standby.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     frequency_hz carrier frequency.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_frequency(rfm95w_state_t* radio, uint32_t frequency_hz)
+{
+	// Frf = FREQ_RF * 2^19 / FXOSC, in integers for an exact channel plan
+	uint32_t frf = (uint32_t)(((uint64_t)frequency_hz << 19U) / RFM95W_FXOSC);
+	uint8_t frf_msb = (uint8_t)((frf >> 16U) & 0xFF);
+	uint8_t frf_mid = (uint8_t)((frf >> 8U) & 0xFF);
+	uint8_t frf_lsb =  (uint8_t)(frf & 0xFF);
+	rfm95w_write_single(radio, RFM95W_REG_06_FRF_MSB, frf_msb);
+	rfm95w_write_single(radio, RFM95W_REG_07_FRF_MID, frf_mid);
+	rfm95w_write_single(radio, RFM95W_REG_08_FRF_LSB, frf_lsb);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Write the link frequency with its correction, and the matching data rate correction.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_write_link_frequency(rfm95w_state_t* radio)
+{
+	rfm95w_write_frequency(radio, (uint32_t)((int64_t)radio->frequency_hz + radio->frequency_correction_hz));
+
+	// The symbol rate is off by the same ppm as the carrier, RegPpmCorrection = 0.95 * offset in ppm
+	int64_t ppm_correction = ((int64_t)radio->frequency_correction_hz * 950000LL) / (int64_t)radio->frequency_hz;
+	if (ppm_correction < INT8_MIN)
+	{
+		ppm_correction = INT8_MIN;
+	}
+	else if (ppm_correction > INT8_MAX)
+	{
+		ppm_correction = INT8_MAX;
+	}
+	rfm95w_write_single(radio, RFM95W_REG_27_PPM_CORRECTION, (uint8_t)(int8_t)ppm_correction);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Derive the preamble length and sniff period from the wake-on-radio latency and write the preamble.
+ *
+ * Called in standby with the DIO0 interrupt disabled. Nothing is changed if the latency is too short.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @param[in]     latency_ms time allowed for the preamble ahead of each packet, 0 to listen continuously.
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_configure_wake_on_radio(rfm95w_state_t* radio, uint32_t latency_ms)
+{
+	uint32_t preamble_length = 8U;
+	uint32_t sniff_period_us = 0;
+	if (latency_ms != 0)
+	{
+		// The whole preamble, with the 4.25 symbols the modem adds, fits in the latency. A detection starts every
+		// sniff period, so the last one that can start within the preamble still leaves it time to lock on.
+		uint32_t symbol_time_us = rfm95w_get_symbol_time_us(radio);
+		uint64_t latency_symbols = ((uint64_t)latency_ms * 1000U) / symbol_time_us;
+		if (latency_symbols < (RFM95W_SNIFF_MIN_PREAMBLE_SYMBOLS + 5U))
+		{
+			// Error
+			return -1;
+		}
+
+		preamble_length = (uint32_t)(latency_symbols - 5U);
+		if (preamble_length > RFM95W_MAX_PREAMBLE_SYMBOLS)
+		{
+			preamble_length = RFM95W_MAX_PREAMBLE_SYMBOLS;
+		}
+		sniff_period_us = (preamble_length - RFM95W_CAD_SYMBOLS - RFM95W_SNIFF_LOCK_SYMBOLS) * symbol_time_us;
+	}
+
+	radio->sniff_latency_ms = latency_ms;
+	radio->preamble_length = (uint16_t)preamble_length;
+	rfm95w_write_single(radio, RFM95W_REG_20_PREAMBLE_MSB, (uint8_t)(radio->preamble_length >> 8U));
+	rfm95w_write_single(radio, RFM95W_REG_21_PREAMBLE_LSB, (uint8_t)(radio->preamble_length & 0xFF));
+
+	// A false detection stays in RX for the longest packet before going back to sleep
+	radio->sniff_period_us = sniff_period_us;
+	radio->sniff_receive_timeout_ticks = (uint32_t)(((uint64_t)rfm95w_get_time_on_air_us(radio, MAX_SPI_BUFFER_LENGTH) * SOFT_TIMER_TICK_FREQUENCY_HZ) / 1000000U);
+
+	if ((radio->sniff_period_us != 0) && radio->config.receive_enabled)
+	{
+		soft_timer_start(radio->sniff_timer, radio->sniff_period_us, radio->sniff_period_us);
+	}
+	else
+	{
+		soft_timer_stop(radio->sniff_timer);
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Start a channel activity detection, with DIO0 on CAD done.
+ *
+ * @param[in/out] radio pointer to the module state struct
+ * @return        0 for success or Error
+ */
+static int32_t rfm95w_start_cad(rfm95w_state_t* radio)
+{
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_STDBY));
+	rfm95w_write_single(radio, RFM95W_REG_12_IRQ_FLAGS, 0xFF);
+	rfm95w_write_single(radio, RFM95W_REG_40_DIO_MAPPING1, RFM95W_REGVAL_40_DIO0_CAD_DONE);
+
+	radio->sniff_state = RFM95W_SNIFF_STATE_CAD;
+	radio->sniff_stats.cad_count++;
+	rfm95w_write_single(radio, RFM95W_REG_01_OP_MODE, (RFM95W_REGVAL_01_LONG_RANGE_MODE | RFM95W_REGVAL_01_MODE_CAD));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Sniff period elapsed - start the next detection, or give up on a detection that received nothing.
+ *
+ * Called from the main loop by the software timer service.
+ *
+ * @param[in]     timer_id the timer
+ * @return        None
+ */
+static void rfm95w_sniff_timer_callback(soft_timer_id_t timer_id)
+{
+	rfm95w_state_t* radio = 0;
+	for (uint32_t idx = 0; idx < g_radio_count; idx++)
+	{
+		if (g_radios[idx]->sniff_timer == timer_id)
+		{
+			radio = g_radios[idx];
+		}
+	}
+
+	if (radio == 0)
+	{
+		// Error
+		return;
+	}
+
+	HAL_NVIC_DisableIRQ(radio->config.g0_irqn);
+
+	// Nothing to do while transmitting, while a packet waits in the FIFO or while sampling noise
+	if ((radio->sniff_period_us != 0) && (radio->transmit_in_progress == 0) && (radio->packet_received == 0) && (radio->noise_sampling == 0))
+	{
+		switch (radio->sniff_state)
+		{
+		case RFM95W_SNIFF_STATE_RECEIVE:
+			// The longest packet would have been received by now - the detection was false
+			if ((soft_timer_get_ticks() - radio->sniff_receive_start_ticks) >= radio->sniff_receive_timeout_ticks)
+			{
+				radio->sniff_stats.false_wakes++;
+				rfm95w_listen_for_packets(radio);
+			}
+			break;
+
+		case RFM95W_SNIFF_STATE_CAD:
+			// CAD done was missed - start again
+		case RFM95W_SNIFF_STATE_SLEEP:
+		default:
+			rfm95w_start_cad(radio);
+			break;
+		}
+	}
+
+	HAL_NVIC_EnableIRQ(radio->config.g0_irqn);
+}
+
+
 /**
  * @brief   Write burst data to the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     buffer_length the length of the data buffer to send.
  * @param[in]     buffer the data buffer to send.
  * @return        0 for success or Error
  */
-static int32_t rfm95w_write_burst(const uint8_t register_address, const uint8_t buffer_length, const uint8_t buffer[buffer_length])
+static int32_t rfm95w_write_burst(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t buffer_length, const uint8_t buffer[buffer_length])
 {
 	uint8_t tx_byte = register_address | SPI_REGISTER_WRITE_FLAG; // set the write flag
 
 	// Chip Select low at start of frame
-	HAL_GPIO_WritePin(RFM95W_CS_GPIO_PORT, RFM95W_CS_GPIO_PIN, 0U);
+	HAL_GPIO_WritePin(radio->config.cs_port, radio->config.cs_pin, 0U);
 	// Transmit the address and write flag
-	HAL_SPI_Transmit(g_spi_handle, &tx_byte, 1, 100);
+	HAL_SPI_Transmit(radio->config.spi_handle, &tx_byte, 1, 100);
 	// transmit the remaining data
-	HAL_SPI_Transmit(g_spi_handle, &buffer[0], buffer_length, 100);
+	HAL_SPI_Transmit(radio->config.spi_handle, &buffer[0], buffer_length, 100);
 	// Chip Select high at end of frame
-	HAL_GPIO_WritePin(RFM95W_CS_GPIO_PORT, RFM95W_CS_GPIO_PIN, 1U);
+	HAL_GPIO_WritePin(radio->config.cs_port, radio->config.cs_pin, 1U);
 
 	asm("nop");
 
@@ -775,36 +2034,39 @@ static int32_t rfm95w_write_burst(const uint8_t register_address, const uint8_t
 /**
  * @brief   Write single data to the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     data_byte the data byte to send.
  * @return        0 for success or Error
  */
-static int32_t rfm95w_write_single(const uint8_t register_address, const uint8_t data_byte)
+static int32_t rfm95w_write_single(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t data_byte)
 {
-	return rfm95w_write_burst(register_address, 1, &data_byte);
+	return rfm95w_write_burst(radio, register_address, 1, &data_byte);
 }
 
 
 /**
  * @brief   Read burst data from the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[in]     buffer_length the length of the data buffer to receive.
  * @param[out]    buffer the data buffer to receive into.
  * @return        0 for success or Error
  */
-static volatile int32_t rfm95w_read_burst(const uint8_t register_address, const uint8_t buffer_length, volatile uint8_t buffer[buffer_length])
+static volatile int32_t rfm95w_read_burst(rfm95w_state_t* radio, const uint8_t register_address, const uint8_t buffer_length, volatile uint8_t buffer[buffer_length])
 {
 	uint8_t tx_byte = register_address & ~(SPI_REGISTER_WRITE_FLAG); // clear the write flag
 
 	// Chip Select low at start of frame
-	HAL_GPIO_WritePin(RFM95W_CS_GPIO_PORT, RFM95W_CS_GPIO_PIN, 0U);
+	HAL_GPIO_WritePin(radio->config.cs_port, radio->config.cs_pin, 0U);
 	// Transmit the address and write flag
-	HAL_SPI_Transmit(g_spi_handle, &tx_byte, 1, 100);
-	// receive the remaining data
-	HAL_SPI_TransmitReceive(g_spi_handle, &g_null_buffer[0], &buffer[0], buffer_length, 100);
+	HAL_SPI_Transmit(radio->config.spi_handle, &tx_byte, 1, 100);
+	// receive the remaining data. The HAL takes a plain pointer, the transfer is blocking so the
+	// buffer is not touched by anything else until it returns.
+	HAL_SPI_TransmitReceive(radio->config.spi_handle, &g_null_buffer[0], (uint8_t*)&buffer[0], buffer_length, 100);
 	// Chip Select high at end of frame
-	HAL_GPIO_WritePin(RFM95W_CS_GPIO_PORT, RFM95W_CS_GPIO_PIN, 1U);
+	HAL_GPIO_WritePin(radio->config.cs_port, radio->config.cs_pin, 1U);
 
 	asm("nop");
 
@@ -815,13 +2077,14 @@ static volatile int32_t rfm95w_read_burst(const uint8_t register_address, const
 /**
  * @brief   Read single data from the RFM95W module.
  *
+ * @param[in/out] radio pointer to the module state struct
  * @param[in]     register_address the register to begin writing to.
  * @param[out]    data_byte the data byte to receive into.
  * @return        0 for success or Error
  */
-static volatile int32_t rfm95w_read_single(const uint8_t register_address, volatile uint8_t* data_byte)
+static volatile int32_t rfm95w_read_single(rfm95w_state_t* radio, const uint8_t register_address, volatile uint8_t* data_byte)
 {
-	return rfm95w_read_burst(register_address, 1, data_byte);
+	return rfm95w_read_burst(radio, register_address, 1, data_byte);
 }
 
 /* End of file */
@@ -0,0 +1,304 @@
+/**
+ * @file    scheduler.c
+ *
+ * @brief   Cooperative Run-to-Completion Task Scheduler.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The task table is kept in registration order, with a second table of
+ *  indexes sorted by priority for the passes. Run times are measured with
+ *  the DWT cycle counter, which only needs to count while a task runs and
+ *  so is unaffected by the core sleeping between passes.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "scheduler.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* A task in the table */
+typedef struct scheduler_task_t_
+{
+	scheduler_task_config_t config;
+	uint32_t last_run_ms;			/*!< Time the task last ran, for the period */
+	scheduler_task_stats_t stats;
+} scheduler_task_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static scheduler_task_t g_tasks[SCHEDULER_MAX_TASKS] = {0};
+static uint8_t g_task_order[SCHEDULER_MAX_TASKS] = {0};	/*!< Task ids, highest priority first */
+static uint32_t g_task_count = 0;
+
+static scheduler_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static uint32_t scheduler_cycles_to_us (uint32_t cycles);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Scheduler with an empty task table.
+ *
+ * Enables the DWT cycle counter used for the run time accounting.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t scheduler_init ()
+{
+	memset(g_tasks, 0, sizeof(g_tasks));
+	g_task_count = 0;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+	g_stats.longest_run_task_id = SCHEDULER_TASK_ID_NONE;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Add a task to the table.
+ *
+ * @param[in]     config task configuration
+ * @param[out]    task_id id of the task for the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_add_task (const scheduler_task_config_t* config, uint8_t* task_id)
+{
+	if ((config == 0) || (config->function == 0) || (g_task_count >= SCHEDULER_MAX_TASKS))
+	{
+		// Error
+		return -1;
+	}
+
+	uint8_t new_id = (uint8_t)g_task_count;
+	g_tasks[new_id].config = *config;
+	g_tasks[new_id].last_run_ms = 0;
+	memset(&g_tasks[new_id].stats, 0, sizeof(scheduler_task_stats_t));
+
+	// Insert behind the tasks of the same or higher priority
+	uint32_t position = g_task_count;
+	while ((position > 0) && (g_tasks[g_task_order[position - 1U]].config.priority > config->priority))
+	{
+		g_task_order[position] = g_task_order[position - 1U];
+		position--;
+	}
+	g_task_order[position] = new_id;
+	g_task_count++;
+
+	if (task_id != 0)
+	{
+		*task_id = new_id;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Run every ready task once, highest priority first.
+ *
+ * @param[in]     events EVENTS_ flags taken since the last pass
+ * @param[in]     now_ms current time
+ * @return        number of tasks run
+ */
+uint32_t scheduler_run (uint32_t events, uint32_t now_ms)
+{
+	uint32_t tasks_run = 0;
+	uint32_t pass_start = DWT->CYCCNT;
+
+	for (uint32_t idx = 0; idx < g_task_count; idx++)
+	{
+		uint8_t task_id = g_task_order[idx];
+		scheduler_task_t* task = &g_tasks[task_id];
+
+		uint8_t ready = ((events & task->config.event_mask) != 0) ? 1U : 0U;
+		if ((task->config.period_ms != 0) && ((now_ms - task->last_run_ms) >= task->config.period_ms))
+		{
+			ready = 1;
+		}
+		if (ready == 0)
+		{
+			continue;
+		}
+
+		uint32_t run_start = DWT->CYCCNT;
+		task->config.function();
+		uint32_t run_end = DWT->CYCCNT;
+
+		task->last_run_ms = now_ms;
+		tasks_run++;
+
+		// Run time accounting
+		uint32_t latency_us = scheduler_cycles_to_us(run_start - pass_start);
+		uint32_t run_time_us = scheduler_cycles_to_us(run_end - run_start);
+
+		task->stats.runs++;
+		task->stats.run_time_total_us += run_time_us;
+		if (run_time_us > task->stats.run_time_max_us)
+		{
+			task->stats.run_time_max_us = run_time_us;
+		}
+		if (latency_us > task->stats.latency_max_us)
+		{
+			task->stats.latency_max_us = latency_us;
+		}
+		if ((task->config.deadline_us != 0) && (latency_us > task->config.deadline_us))
+		{
+			task->stats.deadline_misses++;
+		}
+
+		if ((g_stats.longest_run_task_id == SCHEDULER_TASK_ID_NONE) || (run_time_us > g_stats.longest_run_us))
+		{
+			g_stats.longest_run_us = run_time_us;
+			g_stats.longest_run_task_id = task_id;
+		}
+	}
+
+	if (tasks_run != 0)
+	{
+		g_stats.passes++;
+	}
+
+	return tasks_run;
+}
+
+
+/**
+ * @brief   Get the name of a task.
+ *
+ * @param[in]     task_id id of the task
+ * @return        name of the task, or 0 for an invalid id
+ */
+const char* scheduler_get_task_name (uint8_t task_id)
+{
+	if (task_id >= g_task_count)
+	{
+		return 0;
+	}
+
+	return g_tasks[task_id].config.name;
+}
+
+
+/**
+ * @brief   Get the statistics of a task.
+ *
+ * @param[in]     task_id id of the task
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_get_task_stats (uint8_t task_id, scheduler_task_stats_t* stats)
+{
+	if ((task_id >= g_task_count) || (stats == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	*stats = g_tasks[task_id].stats;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the statistics across all tasks.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t scheduler_get_stats (scheduler_stats_t* stats)
+{
+	if (stats == 0)
+	{
+		// Error
+		return -1;
+	}
+
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Convert DWT cycles to microseconds at the current core clock.
+ *
+ * @param[in]     cycles core clock cycles
+ * @return        microseconds
+ */
+static uint32_t scheduler_cycles_to_us (uint32_t cycles)
+{
+	uint32_t cycles_per_us = SystemCoreClock / 1000000U;
+	if (cycles_per_us == 0)
+	{
+		cycles_per_us = 1;
+	}
+
+	return cycles / cycles_per_us;
+}
+
+
+/* End of file */
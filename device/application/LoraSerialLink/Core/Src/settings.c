@@ -0,0 +1,259 @@
+/**
+ * @file    settings.c
+ *
+ * @brief   Persistent Settings.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The record is a magic number, the layout size, the settings and a CRC,
+ *  padded to whole double words as flash is programmed 64 bits at a time.
+ *  The page is in bank 2 so the program keeps running from bank 1 while it
+ *  is erased and written.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "settings.h"
+#include "rfm95w.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define SETTINGS_FLASH_BANK			(FLASH_BANK_2)
+#define SETTINGS_FLASH_PAGE			(255U)											/*!< Last page of bank 2 */
+#define SETTINGS_FLASH_ADDRESS		(FLASH_BASE + (2U * 256U * FLASH_PAGE_SIZE) - FLASH_PAGE_SIZE)	/*!< 0x080FF800 */
+
+#define SETTINGS_MAGIC				(0x4C53524CU)		/*!< "LRSL" */
+
+#define SETTINGS_CRC32_POLYNOMIAL	(0xEDB88320U)		/*!< Reflected CRC-32 */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/**
+ * @brief   Record stored in flash.
+ */
+typedef struct settings_record_t_
+{
+	uint32_t magic;					/*!< SETTINGS_MAGIC */
+	uint32_t settings_size;			/*!< sizeof(settings_t) when written */
+	settings_t settings;
+	uint32_t crc;					/*!< CRC-32 of the fields above */
+} settings_record_t;
+
+/**
+ * @brief   Record padded to whole double words for programming.
+ */
+typedef union settings_record_flash_t_
+{
+	settings_record_t record;
+	uint64_t double_words[(sizeof(settings_record_t) + sizeof(uint64_t) - 1U) / sizeof(uint64_t)];
+} settings_record_flash_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+static const settings_t g_default_settings =
+{
+	.serial_baud_rate = SETTINGS_DEFAULT_SERIAL_BAUD_RATE,
+	.serial_auto_baud = SETTINGS_DEFAULT_SERIAL_AUTO_BAUD,
+	.serial_wake = 1,
+	.radio_wake_latency_ms = 0,
+	.radio_sync_word = RFM95W_DEFAULT_SYNC_WORD,
+	.radio_iq_mode = RFM95W_IQ_MODE_NORMAL,
+};
+
+
+
+/*
+ * Private: Variables
+ */
+
+static settings_t g_settings = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Calculate the CRC-32 of a buffer.
+ *
+ * @param[in]     buffer_length length of the buffer
+ * @param[in]     buffer the buffer
+ * @return        CRC-32
+ */
+static uint32_t settings_crc32 (uint32_t buffer_length, const uint8_t buffer[buffer_length]);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Settings from flash, or the defaults if none are saved.
+ *
+ * @param         None
+ * @return        0 if loaded from flash, Error if the defaults are in use
+ */
+int32_t settings_init ()
+{
+	const settings_record_t* stored = (const settings_record_t*)SETTINGS_FLASH_ADDRESS;
+
+	if ((stored->magic == SETTINGS_MAGIC) &&
+			(stored->settings_size == sizeof(settings_t)) &&
+			(stored->crc == settings_crc32(offsetof(settings_record_t, crc), (const uint8_t*)stored)))
+	{
+		g_settings = stored->settings;
+		return 0;
+	}
+
+	g_settings = g_default_settings;
+	return -1;
+}
+
+
+/**
+ * @brief   Get the current settings.
+ *
+ * @param[out]    settings copy of the settings
+ * @return        0 for success or Error
+ */
+int32_t settings_get (settings_t* settings)
+{
+	*settings = g_settings;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Change the current settings. They are not persistent until settings_save is called.
+ *
+ * @param[in]     settings the new settings
+ * @return        0 for success or Error
+ */
+int32_t settings_set (const settings_t* settings)
+{
+	g_settings = *settings;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Write the current settings to flash. Blocks for the page erase (around 25 ms).
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t settings_save ()
+{
+	settings_record_flash_t flash_record;
+	memset(&flash_record, 0xFF, sizeof(flash_record));
+
+	flash_record.record.magic = SETTINGS_MAGIC;
+	flash_record.record.settings_size = sizeof(settings_t);
+	flash_record.record.settings = g_settings;
+	flash_record.record.crc = settings_crc32(offsetof(settings_record_t, crc), (const uint8_t*)&flash_record.record);
+
+	// Skip the erase and write if nothing has changed
+	if (memcmp((const void*)SETTINGS_FLASH_ADDRESS, &flash_record, sizeof(flash_record)) == 0)
+	{
+		return 0;
+	}
+
+	int32_t result = 0;
+
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+	FLASH_EraseInitTypeDef erase = {0};
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.Banks = SETTINGS_FLASH_BANK;
+	erase.Page = SETTINGS_FLASH_PAGE;
+	erase.NbPages = 1;
+	uint32_t page_error = 0;
+
+	if (HAL_FLASHEx_Erase(&erase, &page_error) != HAL_OK)
+	{
+		result = -1;
+	}
+
+	for (uint32_t idx = 0; (result == 0) && (idx < (sizeof(flash_record.double_words) / sizeof(uint64_t))); idx++)
+	{
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, SETTINGS_FLASH_ADDRESS + (idx * sizeof(uint64_t)), flash_record.double_words[idx]) != HAL_OK)
+		{
+			result = -1;
+		}
+	}
+
+	HAL_FLASH_Lock();
+
+	return result;
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Calculate the CRC-32 of a buffer.
+ *
+ * @param[in]     buffer_length length of the buffer
+ * @param[in]     buffer the buffer
+ * @return        CRC-32
+ */
+static uint32_t settings_crc32 (uint32_t buffer_length, const uint8_t buffer[buffer_length])
+{
+	uint32_t crc = 0xFFFFFFFFU;
+
+	for (uint32_t idx = 0; idx < buffer_length; idx++)
+	{
+		crc ^= buffer[idx];
+		for (uint32_t bit = 0; bit < 8U; bit++)
+		{
+			crc = (crc & 1U) ? ((crc >> 1) ^ SETTINGS_CRC32_POLYNOMIAL) : (crc >> 1);
+		}
+	}
+
+	return ~crc;
+}
+
+
+/* End of file */
@@ -0,0 +1,551 @@
+/**
+ * @file    soft_timer.c
+ *
+ * @brief   Tickless Software Timer Service on LPTIM1.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  LPTIM1 free-runs through its 16-bit range and the auto-reload match
+ *  extends it to 32 bits. The auto-reload match fires as the counter reaches
+ *  0xFFFF rather than as it wraps, so the time is taken as the counter plus
+ *  one, which makes the overflow count and the low half change together.
+ *  LPTIM1 is driven at register level as it is not part of the CubeMX
+ *  project.
+ *
+ *  The compare is only programmed when the first expiry is within one
+ *  counter range, otherwise the auto-reload match wakes the service every
+ *  2 seconds until it is. Registers written to the LPTIM clock domain need
+ *  a couple of LSE cycles to take effect, so expiries closer than that are
+ *  raised straight away.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "soft_timer.h"
+
+#include "events.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define SOFT_TIMER_COUNTER_MAX		(0xFFFFU)	/*!< 16-bit counter, also the auto-reload */
+#define SOFT_TIMER_MIN_DELTA_TICKS	(3)			/*!< Closest expiry that can be programmed into the compare */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* A timer in the table */
+typedef struct soft_timer_t_
+{
+	soft_timer_callback_t callback;
+	uint32_t expiry_ticks;			/*!< Time of the next expiry */
+	uint32_t period_ticks;			/*!< 0 for one-shot */
+	soft_timer_id_t next;			/*!< Next running timer in expiry order */
+	uint8_t running;
+} soft_timer_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static soft_timer_t g_timers[SOFT_TIMER_MAX_TIMERS] = {0};
+static uint32_t g_timer_count = 0;
+static volatile soft_timer_id_t g_head = SOFT_TIMER_ID_INVALID;	/*!< Running timer that expires first */
+
+static volatile uint32_t g_overflow_count = 0;	/*!< High 16 bits of the ticks */
+static uint8_t g_compare_write_pending = 0;		/*!< Waiting for CMPOK before the next compare write */
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+static uint16_t soft_timer_read_counter ();
+static uint32_t soft_timer_us_to_ticks (uint32_t microseconds);
+static void soft_timer_insert (soft_timer_id_t timer_id);
+static void soft_timer_remove (soft_timer_id_t timer_id);
+static void soft_timer_program_compare ();
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Timer Service. Starts the LSE and LPTIM1.
+ *
+ * @param         None
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_init ()
+{
+	memset(g_timers, 0, sizeof(g_timers));
+	g_timer_count = 0;
+	g_head = SOFT_TIMER_ID_INVALID;
+	g_overflow_count = 0;
+	g_compare_write_pending = 0;
+
+	// Start the LSE, which lives in the backup domain
+	RCC_OscInitTypeDef osc_init = {0};
+	HAL_PWR_EnableBkUpAccess();
+	__HAL_RCC_LSEDRIVE_CONFIG(RCC_LSEDRIVE_LOW);
+	osc_init.OscillatorType = RCC_OSCILLATORTYPE_LSE;
+	osc_init.LSEState = RCC_LSE_ON;
+	osc_init.PLL.PLLState = RCC_PLL_NONE;
+	if (HAL_RCC_OscConfig(&osc_init) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+
+	// LPTIM1 from the LSE, the configuration and interrupt enables can only be written while disabled
+	__HAL_RCC_LPTIM1_CONFIG(RCC_LPTIM1CLKSOURCE_LSE);
+	__HAL_RCC_LPTIM1_CLK_ENABLE();
+
+	LPTIM1->CR = 0;
+	LPTIM1->CFGR = 0;	// Internal clock, no prescaler, software start
+	LPTIM1->IER = LPTIM_IER_CMPMIE | LPTIM_IER_ARRMIE;
+	LPTIM1->CR = LPTIM_CR_ENABLE;
+
+	LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+	LPTIM1->ARR = SOFT_TIMER_COUNTER_MAX;
+	while ((LPTIM1->ISR & LPTIM_ISR_ARROK) == 0)
+	{
+		// Wait for the write to reach the LPTIM clock domain
+	}
+	LPTIM1->ICR = LPTIM_ICR_ARROKCF | LPTIM_ICR_ARRMCF | LPTIM_ICR_CMPMCF;
+
+	LPTIM1->CR |= LPTIM_CR_CNTSTRT;
+
+	HAL_NVIC_SetPriority(LPTIM1_IRQn, SOFT_TIMER_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(LPTIM1_IRQn);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Add a timer to the table, stopped.
+ *
+ * @param[in]     callback called on each expiry
+ * @param[out]    timer_id id of the timer
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_create (soft_timer_callback_t callback, soft_timer_id_t* timer_id)
+{
+	if ((callback == 0) || (timer_id == 0) || (g_timer_count >= SOFT_TIMER_MAX_TIMERS))
+	{
+		// Error
+		return -1;
+	}
+
+	soft_timer_id_t new_id = (soft_timer_id_t)g_timer_count;
+	g_timers[new_id].callback = callback;
+	g_timers[new_id].running = 0;
+	g_timers[new_id].next = SOFT_TIMER_ID_INVALID;
+	g_timer_count++;
+
+	*timer_id = new_id;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Start, or restart, a timer.
+ *
+ * @param[in]     timer_id id of the timer
+ * @param[in]     delay_us time to the first expiry, rounded up to whole ticks
+ * @param[in]     period_us time between later expiries, 0 for one-shot
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_start (soft_timer_id_t timer_id, uint32_t delay_us, uint32_t period_us)
+{
+	if (timer_id >= g_timer_count)
+	{
+		// Error
+		return -1;
+	}
+
+	soft_timer_t* timer = &g_timers[timer_id];
+	if (timer->running)
+	{
+		soft_timer_remove(timer_id);
+	}
+
+	timer->expiry_ticks = soft_timer_get_ticks() + soft_timer_us_to_ticks(delay_us);
+	timer->period_ticks = soft_timer_us_to_ticks(period_us);
+	soft_timer_insert(timer_id);
+
+	soft_timer_program_compare();
+
+	return 0;
+}
+
+
+/**
+ * @brief   Stop a timer. Stopping a stopped timer is not an error.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        0 for success or Error
+ */
+int32_t soft_timer_stop (soft_timer_id_t timer_id)
+{
+	if (timer_id >= g_timer_count)
+	{
+		// Error
+		return -1;
+	}
+
+	if (g_timers[timer_id].running)
+	{
+		soft_timer_remove(timer_id);
+		soft_timer_program_compare();
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Is a timer running.
+ *
+ * A one-shot timer stops before its callback is called, so the callback may restart it.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        1 for running, 0 for stopped, or Error
+ */
+int32_t soft_timer_is_running (soft_timer_id_t timer_id)
+{
+	if (timer_id >= g_timer_count)
+	{
+		// Error
+		return -1;
+	}
+
+	return g_timers[timer_id].running ? 1 : 0;
+}
+
+
+/**
+ * @brief   Get the time on the LPTIM1 timebase - ISR safe.
+ *
+ * @param         None
+ * @return        ticks of SOFT_TIMER_TICK_FREQUENCY_HZ, wraps every 36 hours
+ */
+uint32_t soft_timer_get_ticks ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t high = g_overflow_count;
+	uint32_t low = ((uint32_t)soft_timer_read_counter() + 1U) & SOFT_TIMER_COUNTER_MAX;
+	if (((LPTIM1->ISR & LPTIM_ISR_ARRM) != 0) && (low < 0x8000U))
+	{
+		// Reached the auto-reload but not counted yet
+		high++;
+	}
+
+	__set_PRIMASK(primask);
+
+	return (high << 16) | low;
+}
+
+
+/**
+ * @brief   Get the time to the first expiry of the running timers - ISR safe.
+ *
+ * @param         None
+ * @return        ticks, 0 if already due, SOFT_TIMER_NO_EXPIRY if no timer is running
+ */
+uint32_t soft_timer_get_ticks_to_next ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t ticks = SOFT_TIMER_NO_EXPIRY;
+	if (g_head != SOFT_TIMER_ID_INVALID)
+	{
+		int32_t remaining = (int32_t)(g_timers[g_head].expiry_ticks - soft_timer_get_ticks());
+		ticks = (remaining > 0) ? (uint32_t)remaining : 0U;
+	}
+
+	__set_PRIMASK(primask);
+
+	return ticks;
+}
+
+
+/**
+ * @brief   Call the callbacks of the expired timers and program the next expiry.
+ *
+ * Called from the main loop when EVENTS_TIMER is raised.
+ *
+ * @param         None
+ * @return        number of callbacks called
+ */
+uint32_t soft_timer_process ()
+{
+	uint32_t callbacks_called = 0;
+
+	while (g_head != SOFT_TIMER_ID_INVALID)
+	{
+		soft_timer_id_t timer_id = g_head;
+		soft_timer_t* timer = &g_timers[timer_id];
+		uint32_t now_ticks = soft_timer_get_ticks();
+
+		if ((int32_t)(timer->expiry_ticks - now_ticks) > 0)
+		{
+			break;
+		}
+
+		soft_timer_remove(timer_id);
+		if (timer->period_ticks != 0)
+		{
+			// Keep the period phase unless the timer has fallen a whole period behind
+			timer->expiry_ticks += timer->period_ticks;
+			if ((int32_t)(timer->expiry_ticks - now_ticks) <= 0)
+			{
+				timer->expiry_ticks = now_ticks + timer->period_ticks;
+			}
+			soft_timer_insert(timer_id);
+		}
+
+		timer->callback(timer_id);
+		callbacks_called++;
+	}
+
+	soft_timer_program_compare();
+
+	return callbacks_called;
+}
+
+
+/**
+ * @brief   Process the LPTIM1 interrupt. Call from LPTIM1_IRQHandler.
+ *
+ * @param         None
+ * @return        None
+ */
+void soft_timer_irq_handler ()
+{
+	uint8_t raise_event = 0;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t isr = LPTIM1->ISR;
+	if (isr & LPTIM_ISR_ARRM)
+	{
+		LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+		g_overflow_count++;
+
+		// Expiries beyond one counter range are checked again each time round
+		if (g_head != SOFT_TIMER_ID_INVALID)
+		{
+			raise_event = 1;
+		}
+	}
+	if (isr & LPTIM_ISR_CMPM)
+	{
+		LPTIM1->ICR = LPTIM_ICR_CMPMCF;
+		raise_event = 1;
+	}
+
+	__set_PRIMASK(primask);
+
+	if (raise_event)
+	{
+		events_set(EVENTS_TIMER);
+	}
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Read the LPTIM1 counter, which is clocked asynchronously so must read the same twice.
+ *
+ * @param         None
+ * @return        counter value
+ */
+static uint16_t soft_timer_read_counter ()
+{
+	uint32_t first;
+	uint32_t second = LPTIM1->CNT;
+
+	do
+	{
+		first = second;
+		second = LPTIM1->CNT;
+	} while (first != second);
+
+	return (uint16_t)second;
+}
+
+
+/**
+ * @brief   Convert microseconds to ticks, rounding up.
+ *
+ * @param[in]     microseconds time to convert
+ * @return        ticks
+ */
+static uint32_t soft_timer_us_to_ticks (uint32_t microseconds)
+{
+	return (uint32_t)((((uint64_t)microseconds * SOFT_TIMER_TICK_FREQUENCY_HZ) + 999999U) / 1000000U);
+}
+
+
+/**
+ * @brief   Insert a timer into the running list in expiry order, behind timers with the same expiry.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        None
+ */
+static void soft_timer_insert (soft_timer_id_t timer_id)
+{
+	soft_timer_t* timer = &g_timers[timer_id];
+	uint32_t now_ticks = soft_timer_get_ticks();
+	int32_t remaining = (int32_t)(timer->expiry_ticks - now_ticks);
+
+	soft_timer_id_t previous = SOFT_TIMER_ID_INVALID;
+	soft_timer_id_t current = g_head;
+	while ((current != SOFT_TIMER_ID_INVALID) && ((int32_t)(g_timers[current].expiry_ticks - now_ticks) <= remaining))
+	{
+		previous = current;
+		current = g_timers[current].next;
+	}
+
+	timer->next = current;
+	if (previous == SOFT_TIMER_ID_INVALID)
+	{
+		g_head = timer_id;
+	}
+	else
+	{
+		g_timers[previous].next = timer_id;
+	}
+	timer->running = 1;
+}
+
+
+/**
+ * @brief   Remove a running timer from the list.
+ *
+ * @param[in]     timer_id id of the timer
+ * @return        None
+ */
+static void soft_timer_remove (soft_timer_id_t timer_id)
+{
+	if (g_head == timer_id)
+	{
+		g_head = g_timers[timer_id].next;
+	}
+	else
+	{
+		soft_timer_id_t current = g_head;
+		while ((current != SOFT_TIMER_ID_INVALID) && (g_timers[current].next != timer_id))
+		{
+			current = g_timers[current].next;
+		}
+		if (current != SOFT_TIMER_ID_INVALID)
+		{
+			g_timers[current].next = g_timers[timer_id].next;
+		}
+	}
+
+	g_timers[timer_id].next = SOFT_TIMER_ID_INVALID;
+	g_timers[timer_id].running = 0;
+}
+
+
+/**
+ * @brief   Program the compare for the first expiry, or raise the event if it is too close.
+ *
+ * @param         None
+ * @return        None
+ */
+static void soft_timer_program_compare ()
+{
+	if (g_head == SOFT_TIMER_ID_INVALID)
+	{
+		return;
+	}
+
+	uint32_t expiry_ticks = g_timers[g_head].expiry_ticks;
+	int32_t remaining = (int32_t)(expiry_ticks - soft_timer_get_ticks());
+
+	if (remaining <= SOFT_TIMER_MIN_DELTA_TICKS)
+	{
+		events_set(EVENTS_TIMER);
+		return;
+	}
+
+	if (remaining > (int32_t)SOFT_TIMER_COUNTER_MAX)
+	{
+		// Left to the auto-reload match
+		return;
+	}
+
+	// The counter value one tick before the expiry, see the file description
+	uint32_t compare = (expiry_ticks - 1U) & SOFT_TIMER_COUNTER_MAX;
+	if (compare == SOFT_TIMER_COUNTER_MAX)
+	{
+		// Coincides with the auto-reload match, which must be above the compare
+		return;
+	}
+
+	if (g_compare_write_pending)
+	{
+		while ((LPTIM1->ISR & LPTIM_ISR_CMPOK) == 0)
+		{
+			// Wait for the previous write to reach the LPTIM clock domain
+		}
+	}
+	LPTIM1->ICR = LPTIM_ICR_CMPOKCF;
+	LPTIM1->CMP = compare;
+	g_compare_write_pending = 1;
+}
+
+
+/* End of file */
@@ -22,6 +22,10 @@
 #include "stm32l4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "usart.h"
+#include "timebase.h"
+#include "soft_timer.h"
+#include "isr_stats.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -58,7 +62,7 @@
 extern UART_HandleTypeDef hlpuart1;
 extern UART_HandleTypeDef huart1;
 extern TIM_HandleTypeDef htim15;
-extern TIM_HandleTypeDef htim16;
+extern TIM_HandleTypeDef htim2;
 /* USER CODE BEGIN EV */
 
 /* USER CODE END EV */
@@ -207,11 +211,12 @@ void SysTick_Handler(void)
 void EXTI2_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI2_IRQn 0 */
+  isr_stats_enter(ISR_STATS_EXTI2);
 
   /* USER CODE END EXTI2_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(RFM95W_G0_Pin);
   /* USER CODE BEGIN EXTI2_IRQn 1 */
-
+  isr_stats_exit(ISR_STATS_EXTI2);
   /* USER CODE END EXTI2_IRQn 1 */
 }
 
@@ -221,26 +226,30 @@ void EXTI2_IRQHandler(void)
 void TIM1_BRK_TIM15_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM1_BRK_TIM15_IRQn 0 */
+  isr_stats_enter(ISR_STATS_TIM15);
 
   /* USER CODE END TIM1_BRK_TIM15_IRQn 0 */
   HAL_TIM_IRQHandler(&htim15);
   /* USER CODE BEGIN TIM1_BRK_TIM15_IRQn 1 */
-
+  isr_stats_exit(ISR_STATS_TIM15);
   /* USER CODE END TIM1_BRK_TIM15_IRQn 1 */
 }
 
 /**
-  * @brief This function handles TIM1 update interrupt and TIM16 global interrupt.
+  * @brief This function handles TIM2 global interrupt.
   */
-void TIM1_UP_TIM16_IRQHandler(void)
+void TIM2_IRQHandler(void)
 {
-  /* USER CODE BEGIN TIM1_UP_TIM16_IRQn 0 */
-
-  /* USER CODE END TIM1_UP_TIM16_IRQn 0 */
-  HAL_TIM_IRQHandler(&htim16);
-  /* USER CODE BEGIN TIM1_UP_TIM16_IRQn 1 */
-
-  /* USER CODE END TIM1_UP_TIM16_IRQn 1 */
+  /* USER CODE BEGIN TIM2_IRQn 0 */
+  isr_stats_enter(ISR_STATS_TIM2);
+  // Count the overflow before HAL clears the update flag
+  timebase_irq_handler();
+
+  /* USER CODE END TIM2_IRQn 0 */
+  HAL_TIM_IRQHandler(&htim2);
+  /* USER CODE BEGIN TIM2_IRQn 1 */
+  isr_stats_exit(ISR_STATS_TIM2);
+  /* USER CODE END TIM2_IRQn 1 */
 }
 
 /**
@@ -249,11 +258,12 @@ void TIM1_UP_TIM16_IRQHandler(void)
 void USART1_IRQHandler(void)
 {
   /* USER CODE BEGIN USART1_IRQn 0 */
-
+  isr_stats_enter(ISR_STATS_USART1);
+  usart1_frame_boundary_irq_handler();
   /* USER CODE END USART1_IRQn 0 */
   HAL_UART_IRQHandler(&huart1);
   /* USER CODE BEGIN USART1_IRQn 1 */
-
+  isr_stats_exit(ISR_STATS_USART1);
   /* USER CODE END USART1_IRQn 1 */
 }
 
@@ -263,14 +273,37 @@ void USART1_IRQHandler(void)
 void LPUART1_IRQHandler(void)
 {
   /* USER CODE BEGIN LPUART1_IRQn 0 */
+  isr_stats_enter(ISR_STATS_LPUART1);
 
   /* USER CODE END LPUART1_IRQn 0 */
   HAL_UART_IRQHandler(&hlpuart1);
   /* USER CODE BEGIN LPUART1_IRQn 1 */
-
+  isr_stats_exit(ISR_STATS_LPUART1);
   /* USER CODE END LPUART1_IRQn 1 */
 }
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles LPTIM1 global interrupt.
+  */
+void LPTIM1_IRQHandler(void)
+{
+  isr_stats_enter(ISR_STATS_LPTIM1);
+  soft_timer_irq_handler();
+  isr_stats_exit(ISR_STATS_LPTIM1);
+}
+
+#if LORA_DUAL_RADIO_ENABLED
+/**
+  * @brief This function handles EXTI line1 interrupt, DIO0 of the second radio.
+  */
+void EXTI1_IRQHandler(void)
+{
+  isr_stats_enter(ISR_STATS_EXTI1);
+  HAL_GPIO_EXTI_IRQHandler(RFM95W_RX_G0_Pin);
+  isr_stats_exit(ISR_STATS_EXTI1);
+}
+#endif
+
 /* USER CODE END 1 */
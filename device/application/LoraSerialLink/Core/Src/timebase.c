@@ -0,0 +1,256 @@
+/**
+ * @file    timebase.c
+ *
+ * @brief   Monotonic Microsecond Timebase.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The overflow count and the counter are read together with interrupts
+ *  masked. An overflow that has happened but not yet been counted shows as
+ *  the update flag still being set, in which case the counter is read again
+ *  (it is then certainly past the overflow) and the pending overflow added.
+ *  The interrupt handler clears the flag and counts the overflow in the same
+ *  critical section so the two never disagree.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "timebase.h"
+
+#include "stm32l4xx_hal.h"
+
+#include <stdint.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+
+/*
+ * Private: Variables
+ */
+
+static TIM_TypeDef* g_timer = 0;
+static volatile uint32_t g_overflow_count = 0;	/*!< High 32 bits of the time */
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Timebase and start the timer from zero.
+ *
+ * The timer must be a 32-bit timer with a prescaler giving TIMEBASE_TICK_FREQUENCY_HZ
+ * and an auto-reload of 0xFFFFFFFF.
+ *
+ * @param[in]     htim handle of the timer
+ * @return        0 for success or Error
+ */
+int32_t timebase_init (TIM_HandleTypeDef* htim)
+{
+	if ((htim == 0) || (IS_TIM_32B_COUNTER_INSTANCE(htim->Instance) == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	g_timer = htim->Instance;
+	g_overflow_count = 0;
+
+	__HAL_TIM_SET_COUNTER(htim, 0);
+	__HAL_TIM_CLEAR_FLAG(htim, TIM_FLAG_UPDATE);
+
+	if (HAL_TIM_Base_Start_IT(htim) != HAL_OK)
+	{
+		// Error
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the time since initialisation in microseconds - ISR safe.
+ *
+ * @param         None
+ * @return        microseconds, does not wrap
+ */
+uint64_t timebase_get_us ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t high = g_overflow_count;
+	uint32_t low = g_timer->CNT;
+	if ((g_timer->SR & TIM_SR_UIF) != 0)
+	{
+		// Overflowed but not counted yet
+		low = g_timer->CNT;
+		high++;
+	}
+
+	__set_PRIMASK(primask);
+
+	return ((uint64_t)high << 32) | low;
+}
+
+
+/**
+ * @brief   Get the low 32 bits of the time in microseconds - ISR safe.
+ *
+ * Cheapest read, for intervals under 71 minutes measured as the unsigned difference of two readings.
+ *
+ * @param         None
+ * @return        microseconds, wraps every 2^32 us
+ */
+uint32_t timebase_get_us32 ()
+{
+	return g_timer->CNT;
+}
+
+
+/**
+ * @brief   Get the time since initialisation in milliseconds - ISR safe.
+ *
+ * @param         None
+ * @return        milliseconds, does not wrap
+ */
+uint64_t timebase_get_ms ()
+{
+	return timebase_get_us() / 1000U;
+}
+
+
+/**
+ * @brief   Move the time forward to account for a period the timer was stopped - ISR safe.
+ *
+ * The timer does not count in STOP mode, so the power manager measures the time
+ * spent there on the LPTIM1 timebase and adds it back on wake.
+ *
+ * @param[in]     microseconds time to add
+ * @return        None
+ */
+void timebase_advance_us (uint32_t microseconds)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	// Count any overflow still pending first, so the carry below is the only one
+	timebase_irq_handler();
+
+	uint32_t low = g_timer->CNT;
+	uint32_t new_low = low + microseconds;
+	if (new_low < low)
+	{
+		g_overflow_count++;
+	}
+	g_timer->CNT = new_low;
+
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ * @brief   Keep the timer at TIMEBASE_TICK_FREQUENCY_HZ after its input clock has changed - ISR safe.
+ *
+ * Call straight after the system clock switch. The new prescaler only loads on an update
+ * event, which also clears the counter, so the count is put back afterwards.
+ *
+ * @param[in]     timer_clock_hz new timer input clock, a multiple of TIMEBASE_TICK_FREQUENCY_HZ
+ * @return        0 for success or Error
+ */
+int32_t timebase_set_timer_clock (uint32_t timer_clock_hz)
+{
+	uint32_t prescaler = timer_clock_hz / TIMEBASE_TICK_FREQUENCY_HZ;
+	if ((g_timer == 0) || (prescaler == 0))
+	{
+		// Error
+		return -1;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	timebase_irq_handler();
+
+	uint32_t count = g_timer->CNT;
+	g_timer->PSC = prescaler - 1U;
+	g_timer->CR1 |= TIM_CR1_URS;	// The forced update must not look like an overflow
+	g_timer->EGR = TIM_EGR_UG;
+	g_timer->CNT = count;
+	g_timer->CR1 &= ~TIM_CR1_URS;
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+
+/**
+ * @brief   Count a timer overflow. Call from the timer interrupt handler before the HAL handler.
+ *
+ * @param         None
+ * @return        None
+ */
+void timebase_irq_handler ()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if ((g_timer != 0) && ((g_timer->SR & TIM_SR_UIF) != 0))
+	{
+		g_timer->SR = (uint32_t)~TIM_SR_UIF;
+		g_overflow_count++;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+/*
+ * Private: Function Definitions
+ */
+
+
+/* End of file */
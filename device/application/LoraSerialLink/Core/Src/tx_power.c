@@ -0,0 +1,378 @@
+/**
+ * @file    tx_power.c
+ *
+ * @brief   Closed-Loop Transmit Power Control Per Destination.
+ *
+ * @copyright Copyright (c) 2025 Ben Sherlock
+ *
+ *  The band between TX_POWER_RAISE_MARGIN_QDB and TX_POWER_LOWER_MARGIN_QDB
+ *  is wider than the largest step, so a step in either direction cannot
+ *  carry the margin across the band and the power settles instead of
+ *  hunting between two levels.
+ *
+ */
+
+
+/*
+ * Includes
+ */
+#include "tx_power.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/*
+ * Private: Constants and Macros
+ */
+
+#define TX_POWER_EWMA_SHIFT			(3U)		/*!< Each sample moves the average 1/8 of the way */
+#define TX_POWER_EWMA_SCALE			(16)		/*!< Fraction bits of the averages */
+
+
+
+/*
+ * Public: Opaque Type Definitions
+ */
+
+
+/*
+ * Private: Typedefs
+ */
+
+/* A peer */
+typedef struct tx_power_peer_t_
+{
+	uint8_t in_use;
+	uint8_t address;
+	uint32_t samples;				/*!< Frames measured */
+	int32_t margin_average;			/*!< Average SNR margin of its frames, in 0.25 dB * TX_POWER_EWMA_SCALE */
+	int32_t rssi_average;			/*!< Average RSSI of its frames, in dBm * TX_POWER_EWMA_SCALE */
+	uint64_t last_heard_ms;
+	uint8_t report_valid;			/*!< Reported on our frames within TX_POWER_REPORT_TIMEOUT_MS */
+	uint64_t last_report_ms;
+	int8_t power_dbm;				/*!< Power we send to it at */
+} tx_power_peer_t;
+
+
+
+/*
+ * Public: Constants
+ */
+
+
+/*
+ * Public: Variables
+ */
+
+
+/*
+ * Private: Constants
+ */
+
+
+/*
+ * Private: Variables
+ */
+
+static tx_power_peer_t g_peers[TX_POWER_MAX_PEERS] = {0};
+static uint32_t g_report_idx = 0;					/*!< Peer reported on last */
+static uint64_t g_next_report_ms = 0;
+
+static tx_power_stats_t g_stats = {0};
+
+
+
+/*
+ * Private: Function Prototypes/Declarations
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static tx_power_peer_t* tx_power_get_peer (uint8_t address);
+
+
+
+/*
+ * Public: Function Definitions
+ */
+
+/**
+ * @brief   Initialise the Transmit Power controller with every peer at the default power.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_init (uint64_t now_ms)
+{
+	memset(g_peers, 0, sizeof(g_peers));
+	g_report_idx = 0;
+	g_next_report_ms = now_ms + TX_POWER_REPORT_PERIOD_MS;
+
+	memset(&g_stats, 0, sizeof(g_stats));
+
+	return 0;
+}
+
+
+/**
+ * @brief   Record a frame received from a peer, with its measured margin and RSSI.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     margin_quarter_db SNR margin at the current rate, from adr_get_margin, in 0.25 dB
+ * @param[in]     rssi_dbm packet RSSI
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_on_frame_received (uint8_t source_address, int32_t margin_quarter_db, int32_t rssi_dbm, uint64_t now_ms)
+{
+	tx_power_peer_t* peer = tx_power_get_peer(source_address);
+	int32_t margin_sample = margin_quarter_db * TX_POWER_EWMA_SCALE;
+	int32_t rssi_sample = rssi_dbm * TX_POWER_EWMA_SCALE;
+
+	if (peer->samples == 0)
+	{
+		peer->margin_average = margin_sample;
+		peer->rssi_average = rssi_sample;
+	}
+	else
+	{
+		peer->margin_average += (margin_sample - peer->margin_average) / (1 << TX_POWER_EWMA_SHIFT);
+		peer->rssi_average += (rssi_sample - peer->rssi_average) / (1 << TX_POWER_EWMA_SHIFT);
+	}
+	peer->samples++;
+	peer->last_heard_ms = now_ms;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Apply a link report from a peer, its measurement of our frames, and step the power towards it.
+ *
+ * @param[in]     source_address address of the peer
+ * @param[in]     margin_quarter_db SNR margin of our frames at the peer, in 0.25 dB
+ * @param[in]     rssi_dbm RSSI of our frames at the peer
+ * @param[in]     lower_allowed 1 if the data rate is already the fastest, so surplus margin may go to lowering power
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_on_report (uint8_t source_address, int32_t margin_quarter_db, int32_t rssi_dbm, uint8_t lower_allowed, uint64_t now_ms)
+{
+	if ((margin_quarter_db == TX_POWER_REPORT_MARGIN_UNKNOWN) || (rssi_dbm == TX_POWER_REPORT_RSSI_UNKNOWN))
+	{
+		// Nothing measured yet
+		return 0;
+	}
+
+	tx_power_peer_t* peer = tx_power_get_peer(source_address);
+	peer->report_valid = 1;
+	peer->last_report_ms = now_ms;
+
+	int32_t power_dbm = peer->power_dbm;
+	if (rssi_dbm > TX_POWER_MAX_RSSI_DBM)
+	{
+		// Close enough to saturate the receiver, the SNR it measures is no longer a guide
+		power_dbm -= TX_POWER_LOWER_STEP_DB;
+	}
+	else if (margin_quarter_db < TX_POWER_RAISE_MARGIN_QDB)
+	{
+		power_dbm += TX_POWER_RAISE_STEP_DB;
+	}
+	else if ((margin_quarter_db > TX_POWER_LOWER_MARGIN_QDB) && lower_allowed)
+	{
+		power_dbm -= TX_POWER_LOWER_STEP_DB;
+	}
+
+	if (power_dbm < TX_POWER_MIN_DBM)
+	{
+		power_dbm = TX_POWER_MIN_DBM;
+	}
+	else if (power_dbm > TX_POWER_MAX_DBM)
+	{
+		power_dbm = TX_POWER_MAX_DBM;
+	}
+
+	if (power_dbm > peer->power_dbm)
+	{
+		g_stats.raises++;
+	}
+	else if (power_dbm < peer->power_dbm)
+	{
+		g_stats.lowers++;
+	}
+	peer->power_dbm = (int8_t)power_dbm;
+
+	return 0;
+}
+
+
+/**
+ * @brief   Check whether to send a link report, taking the peers in turn.
+ *
+ * On success the report is counted as sent.
+ *
+ * @param[in]     force 1 if a report is going anyway, to fill it in whether due or not
+ * @param[in]     now_ms current time
+ * @param[out]    peer_address peer the report is on
+ * @param[out]    margin_quarter_db average SNR margin of its frames, in 0.25 dB
+ * @param[out]    rssi_dbm average RSSI of its frames
+ * @return        1 if a report should be sent now, 0 otherwise
+ */
+int32_t tx_power_get_report (uint8_t force, uint64_t now_ms, uint8_t* peer_address, int32_t* margin_quarter_db, int32_t* rssi_dbm)
+{
+	if ((force == 0) && (now_ms < g_next_report_ms))
+	{
+		return 0;
+	}
+
+	// Next peer after the last one reported on that has been measured enough and heard recently
+	for (uint32_t count = 1; count <= TX_POWER_MAX_PEERS; count++)
+	{
+		uint32_t idx = (g_report_idx + count) % TX_POWER_MAX_PEERS;
+		tx_power_peer_t* peer = &g_peers[idx];
+		if ((peer->in_use == 0) || (peer->samples < TX_POWER_MIN_SAMPLES) ||
+				((now_ms - peer->last_heard_ms) >= TX_POWER_REPORT_TIMEOUT_MS))
+		{
+			continue;
+		}
+
+		*peer_address = peer->address;
+		*margin_quarter_db = peer->margin_average / TX_POWER_EWMA_SCALE;
+		*rssi_dbm = peer->rssi_average / TX_POWER_EWMA_SCALE;
+
+		g_report_idx = idx;
+		g_next_report_ms = now_ms + TX_POWER_REPORT_PERIOD_MS;
+		return 1;
+	}
+
+	// Nobody to report on
+	g_next_report_ms = now_ms + TX_POWER_REPORT_PERIOD_MS;
+	return 0;
+}
+
+
+/**
+ * @brief   Restore at least the default power towards peers that have stopped reporting.
+ *
+ * @param[in]     now_ms current time
+ * @return        0 for success or Error
+ */
+int32_t tx_power_poll (uint64_t now_ms)
+{
+	for (uint32_t idx = 0; idx < TX_POWER_MAX_PEERS; idx++)
+	{
+		tx_power_peer_t* peer = &g_peers[idx];
+		if ((peer->in_use == 0) || (peer->report_valid == 0) ||
+				((now_ms - peer->last_report_ms) < TX_POWER_REPORT_TIMEOUT_MS))
+		{
+			continue;
+		}
+
+		// It may have stopped hearing us - a power raised for a weak link is kept
+		peer->report_valid = 0;
+		if (peer->power_dbm < TX_POWER_DEFAULT_DBM)
+		{
+			peer->power_dbm = TX_POWER_DEFAULT_DBM;
+			g_stats.timeouts++;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief   Get the power to transmit at.
+ *
+ * A peer that has not reported is sent to at the default power. A broadcast, or any other
+ * destination not tracked, is sent at the highest power of the peers so they all hear it.
+ *
+ * @param[in]     destination_address destination of the packet
+ * @return        power in dBm
+ */
+int8_t tx_power_get_dbm (uint8_t destination_address)
+{
+	int8_t highest_dbm = TX_POWER_MIN_DBM;
+	uint8_t found = 0;
+
+	for (uint32_t idx = 0; idx < TX_POWER_MAX_PEERS; idx++)
+	{
+		tx_power_peer_t* peer = &g_peers[idx];
+		if (peer->in_use == 0)
+		{
+			continue;
+		}
+
+		if (peer->address == destination_address)
+		{
+			return peer->power_dbm;
+		}
+
+		if (peer->power_dbm > highest_dbm)
+		{
+			highest_dbm = peer->power_dbm;
+		}
+		found = 1;
+	}
+
+	return (found ? highest_dbm : TX_POWER_DEFAULT_DBM);
+}
+
+
+/**
+ * @brief   Get the transmit power control statistics.
+ *
+ * @param[out]    stats copy of the statistics
+ * @return        0 for success or Error
+ */
+int32_t tx_power_get_stats (tx_power_stats_t* stats)
+{
+	*stats = g_stats;
+
+	return 0;
+}
+
+
+
+/*
+ * Private: Function Definitions
+ */
+
+/**
+ * @brief   Find a peer, replacing the least recently heard if it is new.
+ *
+ * @param[in]     address address of the peer
+ * @return        the peer
+ */
+static tx_power_peer_t* tx_power_get_peer (uint8_t address)
+{
+	tx_power_peer_t* oldest = &g_peers[0];
+
+	for (uint32_t idx = 0; idx < TX_POWER_MAX_PEERS; idx++)
+	{
+		tx_power_peer_t* peer = &g_peers[idx];
+		if (peer->in_use && (peer->address == address))
+		{
+			return peer;
+		}
+
+		if ((peer->in_use == 0) || ((oldest->in_use != 0) && (peer->last_heard_ms < oldest->last_heard_ms)))
+		{
+			oldest = peer;
+		}
+	}
+
+	memset(oldest, 0, sizeof(tx_power_peer_t));
+	oldest->in_use = 1;
+	oldest->address = address;
+	oldest->power_dbm = TX_POWER_DEFAULT_DBM;
+
+	return oldest;
+}
+
+/* End of file */
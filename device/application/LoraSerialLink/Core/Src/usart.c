@@ -21,7 +21,8 @@
 #include "usart.h"
 
 /* USER CODE BEGIN 0 */
-
+static volatile usart_error_stats_t g_usart1_error_stats = {0};
+static volatile usart_error_stats_t g_lpuart1_error_stats = {0};
 /* USER CODE END 0 */
 
 UART_HandleTypeDef hlpuart1;
@@ -84,7 +85,15 @@ void MX_USART1_UART_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN USART1_Init 2 */
-
+#if USART1_FLOW_CONTROL_ENABLED
+  // Hold transmission while the host deasserts CTS. RTS is driven by software from the receive fifo
+  // watermarks, the hardware RTS only covers the single byte receive register.
+  huart1.Init.HwFlowCtl = UART_HWCONTROL_CTS;
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
   /* USER CODE END USART1_Init 2 */
 
 }
@@ -97,13 +106,14 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
   if(uartHandle->Instance==LPUART1)
   {
   /* USER CODE BEGIN LPUART1_MspInit 0 */
-
+  // Kernel clock HSI16 is selected in the .ioc, so the UART can wake the MCU from STOP1 and keeps
+  // its baud rate when the clock governor changes the system clock
   /* USER CODE END LPUART1_MspInit 0 */
 
   /** Initializes the peripherals clock
   */
     PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_LPUART1;
-    PeriphClkInit.Lpuart1ClockSelection = RCC_LPUART1CLKSOURCE_PCLK1;
+    PeriphClkInit.Lpuart1ClockSelection = RCC_LPUART1CLKSOURCE_HSI;
     if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
     {
       Error_Handler();
@@ -125,7 +135,7 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
     /* LPUART1 interrupt Init */
-    HAL_NVIC_SetPriority(LPUART1_IRQn, 0, 0);
+    HAL_NVIC_SetPriority(LPUART1_IRQn, 4, 0);
     HAL_NVIC_EnableIRQ(LPUART1_IRQn);
   /* USER CODE BEGIN LPUART1_MspInit 1 */
 
@@ -134,13 +144,14 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
   else if(uartHandle->Instance==USART1)
   {
   /* USER CODE BEGIN USART1_MspInit 0 */
-
+  // Kernel clock HSI16 is selected in the .ioc, so the USART can wake the MCU from STOP1 and keeps
+  // its baud rate when the clock governor changes the system clock. This caps it at 2 Mbaud (HSI16 / 8).
   /* USER CODE END USART1_MspInit 0 */
 
   /** Initializes the peripherals clock
   */
     PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART1;
-    PeriphClkInit.Usart1ClockSelection = RCC_USART1CLKSOURCE_PCLK2;
+    PeriphClkInit.Usart1ClockSelection = RCC_USART1CLKSOURCE_HSI;
     if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
     {
       Error_Handler();
@@ -165,7 +176,26 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(USART1_IRQn);
   /* USER CODE BEGIN USART1_MspInit 1 */
+#if USART1_FLOW_CONTROL_ENABLED
+    /**USART1 Flow Control GPIO Configuration
+    PA11     ------> USART1_CTS (pulled down so an unconnected CTS allows transmission)
+    PA12     ------> USART1_RTS (GPIO, asserted low at start)
+    */
+    GPIO_InitStruct.Pin = USART1_CTS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF7_USART1;
+    HAL_GPIO_Init(USART1_CTS_GPIO_Port, &GPIO_InitStruct);
 
+    HAL_GPIO_WritePin(USART1_RTS_GPIO_Port, USART1_RTS_Pin, GPIO_PIN_RESET);
+    GPIO_InitStruct.Pin = USART1_RTS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = 0;
+    HAL_GPIO_Init(USART1_RTS_GPIO_Port, &GPIO_InitStruct);
+#endif
   /* USER CODE END USART1_MspInit 1 */
   }
 }
@@ -210,11 +240,239 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* uartHandle)
     /* USART1 interrupt Deinit */
     HAL_NVIC_DisableIRQ(USART1_IRQn);
   /* USER CODE BEGIN USART1_MspDeInit 1 */
-
+#if USART1_FLOW_CONTROL_ENABLED
+    HAL_GPIO_DeInit(GPIOA, USART1_CTS_Pin|USART1_RTS_Pin);
+#endif
   /* USER CODE END USART1_MspDeInit 1 */
   }
 }
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief  Change the USART1 baud rate, choosing the oversampling for the rate.
+  *         Any transfer in progress is aborted and must be restarted.
+  * @param  baud_rate up to the USART1 kernel clock / 8, 2 Mbaud from HSI16
+  * @retval 0 for success or Error
+  */
+int32_t usart1_set_baud_rate(uint32_t baud_rate)
+{
+  uint32_t pclk = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_USART1);
+
+  if ((baud_rate == 0) || (baud_rate > (pclk / 8U)))
+  {
+    // Error
+    return -1;
+  }
+
+  HAL_UART_Abort(&huart1);
+
+  // Oversampling by 16 tolerates more clock error, by 8 reaches twice the rate
+  huart1.Init.BaudRate = baud_rate;
+  huart1.Init.OverSampling = (baud_rate > (pclk / 16U)) ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+  huart1.AdvancedInit.AdvFeatureInit &= ~UART_ADVFEATURE_AUTOBAUDRATE_INIT;
+  huart1.AdvancedInit.AutoBaudRateEnable = UART_ADVFEATURE_AUTOBAUDRATE_DISABLE;
+
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    // Error
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Detect the USART1 baud rate from the start bit of the next character received.
+  *         Any transfer in progress is aborted and must be restarted.
+  * @retval 0 for success or Error
+  */
+int32_t usart1_enable_auto_baud(void)
+{
+  HAL_UART_Abort(&huart1);
+
+  // Measured on the start bit so any character with bit 0 set (e.g. CR, most letters) works
+  huart1.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart1.AdvancedInit.AdvFeatureInit |= UART_ADVFEATURE_AUTOBAUDRATE_INIT;
+  huart1.AdvancedInit.AutoBaudRateEnable = UART_ADVFEATURE_AUTOBAUDRATE_ENABLE;
+  huart1.AdvancedInit.AutoBaudRateMode = UART_ADVFEATURE_AUTOBAUDRATE_ONSTARTBIT;
+
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    // Error
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Check whether auto baud detection has finished. ISR safe.
+  * @param  baud_rate set to the detected rate on success
+  * @retval 1 if detected, 0 if still waiting, or Error if detection failed and has been restarted
+  */
+int32_t usart1_get_auto_baud_result(uint32_t* baud_rate)
+{
+  if (__HAL_UART_GET_FLAG(&huart1, UART_FLAG_ABRE))
+  {
+    // Out of range or no valid start bit - try again on the next character
+    __HAL_UART_SEND_REQ(&huart1, UART_AUTOBAUD_REQUEST);
+    return -1;
+  }
+
+  if (__HAL_UART_GET_FLAG(&huart1, UART_FLAG_ABRF) == 0)
+  {
+    return 0;
+  }
+
+  // The hardware has written BRR, work back to the rate (oversampling by 16)
+  uint32_t brr = huart1.Instance->BRR;
+  if (brr == 0)
+  {
+    // Error
+    return -1;
+  }
+  *baud_rate = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_USART1) / brr;
+  huart1.Init.BaudRate = *baud_rate;
+
+  return 1;
+}
+
+/**
+  * @brief  Delimit frames in hardware with the receiver timeout and character match interrupts.
+  *         The timeout is in bit times so it stays correct across baud rate changes.
+  * @param  timeout_bits receiver timeout after the last character, 0 to disable
+  * @param  match_enable 1 to enable the character match
+  * @param  match_character character to match
+  * @retval 0 for success or Error
+  */
+int32_t usart1_enable_frame_delimiting(uint32_t timeout_bits, uint8_t match_enable, uint8_t match_character)
+{
+  if (timeout_bits > USART_RTOR_RTO)
+  {
+    // Error
+    return -1;
+  }
+
+  if (timeout_bits > 0)
+  {
+    // HAL_UART_Receive_IT enables RTOIE whenever RTOEN is set
+    HAL_UART_ReceiverTimeout_Config(&huart1, timeout_bits);
+    HAL_UART_EnableReceiverTimeout(&huart1);
+  }
+  else
+  {
+    HAL_UART_DisableReceiverTimeout(&huart1);
+    __HAL_UART_DISABLE_IT(&huart1, UART_IT_RTO);
+  }
+
+  // The match character in CR2 can only be written while the USART is disabled
+  __HAL_UART_DISABLE(&huart1);
+  MODIFY_REG(huart1.Instance->CR2, USART_CR2_ADD, ((uint32_t)match_character << USART_CR2_ADD_Pos));
+  __HAL_UART_ENABLE(&huart1);
+
+  __HAL_UART_CLEAR_FLAG(&huart1, UART_CLEAR_CMF | UART_CLEAR_RTOF);
+  if (match_enable)
+  {
+    __HAL_UART_ENABLE_IT(&huart1, UART_IT_CM);
+  }
+  else
+  {
+    __HAL_UART_DISABLE_IT(&huart1, UART_IT_CM);
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Count the receive errors HAL has recorded in the handle. Called from HAL_UART_ErrorCallback.
+  * @param  huart UART handle
+  * @retval None
+  */
+void usart_record_errors(UART_HandleTypeDef* huart)
+{
+  volatile usart_error_stats_t* stats = (huart->Instance == USART1) ? &g_usart1_error_stats : &g_lpuart1_error_stats;
+
+  if (huart->ErrorCode & HAL_UART_ERROR_ORE)
+  {
+    stats->overrun++;
+  }
+  if (huart->ErrorCode & HAL_UART_ERROR_FE)
+  {
+    stats->framing++;
+  }
+  if (huart->ErrorCode & HAL_UART_ERROR_NE)
+  {
+    stats->noise++;
+  }
+  if (huart->ErrorCode & HAL_UART_ERROR_PE)
+  {
+    stats->parity++;
+  }
+}
+
+/**
+  * @brief  Get the receive error counters of a UART.
+  * @param  huart UART handle
+  * @param  stats copy of the counters
+  * @retval 0 for success or Error
+  */
+int32_t usart_get_error_stats(UART_HandleTypeDef* huart, usart_error_stats_t* stats)
+{
+  if (huart->Instance == USART1)
+  {
+    *stats = g_usart1_error_stats;
+  }
+  else if (huart->Instance == LPUART1)
+  {
+    *stats = g_lpuart1_error_stats;
+  }
+  else
+  {
+    // Error
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Handle the frame boundary flags. Called from USART1_IRQHandler before HAL_UART_IRQHandler,
+  *         which would otherwise treat the receiver timeout as an error and abort the reception.
+  * @retval None
+  */
+void usart1_frame_boundary_irq_handler(void)
+{
+  uint32_t isr = huart1.Instance->ISR;
+  uint32_t cr1 = huart1.Instance->CR1;
+
+  // Character match is raised with RXNE for the same character, which HAL handles afterwards
+  if ((isr & USART_ISR_CMF) && (cr1 & USART_CR1_CMIE))
+  {
+    __HAL_UART_CLEAR_FLAG(&huart1, UART_CLEAR_CMF);
+    usart1_frame_boundary_callback(USART1_FRAME_BOUNDARY_MATCH);
+  }
+
+  if ((isr & USART_ISR_RTOF) && (cr1 & USART_CR1_RTOIE))
+  {
+    __HAL_UART_CLEAR_FLAG(&huart1, UART_CLEAR_RTOF);
+    usart1_frame_boundary_callback(USART1_FRAME_BOUNDARY_TIMEOUT);
+  }
+}
+
+/**
+  * @brief  Tell the host whether it may send on USART1 (RTS). ISR safe.
+  * @param  ready 1 to assert RTS, 0 to deassert
+  * @retval None
+  */
+void usart1_set_rts(uint8_t ready)
+{
+#if USART1_FLOW_CONTROL_ENABLED
+  // Active low - a single BSRR write so the main loop and the receive interrupt can both call this
+  HAL_GPIO_WritePin(USART1_RTS_GPIO_Port, USART1_RTS_Pin, ready ? GPIO_PIN_RESET : GPIO_PIN_SET);
+#else
+  (void)ready;
+#endif
+}
+
 /* USER CODE END 1 */